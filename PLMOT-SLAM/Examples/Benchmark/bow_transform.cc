@@ -0,0 +1,148 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares the time to transform the ORB features of a frame into a BoW vector
+// with the node tree, the flattened tree and the flattened tree in parallel.
+
+#include<iostream>
+#include<algorithm>
+#include<fstream>
+#include<sstream>
+#include<chrono>
+
+#include<opencv2/core/core.hpp>
+#include<opencv2/imgcodecs.hpp>
+#include<opencv2/imgproc.hpp>
+
+#include"ORBVocabulary.h"
+#include"ORBextractor.h"
+#include"Converter.h"
+
+using namespace std;
+
+void LoadImages(const string &strAssociationFilename, vector<string> &vstrImageFilenamesRGB);
+
+double TransformTime(ORB_SLAM3::ORBVocabulary &voc, const vector<vector<cv::Mat> > &vvDesc,
+                     vector<DBoW2::BowVector> &vBowVec)
+{
+    vBowVec.resize(vvDesc.size());
+    DBoW2::FeatureVector featVec;
+
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    for(size_t i=0; i<vvDesc.size(); i++)
+        voc.transform(vvDesc[i],vBowVec[i],featVec,4);
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+    return std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t2 - t1).count()/vvDesc.size();
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 4)
+    {
+        cerr << endl << "Usage: ./bow_transform path_to_vocabulary path_to_sequence path_to_association [n_threads] [n_features]" << endl;
+        return 1;
+    }
+
+    const int nThreads = argc > 4 ? atoi(argv[4]) : 4;
+    const int nFeatures = argc > 5 ? atoi(argv[5]) : 1000;
+
+    vector<string> vstrImageFilenamesRGB;
+    LoadImages(string(argv[3]), vstrImageFilenamesRGB);
+    if(vstrImageFilenamesRGB.empty())
+    {
+        cerr << endl << "No images found in provided path." << endl;
+        return 1;
+    }
+
+    ORB_SLAM3::ORBVocabulary voc;
+    if(!voc.loadFromTextFile(argv[1]))
+    {
+        cerr << "Falied to open at: " << argv[1] << endl;
+        return 1;
+    }
+
+    // Extract the descriptors of every frame once
+    ORB_SLAM3::ORBextractor extractor(nFeatures,1.2,8,20,7);
+    vector<vector<cv::Mat> > vvDesc;
+    vector<cv::Mat> vDescMats;
+    for(size_t ni=0; ni<vstrImageFilenamesRGB.size(); ni++)
+    {
+        cv::Mat im = cv::imread(string(argv[2])+"/"+vstrImageFilenamesRGB[ni],cv::IMREAD_GRAYSCALE);
+        if(im.empty())
+            continue;
+
+        vector<cv::KeyPoint> vKeys;
+        cv::Mat desc;
+        vector<int> vLapping = {0,1000};
+        extractor(im,cv::Mat(),vKeys,desc,vLapping);
+        vDescMats.push_back(desc);
+        vvDesc.push_back(ORB_SLAM3::Converter::toDescriptorVector(vDescMats.back()));
+    }
+
+    if(vvDesc.empty())
+    {
+        cerr << endl << "Failed to load the images." << endl;
+        return 1;
+    }
+
+    vector<DBoW2::BowVector> vBowTree, vBowFlat, vBowParallel;
+
+    voc.setUseFlatTree(false);
+    voc.setTransformThreads(1);
+    const double tTree = TransformTime(voc,vvDesc,vBowTree);
+
+    voc.setUseFlatTree(true);
+    const double tFlat = TransformTime(voc,vvDesc,vBowFlat);
+
+    voc.setTransformThreads(nThreads);
+    const double tParallel = TransformTime(voc,vvDesc,vBowParallel);
+
+    int nMismatches = 0;
+    for(size_t i=0; i<vvDesc.size(); i++)
+    {
+        if(vBowTree[i]!=vBowFlat[i] || vBowTree[i]!=vBowParallel[i])
+            nMismatches++;
+    }
+
+    cout << "Frames: " << vvDesc.size() << endl;
+    cout << "Node tree:             " << tTree << " ms/frame" << endl;
+    cout << "Flat tree:             " << tFlat << " ms/frame" << endl;
+    cout << "Flat tree (" << nThreads << " threads): " << tParallel << " ms/frame" << endl;
+    cout << "Frames with different BoW vectors: " << nMismatches << endl;
+
+    return nMismatches == 0 ? 0 : 1;
+}
+
+void LoadImages(const string &strAssociationFilename, vector<string> &vstrImageFilenamesRGB)
+{
+    ifstream fAssociation;
+    fAssociation.open(strAssociationFilename.c_str());
+    while(!fAssociation.eof())
+    {
+        string s;
+        getline(fAssociation,s);
+        if(!s.empty())
+        {
+            stringstream ss;
+            ss << s;
+            double t;
+            string sRGB;
+            ss >> t;
+            ss >> sRGB;
+            vstrImageFilenamesRGB.push_back(sRGB);
+        }
+    }
+}
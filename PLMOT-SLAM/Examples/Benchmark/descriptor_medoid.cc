@@ -0,0 +1,130 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Checks the incremental distinctive descriptor (DescriptorMedoid) of a landmark seen by more keyframes
+// than its sample, whose appearance changes along the sequence: the first keyframes see one descriptor
+// and the later ones a different one. After every new observation, and after some are erased, the
+// medoid must be the one of the observations of the most recent keyframes, so a landmark with more
+// observations than the sample ends up with a descriptor of a recent view.
+
+#include<iostream>
+#include<random>
+#include<algorithm>
+#include<climits>
+
+#include<opencv2/core/core.hpp>
+
+#include"KeyFrame.h"
+#include"ORBmatcher.h"
+#include"DescriptorMedoid.h"
+
+using namespace std;
+
+// Least median distance to the rest of the descriptors
+int MedoidMedian(const vector<cv::Mat> &vDesc, const cv::Mat &desc)
+{
+    vector<int> vDists;
+    for(size_t i=0; i<vDesc.size(); i++)
+        vDists.push_back(ORB_SLAM3::ORBmatcher::DescriptorDistance(desc,vDesc[i]));
+    nth_element(vDists.begin(),vDists.begin()+(vDists.size()-1)/2,vDists.end());
+    return vDists[(vDists.size()-1)/2];
+}
+
+int main(int argc, char **argv)
+{
+    const int nKFs = 80;
+    const int nChange = 60;
+    const int nSample = ORB_SLAM3::DescriptorMedoid::MAX_SAMPLE;
+
+    mt19937 rng(0);
+    uniform_int_distribution<int> byte(0,255);
+    uniform_int_distribution<int> bit(0,255);
+
+    // Two appearances, each observation with a few bits flipped
+    cv::Mat descA(1,32,CV_8U), descB(1,32,CV_8U);
+    for(int k=0; k<32; k++)
+    {
+        descA.at<unsigned char>(k) = byte(rng);
+        descB.at<unsigned char>(k) = byte(rng);
+    }
+
+    vector<ORB_SLAM3::KeyFrame*> vpKFs(nKFs);
+    for(int i=0; i<nKFs; i++)
+    {
+        cv::Mat desc = (i<nChange ? descA : descB).clone();
+        for(int f=0; f<6; f++)
+        {
+            const int b = bit(rng);
+            desc.at<unsigned char>(b/8) ^= 1<<(b%8);
+        }
+        ORB_SLAM3::KeyFrame* pKF = new ORB_SLAM3::KeyFrame(desc, cv::Mat());
+        pKF->mnId = i;
+        vpKFs[i] = pKF;
+    }
+
+    // Observations in no particular order, as those of a map point sorted by keyframe pointer
+    ORB_SLAM3::DescriptorMedoid medoid;
+    vector<pair<ORB_SLAM3::KeyFrame*,int> > vObs;
+    int nWrong = 0;
+    cv::Mat last;
+    for(int i=0; i<nKFs; i++)
+    {
+        vObs.push_back(make_pair(vpKFs[i],0));
+        shuffle(vObs.begin(),vObs.end(),rng);
+
+        // Every 10 keyframes the observation of a random recent one is erased
+        if(i%10==9)
+        {
+            const int j = i-1-(int)(rng()%5);
+            for(size_t k=0; k<vObs.size(); k++)
+                if(vObs[k].first==vpKFs[j])
+                    vObs.erase(vObs.begin()+k);
+        }
+
+        const cv::Mat desc = medoid.Update(vObs,false);
+
+        // The medoid of the observations of the most recent keyframes
+        vector<pair<ORB_SLAM3::KeyFrame*,int> > vRecent = vObs;
+        sort(vRecent.begin(),vRecent.end(),[](const pair<ORB_SLAM3::KeyFrame*,int> &a, const pair<ORB_SLAM3::KeyFrame*,int> &b)
+        {
+            return a.first->mnId>b.first->mnId;
+        });
+        vRecent.resize(min((int)vRecent.size(),nSample));
+        vector<cv::Mat> vDesc;
+        for(size_t k=0; k<vRecent.size(); k++)
+            vDesc.push_back(vRecent[k].first->mDescriptors.row(vRecent[k].second));
+
+        int bestMedian = INT_MAX;
+        for(size_t k=0; k<vDesc.size(); k++)
+            bestMedian = min(bestMedian, MedoidMedian(vDesc,vDesc[k]));
+
+        if(desc.empty() || MedoidMedian(vDesc,desc)!=bestMedian)
+            nWrong++;
+        last = desc;
+    }
+
+    // The last keyframes see the second appearance
+    const bool bRecent = ORB_SLAM3::ORBmatcher::DescriptorDistance(last,descB) <
+                         ORB_SLAM3::ORBmatcher::DescriptorDistance(last,descA);
+
+    cout << "Observations: " << vObs.size() << " (sample of " << nSample << ")" << endl;
+    cout << "Updates with a wrong medoid: " << nWrong << endl;
+    cout << "Final descriptor from a recent view: " << (bRecent ? "yes" : "no") << endl;
+
+    for(int i=0; i<nKFs; i++)
+        delete vpKFs[i];
+
+    return nWrong == 0 && bRecent ? 0 : 1;
+}
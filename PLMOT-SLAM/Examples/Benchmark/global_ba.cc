@@ -0,0 +1,187 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Times the global BA solver (BASolver with the PCG reduced system) with points and lines on a synthetic
+// trajectory of RGB-D keyframes, on the whole problem and partitioned in clusters of the covisibility
+// graph, and compares the final chi2 and the keyframe positions with the ground truth.
+
+#include<iostream>
+#include<random>
+#include<chrono>
+#include<thread>
+#include<map>
+
+#include<Eigen/Geometry>
+
+#include"BASolver.h"
+#include"SolverUtils.h"
+
+using namespace std;
+
+// TUM freiburg3 calibration
+const double fx = 535.4, fy = 539.2, cx = 320.1, cy = 247.6, bf = 40.0;
+
+// Keyframes every 10 cm along a corridor, with a drift accumulated in their initial poses. Each
+// keyframe sees the points and lines less than 1 m ahead or behind it. The first keyframe is fixed.
+void CreateMap(const int nKFs, const int nPointsPerKF, const int nLinesPerKF, ORB_SLAM3::BASolver &solver,
+               vector<Eigen::Vector3d> &vtGT, vector<vector<pair<int,int> > > &vCovisibility)
+{
+    mt19937 rng(0);
+    normal_distribution<double> noise(0,1.0);
+    uniform_real_distribution<double> unif(-1,1);
+
+    solver.SetCalibration(fx,fy,cx,cy,bf);
+    solver.Clear();
+
+    vector<Eigen::Matrix3d> vR;
+    vtGT.clear();
+    Eigen::Matrix<double,6,1> drift = Eigen::Matrix<double,6,1>::Zero();
+    for(int i=0; i<nKFs; i++)
+    {
+        const Eigen::Matrix3d R = Eigen::AngleAxisd(0.05*sin(0.1*i),Eigen::Vector3d::UnitY()).toRotationMatrix();
+        const Eigen::Vector3d t = -R*Eigen::Vector3d(0.1*i,0,0);
+        vR.push_back(R);
+        vtGT.push_back(t);
+
+        Eigen::Matrix3d R0 = R;
+        Eigen::Vector3d t0 = t;
+        if(i>0)
+        {
+            for(int k=0; k<6; k++)
+                drift(k) += 0.0005*noise(rng);
+            ORB_SLAM3::UpdatePose(drift,R0,t0);
+        }
+        solver.AddCamera(R0,t0,i==0);
+    }
+
+    const double length = 0.1*nKFs;
+    const int nPoints = nPointsPerKF*nKFs/20;
+    const int nLines = nLinesPerKF*nKFs/20;
+    vector<vector<int> > vKFLandmarks(nKFs);
+
+    auto Visible = [&](const Eigen::Vector3d &X, const int c)
+    {
+        const Eigen::Vector3d p = vR[c]*X + vtGT[c];
+        if(p(2)<0.5 || fabs(X(0)-0.1*c)>1.0)
+            return false;
+        const double u = fx*p(0)/p(2) + cx;
+        const double v = fy*p(1)/p(2) + cy;
+        return u>0 && u<640 && v>0 && v<480;
+    };
+
+    for(int i=0; i<nPoints; i++)
+    {
+        const Eigen::Vector3d X(length*(unif(rng)+1)/2, 1.5*unif(rng), 3+unif(rng));
+        const int idx = solver.AddPoint(X + 0.05*Eigen::Vector3d(noise(rng),noise(rng),noise(rng)));
+        for(int c=max(0,int(10*X(0))-10); c<min(nKFs,int(10*X(0))+11); c++)
+        {
+            if(!Visible(X,c))
+                continue;
+            const Eigen::Vector3d p = vR[c]*X + vtGT[c];
+            const double u = fx*p(0)/p(2) + cx + noise(rng);
+            const double v = fy*p(1)/p(2) + cy + noise(rng);
+            const double ur = i%2 ? u - bf/p(2) + noise(rng) : -1;
+            solver.AddPointObservation(idx,c,u,v,ur,1.0);
+            vKFLandmarks[c].push_back(idx);
+        }
+    }
+
+    for(int i=0; i<nLines; i++)
+    {
+        const Eigen::Vector3d Xs(length*(unif(rng)+1)/2, 1.5*unif(rng), 3+unif(rng));
+        const Eigen::Vector3d Xe = Xs + Eigen::Vector3d(0.3*unif(rng), unif(rng), 0.3*unif(rng));
+        const int idx = solver.AddLine(Xs + 0.05*Eigen::Vector3d(noise(rng),noise(rng),noise(rng)),
+                                       Xe + 0.05*Eigen::Vector3d(noise(rng),noise(rng),noise(rng)));
+        for(int c=max(0,int(10*Xs(0))-10); c<min(nKFs,int(10*Xs(0))+11); c++)
+        {
+            if(!Visible(Xs,c) || !Visible(Xe,c))
+                continue;
+            const Eigen::Vector3d ps = vR[c]*Xs + vtGT[c];
+            const Eigen::Vector3d pe = vR[c]*Xe + vtGT[c];
+            const Eigen::Vector3d sp(fx*ps(0)/ps(2) + cx + noise(rng), fy*ps(1)/ps(2) + cy + noise(rng), 1);
+            const Eigen::Vector3d ep(fx*pe(0)/pe(2) + cx + noise(rng), fy*pe(1)/pe(2) + cy + noise(rng), 1);
+            Eigen::Vector3d l = sp.cross(ep);
+            l = l / std::sqrt(l(0)*l(0) + l(1)*l(1));
+            solver.AddLineObservation(idx,c,l,1.0);
+        }
+    }
+
+    // Covisibility as in KeyFrame::UpdateConnections: keyframes sharing at least 15 points
+    vCovisibility.assign(nKFs, vector<pair<int,int> >());
+    for(int i=0; i<nKFs; i++)
+    {
+        map<int,int> counter;
+        for(size_t k=0; k<vKFLandmarks[i].size(); k++)
+        {
+            const int p = vKFLandmarks[i][k];
+            for(int c=max(0,i-20); c<min(nKFs,i+21); c++)
+                if(c!=i && binary_search(vKFLandmarks[c].begin(), vKFLandmarks[c].end(), p))
+                    counter[c]++;
+        }
+        for(map<int,int>::iterator it=counter.begin(); it!=counter.end(); it++)
+            if(it->second>=15)
+                vCovisibility[i].push_back(*it);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && string(argv[1])=="-h")
+    {
+        cerr << endl << "Usage: ./global_ba [n_keyframes] [points_per_keyframe] [lines_per_keyframe] [cluster_keyframes] [n_threads]" << endl;
+        return 1;
+    }
+
+    const int nKFs = argc > 1 ? atoi(argv[1]) : 500;
+    const int nPointsPerKF = argc > 2 ? atoi(argv[2]) : 300;
+    const int nLinesPerKF = argc > 3 ? atoi(argv[3]) : 40;
+    const int nClusterKFs = argc > 4 ? atoi(argv[4]) : 50;
+    const int nThreads = argc > 5 ? atoi(argv[5]) : std::max(1u, std::thread::hardware_concurrency());
+
+    cout << "Map: " << nKFs << " keyframes, " << nPointsPerKF << " points and " << nLinesPerKF << " lines per keyframe, "
+         << nThreads << " threads" << endl;
+
+    for(int partition=0; partition<2; partition++)
+    {
+        ORB_SLAM3::BASolver solver;
+        solver.SetThreads(nThreads);
+        solver.SetLinearSolver(ORB_SLAM3::BASolver::PCG_SCHUR);
+        solver.SetPartition(partition ? nClusterKFs : 0);
+
+        vector<Eigen::Vector3d> vtGT;
+        vector<vector<pair<int,int> > > vCovisibility;
+        CreateMap(nKFs,nPointsPerKF,nLinesPerKF,solver,vtGT,vCovisibility);
+
+        const double chi2Init = solver.Chi2();
+        double errorInit = 0;
+        for(int i=0; i<nKFs; i++)
+            errorInit += (solver.GetCamera(i).tcw - vtGT[i]).norm();
+
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        const int nIt = solver.OptimizePartitioned(vCovisibility, 10, false);
+        std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+        const double t = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t2 - t1).count();
+
+        double error = 0;
+        for(int i=0; i<nKFs; i++)
+            error += (solver.GetCamera(i).tcw - vtGT[i]).norm();
+
+        cout << (partition ? "Partitioned (" + to_string(nClusterKFs) + " keyframes per cluster): " : "Whole map: ") << t << " ms, "
+             << nIt << " iterations, " << solver.GetCGIterations() << " CG iterations, chi2 " << chi2Init << " -> " << solver.Chi2()
+             << ", mean translation error " << errorInit/nKFs << " -> " << error/nKFs << " m" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Times the multi-threaded local BA solver (BASolver) with points and lines on a synthetic window
+// of RGB-D keyframes for an increasing number of threads, and checks that the estimates match the
+// single thread ones of the dense solver. The reduced camera system can be solved by the dense
+// factorization (0) or by the preconditioned conjugate gradient of the global BA (1).
+
+#include<iostream>
+#include<random>
+#include<chrono>
+#include<thread>
+
+#include<Eigen/Geometry>
+
+#include"BASolver.h"
+#include"SolverUtils.h"
+
+using namespace std;
+
+// TUM freiburg3 calibration
+const double fx = 535.4, fy = 539.2, cx = 320.1, cy = 247.6, bf = 40.0;
+
+// Keyframes moving sideways in front of a scene 2-4 m away, the first two fixed, the others with a
+// perturbed initial pose. 10% of the point observations are outliers.
+void CreateWindow(const int seed, const int nKFs, const int nPoints, const int nLines, ORB_SLAM3::BASolver &solver)
+{
+    mt19937 rng(seed);
+    normal_distribution<double> noise(0,1.0);
+    uniform_real_distribution<double> unif(-1,1);
+
+    solver.SetCalibration(fx,fy,cx,cy,bf);
+    solver.Clear();
+
+    vector<Eigen::Matrix3d> vR;
+    vector<Eigen::Vector3d> vt;
+    for(int i=0; i<nKFs; i++)
+    {
+        const Eigen::Matrix3d R = Eigen::AngleAxisd(0.01*i,Eigen::Vector3d::UnitY()).toRotationMatrix();
+        const Eigen::Vector3d t(-0.05*i,0.01*i,0);
+        vR.push_back(R);
+        vt.push_back(t);
+
+        Eigen::Matrix3d R0 = R;
+        Eigen::Vector3d t0 = t;
+        if(i>=2)
+        {
+            Eigen::Matrix<double,6,1> dx;
+            for(int k=0; k<6; k++)
+                dx(k) = 0.01*noise(rng);
+            ORB_SLAM3::UpdatePose(dx,R0,t0);
+        }
+        solver.AddCamera(R0,t0,i<2);
+    }
+
+    for(int i=0; i<nPoints; i++)
+    {
+        const Eigen::Vector3d X(2*unif(rng)+0.8, 1.5*unif(rng), 3+unif(rng));
+        const int idx = solver.AddPoint(X + 0.05*Eigen::Vector3d(noise(rng),noise(rng),noise(rng)));
+        for(int c=0; c<nKFs; c++)
+        {
+            if(unif(rng)<-0.2)
+                continue;
+            const Eigen::Vector3d p = vR[c]*X + vt[c];
+            double u = fx*p(0)/p(2) + cx + noise(rng);
+            const double v = fy*p(1)/p(2) + cy + noise(rng);
+            const double ur = i%2 ? u - bf/p(2) + noise(rng) : -1;
+            if(unif(rng)>0.8)
+                u += 50;
+            solver.AddPointObservation(idx,c,u,v,ur,1.0);
+        }
+    }
+
+    for(int i=0; i<nLines; i++)
+    {
+        const Eigen::Vector3d Xs(2*unif(rng)+0.8, 1.5*unif(rng), 3+unif(rng));
+        const Eigen::Vector3d Xe = Xs + Eigen::Vector3d(unif(rng), unif(rng), 0.3*unif(rng));
+        const int idx = solver.AddLine(Xs + 0.05*Eigen::Vector3d(noise(rng),noise(rng),noise(rng)),
+                                       Xe + 0.05*Eigen::Vector3d(noise(rng),noise(rng),noise(rng)));
+        for(int c=0; c<nKFs; c++)
+        {
+            if(unif(rng)<-0.3)
+                continue;
+            const Eigen::Vector3d ps = vR[c]*Xs + vt[c];
+            const Eigen::Vector3d pe = vR[c]*Xe + vt[c];
+            const Eigen::Vector3d sp(fx*ps(0)/ps(2) + cx + noise(rng), fy*ps(1)/ps(2) + cy + noise(rng), 1);
+            const Eigen::Vector3d ep(fx*pe(0)/pe(2) + cx + noise(rng), fy*pe(1)/pe(2) + cy + noise(rng), 1);
+            Eigen::Vector3d l = sp.cross(ep);
+            l = l / std::sqrt(l(0)*l(0) + l(1)*l(1));
+            solver.AddLineObservation(idx,c,l,1.0);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && string(argv[1])=="-h")
+    {
+        cerr << endl << "Usage: ./local_ba [n_keyframes] [n_points] [n_lines] [max_threads] [n_runs] [linear_solver]" << endl;
+        return 1;
+    }
+
+    const int nKFs = argc > 1 ? atoi(argv[1]) : 20;
+    const int nPoints = argc > 2 ? atoi(argv[2]) : 3000;
+    const int nLines = argc > 3 ? atoi(argv[3]) : 600;
+    const int maxThreads = argc > 4 ? atoi(argv[4]) : std::max(1u, std::thread::hardware_concurrency());
+    const int nRuns = argc > 5 ? atoi(argv[5]) : 5;
+    const int linearSolver = argc > 6 ? atoi(argv[6]) : ORB_SLAM3::BASolver::DENSE_SCHUR;
+
+    cout << "Window: " << nKFs << " keyframes, " << nPoints << " points, " << nLines << " lines, "
+         << (linearSolver==ORB_SLAM3::BASolver::PCG_SCHUR ? "PCG" : "dense") << " reduced system" << endl;
+
+    vector<Eigen::Vector3d> vtRef;
+    for(int run=0; run<nRuns; run++)
+    {
+        ORB_SLAM3::BASolver solver;
+        CreateWindow(run,nKFs,nPoints,nLines,solver);
+        solver.Solve();
+        for(int i=0; i<nKFs; i++)
+            vtRef.push_back(solver.GetCamera(i).tcw);
+    }
+
+    for(int nThreads=1; nThreads<=maxThreads; nThreads*=2)
+    {
+        double t = 0;
+        double maxDiff = 0;
+        int nCGIterations = 0;
+        for(int run=0; run<nRuns; run++)
+        {
+            ORB_SLAM3::BASolver solver;
+            solver.SetThreads(nThreads);
+            solver.SetLinearSolver(linearSolver);
+            CreateWindow(run,nKFs,nPoints,nLines,solver);
+
+            std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+            solver.Solve();
+            std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+            t += std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t2 - t1).count();
+            nCGIterations += solver.GetCGIterations();
+
+            for(int i=0; i<nKFs; i++)
+                maxDiff = std::max(maxDiff, (solver.GetCamera(i).tcw - vtRef[run*nKFs+i]).norm());
+        }
+
+        cout << nThreads << " threads: " << t/nRuns << " ms/window";
+        if(linearSolver==ORB_SLAM3::BASolver::PCG_SCHUR)
+            cout << ", " << nCGIterations/nRuns << " CG iterations in the last round";
+        cout << ", max translation difference with dense 1 thread " << maxDiff << " m" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,228 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Compares the time of the pose optimization with points and lines of a frame with the g2o graph
+// (Optimizer::PoseOptimizationPL) and with the fixed-size solver (PoseSolver), on synthetic RGB-D
+// frames with noisy and outlier correspondences, and reports the frames where their poses or
+// outlier flags differ.
+
+#include<iostream>
+#include<random>
+#include<chrono>
+
+#include<opencv2/core/core.hpp>
+
+#include"Frame.h"
+#include"Map.h"
+#include"MapPoint.h"
+#include"MapLine.h"
+#include"Optimizer.h"
+#include"PoseSolver.h"
+#include"Converter.h"
+#include"CameraModels/Pinhole.h"
+
+using namespace std;
+
+// TUM freiburg3 calibration
+const float fx = 535.4, fy = 539.2, cx = 320.1, cy = 247.6, bf = 40.0;
+
+struct SyntheticFrame
+{
+    vector<ORB_SLAM3::MapPoint*> vpMP;
+    vector<ORB_SLAM3::MapLine*> vpML;
+    vector<cv::KeyPoint> vKeys;
+    vector<float> vuRight;
+    vector<cv::line_descriptor::KeyLine> vKeyLines;
+    vector<Eigen::Vector3d> vle;
+    cv::Mat Tcw, Tcw_gt;
+};
+
+cv::Mat RandomPose(mt19937 &rng, const double rot, const double trans)
+{
+    normal_distribution<double> nr(0,rot), nt(0,trans);
+    Eigen::Vector3d w(nr(rng),nr(rng),nr(rng));
+    Eigen::Matrix3d R = Eigen::AngleAxisd(w.norm(),w.normalized()).toRotationMatrix();
+    Eigen::Vector3d t(nt(rng),nt(rng),nt(rng));
+    return ORB_SLAM3::Converter::toCvSE3(R,t);
+}
+
+// Visible 3D point in front of the ground truth camera, returned in world coordinates
+Eigen::Vector3d RandomPoint(mt19937 &rng, const Eigen::Matrix4d &Twc)
+{
+    uniform_real_distribution<double> u(0,640), v(0,480), z(0.8,4.0);
+    const double d = z(rng);
+    Eigen::Vector4d Xc((u(rng)-cx)*d/fx,(v(rng)-cy)*d/fy,d,1);
+    return (Twc*Xc).head(3);
+}
+
+SyntheticFrame CreateFrame(mt19937 &rng, ORB_SLAM3::Map* pMap, const int nPoints, const int nLines, const double outlierRatio)
+{
+    SyntheticFrame F;
+    F.Tcw_gt = RandomPose(rng,0.3,1.0);
+    // Initial guess as given by the motion model
+    F.Tcw = RandomPose(rng,0.01,0.02)*F.Tcw_gt;
+
+    const Eigen::Matrix4d Tcw = ORB_SLAM3::Converter::toMatrix4d(F.Tcw_gt);
+    const Eigen::Matrix4d Twc = Tcw.inverse();
+    normal_distribution<double> noise(0,1.0);
+    uniform_real_distribution<double> unif(0,1);
+
+    for(int i=0; i<nPoints; i++)
+    {
+        const Eigen::Vector3d Xw = RandomPoint(rng,Twc);
+        Eigen::Vector3d Xc = Tcw.block<3,3>(0,0)*Xw + Tcw.block<3,1>(0,3);
+        if(unif(rng)<outlierRatio)
+            Xc = Tcw.block<3,3>(0,0)*RandomPoint(rng,Twc) + Tcw.block<3,1>(0,3);
+
+        cv::KeyPoint kp;
+        kp.pt.x = fx*Xc(0)/Xc(2) + cx + noise(rng);
+        kp.pt.y = fy*Xc(1)/Xc(2) + cy + noise(rng);
+        kp.octave = 0;
+        F.vKeys.push_back(kp);
+        F.vuRight.push_back(kp.pt.x - bf/Xc(2));
+
+        ORB_SLAM3::MapPoint* pMP = new ORB_SLAM3::MapPoint();
+        pMP->SetWorldPos(ORB_SLAM3::Converter::toCvMat(Xw));
+        F.vpMP.push_back(pMP);
+    }
+
+    for(int i=0; i<nLines; i++)
+    {
+        const Eigen::Vector3d Xs = RandomPoint(rng,Twc);
+        const Eigen::Vector3d Xe = RandomPoint(rng,Twc);
+        Eigen::Vector3d Xcs = Tcw.block<3,3>(0,0)*Xs + Tcw.block<3,1>(0,3);
+        Eigen::Vector3d Xce = Tcw.block<3,3>(0,0)*Xe + Tcw.block<3,1>(0,3);
+        if(unif(rng)<outlierRatio)
+            Xcs = Tcw.block<3,3>(0,0)*RandomPoint(rng,Twc) + Tcw.block<3,1>(0,3);
+
+        const Eigen::Vector3d sp(fx*Xcs(0)/Xcs(2) + cx + noise(rng), fy*Xcs(1)/Xcs(2) + cy + noise(rng), 1);
+        const Eigen::Vector3d ep(fx*Xce(0)/Xce(2) + cx + noise(rng), fy*Xce(1)/Xce(2) + cy + noise(rng), 1);
+        Eigen::Vector3d le = sp.cross(ep);
+        le = le / std::sqrt(le(0)*le(0) + le(1)*le(1));
+        F.vle.push_back(le);
+
+        cv::line_descriptor::KeyLine kl;
+        kl.octave = 0;
+        F.vKeyLines.push_back(kl);
+
+        F.vpML.push_back(new ORB_SLAM3::MapLine(Xs,Xe,pMap));
+    }
+
+    return F;
+}
+
+void LoadFrame(const SyntheticFrame &F, ORB_SLAM3::Frame &frame)
+{
+    frame.N = F.vpMP.size();
+    frame.mvpMapPoints = F.vpMP;
+    frame.mvKeysUn = F.vKeys;
+    frame.mvuRight = F.vuRight;
+    frame.mvbOutlier = vector<bool>(frame.N,false);
+
+    frame.N_l = F.vpML.size();
+    frame.mvpMapLines = F.vpML;
+    frame.mvKeys_Line = F.vKeyLines;
+    frame.mvle_l = F.vle;
+    frame.mvbOutlier_Line = vector<bool>(frame.N_l,false);
+
+    frame.SetPose(F.Tcw.clone());
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && string(argv[1])=="-h")
+    {
+        cerr << endl << "Usage: ./pose_optimization [n_frames] [n_points] [n_lines] [outlier_ratio]" << endl;
+        return 1;
+    }
+
+    const int nFrames = argc > 1 ? atoi(argv[1]) : 500;
+    const int nPoints = argc > 2 ? atoi(argv[2]) : 300;
+    const int nLines = argc > 3 ? atoi(argv[3]) : 100;
+    const double outlierRatio = argc > 4 ? atof(argv[4]) : 0.1;
+
+    vector<float> vCamCalib{fx,fy,cx,cy};
+    ORB_SLAM3::Pinhole camera(vCamCalib);
+
+    ORB_SLAM3::Frame frame;
+    ORB_SLAM3::Frame::fx = fx;
+    ORB_SLAM3::Frame::fy = fy;
+    ORB_SLAM3::Frame::cx = cx;
+    ORB_SLAM3::Frame::cy = cy;
+    ORB_SLAM3::Frame::invfx = 1.0f/fx;
+    ORB_SLAM3::Frame::invfy = 1.0f/fy;
+    frame.mbf = bf;
+    frame.mpCamera = &camera;
+    frame.mvInvLevelSigma2 = vector<float>(8,1.0f);
+    frame.mvInvLevelSigma2_l = vector<float>(2,1.0f);
+
+    ORB_SLAM3::Map* pMap = new ORB_SLAM3::Map();
+    mt19937 rng(0);
+    vector<SyntheticFrame> vFrames;
+    for(int i=0; i<nFrames; i++)
+        vFrames.push_back(CreateFrame(rng,pMap,nPoints,nLines,outlierRatio));
+
+    ORB_SLAM3::PoseSolver solver;
+    double tG2o = 0, tSolver = 0;
+    double errG2o = 0, errSolver = 0, poseDiff = 0, maxPoseDiff = 0;
+    int nInliersDiff = 0, nFlagsDiff = 0, nFramesDiff = 0;
+
+    for(size_t i=0; i<vFrames.size(); i++)
+    {
+        const SyntheticFrame &F = vFrames[i];
+
+        LoadFrame(F,frame);
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        const int nG2o = ORB_SLAM3::Optimizer::PoseOptimizationPL(&frame);
+        std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+        tG2o += std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t2 - t1).count();
+        const cv::Mat TcwG2o = frame.mTcw.clone();
+        const vector<bool> vbOutlierG2o = frame.mvbOutlier;
+        const vector<bool> vbOutlierLineG2o = frame.mvbOutlier_Line;
+
+        LoadFrame(F,frame);
+        t1 = std::chrono::steady_clock::now();
+        const int nSolver = solver.PoseOptimizationPL(&frame);
+        t2 = std::chrono::steady_clock::now();
+        tSolver += std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t2 - t1).count();
+        const cv::Mat TcwSolver = frame.mTcw.clone();
+
+        errG2o += cv::norm(TcwG2o.rowRange(0,3).col(3) - F.Tcw_gt.rowRange(0,3).col(3));
+        errSolver += cv::norm(TcwSolver.rowRange(0,3).col(3) - F.Tcw_gt.rowRange(0,3).col(3));
+        const double diff = cv::norm(TcwG2o - TcwSolver);
+        poseDiff += diff;
+        maxPoseDiff = max(maxPoseDiff,diff);
+        nInliersDiff += abs(nG2o - nSolver);
+
+        int nFlags = 0;
+        for(int j=0; j<frame.N; j++)
+            nFlags += vbOutlierG2o[j]!=frame.mvbOutlier[j];
+        for(int j=0; j<frame.N_l; j++)
+            nFlags += vbOutlierLineG2o[j]!=frame.mvbOutlier_Line[j];
+        nFlagsDiff += nFlags;
+        nFramesDiff += nFlags>0 || diff>1e-3;
+    }
+
+    const double n = vFrames.size();
+    cout << "Frames: " << vFrames.size() << " (" << nPoints << " points, " << nLines << " lines, "
+         << outlierRatio*100 << "% outliers)" << endl;
+    cout << "g2o graph:         " << tG2o/n << " ms/frame, translation error " << errG2o/n << " m" << endl;
+    cout << "Fixed-size solver: " << tSolver/n << " ms/frame, translation error " << errSolver/n << " m" << endl;
+    cout << "Mean pose difference: " << poseDiff/n << " (max " << maxPoseDiff << "), mean inlier count difference: "
+         << nInliersDiff/n << ", outlier flags differing: " << nFlagsDiff << endl;
+    cout << "Frames where the solvers disagree: " << nFramesDiff << endl;
+
+    return 0;
+}
@@ -0,0 +1,223 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Replays an optimization problem captured during a run (optimizationCapture in the settings file)
+// with a selectable solver, and times it. The problem is loaded again for every repetition.
+//   pose:            PoseSolver
+//   lba, gba:        BASolver, solver 0->dense Schur, 1->PCG (gba partitioned with cluster_keyframes>0)
+//   essential_graph: g2o Levenberg-Marquardt, solver 0->LinearSolverEigen, 1->LinearSolverDense
+
+#include<iostream>
+#include<cmath>
+#include<fstream>
+#include<sstream>
+#include<chrono>
+#include<thread>
+
+#include<Eigen/Geometry>
+
+#include"PoseSolver.h"
+#include"BASolver.h"
+#include"ProblemCapture.h"
+#include"OutlierRejection.h"
+
+#include"Thirdparty/g2o/g2o/core/block_solver.h"
+#include"Thirdparty/g2o/g2o/core/optimization_algorithm_levenberg.h"
+#include"Thirdparty/g2o/g2o/solvers/linear_solver_eigen.h"
+#include"Thirdparty/g2o/g2o/solvers/linear_solver_dense.h"
+#include"Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
+
+using namespace std;
+
+double ElapsedMs(const std::chrono::steady_clock::time_point &t1)
+{
+    return std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(std::chrono::steady_clock::now() - t1).count();
+}
+
+bool ReplayPose(istringstream &data, const streampos start, const int nRepetitions)
+{
+    ORB_SLAM3::PoseSolver solver;
+    Eigen::Matrix3d Rcw0, Rcw;
+    Eigen::Vector3d tcw0, tcw;
+    double t = 0;
+    int nInliers = 0;
+    for(int r=0; r<nRepetitions; r++)
+    {
+        data.clear();
+        data.seekg(start);
+        if(!solver.Load(data, Rcw0, tcw0))
+            return false;
+
+        Rcw = Rcw0;
+        tcw = tcw0;
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        nInliers = solver.Solve(Rcw, tcw);
+        t += ElapsedMs(t1);
+    }
+
+    const double angle = Eigen::AngleAxisd(Rcw*Rcw0.transpose()).angle();
+    const Eigen::Vector3d Ow0 = -Rcw0.transpose()*tcw0;
+    const Eigen::Vector3d Ow = -Rcw.transpose()*tcw;
+    cout << "Pose optimization: " << solver.GetPoints().size() << " points, " << solver.GetLines().size() << " lines" << endl;
+    cout << "PoseSolver: " << t/nRepetitions << " ms, " << nInliers << " inliers, pose correction " << (Ow-Ow0).norm()
+         << " m, " << angle*180.0/M_PI << " deg" << endl;
+    return true;
+}
+
+bool ReplayBA(istringstream &data, const streampos start, const int problem, const int nSolver, const int nThreads,
+              const int nRepetitions, const int nClusterKFs)
+{
+    ORB_SLAM3::BASolver solver;
+    solver.SetThreads(nThreads);
+    solver.SetLinearSolver(nSolver==1 ? ORB_SLAM3::BASolver::PCG_SCHUR : ORB_SLAM3::BASolver::DENSE_SCHUR);
+
+    double t = 0, chi2Init = 0;
+    int nIt = 0, nInliers = 0, nIterations = 0;
+    bool bRobust = false;
+    vector<vector<pair<int,int> > > vCovisibility;
+    for(int r=0; r<nRepetitions; r++)
+    {
+        data.clear();
+        data.seekg(start);
+        if(problem==ORB_SLAM3::ProblemCapture::LOCAL_BA)
+        {
+            if(!solver.Load(data))
+                return false;
+        }
+        else if(!ORB_SLAM3::ProblemCapture::LoadGlobalBA(data, solver, nIterations, bRobust, vCovisibility))
+            return false;
+        solver.SetPartition(nClusterKFs);
+        chi2Init = solver.Chi2();
+
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        if(problem==ORB_SLAM3::ProblemCapture::LOCAL_BA)
+            solver.Solve();
+        else if(nClusterKFs>0)
+            nIt = solver.OptimizePartitioned(vCovisibility, nIterations, bRobust);
+        else
+            nIt = solver.Optimize(nIterations, bRobust);
+        t += ElapsedMs(t1);
+    }
+    nInliers = solver.ClassifyObservations();
+
+    const size_t nObs = solver.GetPointObservations().size() + solver.GetLineObservations().size();
+    cout << ORB_SLAM3::ProblemCapture::GetProblemName(problem) << ": " << solver.GetPointObservations().size() << " point and "
+         << solver.GetLineObservations().size() << " line observations" << endl;
+    cout << "BASolver (" << (nSolver==1 ? "PCG" : "dense Schur") << ", " << nThreads << " threads";
+    if(problem==ORB_SLAM3::ProblemCapture::GLOBAL_BA)
+        cout << (nClusterKFs>0 ? ", clusters of " + to_string(nClusterKFs) + " keyframes" : "") << "): " << t/nRepetitions << " ms, "
+             << nIt << " iterations, " << solver.GetCGIterations() << " CG iterations";
+    else
+        cout << "): " << t/nRepetitions << " ms";
+    cout << ", chi2 " << chi2Init << " -> " << solver.Chi2() << ", " << nInliers << " of " << nObs << " inliers" << endl;
+    return true;
+}
+
+bool ReplayEssentialGraph(istringstream &data, const streampos start, const int nSolver, const int nRepetitions)
+{
+    double t = 0, chi2Init = 0, chi2 = 0;
+    size_t nVertices = 0, nEdges = 0;
+    for(int r=0; r<nRepetitions; r++)
+    {
+        data.clear();
+        data.seekg(start);
+
+        g2o::SparseOptimizer optimizer;
+        optimizer.setVerbose(false);
+        g2o::BlockSolver_7_3::LinearSolverType * linearSolver;
+        if(nSolver==1)
+            linearSolver = new g2o::LinearSolverDense<g2o::BlockSolver_7_3::PoseMatrixType>();
+        else
+            linearSolver = new g2o::LinearSolverEigen<g2o::BlockSolver_7_3::PoseMatrixType>();
+        g2o::BlockSolver_7_3 * solver_ptr = new g2o::BlockSolver_7_3(linearSolver);
+        g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
+        solver->setUserLambdaInit(1e-16);
+        optimizer.setAlgorithm(solver);
+
+        int nIterations = 0;
+        if(!ORB_SLAM3::ProblemCapture::LoadEssentialGraph(data, optimizer, nIterations))
+            return false;
+        nVertices = optimizer.vertices().size();
+        nEdges = optimizer.edges().size();
+
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        optimizer.initializeOptimization();
+        optimizer.computeActiveErrors();
+        chi2Init = optimizer.activeRobustChi2();
+        optimizer.optimize(nIterations);
+        t += ElapsedMs(t1);
+
+        optimizer.computeActiveErrors();
+        chi2 = optimizer.activeRobustChi2();
+    }
+
+    cout << "Essential graph: " << nVertices << " keyframes, " << nEdges << " edges" << endl;
+    cout << "g2o (" << (nSolver==1 ? "LinearSolverDense" : "LinearSolverEigen") << "): " << t/nRepetitions << " ms, chi2 "
+         << chi2Init << " -> " << chi2 << endl;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 2)
+    {
+        cerr << endl << "Usage: ./replay_optimization capture.bin [solver] [n_threads] [repetitions] [cluster_keyframes]" << endl;
+        return 1;
+    }
+
+    const int nSolver = argc > 2 ? atoi(argv[2]) : 0;
+    const int nThreads = argc > 3 ? atoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+    const int nRepetitions = argc > 4 ? std::max(atoi(argv[4]),1) : 10;
+    const int nClusterKFs = argc > 5 ? atoi(argv[5]) : 0;
+
+    ifstream f(argv[1], ios::in | ios::binary);
+    if(!f.is_open())
+    {
+        cerr << "Could not open " << argv[1] << endl;
+        return 1;
+    }
+    stringstream buffer;
+    buffer << f.rdbuf();
+    istringstream data(buffer.str());
+
+    int problem;
+    if(!ORB_SLAM3::ProblemCapture::ReadHeader(data, problem))
+    {
+        cerr << argv[1] << " is not a problem capture" << endl;
+        return 1;
+    }
+    const streampos start = data.tellg();
+
+    const int kernel = ORB_SLAM3::OutlierRejection::GetKernel();
+    cout << "Robust kernel: " << (kernel==ORB_SLAM3::OutlierRejection::KERNEL_CAUCHY ? "Cauchy" :
+                                  kernel==ORB_SLAM3::OutlierRejection::KERNEL_GEMAN_MCCLURE ? "Geman-McClure" : "Huber")
+         << ", outlier threshold scale up to " << ORB_SLAM3::OutlierRejection::GetMaxThresholdScale() << endl;
+
+    bool bOk;
+    if(problem==ORB_SLAM3::ProblemCapture::POSE_OPTIMIZATION)
+        bOk = ReplayPose(data, start, nRepetitions);
+    else if(problem==ORB_SLAM3::ProblemCapture::ESSENTIAL_GRAPH)
+        bOk = ReplayEssentialGraph(data, start, nSolver, nRepetitions);
+    else
+        bOk = ReplayBA(data, start, problem, nSolver, nThreads, nRepetitions, nClusterKFs);
+
+    if(!bOk)
+    {
+        cerr << "Corrupted capture " << argv[1] << endl;
+        return 1;
+    }
+
+    return 0;
+}
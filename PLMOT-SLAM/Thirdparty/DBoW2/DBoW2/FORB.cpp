@@ -14,6 +14,11 @@
 #include <string>
 #include <sstream>
 #include <stdint-gcc.h>
+#include <cstring>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "FORB.h"
 
@@ -100,6 +105,49 @@ int FORB::distance(const FORB::TDescriptor &a,
   return dist;
 }
 
+// --------------------------------------------------------------------------
+
+void FORB::distances(const FORB::TDescriptor &a,
+  const unsigned char *block, int n, int *dists)
+{
+#ifdef __AVX2__
+  // Nibble lookup popcount (Mula et al.), one 256-bit lane per descriptor
+  const __m256i lookup = _mm256_setr_epi8(
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+
+  const __m256i va = _mm256_loadu_si256((const __m256i*)a.ptr<unsigned char>());
+
+  for(int i = 0; i < n; ++i, block += 32)
+  {
+    const __m256i vb = _mm256_load_si256((const __m256i*)block);
+    const __m256i x = _mm256_xor_si256(va, vb);
+    const __m256i lo = _mm256_and_si256(x, low_mask);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+    const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+      _mm256_shuffle_epi8(lookup, hi));
+    const __m256i sad = _mm256_sad_epu8(cnt, zero);
+    const __m128i s = _mm_add_epi64(_mm256_castsi256_si128(sad),
+      _mm256_extracti128_si256(sad, 1));
+    dists[i] = _mm_cvtsi128_si32(s) + _mm_extract_epi32(s, 2);
+  }
+#else
+  uint64_t pa[4];
+  std::memcpy(pa, a.ptr<unsigned char>(), 32);
+
+  const uint64_t *pb = (const uint64_t*)block;
+  for(int i = 0; i < n; ++i, pb += 4)
+  {
+    dists[i] = __builtin_popcountll(pa[0] ^ pb[0]) +
+      __builtin_popcountll(pa[1] ^ pb[1]) +
+      __builtin_popcountll(pa[2] ^ pb[2]) +
+      __builtin_popcountll(pa[3] ^ pb[3]);
+  }
+#endif
+}
+
 // --------------------------------------------------------------------------
   
 std::string FORB::toString(const FORB::TDescriptor &a)
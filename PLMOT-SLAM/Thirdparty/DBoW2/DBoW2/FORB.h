@@ -46,6 +46,17 @@ public:
    */
   static int distance(const TDescriptor &a, const TDescriptor &b);
 
+  /**
+   * Calculates the distances between a descriptor and a block of n
+   * descriptors stored contiguously (L bytes each, 32-byte aligned)
+   * @param a
+   * @param block first byte of the block
+   * @param n number of descriptors in the block
+   * @param dists (out) n distances
+   */
+  static void distances(const TDescriptor &a, const unsigned char *block,
+    int n, int *dists);
+
   /**
    * Returns a string version of the descriptor
    * @param a descriptor
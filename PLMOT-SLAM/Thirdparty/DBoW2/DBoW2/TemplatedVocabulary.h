@@ -26,6 +26,7 @@
 #include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <limits>
+#include <thread>
 
 #include "FeatureVector.h"
 #include "BowVector.h"
@@ -151,6 +152,25 @@ public:
    * @return word id
    */
   virtual WordId transform(const TDescriptor& feature) const;
+
+  /**
+   * Sets the number of threads used to transform the features of a set of
+   * descriptors (1 by default, i.e. run in the calling thread)
+   * @param n number of threads
+   */
+  inline void setTransformThreads(int n) { m_transform_threads = std::max(n, 1); }
+
+  /**
+   * Returns the number of threads used to transform a set of descriptors
+   */
+  inline int getTransformThreads() const { return m_transform_threads; }
+
+  /**
+   * Selects whether features are propagated down the flattened tree (default)
+   * or down the node tree. Both produce the same words
+   * @param use
+   */
+  inline void setUseFlatTree(bool use) { m_use_flat = use; }
   
   /**
    * Returns the score of two vectors
@@ -361,6 +381,19 @@ protected:
    * @param id (out) word id
    */
   virtual void transform(const TDescriptor &feature, WordId &id) const;
+
+  /**
+   * Returns the word id, weight and node id of each feature of a set,
+   * splitting the set among m_transform_threads threads
+   * @param features
+   * @param ids (out) word ids
+   * @param weights (out) word weights
+   * @param nids (out) if given, ids of the nodes "levelsup" levels up
+   * @param levelsup
+   */
+  void transform(const std::vector<TDescriptor>& features,
+    vector<WordId> &ids, vector<WordValue> &weights, vector<NodeId> *nids,
+    int levelsup) const;
       
   /**
    * Creates a level in the tree, under the parent, by running kmeans with
@@ -393,6 +426,12 @@ protected:
    * Create the words of the vocabulary once the tree has been built
    */
   void createWords();
+
+  /**
+   * Creates the flattened copy of the tree used by transform. It must be
+   * called every time m_nodes changes
+   */
+  void createFlatTree();
   
   /**
    * Sets the weights of the nodes of tree according to the given features.
@@ -425,6 +464,23 @@ protected:
   /// Words of the vocabulary (tree leaves)
   /// this condition holds: m_words[wid]->word_id == wid
   std::vector<Node*> m_words;
+
+  /// Flattened tree. The children of node i are
+  /// m_flat_children[m_flat_offsets[i] .. m_flat_offsets[i+1]) and their
+  /// descriptors are stored at the same positions in m_flat_descriptors,
+  /// F::L bytes each, so that the distances to all the children of a node
+  /// are computed over a contiguous block
+  std::vector<unsigned int> m_flat_offsets;
+  std::vector<NodeId> m_flat_children;
+  std::vector<unsigned char> m_flat_buffer;
+  /// 32-byte aligned start of the descriptors inside m_flat_buffer
+  unsigned char *m_flat_descriptors;
+
+  /// Use the flattened tree in transform
+  bool m_use_flat;
+
+  /// Number of threads used to transform a set of features
+  int m_transform_threads;
   
 };
 
@@ -434,7 +490,8 @@ template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
   (int k, int L, WeightingType weighting, ScoringType scoring)
   : m_k(k), m_L(L), m_weighting(weighting), m_scoring(scoring),
-  m_scoring_object(NULL)
+  m_scoring_object(NULL), m_flat_descriptors(NULL), m_use_flat(true),
+  m_transform_threads(1)
 {
   createScoringObject();
 }
@@ -443,7 +500,8 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const std::string &filename): m_scoring_object(NULL)
+  (const std::string &filename): m_scoring_object(NULL),
+  m_flat_descriptors(NULL), m_use_flat(true), m_transform_threads(1)
 {
   load(filename);
 }
@@ -452,7 +510,8 @@ TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
 
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary
-  (const char *filename): m_scoring_object(NULL)
+  (const char *filename): m_scoring_object(NULL),
+  m_flat_descriptors(NULL), m_use_flat(true), m_transform_threads(1)
 {
   load(filename);
 }
@@ -516,7 +575,7 @@ void TemplatedVocabulary<TDescriptor,F>::setWeightingType(WeightingType type)
 template<class TDescriptor, class F>
 TemplatedVocabulary<TDescriptor,F>::TemplatedVocabulary(
   const TemplatedVocabulary<TDescriptor, F> &voc)
-  : m_scoring_object(NULL)
+  : m_scoring_object(NULL), m_flat_descriptors(NULL)
 {
   *this = voc;
 }
@@ -548,6 +607,10 @@ TemplatedVocabulary<TDescriptor,F>::operator=
   
   this->m_nodes = voc.m_nodes;
   this->createWords();
+  this->createFlatTree();
+
+  this->m_use_flat = voc.m_use_flat;
+  this->m_transform_threads = voc.m_transform_threads;
   
   return *this;
 }
@@ -583,6 +646,8 @@ void TemplatedVocabulary<TDescriptor,F>::create(
 
   // and set the weight of each node of the tree
   setNodeWeights(training_features);
+
+  createFlatTree();
   
 }
 
@@ -939,6 +1004,43 @@ void TemplatedVocabulary<TDescriptor,F>::createWords()
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::createFlatTree()
+{
+  m_flat_offsets.clear();
+  m_flat_children.clear();
+  m_flat_buffer.clear();
+  m_flat_descriptors = NULL;
+
+  if(m_nodes.empty()) return;
+
+  m_flat_offsets.resize(m_nodes.size() + 1);
+  m_flat_children.reserve(m_nodes.size());
+
+  for(size_t i = 0; i < m_nodes.size(); ++i)
+  {
+    m_flat_offsets[i] = m_flat_children.size();
+    m_flat_children.insert(m_flat_children.end(),
+      m_nodes[i].children.begin(), m_nodes[i].children.end());
+  }
+  m_flat_offsets[m_nodes.size()] = m_flat_children.size();
+
+  // over-allocate to align the start of the block to 32 bytes
+  const size_t L = F::L;
+  m_flat_buffer.resize(m_flat_children.size() * L + 31);
+  const size_t misalign = (size_t)(&m_flat_buffer[0]) & 31;
+  m_flat_descriptors = &m_flat_buffer[0] + (misalign == 0 ? 0 : 32 - misalign);
+
+  for(size_t i = 0; i < m_flat_children.size(); ++i)
+  {
+    const TDescriptor &d = m_nodes[m_flat_children[i]].descriptor;
+    std::copy(d.template ptr<unsigned char>(),
+      d.template ptr<unsigned char>() + L, m_flat_descriptors + i * L);
+  }
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F>
 void TemplatedVocabulary<TDescriptor,F>::setNodeWeights
   (const vector<vector<TDescriptor> > &training_features)
@@ -1077,20 +1179,19 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
 
-	typename vector<TDescriptor>::const_iterator fit;
+  vector<WordId> ids;
+  vector<WordValue> weights;
+  transform(features, ids, weights, NULL, 0);
 
   if(m_weighting == TF || m_weighting == TF_IDF)
   {
-    for(fit = features.begin(); fit < features.end(); ++fit)
+    for(size_t i = 0; i < ids.size(); ++i)
     {
-      WordId id;
-      WordValue w; 
       // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w);
+      const WordValue w = weights[i];
       
       // not stopped
-      if(w > 0) v.addWeight(id, w);
+      if(w > 0) v.addWeight(ids[i], w);
     }
     
     if(!v.empty() && !must)
@@ -1104,16 +1205,13 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   }
   else // IDF || BINARY
   {
-    for(fit = features.begin(); fit < features.end(); ++fit)
+    for(size_t i = 0; i < ids.size(); ++i)
     {
-      WordId id;
-      WordValue w;
       // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w);
+      const WordValue w = weights[i];
       
       // not stopped
-      if(w > 0) v.addIfNotExist(id, w);
+      if(w > 0) v.addIfNotExist(ids[i], w);
       
     } // if add_features
   } // if m_weighting == ...
@@ -1139,25 +1237,23 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   // normalize 
   LNorm norm;
   bool must = m_scoring_object->mustNormalize(norm);
-  
-  typename vector<TDescriptor>::const_iterator fit;
+
+  vector<WordId> ids;
+  vector<WordValue> weights;
+  vector<NodeId> nids;
+  transform(features, ids, weights, &nids, levelsup);
   
   if(m_weighting == TF || m_weighting == TF_IDF)
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    for(unsigned int i_feature = 0; i_feature < ids.size(); ++i_feature)
     {
-      WordId id;
-      NodeId nid;
-      WordValue w; 
       // w is the idf value if TF_IDF, 1 if TF
-      
-      transform(*fit, id, w, &nid, levelsup);
+      const WordValue w = weights[i_feature];
       
       if(w > 0) // not stopped
       { 
-        v.addWeight(id, w);
-        fv.addFeature(nid, i_feature);
+        v.addWeight(ids[i_feature], w);
+        fv.addFeature(nids[i_feature], i_feature);
       }
     }
     
@@ -1172,20 +1268,15 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
   }
   else // IDF || BINARY
   {
-    unsigned int i_feature = 0;
-    for(fit = features.begin(); fit < features.end(); ++fit, ++i_feature)
+    for(unsigned int i_feature = 0; i_feature < ids.size(); ++i_feature)
     {
-      WordId id;
-      NodeId nid;
-      WordValue w;
       // w is idf if IDF, or 1 if BINARY
-      
-      transform(*fit, id, w, &nid, levelsup);
+      const WordValue w = weights[i_feature];
       
       if(w > 0) // not stopped
       {
-        v.addIfNotExist(id, w);
-        fv.addFeature(nid, i_feature);
+        v.addIfNotExist(ids[i_feature], w);
+        fv.addFeature(nids[i_feature], i_feature);
       }
     }
   } // if m_weighting == ...
@@ -1195,6 +1286,57 @@ void TemplatedVocabulary<TDescriptor,F>::transform(
 
 // --------------------------------------------------------------------------
 
+template<class TDescriptor, class F>
+void TemplatedVocabulary<TDescriptor,F>::transform(
+  const std::vector<TDescriptor>& features,
+  vector<WordId> &ids, vector<WordValue> &weights, vector<NodeId> *nids,
+  int levelsup) const
+{
+  const int N = features.size();
+
+  ids.resize(N);
+  weights.resize(N);
+  if(nids) nids->resize(N);
+
+  // do not pay the thread start-up for small sets
+  const int min_features_per_thread = 128;
+  const int nthreads = std::min(m_transform_threads,
+    std::max(N / min_features_per_thread, 1));
+
+  // each thread writes a disjoint range, so the output does not depend on
+  // the number of threads
+  auto transform_range = [&](int begin, int end)
+  {
+    for(int i = begin; i < end; ++i)
+    {
+      transform(features[i], ids[i], weights[i],
+        nids ? &(*nids)[i] : NULL, levelsup);
+    }
+  };
+
+  if(nthreads <= 1)
+  {
+    transform_range(0, N);
+    return;
+  }
+
+  vector<std::thread> threads;
+  threads.reserve(nthreads - 1);
+  const int chunk = (N + nthreads - 1) / nthreads;
+  for(int t = 1; t < nthreads; ++t)
+  {
+    const int begin = std::min(t * chunk, N);
+    const int end = std::min(begin + chunk, N);
+    threads.push_back(std::thread(transform_range, begin, end));
+  }
+  transform_range(0, std::min(chunk, N));
+
+  for(size_t t = 0; t < threads.size(); ++t)
+    threads[t].join();
+}
+
+// --------------------------------------------------------------------------
+
 template<class TDescriptor, class F> 
 inline double TemplatedVocabulary<TDescriptor,F>::score
   (const BowVector &v1, const BowVector &v2) const
@@ -1229,6 +1371,48 @@ void TemplatedVocabulary<TDescriptor,F>::transform(const TDescriptor &feature,
   NodeId final_id = 0; // root
   int current_level = 0;
 
+  if(m_use_flat && !m_flat_offsets.empty())
+  {
+    const size_t L = F::L;
+
+    // distances to a block of children at a time
+    const int block_size = 64;
+    int dists[block_size];
+
+    do
+    {
+      ++current_level;
+      const unsigned int first = m_flat_offsets[final_id];
+      const int nchildren = m_flat_offsets[final_id + 1] - first;
+
+      int best_d = std::numeric_limits<int>::max();
+      for(int b = 0; b < nchildren; b += block_size)
+      {
+        const int n = std::min(block_size, nchildren - b);
+        F::distances(feature, m_flat_descriptors + (first + b) * L, n, dists);
+
+        // strict comparison keeps the first best child, as the tree walk
+        for(int i = 0; i < n; ++i)
+        {
+          if(dists[i] < best_d)
+          {
+            best_d = dists[i];
+            final_id = m_flat_children[first + b + i];
+          }
+        }
+      }
+
+      if(nid != NULL && current_level == nid_level)
+        *nid = final_id;
+
+    } while(m_flat_offsets[final_id + 1] != m_flat_offsets[final_id]);
+
+    // turn node id into word id
+    word_id = m_nodes[final_id].word_id;
+    weight = m_nodes[final_id].weight;
+    return;
+  }
+
   do
   {
     ++current_level;
@@ -1419,6 +1603,8 @@ bool TemplatedVocabulary<TDescriptor,F>::loadFromTextFile(const std::string &fil
         }
     }
 
+    createFlatTree();
+
     return true;
 
 }
@@ -1619,6 +1805,8 @@ void TemplatedVocabulary<TDescriptor,F>::load(const cv::FileStorage &fs,
     m_nodes[nid].word_id = wid;
     m_words[wid] = &m_nodes[nid];
   }
+
+  createFlatTree();
 }
 
 // --------------------------------------------------------------------------
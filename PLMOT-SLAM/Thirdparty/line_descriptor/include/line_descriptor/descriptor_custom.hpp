@@ -311,6 +311,19 @@ class CV_EXPORTS BinaryDescriptor : public Algorithm
   void compute( const std::vector<Mat>& images, std::vector<std::vector<KeyLine> >& keylines, std::vector<Mat>& descriptors, bool returnFloatDescr =
                     false ) const;
 
+  /** @brief Requires descriptors computation on the pyramid used to detect the lines
+
+    Gradients are computed only in the support regions of the given lines, so the cost depends on
+    the number of lines and not on the image size. Descriptors are the same as with compute() when
+    the pyramid levels are the ones compute() would build.
+
+    @param pyramid octave images (octave coordinates of the lines refer to them)
+    @param keylines vector containing lines for which descriptors must be computed
+    @param descriptors
+    @param returnFloatDescr flag (when set to true, original non-binary descriptors are returned)
+     */
+  void computeFromPyramid( const std::vector<Mat>& pyramid, std::vector<KeyLine>& keylines, Mat& descriptors, bool returnFloatDescr = false ) const;
+
   /** @brief Return descriptor size
    */
   int descriptorSize() const;
@@ -850,6 +863,12 @@ void computeGaussianPyramid( const Mat& image, const int numOctaves );
 /* compute Sobel's derivatives */
 void computeSobel( const Mat& image, const int numOctaves );
 
+/* compute Sobel's derivatives only around the support regions of the lines */
+void computeSobelInSupportRegions( const std::vector<Mat>& pyramid, const std::vector<KeyLine>& keylines, const int numOctaves );
+
+/* compute LBD descriptors of the lines once the derivatives are available */
+void describeKeyLines( std::vector<KeyLine>& keylines, Mat& descriptors, bool returnFloatDescr, bool useDetectionData, int numLines, int octaveIndex );
+
 /* conversion of an LBD descriptor to its binary representation */
 unsigned char binaryConversion( float* f1, float* f2 );
 
@@ -398,6 +398,96 @@ void BinaryDescriptor::computeSobel( const cv::Mat& image, const int numOctaves
   }
 }
 
+/* compute Sobel's derivatives only around the support regions of the lines */
+void BinaryDescriptor::computeSobelInSupportRegions( const std::vector<Mat>& pyramid, const std::vector<KeyLine>& keylines, const int numOctaves )
+{
+  /* side of the tiles in which derivatives are computed */
+  const int tileSize = 32;
+  /* radius of the support region orthogonal to the line */
+  const float halfHeight = (float) ( ( params.widthOfBand_ * NUM_OF_BANDS - 1 ) / 2 );
+
+  images_sizes.resize( numOctaves );
+  dxImg_vector.resize( numOctaves );
+  dyImg_vector.resize( numOctaves );
+
+  for ( int octave = 0; octave < numOctaves; octave++ )
+  {
+    const Mat& octaveImage = pyramid[octave];
+    const int width = octaveImage.cols;
+    const int height = octaveImage.rows;
+    images_sizes[octave] = octaveImage.size();
+
+    /* buffers are kept between calls, only the tiles touched by the support regions are filled */
+    dxImg_vector[octave].create( height, width, CV_16SC1 );
+    dyImg_vector[octave].create( height, width, CV_16SC1 );
+
+    const int tilesX = ( width + tileSize - 1 ) / tileSize;
+    const int tilesY = ( height + tileSize - 1 ) / tileSize;
+    std::vector<uchar> tiles( tilesX * tilesY, 0 );
+
+    for ( size_t l = 0; l < keylines.size(); l++ )
+    {
+      const KeyLine& kl = keylines[l];
+      if( kl.octave != octave )
+        continue;
+
+      /* bounding box of the rotated support region (same geometry as computeLBD) */
+      const float halfWidth = (float) ( ( kl.numOfPixels - 1 ) / 2 ) + 1.f;
+      const float c = fabs( cos( kl.angle ) ), s = fabs( sin( kl.angle ) );
+      const float midX = 0.5f * ( kl.sPointInOctaveX + kl.ePointInOctaveX );
+      const float midY = 0.5f * ( kl.sPointInOctaveY + kl.ePointInOctaveY );
+      const float extX = c * halfWidth + s * halfHeight + 1.f;
+      const float extY = s * halfWidth + c * halfHeight + 1.f;
+
+      /* coordinates outside the image are clamped to its border by computeLBD */
+      const int minX = std::max( 0, std::min( width - 1, (int) floor( midX - extX ) ) );
+      const int maxX = std::max( 0, std::min( width - 1, (int) ceil( midX + extX ) ) );
+      const int minY = std::max( 0, std::min( height - 1, (int) floor( midY - extY ) ) );
+      const int maxY = std::max( 0, std::min( height - 1, (int) ceil( midY + extY ) ) );
+
+      for ( int ty = minY / tileSize; ty <= maxY / tileSize; ty++ )
+        for ( int tx = minX / tileSize; tx <= maxX / tileSize; tx++ )
+          tiles[ty * tilesX + tx] = 1;
+    }
+
+    /* runs of consecutive tiles in a row are processed at once. The smoothing reads the pixels around the
+     run from the pyramid image and the derivatives are computed on a margin that is then discarded,
+     so the result is the same as on the whole image */
+    cv::Mat blurred, dx, dy;
+    for ( int ty = 0; ty < tilesY; ty++ )
+    {
+      int tx = 0;
+      while ( tx < tilesX )
+      {
+        if( !tiles[ty * tilesX + tx] )
+        {
+          tx++;
+          continue;
+        }
+        int txEnd = tx;
+        while ( txEnd < tilesX && tiles[ty * tilesX + txEnd] )
+          txEnd++;
+
+        const cv::Rect run( tx * tileSize, ty * tileSize, std::min( txEnd * tileSize, width ) - tx * tileSize,
+                            std::min( ( ty + 1 ) * tileSize, height ) - ty * tileSize );
+        const int x0 = std::max( 0, run.x - 1 ), y0 = std::max( 0, run.y - 1 );
+        const int x1 = std::min( width, run.x + run.width + 1 ), y1 = std::min( height, run.y + run.height + 1 );
+        const cv::Rect margin( x0, y0, x1 - x0, y1 - y0 );
+
+        cv::GaussianBlur( octaveImage( margin ), blurred, cv::Size( 5, 5 ), 1 );
+        cv::Sobel( blurred, dx, CV_16SC1, 1, 0, 3 );
+        cv::Sobel( blurred, dy, CV_16SC1, 0, 1, 3 );
+
+        const cv::Rect inner( run.x - x0, run.y - y0, run.width, run.height );
+        dx( inner ).copyTo( dxImg_vector[octave]( run ) );
+        dy( inner ).copyTo( dyImg_vector[octave]( run ) );
+
+        tx = txEnd;
+      }
+    }
+  }
+}
+
 /* utility function for conversion of an LBD descriptor to its binary representation */
 unsigned char BinaryDescriptor::binaryConversion( float* f1, float* f2 )
 {
@@ -577,6 +667,47 @@ void BinaryDescriptor::computeImpl( const Mat& imageSrc, std::vector<KeyLine>& k
   if( !useDetectionData )
     bd->computeSobel( image, octaveIndex + 1 );
 
+  bd->describeKeyLines( keylines, descriptors, returnFloatDescr, useDetectionData, numLines, octaveIndex );
+}
+
+/* requires descriptors computation on an already computed pyramid */
+void BinaryDescriptor::computeFromPyramid( const std::vector<Mat>& pyramid, std::vector<KeyLine>& keylines, Mat& descriptors,
+                                           bool returnFloatDescr ) const
+{
+  /* keypoints list can't be empty */
+  if( keylines.size() == 0 )
+  {
+    std::cout << "Error: keypoint list is empty" << std::endl;
+    return;
+  }
+
+  BinaryDescriptor* bd = const_cast<BinaryDescriptor*>( this );
+
+  /* get maximum class_id and octave*/
+  int numLines = 0;
+  int octaveIndex = -1;
+  for ( size_t l = 0; l < keylines.size(); l++ )
+  {
+    if( keylines[l].class_id > numLines )
+      numLines = keylines[l].class_id;
+
+    if( keylines[l].octave > octaveIndex )
+      octaveIndex = keylines[l].octave;
+  }
+
+  if( octaveIndex >= (int) pyramid.size() )
+    throw std::runtime_error( "Error, a keyline octave is not in the pyramid" );
+
+  bd->computeSobelInSupportRegions( pyramid, keylines, octaveIndex + 1 );
+  bd->describeKeyLines( keylines, descriptors, returnFloatDescr, false, numLines, octaveIndex );
+}
+
+/* compute LBD descriptors once the derivatives are available */
+void BinaryDescriptor::describeKeyLines( std::vector<KeyLine>& keylines, Mat& descriptors, bool returnFloatDescr, bool useDetectionData,
+                                         int numLines, int octaveIndex )
+{
+  BinaryDescriptor* bd = this;
+
   /* create a ScaleLines object */
   OctaveSingleLine fictiousOSL;
 //  fictiousOSL.octaveCount = params.numOfOctave_ + 1;
@@ -684,7 +815,6 @@ void BinaryDescriptor::computeImpl( const Mat& imageSrc, std::vector<KeyLine>& k
 
     }
   }
-
 }
 
 int BinaryDescriptor::OctaveKeyLines( cv::Mat& image, ScaleLines &keyLines )
@@ -0,0 +1,344 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef BASOLVER_H
+#define BASOLVER_H
+
+#include <vector>
+#include <list>
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+#include "OptimizationBudget.h"
+#include "OutlierRejection.h"
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+class Map;
+class MapPoint;
+class MapLine;
+
+// Bundle adjustment of keyframes, points and lines (same cost, robust kernels and inlier/outlier
+// schedule as Optimizer::LocalBundleAdjustmentPL) solved by Levenberg-Marquardt on the reduced
+// camera system. The observations are linearized and the landmarks eliminated (Schur complement)
+// by several threads, each one over a contiguous range of landmarks and with its own copy of the
+// reduced system. The copies are added in thread order, so the result only depends on the number
+// of threads. A line is optimized as its two endpoints, each one eliminated as a 3D landmark.
+// Only for pinhole cameras. One instance must not be used by two threads at the same time.
+//
+// As a sliding window, the problem of the local window and its structure (the observations of each
+// landmark) are kept between calls of LocalBundleAdjustmentPL: the keyframes, points and lines that
+// enter the window are added with their observations, those that leave it are removed, and only the
+// landmarks whose observations changed in the map have them read and replaced. The poses and
+// positions are read again every call, as other threads move them. As in the g2o version, the
+// keyframes that leave the window are not marginalized: those still observing a local landmark are
+// fixed, the others are removed.
+//
+// For the global BA the reduced camera system can be solved by conjugate gradient preconditioned with
+// its block diagonal (block-Jacobi) instead of the dense factorization: the reduced system is never
+// formed, its products are computed from the landmark blocks by the same threads, so the memory and
+// the cost per iteration grow with the number of observations and not with the square of the number
+// of keyframes.
+//
+// The global BA can also be partitioned: the keyframes are split into clusters grown along the
+// covisibility graph, the keyframes with covisible keyframes in other clusters are the separators.
+// The clusters are optimized in parallel, one per thread, with the separators and the landmarks of
+// other clusters fixed. Then the separators and their landmarks are optimized with the rest fixed,
+// which stitches the clusters. It is an approximation of the full problem that trades accuracy at
+// the borders of the clusters for an almost linear speedup with the threads.
+class BASolver
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    typedef Eigen::Matrix<double,6,6> Matrix6d;
+    typedef Eigen::Matrix<double,6,1> Vector6d;
+    typedef Eigen::Matrix<double,6,3> Matrix63d;
+
+    struct Camera
+    {
+        Eigen::Matrix3d Rcw;
+        Eigen::Vector3d tcw;
+        bool bFixed;
+    };
+
+    struct PointObs
+    {
+        int cam, point;
+        double u, v, ur;    // ur < 0 for a monocular observation
+        double invSigma2;
+        bool bOutlier;
+    };
+
+    struct LineObs
+    {
+        int cam, line;
+        Eigen::Vector3d l;  // normalized image line
+        double invSigma2;
+        double weight;      // the information is weight*invSigma2
+        bool bOutlier;
+    };
+
+    // Solver of the reduced camera system
+    enum eLinearSolver
+    {
+        DENSE_SCHUR=0,  // dense LDLT factorization
+        PCG_SCHUR=1     // block-Jacobi preconditioned conjugate gradient
+    };
+
+    BASolver();
+
+    // Same interface as Optimizer::LocalBundleAdjustmentPL (lines parameterized by their endpoints)
+    void LocalBundleAdjustmentPL(KeyFrame* pKF, bool* pbStopFlag, Map* pMap, int& num_fixedKF,
+                                 const OptimizationBudget* pBudget = NULL, OptimizationStats* pStats = NULL);
+
+    // Same interface as Optimizer::GlobalBundleAdjustemntWithLines (lines parameterized by their endpoints)
+    void GlobalBundleAdjustmentWithLines(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF,
+                                         const bool bRobust);
+
+    // Partition of the global BA in clusters of about nClusterKFs keyframes (0, default, no partition)
+    void SetPartition(const int nClusterKFs);
+
+    // Keep the problem of the local window between calls of LocalBundleAdjustmentPL (rebuilt every call by default)
+    void SetSlidingWindow(const bool bSlidingWindow);
+    void ResetWindow();
+
+    // Lower level interface (benchmarks): the problem is built between Clear() and Solve()
+    void SetCalibration(const double &fx, const double &fy, const double &cx, const double &cy, const double &bf);
+    void SetThreads(const int n);
+    int GetThreads() const { return mnThreads; }
+    // PCG stops at nMaxIterations or when the residual falls under tol times the initial one
+    void SetLinearSolver(const int type, const int nMaxIterations = 100, const double &tol = 1e-6);
+    void Clear();
+    int AddCamera(const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw, const bool bFixed);
+    int AddPoint(const Eigen::Vector3d &Xw, const bool bFixed = false);
+    int AddLine(const Eigen::Vector3d &Xs, const Eigen::Vector3d &Xe, const bool bFixed = false);
+    void AddPointObservation(const int point, const int cam, const double &u, const double &v, const double &ur, const double &invSigma2);
+    void AddLineObservation(const int line, const int cam, const Eigen::Vector3d &l, const double &invSigma2);
+
+    // Removal from a built problem, without rebuilding its structure. The last observation takes the index of
+    // a removed one. A removed camera, point or line (with its observations) leaves a free index, reused by the
+    // next AddCamera, AddPoint or AddLine: free cameras and landmarks are fixed, without observations.
+    void RemovePointObservation(const int i);
+    void RemoveLineObservation(const int i);
+    void RemoveCamera(const int cam);
+    void RemovePoint(const int point);
+    void RemoveLine(const int line);
+
+    // Binary problem capture (calibration, initial damping, cameras, landmarks and observations) for the replay tool
+    void Save(std::ostream &os) const;
+    bool Load(std::istream &is);
+
+    // Robust optimization, outlier classification and optimization without the outliers
+    void Solve(bool* pbStopFlag=NULL, OptimizationMonitor* pMonitor=NULL);
+
+    // Levenberg-Marquardt iterations over the observations not flagged as outliers.
+    // Returns the number of iterations done.
+    int Optimize(const int nIterations, const bool bRobust, bool* pbStopFlag=NULL, OptimizationMonitor* pMonitor=NULL);
+
+    // Optimize partitioned in clusters (SetPartition), given the covisible cameras of each camera and their weights.
+    // Returns the iterations of the slowest cluster plus those of the separator problem.
+    int OptimizePartitioned(const std::vector<std::vector<std::pair<int,int> > > &vCovisibility, const int nIterations,
+                            const bool bRobust, bool* pbStopFlag=NULL);
+
+    // Chi2 of the observations not flagged as outliers at the current estimate
+    double Chi2();
+
+    // Inlier/outlier classification of all the observations at the current estimate (chi2 under the
+    // threshold and positive depth). Returns the number of inliers, the result of each observation is
+    // given by IsPointObsOutlier/IsLineObsOutlier until the next classification.
+    int ClassifyObservations();
+    bool IsPointObsOutlier(const size_t i) const { return mClassifier.IsOutlier(i); }
+    bool IsLineObsOutlier(const size_t i) const { return mClassifier.IsOutlier(mvPointObs.size()+i); }
+
+    const Camera& GetCamera(const size_t i) const { return mvCameras[i]; }
+    const Eigen::Vector3d& GetPoint(const size_t i) const { return mvLandmarks[mvPointLandmark[i]]; }
+    void GetLine(const size_t i, Eigen::Vector3d &Xs, Eigen::Vector3d &Xe) const;
+    const std::vector<PointObs>& GetPointObservations() const { return mvPointObs; }
+    const std::vector<LineObs>& GetLineObservations() const { return mvLineObs; }
+    // Conjugate gradient iterations of the last Optimize
+    int GetCGIterations() const { return mnCGIterations; }
+
+    // Initial damping, computed from the Hessian as g2o if negative
+    double mdLambdaInit;
+
+protected:
+
+    // Observations (keyframe, keypoint or keyline index) of a landmark of the local window, as read
+    // at version nObsVersion of its observations, and its point or line in the problem
+    struct WindowLandmark
+    {
+        long unsigned int nId;
+        long unsigned int nObsVersion;
+        long unsigned int nWindowKF;    // keyframe of the last local BA that used the landmark
+        int idx;                        // -1 until added to the problem
+        bool bObsChanged;               // vObs read again, not yet in the problem
+        std::vector<std::pair<KeyFrame*,int> > vObs;
+    };
+
+    struct WindowCamera
+    {
+        int idx;
+        long unsigned int nWindowKF;
+    };
+
+    // Local and fixed keyframes, points and lines around pKF (as Optimizer::LocalWindowPL), with the
+    // observations of the points and lines updated in mmWindowPoints and mmWindowLines
+    void UpdateWindow(KeyFrame* pKF, Map* pMap, std::list<KeyFrame*> &lLocalKeyFrames, std::list<KeyFrame*> &lFixedCameras,
+                      std::vector<MapPoint*> &vpLocalMapPoints, std::vector<MapLine*> &vpLocalMapLines, int& num_fixedKF);
+    WindowLandmark& GetWindowPoint(MapPoint* pMP, const long unsigned int nWindowKF);
+    WindowLandmark& GetWindowLine(MapLine* pML, const long unsigned int nWindowKF);
+
+    // Brings the problem to the window of UpdateWindow: adds the keyframes, points and lines that entered it,
+    // replaces the observations of the landmarks whose observations changed and removes what left it.
+    // Returns the camera of each local keyframe and the point and line of each local map point and map line.
+    void UpdateWindowProblem(KeyFrame* pKF, Map* pMap, const std::list<KeyFrame*> &lLocalKeyFrames, const std::list<KeyFrame*> &lFixedCameras,
+                             const std::vector<MapPoint*> &vpLocalMapPoints, const std::vector<MapLine*> &vpLocalMapLines,
+                             std::vector<int> &vLocalCameras, std::vector<int> &vPoints, std::vector<int> &vLines);
+
+    // Per thread accumulation of the normal equations of the cameras and of the reduced system
+    // (S only with the dense solver, the diagonal blocks P and the products q only with PCG)
+    struct Accumulator
+    {
+        std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > Hcc;
+        std::vector<Vector6d, Eigen::aligned_allocator<Vector6d> > bc;
+        Eigen::MatrixXd S;
+        Eigen::VectorXd r;
+        std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > P;
+        Eigen::VectorXd q;
+        double cost, scale, maxDiag;
+    };
+
+    // Builds the observations of the landmarks if needed (or compacts them) and the blocks of the cameras
+    void BuildStructure();
+
+    int AddLandmark(const Eigen::Vector3d &Xw, const bool bFixed);
+    // Observation o (point observation o or line observation -1-o) of landmark j in a built structure
+    void InsertLandmarkObs(const int j, const int o);
+    void EraseLandmarkObs(const int j, const int o);
+    void RenameLandmarkObs(const int j, const int o, const int oNew);
+    void RemoveLandmarkObservations(const int j);
+
+    // Clusters of the cameras grown along the covisibility (camera index, weight), returns their number
+    int PartitionCameras(const std::vector<std::vector<std::pair<int,int> > > &vCovisibility, std::vector<int> &vCluster) const;
+
+    // Problem with the given cameras, points and lines optimized, the other cameras that observe them and the
+    // given landmarks fixed. The indices of its cameras, points and lines in this problem are returned.
+    void BuildSubproblem(const std::vector<int> &vFreeCameras, const std::vector<int> &vFreePoints, const std::vector<int> &vFreeLines,
+                         const std::vector<int> &vFixedPoints, const std::vector<int> &vFixedLines,
+                         const std::vector<int> &vPointObsStart, const std::vector<int> &vPointObsIdx,
+                         const std::vector<int> &vLineObsStart, const std::vector<int> &vLineObsIdx,
+                         BASolver &sub, std::vector<int> &vCameras, std::vector<int> &vPoints, std::vector<int> &vLines) const;
+
+    // Copies the optimized cameras, points and lines of a subproblem
+    void GetSubproblemResult(const BASolver &sub, const std::vector<int> &vCameras, const std::vector<int> &vPoints,
+                             const std::vector<int> &vLines);
+
+    // Normal equations at the current estimate, returns the robust cost
+    double Linearize(const bool bRobust);
+
+    // Schur complement of the landmarks with damping lambda, and solution of the cameras and landmarks.
+    // False if the system could not be solved or the stop flag was set during PCG.
+    bool SolveStep(const double &lambda, bool* pbStopFlag=NULL);
+    bool SolveReducedPCG(const double &lambda, bool* pbStopFlag);
+    void BackSubstitute();
+
+    double Cost(const std::vector<Camera> &vCameras, const std::vector<Eigen::Vector3d> &vLandmarks, const bool bRobust);
+
+    void LinearizeLandmark(const int j, const bool bRobust, Accumulator &acc);
+    void EliminateLandmark(const int j, const double &lambda, Accumulator &acc);
+
+    // PCG: inverse of the damped landmark block, its terms of the right hand side and of the diagonal
+    // blocks of the reduced system, and its term of the product of the reduced system with x
+    void PrepareLandmarkPCG(const int j, const double &lambda, Accumulator &acc);
+    void MultiplyLandmark(const int j, const Eigen::VectorXd &x, Eigen::VectorXd &q) const;
+
+    // Error and chi2 of an observation, false if behind the camera
+    bool PointError(const PointObs &obs, const Camera &cam, const Eigen::Vector3d &Xw, Eigen::Vector3d &e, double &chi2) const;
+    bool LineError(const LineObs &obs, const Camera &cam, const Eigen::Vector3d &Xs, const Eigen::Vector3d &Xe, Eigen::Vector2d &e, double &chi2) const;
+
+    double fx, fy, cx, cy, bf;
+    int mnThreads;
+
+    int mnLinearSolver;
+    int mnMaxCGIterations;
+    double mdCGTolerance;
+    int mnCGIterations;
+    int mnClusterKFs;
+
+    std::vector<Camera> mvCameras;
+    std::vector<int> mvCameraBlock;             // block of the camera in the reduced system, -1 if fixed
+    int mnBlocks;
+
+    // 3D landmarks: the points and the two endpoints of the lines
+    std::vector<Eigen::Vector3d> mvLandmarks;
+    std::vector<char> mvLandmarkFixed;
+    std::vector<int> mvPointLandmark;
+    std::vector<int> mvLineLandmark;            // start point, the end point is the next landmark
+    std::vector<PointObs> mvPointObs;
+    std::vector<LineObs> mvLineObs;
+    std::vector<int> mvCameraObs;               // observations of each camera
+    std::vector<int> mvFreeCameras, mvFreePoints, mvFreeLines;
+    bool mbStructureBuilt;                      // observations of the landmarks
+    bool mbBlocksBuilt;                         // blocks of the cameras and per thread buffers
+
+    // Observations of each landmark (point observation i or line observation -1-i) in
+    // mvLandmarkObs[mvLandmarkObsStart[j],mvLandmarkObsEnd[j]), with room for mvLandmarkObsCapacity[j].
+    // The range of a landmark that fills up is moved to the end of mvLandmarkObs with twice the room,
+    // the entries it leaves are counted in mnLandmarkObsUnused until the next BuildStructure compacts them.
+    std::vector<int> mvLandmarkObsStart, mvLandmarkObsEnd, mvLandmarkObsCapacity;
+    std::vector<int> mvLandmarkObs;
+    int mnLandmarkObsUnused;
+
+    // Linearization: Hcl = Jc'*W*Jl of each entry of mvLandmarkObs (only for active observations and
+    // optimizable cameras), Hll and bl of each landmark, Hcc and bc of the cameras
+    std::vector<Matrix63d, Eigen::aligned_allocator<Matrix63d> > mvHcl;
+    std::vector<char> mvObsActive;
+    std::vector<Eigen::Matrix3d> mvHll, mvHllInv;
+    std::vector<Eigen::Vector3d> mvbl, mvdl;
+    std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > mvHcc;
+    std::vector<Vector6d, Eigen::aligned_allocator<Vector6d> > mvbc;
+    Eigen::MatrixXd mS;
+    Eigen::VectorXd mr, mdc;
+    std::vector<Matrix6d, Eigen::aligned_allocator<Matrix6d> > mvPrecond;     // inverse of the diagonal blocks (PCG)
+    double mdMaxDiag;
+
+    std::vector<Accumulator> mvAccumulators;
+    std::vector<Camera> mvCamerasNew;
+    std::vector<Eigen::Vector3d> mvLandmarksNew;
+
+    OutlierClassifier mClassifier;
+
+    bool mbSlidingWindow;
+    std::unordered_map<KeyFrame*,WindowCamera> mmWindowCameras;
+    std::unordered_map<MapPoint*,WindowLandmark> mmWindowPoints;
+    std::unordered_map<MapLine*,WindowLandmark> mmWindowLines;
+    // Keyframe, map point and map line of each camera, point and line of the problem (NULL if free)
+    std::vector<KeyFrame*> mvpWindowKFs;
+    std::vector<MapPoint*> mvpWindowMPs;
+    std::vector<MapLine*> mvpWindowMLs;
+    int mnReadLandmarks;    // landmarks whose observations were read from the map in the last call
+};
+
+} //namespace ORB_SLAM
+
+#endif // BASOLVER_H
@@ -0,0 +1,60 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DESCRIPTORMEDOID_H
+#define DESCRIPTORMEDOID_H
+
+#include <vector>
+#include <mutex>
+
+#include <opencv2/core/core.hpp>
+
+namespace ORB_SLAM3
+{
+
+class KeyFrame;
+
+// Incremental selection of the distinctive descriptor of a map point or a map line: the descriptor
+// of its observations with least median distance to the rest. The descriptors of a sample of the
+// observations are kept together with their pairwise distances, so an update only computes the
+// distances of the observations added since the last one. The sample is capped, which bounds the
+// cost for landmarks seen by hundreds of keyframes: once full, an observation from a keyframe more
+// recent than the oldest sampled one replaces it, so the medoid follows the recent views.
+class DescriptorMedoid
+{
+public:
+    static const int MAX_SAMPLE = 32;
+
+    // vObs are the current observations as (keyframe, row of its descriptors), with the point
+    // (mDescriptors) or line (mDescriptors_l) descriptors. Returns a copy of the medoid, empty if
+    // no keyframe observing the landmark is good.
+    cv::Mat Update(const std::vector<std::pair<KeyFrame*,int> > &vObs, const bool bLines);
+
+protected:
+    // Index of the sampled observation of the oldest keyframe
+    size_t OldestSample() const;
+
+    std::vector<std::pair<KeyFrame*,int> > mvSampleObs;
+    std::vector<cv::Mat> mvSampleDescriptors;
+    // Distances between the sampled descriptors, one row per descriptor
+    std::vector<std::vector<int> > mvvDistances;
+
+    std::mutex mMutex;
+};
+
+} //namespace ORB_SLAM
+
+#endif // DESCRIPTORMEDOID_H
@@ -0,0 +1,81 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef EPOCHRECLAIMER_H
+#define EPOCHRECLAIMER_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+
+namespace ORB_SLAM3
+{
+
+class MapPoint;
+class MapLine;
+
+// Deferred deletion of the map points and map lines set bad, which are otherwise never deleted as other
+// threads may still hold them. A landmark set bad is retired with the current epoch, and the epoch advances
+// once every registered thread has passed a quiescent state in it: a point of its loop where it holds no
+// landmark that was bad when it got it. A landmark retired in epoch e is deleted when the epoch reaches
+// e+3, when every thread has passed two quiescent states after its retirement: the first one drops the
+// landmarks the thread held, the second one those handed over meanwhile through the keyframes it created.
+// Process-wide, off by default, set once from the settings file.
+class EpochReclaimer
+{
+public:
+    enum eParticipant
+    {
+        TRACKING=0,
+        LOCAL_MAPPING=1,
+        LOOP_CLOSING=2,
+        VIEWER=3
+    };
+
+    static void Enable(const bool bEnable);
+    static bool IsEnabled() { return sbEnabled; }
+
+    // Threads holding landmarks across the iterations of their loop, registered before they start
+    static void Register(const int participant);
+    static void Unregister(const int participant);
+
+    // The thread holds no landmark retired before this call. Deletes the landmarks of past epochs
+    static void Quiescent(const int participant);
+
+    // Called once for a landmark, when it is set bad or replaced
+    static void Retire(MapPoint* pMP);
+    static void Retire(MapLine* pML);
+
+    // Landmarks retired and not yet deleted
+    static size_t GetPending();
+
+protected:
+    // Advances the epoch if every registered thread has passed, with the mutex locked
+    static void TryAdvance(std::vector<MapPoint*> &vpMPs, std::vector<MapLine*> &vpMLs);
+
+    static bool sbEnabled;
+    static std::mutex smMutex;
+    static unsigned long snEpoch;
+    // Bitmasks of the registered threads and of those that passed in the current epoch
+    static unsigned int snRegistered;
+    static unsigned int snPassed;
+    static std::deque<std::pair<unsigned long,MapPoint*> > sdRetiredPoints;
+    static std::deque<std::pair<unsigned long,MapLine*> > sdRetiredLines;
+};
+
+} //namespace ORB_SLAM
+
+#endif // EPOCHRECLAIMER_H
@@ -74,8 +74,8 @@ public:
     // Constructor for RGB-D cameras.
     Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera,Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
 
-    // Constructor for RGB-D with lines
-    Frame(const std::vector<string> &labels, const std::vector<uint8_t> &masks, const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor, Lineextractor* LineextractorLeft, ORBVocabulary* voc, LineVocabulary* voc_l, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera,Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
+    // Constructor for RGB-D with lines. If pLineTrackF (pPointTrackF) is given, its lines (keypoints with a MapPoint) are tracked instead of detected.
+    Frame(const std::vector<string> &labels, const std::vector<uint8_t> &masks, const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor, Lineextractor* LineextractorLeft, ORBVocabulary* voc, LineVocabulary* voc_l, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera,Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib(), Frame* pLineTrackF = static_cast<Frame*>(NULL), Frame* pPointTrackF = static_cast<Frame*>(NULL));
 
     // Constructor for Monocular cameras.
     Frame(const cv::Mat &imGray, const double &timeStamp, ORBextractor* extractor,ORBVocabulary* voc, GeometricCamera* pCamera, cv::Mat &distCoef, const float &bf, const float &thDepth, Frame* pPrevF = static_cast<Frame*>(NULL), const IMU::Calib &ImuCalib = IMU::Calib());
@@ -146,6 +146,12 @@ public:
     // compute the line depth from RGB-D image
     void ComputeRGBDLines(const cv::Mat &imDepth);
 
+    // Replace the tracked keypoints of a RGB-D frame by ORB features (used before becoming a keyframe)
+    void DetectRGBDPoints(const cv::Mat &imGray, const cv::Mat &imDepth, const std::vector<string> &labels, const std::vector<uint8_t> &masks);
+
+    // Replace the tracked lines of a RGB-D frame by LSD+LBD lines (used before becoming a keyframe)
+    void DetectRGBDLines(const cv::Mat &imGray, const cv::Mat &imDepth, const std::vector<string> &labels, const std::vector<uint8_t> &masks);
+
     // Associate a "right" coordinate to a keypoint if there is valid depth in the depthmap.
     void ComputeStereoFromRGBD(const cv::Mat &imDepth);
 
@@ -261,6 +267,17 @@ public:
     // Flag to identify outlier associations.
     std::vector<bool> mvbOutlier;
     std::vector<bool> mvbOutlier_Line;
+
+    // Lines tracked by optical flow from the last frame instead of detected, and index of the line they come from.
+    bool mbLinesTracked = false;
+    std::vector<int> mvLineTrackIdx;
+
+    // Keypoints tracked by optical flow from the last frame instead of detected, and index of the keypoint they come from.
+    bool mbPointsTracked = false;
+    std::vector<int> mvPointTrackIdx;
+
+    // Gray image, kept only when point or line tracking is enabled (the next frame tracks on it).
+    cv::Mat mImTrack;
     int mnCloseMPs;
     int mnCloseMLs;
 
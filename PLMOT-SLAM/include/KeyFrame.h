@@ -32,6 +32,7 @@
 #include "ImuTypes.h"
 
 #include "GeometricCamera.h"
+#include "SlabAllocator.h"
 
 #include <mutex>
 
@@ -284,6 +285,12 @@ class KeyFrame
 public:
     KeyFrame();
     KeyFrame(Frame &F, Map* pMap, KeyFrameDatabase* pKFDB);
+    // Without a frame, with only the point and line descriptors (checks of the descriptor selection)
+    KeyFrame(const cv::Mat &descriptors, const cv::Mat &descriptors_l);
+
+    // Allocated from slabs of keyframes (never deleted, the trajectory goes through the bad ones)
+    static void* operator new(size_t size) { return SlabAllocator<KeyFrame,64>::Allocate(size); }
+    static void operator delete(void* p, size_t size) { SlabAllocator<KeyFrame,64>::Deallocate(p, size); }
 
     // Pose functions
     void SetPose(const cv::Mat &Tcw);
@@ -313,6 +320,9 @@ public:
     std::set<KeyFrame *> GetConnectedKeyFrames();
     std::vector<KeyFrame* > GetVectorCovisibleKeyFrames();
     std::vector<KeyFrame*> GetBestCovisibilityKeyFrames(const int &N);
+    // Same as above, into a vector of the caller (its capacity is reused between calls)
+    void GetVectorCovisibleKeyFrames(std::vector<KeyFrame*> &vpKFs);
+    void GetBestCovisibilityKeyFrames(const int &N, std::vector<KeyFrame*> &vpKFs);
     std::vector<KeyFrame*> GetCovisiblesByWeight(const int &w);
     int GetWeight(KeyFrame* pKF);
 
@@ -571,7 +581,8 @@ protected:
     // Grid over the image to speed up feature matching
     std::vector< std::vector <std::vector<size_t> > > mGrid;
 
-    std::map<KeyFrame*,int> mConnectedKeyFrameWeights;
+    // Covisibility weights as a flat adjacency, sorted by keyframe pointer
+    std::vector<std::pair<KeyFrame*,int> > mvConnectedKeyFrameWeights;
     std::vector<KeyFrame*> mvpOrderedConnectedKeyFrames;
     std::vector<int> mvOrderedWeights;
     // For save relation without pointer, this is necessary for save/load function
@@ -62,6 +62,22 @@ public:
       cv::Mat& descriptors_line,
       const std::vector<std::string> &labels, const std::vector<uint8_t> &masks);
 
+    // Track the segments of the previous image by pyramidal KLT on points sampled along each segment
+    // and refit them in the current image (no LSD detection nor LBD description).
+    // Tracked segments keep the descriptor of the segment they come from. vPrevIdx stores that index.
+    // As in the extraction, segments with an endpoint inside or near a "person" mask are dropped.
+    int Track(const cv::Mat &prevImage, const cv::Mat &image,
+      const std::vector<cv::line_descriptor::KeyLine>& prevKeylines, const cv::Mat& prevDescriptors,
+      std::vector<cv::line_descriptor::KeyLine>& keylines, cv::Mat& descriptors_line, std::vector<int> &vPrevIdx,
+      const std::vector<std::string> &labels, const std::vector<uint8_t> &masks);
+
+    // Line tracking between keyframes (LSD+LBD is used on keyframes or when too few lines are tracked)
+    bool mbTrackLines;
+    int mnMinTrackedLines;
+
+    // LBD computed on the LSD pyramid and only around the kept lines (LSD extractor)
+    bool mbIncrementalLBD;
+
     // Images on the pyramid
     std::vector<cv::Mat> mvImagePyramid_l;
     std::vector<float> mvScaleFactor_l;
@@ -71,6 +87,9 @@ public:
     int nlevels_l;
 
 protected:
+    // Keep the pyramid and scale info of the detector
+    void SetPyramid(const cv::Ptr<line_descriptor::LSDDetectorC> &lsd);
+
     // filtering after extraction
     int    lsd_nfeatures;
     double min_line_length;
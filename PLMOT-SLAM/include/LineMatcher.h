@@ -35,6 +35,7 @@
 namespace ORB_SLAM3 {
 
 class Frame;
+class KeyFrame;
 class MapPoint;
 class MapLine;
 
@@ -52,6 +53,17 @@ inline void normalize(std::pair<double, double> &v) {
     v.second /= magnitude;
 }
 
+// Statistics of a line search by projection, used to tune the search windows
+struct LineProjectionStats
+{
+    int nProjected;   // last frame lines projected inside the current image
+    int nCandidates;  // candidate keylines whose descriptor was compared
+    int nMatches;     // accepted matches
+    double mTime;     // time spent in the search (ms)
+
+    LineProjectionStats(): nProjected(0), nCandidates(0), nMatches(0), mTime(0.0) {}
+};
+
 class LineMatcher
 {
 public:
@@ -65,7 +77,20 @@ public:
 
     int static matchGrid(const std::vector<line_2d> &lines1, const cv::Mat &desc1, const GridStructure &grid, const cv::Mat &desc2, const std::vector<std::pair<double, double>> &directions2, const GridWindow &w, std::vector<int> &matches_12);
 
-    int static SearchByProjection(Frame &CurrentFrame, Frame &LastFrame, const GridStructure &grid, const float &th, const float &angth);
+    // Match the map lines of the last frame projecting them with the predicted pose of the current frame.
+    // The search window of each line is the 95% region of its endpoints given the covariance of the
+    // predicted pose (6x6, rotation first), and never smaller than th pixels.
+    int static SearchByProjection(Frame &CurrentFrame, Frame &LastFrame, const Eigen::Matrix<double,6,6> &covTcw, const float &th, const float &angth, LineProjectionStats *pStats = NULL);
+
+    // Match the keylines without a MapLine of two keyframes for triangulation (pinhole cameras, x1'*F12*x2 = 0).
+    // The candidates of a keyline of pKF1 are the keylines of pKF2 on the epipolar line of its midpoint (line
+    // grid), not parallel to the epipolar lines and overlapping the band between the epipolar lines of its endpoints.
+    int static SearchForTriangulation(KeyFrame* pKF1, KeyFrame* pKF2, const cv::Mat &F12, std::vector<std::pair<size_t,size_t> > &vMatchedPairs);
+
+    // Project the map lines into the keyframe and search for duplicated map lines (pinhole cameras). A keyline
+    // matches a map line if the projected endpoints lie on it (chi2 95%), both overlap and the descriptors are close.
+    // The map line with fewer observations is replaced, or the keyline is added as a new observation.
+    int static Fuse(KeyFrame* pKF, const std::vector<MapLine*> &vpMapLines);
 };
 
 } // namesapce ORB_SLAM3
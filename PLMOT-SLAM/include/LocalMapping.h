@@ -27,8 +27,11 @@
 #include "Tracking.h"
 #include "KeyFrameDatabase.h"
 #include "Initializer.h"
+#include "BASolver.h"
 
 #include <mutex>
+#include <thread>
+#include <condition_variable>
 
 
 namespace ORB_SLAM3
@@ -119,12 +122,22 @@ protected:
     void ProcessNewKeyFrame();
     void ProcessNewKeyFrameWithLines();
     void CreateNewMapPoints();
+    // Point triangulated from a keypoint of the current keyframe and one of a neighbor, before its insertion in the map
+    struct TriangulatedPoint
+    {
+        int idx1;
+        int idx2;
+        cv::Mat x3D;
+    };
+    void TriangulateWithKeyFrame(KeyFrame* pKF2, std::vector<TriangulatedPoint> &vPoints);
+    void AddTriangulatedPoints(KeyFrame* pKF2, const std::vector<TriangulatedPoint> &vPoints);
+    void CreateNewMapLines();
 
     void MapPointCulling();
     void MapLineCulling();
     void SearchInNeighbors();
     void KeyFrameCulling();
-    void KeyFrameCullingWithLines();
+    void KeyFrameCullingWithLines(KeyFrame* pCurrentKF);
 
     cv::Mat ComputeF12(KeyFrame* &pKF1, KeyFrame* &pKF2);
 
@@ -148,6 +161,19 @@ protected:
     bool mbFinished;
     std::mutex mMutexFinish;
 
+    // Blocks until a keyframe is inserted (not while stopped) or a stop, release, reset or finish is requested.
+    // The wait is bounded, as a safety net for any other request.
+    void WaitForWork(const bool bStopped);
+    void WakeUp();
+
+    // Quiescent state of the local mapping for the EpochReclaimer, once the queue is empty: drops the
+    // recently added landmarks that are bad
+    void ReleaseBadLandmarks();
+    // Signaled with mMutexNewKFs on new keyframes and requests, and with mMutexReset when a reset is done
+    std::condition_variable mcvNewKFs;
+    bool mbWakeUp;
+    std::condition_variable mcvReset;
+
     Atlas* mpAtlas;
 
     LoopClosing* mpLoopCloser;
@@ -164,6 +190,28 @@ protected:
 
     bool mbAbortBA;
 
+    // Map lines fused by SearchInNeighbors for the current keyframe (Tracking::mbLineFusion)
+    int mnLinesFused;
+
+    // Local BA of the points and lines (not inertial) with the solver selected in the tracking
+    void LocalBundleAdjustmentWithLines(KeyFrame* pKF, bool* pbStopFlag, int &num_FixedKF_BA);
+
+    // Pipelined local mapping (Tracking::mbLocalMappingPipeline): the local BA, keyframe culling and insertion in
+    // the loop closing of a keyframe run in the BA thread while the next keyframe is processed. The keyframe culling
+    // and the processing of a keyframe exclude each other with mMutexLocalBAStage.
+    void StartLocalBA(KeyFrame* pKF);
+    void JoinLocalBA(const bool bAbort);
+    void RunLocalBA(KeyFrame* pKF);
+    std::thread* mptLocalBA;
+    bool mbAbortLocalBA;
+    std::mutex mMutexLocalBAStage;
+
+    // Multi-threaded Local BA with points and lines (Tracking::mnBASolver>=1)
+    BASolver mBASolver;
+
+    // Statistics of the last Local BA with points and lines (Tracking::mbOptimizationBudget)
+    OptimizationStats mLocalBAStats;
+
     bool mbStopped;
     bool mbStopRequested;
     bool mbNotStop;
@@ -27,10 +27,12 @@
 #include "Tracking.h"
 
 #include "KeyFrameDatabase.h"
+#include "OptimizationBudget.h"
 
 #include <boost/algorithm/string.hpp>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
 
 namespace ORB_SLAM3
@@ -99,6 +101,38 @@ protected:
                                         std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs);
     bool DetectCommonRegionsFromBoW(std::vector<KeyFrame*> &vpBowCand, KeyFrame* &pMatchedKF, KeyFrame* &pLastCurrentKF, g2o::Sim3 &g2oScw,
                                      int &nNumCoincidences, std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs);
+    // Geometric verification of a BoW candidate against the current keyframe (BoW matching with its covisibles,
+    // Sim3 RANSAC, Sim3 optimization and matching by projection). Reads the map only, so that the candidates
+    // can be verified concurrently
+    struct BoWCandidateResult
+    {
+        BoWCandidateResult() : nProjOptMatches(0), nNumKFs(0), pMatchedKF(static_cast<KeyFrame*>(NULL)), nProjMatches(-1), nCloudPoints(0) {}
+        // Matches with the optimized Sim3, 0 if the candidate is rejected
+        int nProjOptMatches;
+        // Covisibles of the current keyframe that also match with the Sim3
+        int nNumKFs;
+        KeyFrame* pMatchedKF;
+        g2o::Sim3 gScw;
+        std::vector<MapPoint*> vpMapPoints;
+        std::vector<MapPoint*> vpMatchedMPs;
+
+        // Printed after the verification of every candidate, in their order: matches with the coarse Sim3
+        // (-1 if not reached) among the points of the cloud, and the covisibles that also match with their
+        // distance and rotation to the current keyframe
+        int nProjMatches;
+        int nCloudPoints;
+        struct CoincidentKF
+        {
+            long unsigned int nId;
+            double dist;
+            cv::Mat Rc_cj;
+        };
+        std::vector<CoincidentKF> vCoincidentKFs;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+    void VerifyBoWCandidate(KeyFrame* pKFi, const std::set<KeyFrame*> &spConnectedKeyFrames, BoWCandidateResult &result,
+                            int &nStage, int &nMatchesStage);
     bool DetectCommonRegionsFromLastKF(KeyFrame* pCurrentKF, KeyFrame* pMatchedKF, g2o::Sim3 &gScw, int &nNumProjMatches,
                                             std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs);
     int FindMatchesByProjection(KeyFrame* pCurrentKF, KeyFrame* pMatchedKFw, g2o::Sim3 &g2oScw,
@@ -144,6 +178,17 @@ protected:
 
     std::mutex mMutexLoopQueue;
 
+    // Blocks until a keyframe is queued or a reset or finish is requested (bounded wait)
+    void WaitForWork();
+    void WakeUp();
+    // Quiescent state of the loop closing for the EpochReclaimer, when no candidate is being checked
+    // and no global BA is running: drops the map points of the last candidates
+    void ReleaseBadLandmarks();
+    // Signaled with mMutexLoopQueue on new keyframes and requests, and with mMutexReset when a reset is done
+    std::condition_variable mcvLoopQueue;
+    bool mbWakeUp;
+    std::condition_variable mcvReset;
+
     // Loop detector parameters
     float mnCovisibilityConsistencyTh;
 
@@ -198,6 +243,9 @@ protected:
     // Fix scale in the stereo/RGB-D case
     bool mbFixScale;
 
+    // Statistics of the last essential graph optimization (Tracking::mbOptimizationBudget)
+    OptimizationStats mEssentialGraphStats;
+
 
     bool mnFullBAIdx;
 
@@ -23,6 +23,8 @@
 #include"KeyFrame.h"
 #include"Frame.h"
 #include"Map.h"
+#include"DescriptorMedoid.h"
+#include"SlabAllocator.h"
 
 #include<opencv2/core/core.hpp>
 #include<mutex>
@@ -48,6 +50,10 @@ public:
     MapLine(const Eigen::Vector3d &sP, const Eigen::Vector3d &eP, KeyFrame* pRefKF, Map* pMap);
     MapLine(const Eigen::Vector3d &sP, const Eigen::Vector3d &eP,  Map* pMap, Frame* pFrame, const int &idxF);
 
+    // Allocated from slabs of map lines
+    static void* operator new(size_t size) { return SlabAllocator<MapLine>::Allocate(size); }
+    static void operator delete(void* p, size_t size) { SlabAllocator<MapLine>::Deallocate(p, size); }
+
     void SetWorldPos(const Eigen::Vector3d &sP, const Eigen::Vector3d &eP);
     Vector6d GetWorldPos();
 
@@ -56,7 +62,18 @@ public:
     KeyFrame* GetReferenceKeyFrame();
 
     std::map<KeyFrame*,size_t> GetObservations();
+    // Calls f(pKF,idx) for every observation without copying them. The observations are locked
+    // meanwhile, so f must not call back into this line
+    template<class F>
+    void ForEachObservation(F f)
+    {
+        std::unique_lock<std::mutex> lock(mMutexFeatures);
+        for(size_t i=0, iend=mObservations.size(); i<iend; i++)
+            f(mObservations[i].first, mObservations[i].second);
+    }
     int Observations();
+    // Changes every time an observation is added or erased
+    long unsigned int GetObservationsVersion();
 
     void AddObservation(KeyFrame* pKF,size_t idx);
     void EraseObservation(KeyFrame* pKF);
@@ -98,6 +115,7 @@ public:
     long int mnFirstKFid;
     long int mnFirstFrame;
     int nObs;
+    long unsigned int mnObsVersion;
 
     // Variables used by loop closing
     long unsigned int mnCorrectedByKF;
@@ -121,6 +139,7 @@ public:
 
     // Variables used by local mapping
     long unsigned int mnBALocalForKF;
+    long unsigned int mnFuseCandidateForKF;
 
     // Used for Loop Closing
     Vector6d mPosGBA;
@@ -133,14 +152,18 @@ public:
     
 protected:    
 
-     // Keyframes observing the line and associated index in keyframe
-     std::map<KeyFrame*,size_t> mObservations;
+     // Keyframes observing the line and associated index in keyframe, in the order they were added
+     std::vector<std::pair<KeyFrame*,size_t> > mObservations;
+     std::vector<std::pair<KeyFrame*,size_t> >::iterator FindObservation(KeyFrame* pKF);
+     // Hands the landmark to the EpochReclaimer when it has just been set bad
+     void Retire(const bool bWasBad);
 
     // Mean viewing direction
      cv::Mat mNormalVector;
 
      // Best descriptor to fast matching
      cv::Mat mDescriptor;
+     DescriptorMedoid mDescriptorMedoid;
 
      // Reference KeyFrame
      KeyFrame* mpRefKF;
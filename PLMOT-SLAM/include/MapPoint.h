@@ -23,6 +23,8 @@
 #include"KeyFrame.h"
 #include"Frame.h"
 #include"Map.h"
+#include"DescriptorMedoid.h"
+#include"SlabAllocator.h"
 
 #include<opencv2/core/core.hpp>
 #include<mutex>
@@ -131,6 +133,10 @@ public:
     MapPoint(const double invDepth, cv::Point2f uv_init, KeyFrame* pRefKF, KeyFrame* pHostKF, Map* pMap);
     MapPoint(const cv::Mat &Pos,  Map* pMap, Frame* pFrame, const int &idxF);
 
+    // Allocated from slabs of map points
+    static void* operator new(size_t size) { return SlabAllocator<MapPoint>::Allocate(size); }
+    static void operator delete(void* p, size_t size) { SlabAllocator<MapPoint>::Deallocate(p, size); }
+
     void SetWorldPos(const cv::Mat &Pos);
 
     cv::Mat GetWorldPos();
@@ -139,7 +145,18 @@ public:
     KeyFrame* GetReferenceKeyFrame();
 
     std::map<KeyFrame*,std::tuple<int,int>> GetObservations();
+    // Calls f(pKF,indexes) for every observation without copying them. The observations are locked
+    // meanwhile, so f must not call back into this point
+    template<class F>
+    void ForEachObservation(F f)
+    {
+        std::unique_lock<std::mutex> lock(mMutexFeatures);
+        for(size_t i=0, iend=mObservations.size(); i<iend; i++)
+            f(mObservations[i].first, mObservations[i].second);
+    }
     int Observations();
+    // Changes every time an observation is added or erased
+    long unsigned int GetObservationsVersion();
 
     void AddObservation(KeyFrame* pKF,int idx);
     void EraseObservation(KeyFrame* pKF);
@@ -186,6 +203,7 @@ public:
     long int mnFirstKFid;
     long int mnFirstFrame;
     int nObs;
+    long unsigned int mnObsVersion;
 
     // Variables used by the tracking
     float mTrackProjX;
@@ -232,8 +250,12 @@ protected:
      // Position in absolute coordinates
      cv::Mat mWorldPos;
 
-     // Keyframes observing the point and associated index in keyframe
-     std::map<KeyFrame*,std::tuple<int,int> > mObservations;
+     // Keyframes observing the point and associated index in keyframe, in the order they were added
+     // (a point is seen by a few keyframes, so a flat vector searched linearly beats a map)
+     std::vector<std::pair<KeyFrame*,std::tuple<int,int> > > mObservations;
+     std::vector<std::pair<KeyFrame*,std::tuple<int,int> > >::iterator FindObservation(KeyFrame* pKF);
+     // Hands the landmark to the EpochReclaimer when it has just been set bad
+     void Retire(const bool bWasBad);
      // For save relation without pointer, this is necessary for save/load function
      std::map<long unsigned int, int> mBackupObservationsId1;
      std::map<long unsigned int, int> mBackupObservationsId2;
@@ -243,6 +265,7 @@ protected:
 
      // Best descriptor to fast matching
      cv::Mat mDescriptor;
+     DescriptorMedoid mDescriptorMedoid;
 
      // Reference KeyFrame
      KeyFrame* mpRefKF;
@@ -64,6 +64,19 @@ public:
                     std::vector<cv::KeyPoint>& _keypoints,
                     cv::OutputArray _descriptors, std::vector<int> &vLappingArea);
 
+    // Track keypoints of the previous image by pyramidal KLT with a forward-backward check.
+    // Tracked keypoints keep the octave of the keypoint they come from. vPrevIdx stores its index.
+    // As in the extraction, keypoints tracked inside or near a "person" mask are dropped.
+    int Track(const cv::Mat &prevImage, const cv::Mat &image, const std::vector<cv::KeyPoint> &prevKeypoints,
+              std::vector<cv::KeyPoint> &keypoints, std::vector<int> &vPrevIdx,
+              const std::vector<std::string> &labels, const std::vector<uint8_t> &masks);
+
+    // Outer contours of the "person" masks of the segmentation (one image-sized mask per label)
+    static void PersonContours(const cv::Size &size, const std::vector<std::string> &labels, const std::vector<uint8_t> &masks,
+                               std::vector<std::vector<cv::Point> > &contours);
+    // Inside a contour or closer than 15 pixels to it
+    static bool NearContours(const cv::Point2f &pt, const std::vector<std::vector<cv::Point> > &contours);
+
     int inline GetLevels(){
         return nlevels;}
 
@@ -88,6 +101,10 @@ public:
 
     std::vector<cv::Mat> mvImagePyramid;
 
+    // Keypoint tracking between keyframes (ORB is used on keyframes or when too few points are tracked)
+    bool mbTrackPoints;
+    int mnMinTrackedPoints;
+
 protected:
 
     void ComputePyramid(cv::Mat image);
@@ -215,6 +215,66 @@ public:
 
 };
 
+// Projection of a line endpoint given in camera coordinates, computed once per endpoint and
+// shared by the error and the Jacobians of the line edges
+struct LineEndpointProjection
+{
+    LineEndpointProjection(const Eigen::Vector3d &Xc, const double &fx, const double &fy, const double &cx, const double &cy)
+    {
+        x = Xc[0];
+        y = Xc[1];
+        z = Xc[2];
+        invz = 1.0/z;
+        u = fx*x*invz + cx;
+        v = fy*y*invz + cy;
+    }
+
+    Eigen::Vector2d Point() const { return Eigen::Vector2d(u,v); }
+
+    // Signed distance to the normalized image line l
+    double LineDistance(const Eigen::Vector3d &l) const { return l[0]*u + l[1]*v + l[2]; }
+
+    // Derivative of the projection with respect to the point in camera coordinates
+    Eigen::Matrix<double,2,3> ProjectionJacobian(const double &fx, const double &fy) const
+    {
+        Eigen::Matrix<double,2,3> J;
+        J << fx*invz, 0, -fx*x*invz*invz,
+             0, fy*invz, -fy*y*invz*invz;
+        return J;
+    }
+
+    // Derivative of LineDistance with respect to the point in camera coordinates
+    Eigen::Matrix<double,1,3> LineDistanceJacobian(const Eigen::Vector3d &l, const double &fx, const double &fy) const
+    {
+        return Eigen::Matrix<double,1,3>(l[0]*fx*invz, l[1]*fy*invz, -(l[0]*fx*x + l[1]*fy*y)*invz*invz);
+    }
+
+    // Chain rule with the derivative of the point with respect to the pose (rotation first)
+    Eigen::Matrix<double,1,6> PoseJacobian(const Eigen::Matrix<double,1,3> &g) const
+    {
+        Eigen::Matrix<double,1,6> J;
+        J << g[2]*y - g[1]*z, g[0]*z - g[2]*x, g[1]*x - g[0]*y, g[0], g[1], g[2];
+        return J;
+    }
+
+    double x, y, z, invz;
+    double u, v;
+};
+
+// Cosine between the observed segment QP and the segment from an observed endpoint to a projected one,
+// and its derivative with respect to the projected endpoint
+inline double LineAngleCos(const Eigen::Vector2d &d_pr, const Eigen::Vector2d &QP)
+{
+    return d_pr.dot(QP)/(d_pr.norm()*QP.norm());
+}
+
+inline Eigen::Matrix<double,1,2> LineAngleCosJacobian(const Eigen::Vector2d &d_pr, const Eigen::Vector2d &QP)
+{
+    const double n_pr = d_pr.norm();
+    const double n = QP.norm();
+    return (QP/(n*n_pr) - d_pr.dot(QP)/(n*n_pr*n_pr*n_pr)*d_pr).transpose();
+}
+
 class  EdgeLineSE3ProjectXYZOnlyPose: public  g2o::BaseUnaryEdge<2, Eigen::Vector3d, g2o::VertexSE3Expmap>{
 public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -227,17 +287,9 @@ public:
 
     void computeError()  {
         const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
-        Eigen::Vector3d obs(_measurement);
-        Eigen::Matrix<double,2,3> Matrix23d; 
-        Matrix23d(0,0) = cam_project(v1->estimate().map(Xw_s))(0); 
-        Matrix23d(0,1) = cam_project(v1->estimate().map(Xw_s))(1);
-        Matrix23d(0,2) = 1.0;
-        Matrix23d(1,0) = cam_project(v1->estimate().map(Xw_e))(0); 
-        Matrix23d(1,1) = cam_project(v1->estimate().map(Xw_e))(1);
-        Matrix23d(1,2) = 1.0;
-        _error = Matrix23d * obs;
-
-
+        const LineEndpointProjection ps(v1->estimate().map(Xw_s),fx,fy,cx,cy);
+        const LineEndpointProjection pe(v1->estimate().map(Xw_e),fx,fy,cx,cy);
+        _error << ps.LineDistance(_measurement), pe.LineDistance(_measurement);
     }
 
     bool isDepthPositive() {
@@ -252,7 +304,6 @@ public:
 
     Eigen::Vector3d Xw_s;
     Eigen::Vector3d Xw_e;
-    Eigen::Vector3d obs_temp;
     double fx, fy, cx, cy;
 };
 
@@ -268,20 +319,13 @@ public:
 
     void computeError()  {
         const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
-        Eigen::Matrix<double,4,1> obs(_measurement);
-        Eigen::Vector2d P; 
-        Eigen::Vector2d Q; 
-        Eigen::Vector2d QP_pr; 
-        Eigen::Vector2d QP; 
-        Eigen::Vector2d PQ_pr; 
+        const Eigen::Vector2d P(_measurement(0), _measurement(1));
+        const Eigen::Vector2d Q(_measurement(2), _measurement(3));
+        const Eigen::Vector2d QP = P - Q;
+        const LineEndpointProjection ps(v1->estimate().map(Xw_s),fx,fy,cx,cy);
+        const LineEndpointProjection pe(v1->estimate().map(Xw_e),fx,fy,cx,cy);
 
-        P << obs(0), obs(1);
-        Q << obs(2), obs(3);
-        QP_pr = cam_project(v1->estimate().map(Xw_s)) - Q; 
-        QP = P - Q;
-        PQ_pr = cam_project(v1->estimate().map(Xw_e)) - P; 
-
-       _error << (QP_pr(0)*QP(0)+QP_pr(1)*QP(1))/(QP_pr.norm()*QP.norm()) - 1, (PQ_pr(0)*QP(0)+PQ_pr(1)*QP(1))/(PQ_pr.norm()*QP.norm()) + 1;
+       _error << LineAngleCos(ps.Point() - Q, QP) - 1, LineAngleCos(pe.Point() - P, QP) + 1;
     }
 
     bool isDepthPositive() {
@@ -296,7 +340,6 @@ public:
 
     Eigen::Vector3d Xw_s;
     Eigen::Vector3d Xw_e;
-    Eigen::Matrix<double,4,1> obs_temp;
     double fx, fy, cx, cy;
 };
 
@@ -312,21 +355,14 @@ public:
 
     void computeError()  {
         const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[0]);
-        Eigen::Matrix<double,7,1> obs(_measurement);
-        Eigen::Vector2d P; 
-        Eigen::Vector2d Q; 
-        Eigen::Vector2d QP_pr; 
-        Eigen::Vector2d QP; 
-        Eigen::Vector2d PQ_pr; 
-
-
-        P << obs(0), obs(1);
-        Q << obs(2), obs(3);
-        QP_pr = cam_project(v1->estimate().map(Xw_s)) - Q; 
-        QP = P - Q;
-        PQ_pr = cam_project(v1->estimate().map(Xw_e)) - P; 
-
-       _error << obs(4)*cam_project(v1->estimate().map(Xw_s))(0)+obs(5)*cam_project(v1->estimate().map(Xw_s))(1)+obs(6), obs(4)*cam_project(v1->estimate().map(Xw_e))(0)+obs(5)*cam_project(v1->estimate().map(Xw_e))(1)+obs(6), (QP_pr(0)*QP(0)+QP_pr(1)*QP(1))/(QP_pr.norm()*QP.norm()) - 1, (PQ_pr(0)*QP(0)+PQ_pr(1)*QP(1))/(PQ_pr.norm()*QP.norm()) + 1;
+        const Eigen::Vector2d P(_measurement(0), _measurement(1));
+        const Eigen::Vector2d Q(_measurement(2), _measurement(3));
+        const Eigen::Vector2d QP = P - Q;
+        const Eigen::Vector3d l = _measurement.tail(3);
+        const LineEndpointProjection ps(v1->estimate().map(Xw_s),fx,fy,cx,cy);
+        const LineEndpointProjection pe(v1->estimate().map(Xw_e),fx,fy,cx,cy);
+
+       _error << ps.LineDistance(l), pe.LineDistance(l), LineAngleCos(ps.Point() - Q, QP) - 1, LineAngleCos(pe.Point() - P, QP) + 1;
     }
 
     bool isDepthPositive() {
@@ -341,7 +377,6 @@ public:
 
     Eigen::Vector3d Xw_s;
     Eigen::Vector3d Xw_e;
-    Eigen::Matrix<double,7,1> obs_temp;
     double fx, fy, cx, cy;
 };
 
@@ -358,17 +393,9 @@ public:
     void computeError()  {
         const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
         const g2o::VertexSBALineXYZ* v2 = static_cast<const g2o::VertexSBALineXYZ*>(_vertices[0]);
-        Eigen::Vector3d obs(_measurement);
-        Eigen::Matrix<double,2,3> Matrix23d; 
-        Matrix23d(0,0) = cam_project(v1->estimate().map(v2->estimate().head(3)))(0); 
-        Matrix23d(0,1) = cam_project(v1->estimate().map(v2->estimate().head(3)))(1);
-        Matrix23d(0,2) = 1.0;
-        Matrix23d(1,0) = cam_project(v1->estimate().map(v2->estimate().tail(3)))(0); 
-        Matrix23d(1,1) = cam_project(v1->estimate().map(v2->estimate().tail(3)))(1);
-        Matrix23d(1,2) = 1.0;
-        _error = Matrix23d * obs;
-
-
+        const LineEndpointProjection ps(v1->estimate().map(v2->estimate().head(3)),fx,fy,cx,cy);
+        const LineEndpointProjection pe(v1->estimate().map(v2->estimate().tail(3)),fx,fy,cx,cy);
+        _error << ps.LineDistance(_measurement), pe.LineDistance(_measurement);
     }
 
     bool isDepthPositive() {
@@ -382,7 +409,6 @@ public:
 
     Eigen::Vector2d cam_project(const Eigen::Vector3d & trans_xyz) const;
 
-    Eigen::Vector3d obs_temp;
     double fx, fy, cx, cy;
 };
 
@@ -399,21 +425,13 @@ public:
     void computeError()  {
         const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
         const g2o::VertexSBALineXYZ* v2 = static_cast<const g2o::VertexSBALineXYZ*>(_vertices[0]);
-        Eigen::Matrix<double,4,1> obs(_measurement);
-        Eigen::Vector2d P; 
-        Eigen::Vector2d Q; 
-        Eigen::Vector2d QP_pr; 
-        Eigen::Vector2d QP; 
-        Eigen::Vector2d PQ_pr; 
-
-
-        P << obs(0), obs(1);
-        Q << obs(2), obs(3);
-        QP_pr = cam_project(v1->estimate().map(v2->estimate().head(3))) - Q; 
-        QP = P - Q;
-        PQ_pr = cam_project(v1->estimate().map(v2->estimate().tail(3))) - P; 
+        const Eigen::Vector2d P(_measurement(0), _measurement(1));
+        const Eigen::Vector2d Q(_measurement(2), _measurement(3));
+        const Eigen::Vector2d QP = P - Q;
+        const LineEndpointProjection ps(v1->estimate().map(v2->estimate().head(3)),fx,fy,cx,cy);
+        const LineEndpointProjection pe(v1->estimate().map(v2->estimate().tail(3)),fx,fy,cx,cy);
 
-       _error << (QP_pr(0)*QP(0)+QP_pr(1)*QP(1))/(QP_pr.norm()*QP.norm()) - 1, (PQ_pr(0)*QP(0)+PQ_pr(1)*QP(1))/(PQ_pr.norm()*QP.norm()) + 1;
+       _error << LineAngleCos(ps.Point() - Q, QP) - 1, LineAngleCos(pe.Point() - P, QP) + 1;
     }
 
     bool isDepthPositive() {
@@ -427,7 +445,6 @@ public:
 
     Eigen::Vector2d cam_project(const Eigen::Vector3d & trans_xyz) const;
 
-    Eigen::Matrix<double,4,1> obs_temp;
     double fx, fy, cx, cy;
 };
 
@@ -444,21 +461,14 @@ public:
     void computeError()  {
         const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
         const g2o::VertexSBALineXYZ* v2 = static_cast<const g2o::VertexSBALineXYZ*>(_vertices[0]);
-        Eigen::Matrix<double,7,1> obs(_measurement);
-        Eigen::Vector2d P; 
-        Eigen::Vector2d Q; 
-        Eigen::Vector2d QP_pr; 
-        Eigen::Vector2d QP; 
-        Eigen::Vector2d PQ_pr; 
-
-
-        P << obs(0), obs(1);
-        Q << obs(2), obs(3);
-        QP_pr = cam_project(v1->estimate().map(v2->estimate().head(3))) - Q; 
-        QP = P - Q;
-        PQ_pr = cam_project(v1->estimate().map(v2->estimate().tail(3))) - P; 
-
-       _error << obs(4)*cam_project(v1->estimate().map(v2->estimate().head(3)))(0)+obs(5)*cam_project(v1->estimate().map(v2->estimate().head(3)))(1)+obs(6), obs(4)*cam_project(v1->estimate().map(v2->estimate().tail(3)))(0)+obs(5)*cam_project(v1->estimate().map(v2->estimate().tail(3)))(1)+obs(6), (QP_pr(0)*QP(0)+QP_pr(1)*QP(1))/(QP_pr.norm()*QP.norm()) - 1, (PQ_pr(0)*QP(0)+PQ_pr(1)*QP(1))/(PQ_pr.norm()*QP.norm()) + 1;
+        const Eigen::Vector2d P(_measurement(0), _measurement(1));
+        const Eigen::Vector2d Q(_measurement(2), _measurement(3));
+        const Eigen::Vector2d QP = P - Q;
+        const Eigen::Vector3d l = _measurement.tail(3);
+        const LineEndpointProjection ps(v1->estimate().map(v2->estimate().head(3)),fx,fy,cx,cy);
+        const LineEndpointProjection pe(v1->estimate().map(v2->estimate().tail(3)),fx,fy,cx,cy);
+
+       _error << ps.LineDistance(l), pe.LineDistance(l), LineAngleCos(ps.Point() - Q, QP) - 1, LineAngleCos(pe.Point() - P, QP) + 1;
     }
 
     bool isDepthPositive() {
@@ -472,7 +482,78 @@ public:
 
     Eigen::Vector2d cam_project(const Eigen::Vector3d & trans_xyz) const;
 
-    Eigen::Matrix<double,7,1> obs_temp;
+    double fx, fy, cx, cy;
+};
+
+
+// Plücker coordinates (moment n, direction d) of the infinite line through two points
+Eigen::Matrix<double,6,1> PluckerFromEndpoints(const Eigen::Vector3d &sP, const Eigen::Vector3d &eP);
+
+// Moves the endpoints of a segment onto the Plücker line L (closest points), keeping its extent
+void EndpointsOnPlucker(const Eigen::Matrix<double,6,1> &L, Eigen::Vector3d &sP, Eigen::Vector3d &eP);
+
+// Minimal (4 DoF) orthonormal representation of a map line (Bartoli and Sturm). The estimate is kept
+// in Plücker coordinates and the update U <- U*exp(theta), W <- W*R(phi) is applied in oplus.
+class VertexLineOrth : public g2o::BaseVertex<4, Eigen::Matrix<double,6,1> >
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    VertexLineOrth(){}
+
+    bool read(std::istream& is);
+
+    bool write(std::ostream& os) const;
+
+    virtual void setToOriginImpl() {
+        _estimate << 1, 0, 0, 0, 1, 0;
+    }
+
+    virtual void oplusImpl(const double* update_);
+};
+
+// Distance of the observed endpoints (measurement: us, vs, ue, ve) to the projection of a line in
+// orthonormal representation
+class  EdgeLineOrthSE3Project: public  g2o::BaseBinaryEdge<2, Eigen::Vector4d, VertexLineOrth, g2o::VertexSE3Expmap>{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    EdgeLineOrthSE3Project();
+
+    bool read(std::istream& is);
+
+    bool write(std::ostream& os) const;
+
+    void computeError()  {
+        const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
+        const VertexLineOrth* v2 = static_cast<const VertexLineOrth*>(_vertices[0]);
+        Eigen::Vector3d nc, dc;
+        TransformLine(v1->estimate(), v2->estimate(), nc, dc);
+        const Eigen::Vector3d l = ImageLine(nc);
+        const double invNorm = 1.0/l.head(2).norm();
+        _error << (_measurement(0)*l(0) + _measurement(1)*l(1) + l(2))*invNorm,
+                  (_measurement(2)*l(0) + _measurement(3)*l(1) + l(2))*invNorm;
+    }
+
+    // The point of the line closest to the camera center is in front of it
+    bool isDepthPositive() {
+        const g2o::VertexSE3Expmap* v1 = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
+        const VertexLineOrth* v2 = static_cast<const VertexLineOrth*>(_vertices[0]);
+        Eigen::Vector3d nc, dc;
+        TransformLine(v1->estimate(), v2->estimate(), nc, dc);
+        return dc.cross(nc)(2)>0.0;
+    }
+
+    virtual void linearizeOplus();
+
+    // Plücker coordinates of the line in the camera frame
+    static void TransformLine(const g2o::SE3Quat &Tcw, const Eigen::Matrix<double,6,1> &Lw, Eigen::Vector3d &nc, Eigen::Vector3d &dc);
+
+    // Projection of the line in pixels, l = K_L*nc
+    Eigen::Vector3d ImageLine(const Eigen::Vector3d &nc) const {
+        return Eigen::Vector3d(fy*nc(0), fx*nc(1), -fy*cx*nc(0) - fx*cy*nc(1) + fx*fy*nc(2));
+    }
+
     double fx, fy, cx, cy;
 };
 
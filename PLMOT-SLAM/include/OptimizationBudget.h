@@ -0,0 +1,82 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef OPTIMIZATIONBUDGET_H
+#define OPTIMIZATIONBUDGET_H
+
+#include <chrono>
+
+namespace ORB_SLAM3
+{
+
+// Iteration and time budget of an optimization call. The iteration schedule of each optimization
+// is kept as the maximum, the budget can only stop it earlier.
+struct OptimizationBudget
+{
+    OptimizationBudget(): dMaxTime(0), dMinChi2Decrease(0) {}
+    OptimizationBudget(const double maxTime, const double minChi2Decrease): dMaxTime(maxTime), dMinChi2Decrease(minChi2Decrease) {}
+
+    // Deadline in ms from the start of the call (0 for none). No new round of iterations starts
+    // after it and the current one is stopped at the end of an iteration.
+    double dMaxTime;
+
+    // A round of iterations stops when an iteration decreases the chi2 by less than this fraction (0 for none)
+    double dMinChi2Decrease;
+};
+
+// Statistics of an optimization call
+struct OptimizationStats
+{
+    OptimizationStats(): nIterations(0), dChi2(0), dTime(0), bConverged(false), bDeadline(false) {}
+
+    int nIterations;    // over all the rounds
+    double dChi2;       // chi2 after the last iteration (robust if the last round used robust kernels)
+    double dTime;       // ms
+    bool bConverged;    // a round was stopped by the chi2 decrease
+    bool bDeadline;     // the call was cut by the deadline
+};
+
+// Follows an optimization call against its budget. The time counts from the construction and the
+// statistics are written on destruction. Both pointers can be NULL.
+class OptimizationMonitor
+{
+public:
+    OptimizationMonitor(const OptimizationBudget* pBudget, OptimizationStats* pStats);
+    ~OptimizationMonitor();
+
+    // True if there is a budget or statistics to fill (otherwise the optimizer does not need to report)
+    bool IsActive() const { return mpBudget || mpStats; }
+
+    // Starts a new round of iterations
+    void StartRound();
+
+    // Reports an iteration with the resulting chi2. Returns true if the round must stop.
+    bool Iteration(const double chi2);
+
+    // True once the deadline has passed
+    bool Expired();
+
+protected:
+    const OptimizationBudget* mpBudget;
+    OptimizationStats* mpStats;
+    OptimizationStats mStats;
+    double mdLastChi2;
+    std::chrono::steady_clock::time_point mStart;
+};
+
+} //namespace ORB_SLAM
+
+#endif // OPTIMIZATIONBUDGET_H
@@ -27,6 +27,7 @@
 #include "KeyFrame.h"
 #include "LoopClosing.h"
 #include "Frame.h"
+#include "OptimizationBudget.h"
 #include "Converter.h"
 
 #include <math.h>
@@ -58,23 +59,34 @@ public:
                                  int nIterations = 5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
                                  const bool bRobust = true);
 
+    // bLineOrth: MapLines optimized with the 4 DoF orthonormal representation instead of their two endpoints
     void static BundleAdjustmentWithLines(const std::vector<KeyFrame*> &vpKF, const std::vector<MapPoint*> &vpMP, const std::vector<MapLine*> &vpML,
                                  int nIterations = 5, bool *pbStopFlag=NULL, const unsigned long nLoopKF=0,
-                                 const bool bRobust = true);
+                                 const bool bRobust = true, const bool bLineOrth = false);
 
     void static GlobalBundleAdjustemnt(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
                                        const unsigned long nLoopKF=0, const bool bRobust = true);
 
     void static GlobalBundleAdjustemntWithLines(Map* pMap, int nIterations=5, bool *pbStopFlag=NULL,
-                                       const unsigned long nLoopKF=0, const bool bRobust = true);
+                                       const unsigned long nLoopKF=0, const bool bRobust = true, const bool bLineOrth = false);
     
     void static FullInertialBA(Map *pMap, int its, const bool bFixLocal=false, const unsigned long nLoopKF=0, bool *pbStopFlag=NULL, bool bInit=false, float priorG = 1e2, float priorA=1e6, Eigen::VectorXd *vSingVal = NULL, bool *bHess=NULL);
 
     void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, vector<KeyFrame*> &vpNonEnoughOptKFs);
     void static LocalBundleAdjustment(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF);
 
-    // Local BA With Points and Lines
-    void static LocalBundleAdjustmentPL(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF);
+    // Local and fixed KeyFrames, MapPoints and MapLines of the Local BA With Points and Lines
+    void static LocalWindowPL(KeyFrame* pKF, Map* pMap, std::list<KeyFrame*> &lLocalKeyFrames, std::list<KeyFrame*> &lFixedCameras,
+                              std::list<MapPoint*> &lLocalMapPoints, std::list<MapLine*> &lLocalMapLines, int& num_fixedKF);
+
+    // Moves the two oldest local KeyFrames to the fixed ones if less than two KeyFrames are fixed
+    void static FixOldestKeyFramesPL(KeyFrame* pKF, Map* pMap, std::list<KeyFrame*> &lLocalKeyFrames, std::list<KeyFrame*> &lFixedCameras,
+                                     int& num_fixedKF);
+
+    // Local BA With Points and Lines. Optional budget (early termination, deadline) and statistics of the call,
+    // also in PoseOptimizationPL and in the OptimizeEssentialGraph used with lines
+    void static LocalBundleAdjustmentPL(KeyFrame* pKF, bool *pbStopFlag, Map *pMap, int& num_fixedKF, const bool bLineOrth = false,
+                                        const OptimizationBudget* pBudget = NULL, OptimizationStats* pStats = NULL);
 
     // Local BA Only With Lines
     void static LocalBundleAdjustmentOnlyLines(KeyFrame* pKF, bool *pbStopFlag, Map *pMap);
@@ -84,7 +96,7 @@ public:
     void static MergeBundleAdjustmentVisual(KeyFrame* pCurrentKF, vector<KeyFrame*> vpWeldingKFs, vector<KeyFrame*> vpFixedKFs, bool *pbStopFlag);
 
     int static PoseOptimization(Frame* pFrame); 
-    int static PoseOptimizationPL(Frame* pFrame);
+    int static PoseOptimizationPL(Frame* pFrame, const OptimizationBudget* pBudget = NULL, OptimizationStats* pStats = NULL);
     int static PoseOptimizationOnlyLine(Frame* pFrame); 
     int static PoseOptimizationOnlyLineAngles(Frame* pFrame); 
     int static PoseOptimizationOnlyLineWithAngles(Frame* pFrame); 
@@ -97,11 +109,12 @@ public:
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
                                        const map<KeyFrame *, set<KeyFrame *> > &LoopConnections,
-                                       const bool &bFixScale);
+                                       const bool &bFixScale, const OptimizationBudget* pBudget = NULL, OptimizationStats* pStats = NULL);
     void static OptimizeEssentialGraph6DoF(KeyFrame* pCurKF, vector<KeyFrame*> &vpFixedKFs, vector<KeyFrame*> &vpFixedCorrectedKFs,
                                            vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs, double scale);
     void static OptimizeEssentialGraph(KeyFrame* pCurKF, vector<KeyFrame*> &vpFixedKFs, vector<KeyFrame*> &vpFixedCorrectedKFs,
-                                       vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs, vector<MapLine*> &vpNonCorrectedMLs);
+                                       vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs, vector<MapLine*> &vpNonCorrectedMLs,
+                                       const OptimizationBudget* pBudget = NULL, OptimizationStats* pStats = NULL);
     void static OptimizeEssentialGraph(KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3);
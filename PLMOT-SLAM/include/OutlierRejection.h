@@ -0,0 +1,167 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef OUTLIERREJECTION_H
+#define OUTLIERREJECTION_H
+
+#include <cmath>
+#include <vector>
+
+namespace g2o
+{
+class RobustKernel;
+}
+
+namespace ORB_SLAM3
+{
+
+// Robust kernel and outlier thresholds shared by the pose optimizations, the Local BA and the Sim3
+// optimizations, with the g2o graphs as well as with PoseSolver and BASolver. The kernel and the
+// adaptive thresholds are process-wide settings, set once from the settings file.
+class OutlierRejection
+{
+public:
+    enum eKernel
+    {
+        KERNEL_HUBER=0,
+        KERNEL_CAUCHY=1,
+        KERNEL_GEMAN_MCCLURE=2
+    };
+
+    static void SetKernel(const int kernel) { snKernel = kernel; }
+    static int GetKernel() { return snKernel; }
+
+    // Outlier thresholds can grow up to maxScale times the chi2 thresholds (1 for fixed thresholds)
+    static void SetMaxThresholdScale(const double &maxScale) { sdMaxThresholdScale = maxScale<1.0 ? 1.0 : maxScale; }
+    static double GetMaxThresholdScale() { return sdMaxThresholdScale; }
+
+    // rho(chi2) and its first and second derivatives (g2o::RobustKernel convention). delta is
+    // the square root of the chi2 where the kernel starts to down-weight the observation.
+    static void Robustify(const int kernel, const double &chi2, const double &delta, double* rho)
+    {
+        const double delta2 = delta*delta;
+        if(kernel==KERNEL_CAUCHY)
+        {
+            const double aux = 1.0/(1.0 + chi2/delta2);
+            rho[0] = delta2*log(1.0 + chi2/delta2);
+            rho[1] = aux;
+            rho[2] = -aux*aux/delta2;
+        }
+        else if(kernel==KERNEL_GEMAN_MCCLURE)
+        {
+            const double aux = 1.0/(delta2 + chi2);
+            rho[0] = delta2*chi2*aux;
+            rho[1] = delta2*delta2*aux*aux;
+            rho[2] = -2.0*rho[1]*aux;
+        }
+        else if(chi2<=delta2)
+        {
+            rho[0] = chi2;
+            rho[1] = 1.0;
+            rho[2] = 0.0;
+        }
+        else
+        {
+            const double e = sqrt(chi2);
+            rho[0] = 2*delta*e - delta2;
+            rho[1] = delta/e;
+            rho[2] = -0.5*rho[1]/chi2;
+        }
+    }
+
+    // Robust cost of a chi2 with the current kernel and the weight of its normal equations
+    static double Cost(const double &chi2, const double &delta, double &w)
+    {
+        double rho[3];
+        Robustify(snKernel, chi2, delta, rho);
+        w = rho[1];
+        return rho[0];
+    }
+
+    // g2o edge kernel: g2o::RobustKernelHuber for the Huber kernel, the other kernels through Robustify
+    static g2o::RobustKernel* CreateG2oKernel(const double &delta);
+
+protected:
+    static int snKernel;
+    static double sdMaxThresholdScale;
+};
+
+// Inlier/outlier classification of a block of observations. The chi2, thresholds and degrees of
+// freedom are kept in contiguous arrays that keep their capacity between calls, and classified
+// in a single pass. With adaptive thresholds all the thresholds are scaled by the median of the
+// chi2 of the block over the median of a chi2 distribution (of the degrees of freedom of each
+// observation), between 1 and OutlierRejection::GetMaxThresholdScale().
+class OutlierClassifier
+{
+public:
+    OutlierClassifier(): mdScale(1.0) {}
+
+    void Clear();
+
+    // Adds an observation and returns its index in the block. An invalid observation (e.g. behind
+    // the camera) is always an outlier, as one with a chi2 that is not a number.
+    int Add(const double &chi2, const double &th, const int dof, const bool bValid = true);
+
+    // Adds the chi2 of g2o edges, with the same threshold. The error of an edge out of the last
+    // optimization (level 1) is computed again.
+    template<class EdgeT>
+    void AddG2oEdges(const std::vector<EdgeT*> &vpEdges, const double &th, const int dof)
+    {
+        for(size_t i=0, iend=vpEdges.size(); i<iend; i++)
+        {
+            EdgeT* e = vpEdges[i];
+            if(e->level()!=0)
+                e->computeError();
+            Add(e->chi2(), th, dof);
+        }
+    }
+
+    // Same, an edge with its point behind the camera is an outlier
+    template<class EdgeT>
+    void AddG2oEdgesCheckDepth(const std::vector<EdgeT*> &vpEdges, const double &th, const int dof)
+    {
+        for(size_t i=0, iend=vpEdges.size(); i<iend; i++)
+        {
+            EdgeT* e = vpEdges[i];
+            if(e->level()!=0)
+                e->computeError();
+            Add(e->chi2(), th, dof, e->isDepthPositive());
+        }
+    }
+
+    // Classifies the whole block and returns the number of inliers
+    int Classify();
+
+    bool IsOutlier(const size_t i) const { return mvbOutlier[i]; }
+    double GetChi2(const size_t i) const { return mvChi2[i]; }
+    size_t Size() const { return mvChi2.size(); }
+
+    // Scale applied to the thresholds in the last classification
+    double GetThresholdScale() const { return mdScale; }
+
+protected:
+    std::vector<double> mvChi2;
+    std::vector<double> mvTh;
+    std::vector<char> mvDof;
+    std::vector<char> mvbValid;
+    std::vector<char> mvbOutlier;
+    std::vector<double> mvNormalized;
+    double mdScale;
+};
+
+} //namespace ORB_SLAM
+
+#endif // OUTLIERREJECTION_H
@@ -0,0 +1,114 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef POSESOLVER_H
+#define POSESOLVER_H
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "OptimizationBudget.h"
+#include "OutlierRejection.h"
+
+namespace ORB_SLAM3
+{
+
+class Frame;
+
+// Pose only optimization with points and lines (same cost, robust kernels and inlier/outlier
+// schedule as Optimizer::PoseOptimizationPL) solved with 6x6 normal equations over flat arrays
+// of observations instead of a g2o graph. The observation buffers keep their capacity between
+// calls, so once they have grown to the size of a frame no memory is allocated.
+// Only for pinhole cameras. One instance must not be used by two threads at the same time.
+class PoseSolver
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    struct PointObs
+    {
+        Eigen::Vector3d Xw;
+        double u, v, ur;    // ur < 0 for a monocular observation
+        double invSigma2;
+        size_t idx;         // keypoint index in the frame
+        bool bOutlier;
+    };
+
+    struct LineObs
+    {
+        Eigen::Vector3d Xs, Xe;
+        Eigen::Vector3d l;  // normalized image line
+        double invSigma2;
+        size_t idx;         // keyline index in the frame
+        bool bOutlier;
+    };
+
+    PoseSolver();
+
+    // Same interface as Optimizer::PoseOptimizationPL: sets the pose and the outlier flags of
+    // pFrame and returns the number of inlier correspondences
+    int PoseOptimizationPL(Frame* pFrame, const OptimizationBudget* pBudget = NULL, OptimizationStats* pStats = NULL);
+
+    // Lower level interface (benchmarks): observations are added between Clear() and Solve().
+    // Tcw is the initial pose of every round and is overwritten with the result.
+    void SetCalibration(const double &fx, const double &fy, const double &cx, const double &cy, const double &bf);
+    void Clear();
+    void AddPoint(const Eigen::Vector3d &Xw, const double &u, const double &v, const double &ur, const double &invSigma2, const size_t idx);
+    void AddLine(const Eigen::Vector3d &Xs, const Eigen::Vector3d &Xe, const Eigen::Vector3d &l, const double &invSigma2, const size_t idx);
+    int Solve(Eigen::Matrix3d &Rcw, Eigen::Vector3d &tcw, OptimizationMonitor* pMonitor = NULL);
+
+    // Sets the calibration, the observations with a MapPoint or MapLine and the pose Tcw of
+    // pFrame (pinhole), without changing the frame
+    void SetFrame(Frame* pFrame, Eigen::Matrix3d &Rcw, Eigen::Vector3d &tcw);
+
+    // Binary problem capture (calibration, observations and initial pose Tcw) for the replay tool
+    void Save(std::ostream &os, const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw) const;
+    bool Load(std::istream &is, Eigen::Matrix3d &Rcw, Eigen::Vector3d &tcw);
+
+    const std::vector<PointObs>& GetPoints() const { return mvPoints; }
+    const std::vector<LineObs>& GetLines() const { return mvLines; }
+
+    // Levenberg-Marquardt iterations per round
+    int mnIterations;
+
+protected:
+
+    // Accumulates the normal equations of the active observations and returns the cost, with the robust
+    // kernels of the points and lines if bRobust (all rounds but the last one)
+    double Linearize(const Eigen::Matrix3d &R, const Eigen::Vector3d &t, const double &lineWeight,
+                     const double &deltaLine, const bool bRobust,
+                     Eigen::Matrix<double,6,6> &H, Eigen::Matrix<double,6,1> &b) const;
+
+    double Cost(const Eigen::Matrix3d &R, const Eigen::Vector3d &t, const double &lineWeight,
+                const double &deltaLine, const bool bRobust) const;
+
+    void Optimize(Eigen::Matrix3d &R, Eigen::Vector3d &t, const double &lineWeight,
+                  const double &deltaLine, const bool bRobust, OptimizationMonitor* pMonitor) const;
+
+    double fx, fy, cx, cy, bf;
+
+    std::vector<PointObs> mvPoints;
+    std::vector<LineObs> mvLines;
+
+    OutlierClassifier mClassifier;
+};
+
+} //namespace ORB_SLAM
+
+#endif // POSESOLVER_H
@@ -0,0 +1,94 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PROBLEMCAPTURE_H
+#define PROBLEMCAPTURE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <atomic>
+
+#include <Eigen/Core>
+
+namespace g2o
+{
+class SparseOptimizer;
+}
+
+namespace ORB_SLAM3
+{
+
+class Frame;
+class PoseSolver;
+class BASolver;
+
+// Capture of the inputs of the optimizations to binary files, to replay them offline with
+// different solvers and settings (Examples/Benchmark/replay_optimization). Each file holds one
+// problem as it is given to the solver: the pose optimization of a frame, a local or global BA of
+// points and lines (as BASolver problems) or the essential graph of a loop closure (as its g2o
+// vertices and edges), with the robust kernel settings of the run. Files are written to
+// <dir>/<problem>_<n>.bin, up to a maximum number per type of problem. The capture is a
+// process-wide setting, off by default, set once from the settings file.
+class ProblemCapture
+{
+public:
+    enum eProblem
+    {
+        POSE_OPTIMIZATION=0,
+        LOCAL_BA=1,
+        GLOBAL_BA=2,
+        ESSENTIAL_GRAPH=3
+    };
+
+    // Captures up to nMaxPerProblem problems of each type in the (existing) directory dir (0 disables the capture)
+    static void Enable(const std::string &dir, const int nMaxPerProblem);
+    static bool IsEnabled() { return snMaxPerProblem>0; }
+
+    // Pose optimization of a frame (pinhole cameras), with its current pose as initial value
+    static void CapturePose(Frame* pFrame);
+    static void CapturePose(const PoseSolver &solver, const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw);
+
+    // Local BA (BASolver::Solve schedule) and global BA (nIterations of Optimize, with the
+    // covisibility of the cameras to replay it partitioned)
+    static void CaptureLocalBA(const BASolver &solver);
+    static void CaptureGlobalBA(const BASolver &solver, const int nIterations, const bool bRobust,
+                                const std::vector<std::vector<std::pair<int,int> > > &vCovisibility);
+
+    // Essential graph of VertexSim3Expmap and EdgeSim3, before initializeOptimization
+    static void CaptureEssentialGraph(const g2o::SparseOptimizer &optimizer, const int nIterations);
+
+    // Replay: header of a file (restores its OutlierRejection settings), false if it is not a capture
+    static bool ReadHeader(std::istream &is, int &problem);
+    static bool LoadGlobalBA(std::istream &is, BASolver &solver, int &nIterations, bool &bRobust,
+                             std::vector<std::vector<std::pair<int,int> > > &vCovisibility);
+    // Adds the vertices and edges of the graph to an optimizer with its algorithm already set
+    static bool LoadEssentialGraph(std::istream &is, g2o::SparseOptimizer &optimizer, int &nIterations);
+
+    static const char* GetProblemName(const int problem);
+
+protected:
+    // Opens the next file of the problem and writes its header, false once the maximum is reached
+    static bool Open(const int problem, std::ofstream &f);
+
+    static std::string msDir;
+    static int snMaxPerProblem;
+    static std::atomic<int> snCaptured[4];
+};
+
+} //namespace ORB_SLAM
+
+#endif // PROBLEMCAPTURE_H
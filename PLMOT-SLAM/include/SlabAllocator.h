@@ -0,0 +1,112 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SLABALLOCATOR_H
+#define SLABALLOCATOR_H
+
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+namespace ORB_SLAM3
+{
+
+// Allocation of the objects of a class from slabs of nSlabObjects fixed-size slots, used by the class
+// operators new and delete of the map points, map lines and keyframes. Objects created together (the
+// points triangulated from a keyframe, the lines of a new keyframe) are contiguous in memory, and the
+// slots of deleted objects are reused by the next ones without going back to the heap. Slabs are never
+// released, so the memory is bounded by the peak number of live objects. Thread-safe.
+template<class T, size_t nSlabObjects=256>
+class SlabAllocator
+{
+public:
+    static void* Allocate(const size_t size)
+    {
+        // Objects of other sizes (derived classes) are not allocated from the slabs
+        if(size!=sizeof(T))
+            return ::operator new(size);
+
+        Pool &pool = GetPool();
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        if(!pool.pFree)
+            AddSlab(pool);
+        Slot* pSlot = pool.pFree;
+        pool.pFree = pSlot->pNext;
+        return pSlot;
+    }
+
+    static void Deallocate(void* p, const size_t size)
+    {
+        if(!p)
+            return;
+        if(size!=sizeof(T))
+        {
+            ::operator delete(p);
+            return;
+        }
+
+        Pool &pool = GetPool();
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        Slot* pSlot = static_cast<Slot*>(p);
+        pSlot->pNext = pool.pFree;
+        pool.pFree = pSlot;
+    }
+
+protected:
+    // A free slot holds the next free one
+    union Slot
+    {
+        Slot* pNext;
+        typename std::aligned_storage<sizeof(T),alignof(T)>::type storage;
+    };
+
+    struct Pool
+    {
+        Pool() : pFree(NULL) {}
+        std::mutex mutex;
+        Slot* pFree;
+        std::vector<void*> vpSlabs;
+    };
+
+    // Never destroyed, objects may be deleted during the destruction of static objects
+    static Pool& GetPool()
+    {
+        static Pool* pPool = new Pool();
+        return *pPool;
+    }
+
+    static void AddSlab(Pool &pool)
+    {
+        // ::operator new only guarantees the alignment of the fundamental types
+        size_t space = nSlabObjects*sizeof(Slot)+alignof(Slot);
+        void* pMemory = ::operator new(space);
+        void* pAligned = pMemory;
+        std::align(alignof(Slot), nSlabObjects*sizeof(Slot), pAligned, space);
+        pool.vpSlabs.push_back(pMemory);
+
+        Slot* pSlab = static_cast<Slot*>(pAligned);
+        for(size_t i=0; i+1<nSlabObjects; i++)
+            pSlab[i].pNext = &pSlab[i+1];
+        pSlab[nSlabObjects-1].pNext = pool.pFree;
+        pool.pFree = pSlab;
+    }
+};
+
+} //namespace ORB_SLAM
+
+#endif // SLABALLOCATOR_H
@@ -0,0 +1,104 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SOLVERUTILS_H
+#define SOLVERUTILS_H
+
+#include <cmath>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+
+#include <Eigen/Core>
+
+#include "G2oTypes.h"
+
+// Helpers shared by the solvers that do not build a g2o graph (PoseSolver, BASolver)
+namespace ORB_SLAM3
+{
+
+// Binary write and read of a trivially copyable value or fixed-size Eigen matrix (problem captures)
+template<class T>
+inline void WriteBinary(std::ostream &os, const T &v)
+{
+    os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template<class T>
+inline bool ReadBinary(std::istream &is, T &v)
+{
+    is.read(reinterpret_cast<char*>(&v), sizeof(T));
+    return bool(is);
+}
+
+// Left update T <- exp(dx)*T, rotation first (as g2o::SE3Quat::exp)
+inline void UpdatePose(const Eigen::Matrix<double,6,1> &dx, Eigen::Matrix3d &R, Eigen::Vector3d &t)
+{
+    const Eigen::Vector3d w = dx.head<3>();
+    const Eigen::Vector3d v = dx.tail<3>();
+    const double theta = w.norm();
+    const Eigen::Matrix3d W = Skew(w);
+    const Eigen::Matrix3d W2 = W*W;
+
+    Eigen::Matrix3d dR, V;
+    if(theta<1e-5)
+    {
+        dR = Eigen::Matrix3d::Identity() + W + 0.5*W2;
+        V = Eigen::Matrix3d::Identity() + 0.5*W + W2/6.0;
+    }
+    else
+    {
+        const double theta2 = theta*theta;
+        dR = Eigen::Matrix3d::Identity() + sin(theta)/theta*W + (1-cos(theta))/theta2*W2;
+        V = Eigen::Matrix3d::Identity() + (1-cos(theta))/theta2*W + (theta-sin(theta))/(theta2*theta)*W2;
+    }
+
+    R = dR*R;
+    t = dR*t + V*v;
+}
+
+// Splits [0,n) in nThreads contiguous ranges and calls f(thread, begin, end) for each of them,
+// the first one in the calling thread. The ranges only depend on n and nThreads.
+template<class F>
+void ParallelFor(const int nThreads, const int n, const F &f)
+{
+    const int nt = std::max(1, std::min(nThreads, n));
+    if(nt==1)
+    {
+        f(0, 0, n);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(nt-1);
+    const int chunk = (n + nt - 1)/nt;
+    for(int t=1; t<nt; t++)
+    {
+        const int begin = std::min(t*chunk, n);
+        const int end = std::min(begin + chunk, n);
+        threads.push_back(std::thread([&f, t, begin, end]() { f(t, begin, end); }));
+    }
+    f(0, 0, std::min(chunk, n));
+
+    for(size_t t=0; t<threads.size(); t++)
+        threads[t].join();
+}
+
+} //namespace ORB_SLAM
+
+#endif // SOLVERUTILS_H
@@ -41,6 +41,8 @@
 #include "ImuTypes.h"
 
 #include "GeometricCamera.h"
+#include "PoseSolver.h"
+#include "OptimizationBudget.h"
 
 #include <mutex>
 #include <unordered_set>
@@ -186,6 +188,40 @@ public:
     // Parameter for Choosing Pose Optimization and Local BA
     int SLAM; 
 
+    // MapLines optimized in the Local/Global BA with the orthonormal representation instead of their endpoints
+    bool mbLineOrthonormal;
+
+    // Local BA with points and lines by g2o (0) or by the multi-threaded Schur complement solver (1), and its threads
+    int mnBASolver;
+    int mnBAThreads;
+
+    // Global BA of the points by g2o (0) or of the points and lines by the multi-threaded PCG solver (1), its
+    // threads and maximum conjugate gradient iterations per step
+    int mnGBASolver;
+    int mnGBAThreads;
+    int mnGBACGIterations;
+    // Keyframes per cluster of the partitioned global BA (0, no partition)
+    int mnGBAClusterKFs;
+
+    // Budget of the pose optimizations, the local BA and the essential graph optimization (optimizationBudget),
+    // and statistics of the last pose optimization
+    bool mbOptimizationBudget;
+    OptimizationBudget mPoseBudget;
+    OptimizationBudget mLocalBABudget;
+    OptimizationBudget mEssentialGraphBudget;
+    OptimizationStats mPoseStats;
+
+    // New keyframe lines triangulated against the covisible keyframes by the local mapping (lineTriangulation)
+    bool mbLineTriangulation;
+    // Duplicated map lines fused by the local mapping with those of the neighbor keyframes (lineFusion)
+    bool mbLineFusion;
+    // Local BA of a keyframe overlapped with the processing of the next one in the local mapping (localMappingPipeline)
+    bool mbLocalMappingPipeline;
+    // Threads of the triangulation of new map points, one neighbor keyframe per task (triangulationThreads)
+    int mnTriangulationThreads;
+    // Threads of the verification of the loop and merge candidates, one candidate per task (loopCandidateThreads)
+    int mnLoopCandidateThreads;
+
 protected:
 
     // Main tracking function. It is independent of the input sensor.
@@ -217,6 +253,10 @@ protected:
     void CreateInitialMapMonocular();
 
     void CheckReplacedInLastFrame();
+    // Quiescent state of the tracking for the EpochReclaimer, at the end of the frames tracked with the
+    // local map or by optical flow: drops the bad landmarks of the current and last frames, and of the
+    // local map when it is kept
+    void ReleaseBadLandmarks();
     void CheckReplacedInLastFrameWithLines();
     bool TrackReferenceKeyFrame();
     bool TrackReferenceKeyFrameWithLines();
@@ -224,6 +264,23 @@ protected:
     void UpdateLastFrameWithLines();
     bool TrackWithMotionModel();
     bool TrackWithMotionModelWithLines();
+
+    // Covariance of the pose predicted by the motion model (rotation first)
+    Eigen::Matrix<double,6,6> PredictedPoseCovariance();
+
+    // Pose optimization with points and lines by the solver selected in the settings
+    int PoseOptimizationPL(Frame* pFrame);
+
+    // Frame to frame line association (by optical flow index or by projection)
+    int MatchLinesWithLastFrame();
+
+    // OK_KLT: pose from the keypoints and lines tracked by optical flow, without searching the local map
+    bool TrackWithOpticalFlow();
+
+    // Detect ORB and LSD+LBD features on a frame with tracked points or lines
+    void DetectTrackedFeatures();
+    // Same before it becomes a keyframe, recovering the MapPoints and MapLines of the tracked features
+    void DetectFeaturesForKeyFrame();
     bool PredictStateIMU();
 
     bool Relocalization();
@@ -371,6 +428,7 @@ protected:
     ofstream f_track_stats;
 
     ofstream f_track_times;
+    ofstream f_line_proj_stats;
     double mTime_PreIntIMU;
     double mTime_PosePred;
     double mTime_LocalMapTrack;
@@ -378,6 +436,10 @@ protected:
 
     GeometricCamera* mpCamera, *mpCamera2;
 
+    // Pose optimization with points and lines: 0 g2o (Optimizer::PoseOptimizationPL), 1 PoseSolver
+    int mnPoseSolver;
+    PoseSolver mPoseSolver;
+
     int initID, lastID;
 
     cv::Mat mTlr;
@@ -0,0 +1,2203 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "BASolver.h"
+
+#include <cmath>
+#include <map>
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <queue>
+
+#include <Eigen/Cholesky>
+#include <Eigen/Geometry>
+
+#include "KeyFrame.h"
+#include "Map.h"
+#include "MapPoint.h"
+#include "MapLine.h"
+#include "Optimizer.h"
+#include "Converter.h"
+#include "GeometricCamera.h"
+#include "SolverUtils.h"
+#include "ProblemCapture.h"
+
+namespace ORB_SLAM3
+{
+
+namespace
+{
+
+const double chi2Mono = 5.991;
+const double chi2Stereo = 7.815;
+const double chi2LineBase = 7.815;
+const double deltaMono = sqrt(5.991);
+const double deltaStereo = sqrt(7.815);
+
+// Threshold so as to lower the weight of Lines according to the Number of the initial ORB Edges
+const int thrLineWeight = 50;
+
+inline double LineWeight(const int nPointEdges)
+{
+    return pow(2.0,-(nPointEdges/thrLineWeight));
+}
+
+} // namespace
+
+BASolver::BASolver(): mdLambdaInit(-1), fx(0), fy(0), cx(0), cy(0), bf(0), mnThreads(1), mnLinearSolver(DENSE_SCHUR),
+    mnMaxCGIterations(100), mdCGTolerance(1e-6), mnCGIterations(0), mnClusterKFs(0), mnBlocks(0), mbStructureBuilt(false), mbBlocksBuilt(false),
+    mnLandmarkObsUnused(0), mdMaxDiag(0), mbSlidingWindow(false), mnReadLandmarks(0)
+{
+}
+
+void BASolver::SetCalibration(const double &fx_, const double &fy_, const double &cx_, const double &cy_, const double &bf_)
+{
+    fx = fx_;
+    fy = fy_;
+    cx = cx_;
+    cy = cy_;
+    bf = bf_;
+}
+
+void BASolver::SetThreads(const int n)
+{
+    if(std::max(n,1)==mnThreads)
+        return;
+    mnThreads = std::max(n,1);
+    mbBlocksBuilt = false;
+}
+
+void BASolver::SetLinearSolver(const int type, const int nMaxIterations, const double &tol)
+{
+    mnLinearSolver = type==PCG_SCHUR ? PCG_SCHUR : DENSE_SCHUR;
+    mnMaxCGIterations = std::max(nMaxIterations,1);
+    mdCGTolerance = tol;
+    mbBlocksBuilt = false;
+}
+
+void BASolver::SetPartition(const int nClusterKFs)
+{
+    mnClusterKFs = std::max(nClusterKFs,0);
+}
+
+void BASolver::Clear()
+{
+    mvCameras.clear();
+    mvLandmarks.clear();
+    mvLandmarkFixed.clear();
+    mvPointLandmark.clear();
+    mvLineLandmark.clear();
+    mvPointObs.clear();
+    mvLineObs.clear();
+    mvCameraObs.clear();
+    mvFreeCameras.clear();
+    mvFreePoints.clear();
+    mvFreeLines.clear();
+    mbStructureBuilt = false;
+    mbBlocksBuilt = false;
+
+    // The window refers to the cameras, points and lines of the problem
+    mmWindowCameras.clear();
+    mmWindowPoints.clear();
+    mmWindowLines.clear();
+    mvpWindowKFs.clear();
+    mvpWindowMPs.clear();
+    mvpWindowMLs.clear();
+}
+
+int BASolver::AddCamera(const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw, const bool bFixed)
+{
+    Camera cam;
+    cam.Rcw = Rcw;
+    cam.tcw = tcw;
+    cam.bFixed = bFixed;
+    mbBlocksBuilt = false;
+
+    if(!mvFreeCameras.empty())
+    {
+        const int idx = mvFreeCameras.back();
+        mvFreeCameras.pop_back();
+        mvCameras[idx] = cam;
+        return idx;
+    }
+
+    mvCameras.push_back(cam);
+    mvCameraObs.push_back(0);
+    return mvCameras.size()-1;
+}
+
+int BASolver::AddLandmark(const Eigen::Vector3d &Xw, const bool bFixed)
+{
+    // In a built structure a new landmark starts with an empty range
+    if(mbStructureBuilt)
+    {
+        mvLandmarkObsStart.push_back(mvLandmarkObs.size());
+        mvLandmarkObsEnd.push_back(mvLandmarkObs.size());
+        mvLandmarkObsCapacity.push_back(0);
+    }
+    mvLandmarks.push_back(Xw);
+    mvLandmarkFixed.push_back(bFixed);
+    return mvLandmarks.size()-1;
+}
+
+int BASolver::AddPoint(const Eigen::Vector3d &Xw, const bool bFixed)
+{
+    if(!mvFreePoints.empty())
+    {
+        const int idx = mvFreePoints.back();
+        mvFreePoints.pop_back();
+        mvLandmarks[mvPointLandmark[idx]] = Xw;
+        mvLandmarkFixed[mvPointLandmark[idx]] = bFixed;
+        return idx;
+    }
+
+    mvPointLandmark.push_back(AddLandmark(Xw, bFixed));
+    return mvPointLandmark.size()-1;
+}
+
+int BASolver::AddLine(const Eigen::Vector3d &Xs, const Eigen::Vector3d &Xe, const bool bFixed)
+{
+    if(!mvFreeLines.empty())
+    {
+        const int idx = mvFreeLines.back();
+        mvFreeLines.pop_back();
+        const int j = mvLineLandmark[idx];
+        mvLandmarks[j] = Xs;
+        mvLandmarks[j+1] = Xe;
+        mvLandmarkFixed[j] = bFixed;
+        mvLandmarkFixed[j+1] = bFixed;
+        return idx;
+    }
+
+    mvLineLandmark.push_back(AddLandmark(Xs, bFixed));
+    AddLandmark(Xe, bFixed);
+    return mvLineLandmark.size()-1;
+}
+
+void BASolver::AddPointObservation(const int point, const int cam, const double &u, const double &v, const double &ur, const double &invSigma2)
+{
+    PointObs obs;
+    obs.cam = cam;
+    obs.point = point;
+    obs.u = u;
+    obs.v = v;
+    obs.ur = ur;
+    obs.invSigma2 = invSigma2;
+    obs.bOutlier = false;
+    mvPointObs.push_back(obs);
+    mvCameraObs[cam]++;
+    if(mbStructureBuilt)
+        InsertLandmarkObs(mvPointLandmark[point], mvPointObs.size()-1);
+}
+
+void BASolver::AddLineObservation(const int line, const int cam, const Eigen::Vector3d &l, const double &invSigma2)
+{
+    LineObs obs;
+    obs.cam = cam;
+    obs.line = line;
+    obs.l = l;
+    obs.invSigma2 = invSigma2;
+    obs.weight = 1.0;
+    obs.bOutlier = false;
+    mvLineObs.push_back(obs);
+    mvCameraObs[cam]++;
+    if(mbStructureBuilt)
+    {
+        const int o = -(int)mvLineObs.size();
+        InsertLandmarkObs(mvLineLandmark[line], o);
+        InsertLandmarkObs(mvLineLandmark[line]+1, o);
+    }
+}
+
+void BASolver::RemovePointObservation(const int i)
+{
+    const int last = mvPointObs.size()-1;
+    if(mbStructureBuilt)
+    {
+        EraseLandmarkObs(mvPointLandmark[mvPointObs[i].point], i);
+        if(i!=last)
+            RenameLandmarkObs(mvPointLandmark[mvPointObs[last].point], last, i);
+    }
+    mvCameraObs[mvPointObs[i].cam]--;
+    mvPointObs[i] = mvPointObs[last];
+    mvPointObs.pop_back();
+}
+
+void BASolver::RemoveLineObservation(const int i)
+{
+    const int last = mvLineObs.size()-1;
+    if(mbStructureBuilt)
+    {
+        const int j = mvLineLandmark[mvLineObs[i].line];
+        EraseLandmarkObs(j, -1-i);
+        EraseLandmarkObs(j+1, -1-i);
+        if(i!=last)
+        {
+            const int jLast = mvLineLandmark[mvLineObs[last].line];
+            RenameLandmarkObs(jLast, -1-last, -1-i);
+            RenameLandmarkObs(jLast+1, -1-last, -1-i);
+        }
+    }
+    mvCameraObs[mvLineObs[i].cam]--;
+    mvLineObs[i] = mvLineObs[last];
+    mvLineObs.pop_back();
+}
+
+void BASolver::RemoveCamera(const int cam)
+{
+    // Observations left from landmarks still in the problem. From the last one, the observation that takes
+    // the index of a removed one has already been checked.
+    if(mvCameraObs[cam]>0)
+    {
+        for(int i=mvPointObs.size()-1; i>=0; i--)
+            if(mvPointObs[i].cam==cam)
+                RemovePointObservation(i);
+        for(int i=mvLineObs.size()-1; i>=0; i--)
+            if(mvLineObs[i].cam==cam)
+                RemoveLineObservation(i);
+    }
+
+    mvCameras[cam].bFixed = true;
+    mvFreeCameras.push_back(cam);
+    mbBlocksBuilt = false;
+}
+
+void BASolver::RemovePoint(const int point)
+{
+    RemoveLandmarkObservations(mvPointLandmark[point]);
+    mvLandmarkFixed[mvPointLandmark[point]] = true;
+    mvFreePoints.push_back(point);
+}
+
+void BASolver::RemoveLine(const int line)
+{
+    // The observations of a line are in the ranges of both endpoints, removed with those of the start
+    const int j = mvLineLandmark[line];
+    RemoveLandmarkObservations(j);
+    mvLandmarkFixed[j] = true;
+    mvLandmarkFixed[j+1] = true;
+    mvFreeLines.push_back(line);
+}
+
+void BASolver::RemoveLandmarkObservations(const int j)
+{
+    BuildStructure();
+    while(mvLandmarkObsEnd[j]>mvLandmarkObsStart[j])
+    {
+        const int o = mvLandmarkObs[mvLandmarkObsEnd[j]-1];
+        if(o>=0)
+            RemovePointObservation(o);
+        else
+            RemoveLineObservation(-1-o);
+    }
+}
+
+void BASolver::InsertLandmarkObs(const int j, const int o)
+{
+    const int n = mvLandmarkObsEnd[j]-mvLandmarkObsStart[j];
+    if(n==mvLandmarkObsCapacity[j])
+    {
+        const int capacity = std::max(2*n,4);
+        const int start = mvLandmarkObs.size();
+        mvLandmarkObs.resize(start+capacity);
+        std::copy(mvLandmarkObs.begin()+mvLandmarkObsStart[j], mvLandmarkObs.begin()+mvLandmarkObsEnd[j], mvLandmarkObs.begin()+start);
+        mnLandmarkObsUnused += mvLandmarkObsCapacity[j];
+        mvLandmarkObsStart[j] = start;
+        mvLandmarkObsEnd[j] = start+n;
+        mvLandmarkObsCapacity[j] = capacity;
+    }
+    mvLandmarkObs[mvLandmarkObsEnd[j]++] = o;
+}
+
+void BASolver::EraseLandmarkObs(const int j, const int o)
+{
+    for(int k=mvLandmarkObsStart[j]; k<mvLandmarkObsEnd[j]; k++)
+    {
+        if(mvLandmarkObs[k]==o)
+        {
+            mvLandmarkObs[k] = mvLandmarkObs[--mvLandmarkObsEnd[j]];
+            return;
+        }
+    }
+}
+
+void BASolver::RenameLandmarkObs(const int j, const int o, const int oNew)
+{
+    for(int k=mvLandmarkObsStart[j]; k<mvLandmarkObsEnd[j]; k++)
+    {
+        if(mvLandmarkObs[k]==o)
+        {
+            mvLandmarkObs[k] = oNew;
+            return;
+        }
+    }
+}
+
+void BASolver::GetLine(const size_t i, Eigen::Vector3d &Xs, Eigen::Vector3d &Xe) const
+{
+    Xs = mvLandmarks[mvLineLandmark[i]];
+    Xe = mvLandmarks[mvLineLandmark[i]+1];
+}
+
+void BASolver::Save(std::ostream &os) const
+{
+    WriteBinary(os, fx);
+    WriteBinary(os, fy);
+    WriteBinary(os, cx);
+    WriteBinary(os, cy);
+    WriteBinary(os, bf);
+    WriteBinary(os, mdLambdaInit);
+
+    WriteBinary(os, static_cast<int>(mvCameras.size()));
+    for(size_t i=0; i<mvCameras.size(); i++)
+    {
+        WriteBinary(os, mvCameras[i].Rcw);
+        WriteBinary(os, mvCameras[i].tcw);
+        WriteBinary(os, static_cast<char>(mvCameras[i].bFixed));
+    }
+
+    WriteBinary(os, static_cast<int>(mvPointLandmark.size()));
+    for(size_t i=0; i<mvPointLandmark.size(); i++)
+    {
+        WriteBinary(os, mvLandmarks[mvPointLandmark[i]]);
+        WriteBinary(os, mvLandmarkFixed[mvPointLandmark[i]]);
+    }
+
+    WriteBinary(os, static_cast<int>(mvLineLandmark.size()));
+    for(size_t i=0; i<mvLineLandmark.size(); i++)
+    {
+        WriteBinary(os, mvLandmarks[mvLineLandmark[i]]);
+        WriteBinary(os, mvLandmarks[mvLineLandmark[i]+1]);
+        WriteBinary(os, mvLandmarkFixed[mvLineLandmark[i]]);
+    }
+
+    WriteBinary(os, static_cast<int>(mvPointObs.size()));
+    for(size_t i=0; i<mvPointObs.size(); i++)
+    {
+        const PointObs &obs = mvPointObs[i];
+        WriteBinary(os, obs.cam);
+        WriteBinary(os, obs.point);
+        WriteBinary(os, obs.u);
+        WriteBinary(os, obs.v);
+        WriteBinary(os, obs.ur);
+        WriteBinary(os, obs.invSigma2);
+    }
+
+    WriteBinary(os, static_cast<int>(mvLineObs.size()));
+    for(size_t i=0; i<mvLineObs.size(); i++)
+    {
+        const LineObs &obs = mvLineObs[i];
+        WriteBinary(os, obs.cam);
+        WriteBinary(os, obs.line);
+        WriteBinary(os, obs.l);
+        WriteBinary(os, obs.invSigma2);
+        WriteBinary(os, obs.weight);
+    }
+}
+
+bool BASolver::Load(std::istream &is)
+{
+    Clear();
+
+    double fx_, fy_, cx_, cy_, bf_;
+    ReadBinary(is, fx_);
+    ReadBinary(is, fy_);
+    ReadBinary(is, cx_);
+    ReadBinary(is, cy_);
+    ReadBinary(is, bf_);
+    ReadBinary(is, mdLambdaInit);
+    SetCalibration(fx_, fy_, cx_, cy_, bf_);
+
+    int n = 0;
+    if(!ReadBinary(is, n) || n<0)
+        return false;
+    mvCameras.reserve(n);
+    for(int i=0; i<n; i++)
+    {
+        Eigen::Matrix3d Rcw;
+        Eigen::Vector3d tcw;
+        char bFixed;
+        ReadBinary(is, Rcw);
+        ReadBinary(is, tcw);
+        if(!ReadBinary(is, bFixed))
+            return false;
+        AddCamera(Rcw, tcw, bFixed);
+    }
+
+    if(!ReadBinary(is, n) || n<0)
+        return false;
+    for(int i=0; i<n; i++)
+    {
+        Eigen::Vector3d Xw;
+        char bFixed;
+        ReadBinary(is, Xw);
+        if(!ReadBinary(is, bFixed))
+            return false;
+        AddPoint(Xw, bFixed);
+    }
+
+    if(!ReadBinary(is, n) || n<0)
+        return false;
+    for(int i=0; i<n; i++)
+    {
+        Eigen::Vector3d Xs, Xe;
+        char bFixed;
+        ReadBinary(is, Xs);
+        ReadBinary(is, Xe);
+        if(!ReadBinary(is, bFixed))
+            return false;
+        AddLine(Xs, Xe, bFixed);
+    }
+
+    if(!ReadBinary(is, n) || n<0)
+        return false;
+    mvPointObs.reserve(n);
+    for(int i=0; i<n; i++)
+    {
+        int cam, point;
+        double u, v, ur, invSigma2;
+        ReadBinary(is, cam);
+        ReadBinary(is, point);
+        ReadBinary(is, u);
+        ReadBinary(is, v);
+        ReadBinary(is, ur);
+        if(!ReadBinary(is, invSigma2))
+            return false;
+        if(cam<0 || cam>=(int)mvCameras.size() || point<0 || point>=(int)mvPointLandmark.size())
+            return false;
+        AddPointObservation(point, cam, u, v, ur, invSigma2);
+    }
+
+    if(!ReadBinary(is, n) || n<0)
+        return false;
+    mvLineObs.reserve(n);
+    for(int i=0; i<n; i++)
+    {
+        int cam, line;
+        Eigen::Vector3d l;
+        double invSigma2, weight;
+        ReadBinary(is, cam);
+        ReadBinary(is, line);
+        ReadBinary(is, l);
+        ReadBinary(is, invSigma2);
+        if(!ReadBinary(is, weight))
+            return false;
+        if(cam<0 || cam>=(int)mvCameras.size() || line<0 || line>=(int)mvLineLandmark.size())
+            return false;
+        AddLineObservation(line, cam, l, invSigma2);
+        mvLineObs.back().weight = weight;
+    }
+
+    return true;
+}
+
+void BASolver::BuildStructure()
+{
+    // Compacted once the moved ranges leave more than half of mvLandmarkObs unused
+    if(mbStructureBuilt && 2*mnLandmarkObsUnused>(int)mvLandmarkObs.size())
+        mbStructureBuilt = false;
+
+    const int nLandmarks = mvLandmarks.size();
+    if(!mbStructureBuilt)
+    {
+        // Observations sorted by landmark (counting sort), a line observation goes to both endpoints
+        mvLandmarkObsStart.assign(nLandmarks+1,0);
+        for(size_t i=0; i<mvPointObs.size(); i++)
+            mvLandmarkObsStart[mvPointLandmark[mvPointObs[i].point]+1]++;
+        for(size_t i=0; i<mvLineObs.size(); i++)
+        {
+            mvLandmarkObsStart[mvLineLandmark[mvLineObs[i].line]+1]++;
+            mvLandmarkObsStart[mvLineLandmark[mvLineObs[i].line]+2]++;
+        }
+        for(int j=0; j<nLandmarks; j++)
+            mvLandmarkObsStart[j+1] += mvLandmarkObsStart[j];
+
+        mvLandmarkObs.resize(mvLandmarkObsStart[nLandmarks]);
+        mvLandmarkObsEnd.assign(mvLandmarkObsStart.begin(), mvLandmarkObsStart.end()-1);
+        for(size_t i=0; i<mvPointObs.size(); i++)
+            mvLandmarkObs[mvLandmarkObsEnd[mvPointLandmark[mvPointObs[i].point]]++] = i;
+        for(size_t i=0; i<mvLineObs.size(); i++)
+        {
+            const int j = mvLineLandmark[mvLineObs[i].line];
+            mvLandmarkObs[mvLandmarkObsEnd[j]++] = -1-i;
+            mvLandmarkObs[mvLandmarkObsEnd[j+1]++] = -1-i;
+        }
+
+        mvLandmarkObsStart.pop_back();
+        mvLandmarkObsCapacity.resize(nLandmarks);
+        for(int j=0; j<nLandmarks; j++)
+            mvLandmarkObsCapacity[j] = mvLandmarkObsEnd[j]-mvLandmarkObsStart[j];
+        mnLandmarkObsUnused = 0;
+        mbStructureBuilt = true;
+    }
+
+    // Grow with the landmarks and observations added to a built structure
+    mvHcl.resize(mvLandmarkObs.size());
+    mvObsActive.resize(mvLandmarkObs.size());
+    mvHll.resize(nLandmarks);
+    mvHllInv.resize(nLandmarks);
+    mvbl.resize(nLandmarks);
+    mvdl.resize(nLandmarks);
+
+    if(mbBlocksBuilt)
+        return;
+
+    mnBlocks = 0;
+    mvCameraBlock.resize(mvCameras.size());
+    for(size_t i=0; i<mvCameras.size(); i++)
+        mvCameraBlock[i] = mvCameras[i].bFixed ? -1 : mnBlocks++;
+
+    mvHcc.resize(mnBlocks);
+    mvbc.resize(mnBlocks);
+
+    mvAccumulators.resize(mnThreads);
+    for(int t=0; t<mnThreads; t++)
+    {
+        mvAccumulators[t].Hcc.resize(mnBlocks);
+        mvAccumulators[t].bc.resize(mnBlocks);
+        mvAccumulators[t].r.resize(6*mnBlocks);
+        if(mnLinearSolver==PCG_SCHUR)
+        {
+            mvAccumulators[t].S.resize(0,0);
+            mvAccumulators[t].P.resize(mnBlocks);
+            mvAccumulators[t].q.resize(6*mnBlocks);
+        }
+        else
+        {
+            mvAccumulators[t].S.resize(6*mnBlocks,6*mnBlocks);
+            mvAccumulators[t].P.clear();
+            mvAccumulators[t].q.resize(0);
+        }
+    }
+    if(mnLinearSolver==PCG_SCHUR)
+    {
+        mS.resize(0,0);
+        mvPrecond.resize(mnBlocks);
+    }
+    else
+        mvPrecond.clear();
+
+    mbBlocksBuilt = true;
+}
+
+bool BASolver::PointError(const PointObs &obs, const Camera &cam, const Eigen::Vector3d &Xw, Eigen::Vector3d &e, double &chi2) const
+{
+    const Eigen::Vector3d p = cam.Rcw*Xw + cam.tcw;
+    if(p(2)<=0)
+        return false;
+
+    const double invz = 1.0/p(2);
+    const double u = fx*p(0)*invz + cx;
+    e << obs.u - u, obs.v - (fy*p(1)*invz + cy), obs.ur<0 ? 0.0 : obs.ur - (u - bf*invz);
+    chi2 = obs.invSigma2*e.squaredNorm();
+    return true;
+}
+
+bool BASolver::LineError(const LineObs &obs, const Camera &cam, const Eigen::Vector3d &Xs, const Eigen::Vector3d &Xe, Eigen::Vector2d &e, double &chi2) const
+{
+    const Eigen::Vector3d ps = cam.Rcw*Xs + cam.tcw;
+    const Eigen::Vector3d pe = cam.Rcw*Xe + cam.tcw;
+    if(ps(2)<=0 || pe(2)<=0)
+        return false;
+
+    e << obs.l(0)*(fx*ps(0)/ps(2) + cx) + obs.l(1)*(fy*ps(1)/ps(2) + cy) + obs.l(2),
+         obs.l(0)*(fx*pe(0)/pe(2) + cx) + obs.l(1)*(fy*pe(1)/pe(2) + cy) + obs.l(2);
+    chi2 = obs.weight*obs.invSigma2*e.squaredNorm();
+    return true;
+}
+
+int BASolver::ClassifyObservations()
+{
+    mClassifier.Clear();
+
+    for(size_t i=0; i<mvPointObs.size(); i++)
+    {
+        const PointObs &obs = mvPointObs[i];
+        Eigen::Vector3d e;
+        double chi2 = 0;
+        const bool bValid = PointError(obs, mvCameras[obs.cam], mvLandmarks[mvPointLandmark[obs.point]], e, chi2);
+        if(obs.ur<0)
+            mClassifier.Add(chi2, chi2Mono, 2, bValid);
+        else
+            mClassifier.Add(chi2, chi2Stereo, 3, bValid);
+    }
+
+    for(size_t i=0; i<mvLineObs.size(); i++)
+    {
+        const LineObs &obs = mvLineObs[i];
+        const int j = mvLineLandmark[obs.line];
+        Eigen::Vector2d e;
+        double chi2 = 0;
+        const bool bValid = LineError(obs, mvCameras[obs.cam], mvLandmarks[j], mvLandmarks[j+1], e, chi2);
+        mClassifier.Add(chi2, obs.weight*chi2LineBase, 2, bValid);
+    }
+
+    return mClassifier.Classify();
+}
+
+void BASolver::LinearizeLandmark(const int j, const bool bRobust, Accumulator &acc)
+{
+    Eigen::Matrix3d Hll = Eigen::Matrix3d::Zero();
+    Eigen::Vector3d bl = Eigen::Vector3d::Zero();
+    const Eigen::Vector3d &Xw = mvLandmarks[j];
+
+    // A fixed landmark only adds to the normal equations of the cameras: its observations are not
+    // active in the elimination and its step is zero
+    const bool bFixed = mvLandmarkFixed[j];
+
+    for(int k=mvLandmarkObsStart[j]; k<mvLandmarkObsEnd[j]; k++)
+    {
+        mvObsActive[k] = 0;
+        const int o = mvLandmarkObs[k];
+
+        if(o>=0)
+        {
+            const PointObs &obs = mvPointObs[o];
+            if(obs.bOutlier)
+                continue;
+
+            const Camera &cam = mvCameras[obs.cam];
+            const Eigen::Vector3d p = cam.Rcw*Xw + cam.tcw;
+            if(p(2)<=0)
+                continue;
+            const double invz = 1.0/p(2);
+            const double invz2 = invz*invz;
+            const double u = fx*p(0)*invz + cx;
+
+            // Jacobian of the projection with respect to the point in camera coordinates
+            Eigen::Matrix3d A;
+            A << fx*invz, 0, -fx*p(0)*invz2,
+                 0, fy*invz, -fy*p(1)*invz2,
+                 fx*invz, 0, -fx*p(0)*invz2 + bf*invz2;
+
+            // A monocular observation has the third row of the error and the Jacobian set to zero
+            Eigen::Vector3d e;
+            e << obs.u - u, obs.v - (fy*p(1)*invz + cy), obs.ur - (u - bf*invz);
+            const bool bMono = obs.ur<0;
+            if(bMono)
+            {
+                A.row(2).setZero();
+                e(2) = 0;
+            }
+
+            const double chi2 = obs.invSigma2*e.squaredNorm();
+            double w = 1.0;
+            acc.cost += bRobust ? OutlierRejection::Cost(chi2, bMono ? deltaMono : deltaStereo, w) : chi2;
+            const double W = w*obs.invSigma2;
+
+            // e = obs - proj(exp(dx)*T*Xw), d(exp(dx)*p)/d(dx) = [-[p]x I]
+            const Eigen::Matrix3d Jl = -A*cam.Rcw;
+            if(!bFixed)
+            {
+                Hll.noalias() += W*Jl.transpose()*Jl;
+                bl.noalias() += W*Jl.transpose()*e;
+            }
+
+            const int blk = mvCameraBlock[obs.cam];
+            if(blk>=0)
+            {
+                Eigen::Matrix<double,3,6> Jc;
+                Jc.leftCols<3>() = A*Skew(p);
+                Jc.rightCols<3>() = -A;
+                acc.Hcc[blk].noalias() += W*Jc.transpose()*Jc;
+                acc.bc[blk].noalias() += W*Jc.transpose()*e;
+                mvHcl[k].noalias() = W*Jc.transpose()*Jl;
+            }
+            mvObsActive[k] = !bFixed;
+        }
+        else
+        {
+            const LineObs &obs = mvLineObs[-1-o];
+            if(obs.bOutlier)
+                continue;
+
+            const Camera &cam = mvCameras[obs.cam];
+            const int js = mvLineLandmark[obs.line];
+            Eigen::Vector2d e;
+            double chi2;
+            if(!LineError(obs, cam, mvLandmarks[js], mvLandmarks[js+1], e, chi2))
+                continue;
+
+            // Both endpoints share the robust weight of the observation, its cost is added once
+            double w = 1.0;
+            const double cost = bRobust ? OutlierRejection::Cost(chi2, sqrt(obs.weight*chi2LineBase), w) : chi2;
+            if(j==js)
+                acc.cost += cost;
+            const double W = w*obs.weight*obs.invSigma2;
+
+            // e = l . [proj(p) 1], only the residual of this endpoint depends on it
+            const Eigen::Vector3d p = cam.Rcw*Xw + cam.tcw;
+            const double invz = 1.0/p(2);
+            const double ek = j==js ? e(0) : e(1);
+            const Eigen::RowVector3d g(obs.l(0)*fx*invz, obs.l(1)*fy*invz,
+                                       -(obs.l(0)*fx*p(0) + obs.l(1)*fy*p(1))*invz*invz);
+            const Eigen::RowVector3d Jl = g*cam.Rcw;
+            if(!bFixed)
+            {
+                Hll.noalias() += W*Jl.transpose()*Jl;
+                bl.noalias() += W*ek*Jl.transpose();
+            }
+
+            const int blk = mvCameraBlock[obs.cam];
+            if(blk>=0)
+            {
+                Eigen::Matrix<double,1,6> Jc;
+                Jc.leftCols<3>() = -g*Skew(p);
+                Jc.rightCols<3>() = g;
+                acc.Hcc[blk].noalias() += W*Jc.transpose()*Jc;
+                acc.bc[blk].noalias() += W*ek*Jc.transpose();
+                mvHcl[k].noalias() = W*Jc.transpose()*Jl;
+            }
+            mvObsActive[k] = !bFixed;
+        }
+    }
+
+    mvHll[j] = Hll;
+    mvbl[j] = bl;
+    acc.maxDiag = std::max(acc.maxDiag, Hll.diagonal().maxCoeff());
+}
+
+double BASolver::Linearize(const bool bRobust)
+{
+    for(int t=0; t<mnThreads; t++)
+    {
+        Accumulator &acc = mvAccumulators[t];
+        for(int b=0; b<mnBlocks; b++)
+        {
+            acc.Hcc[b].setZero();
+            acc.bc[b].setZero();
+        }
+        acc.cost = 0;
+        acc.maxDiag = 0;
+    }
+
+    ParallelFor(mnThreads, mvLandmarks.size(), [this, bRobust](const int t, const int begin, const int end)
+    {
+        for(int j=begin; j<end; j++)
+            LinearizeLandmark(j, bRobust, mvAccumulators[t]);
+    });
+
+    double cost = 0;
+    mdMaxDiag = 0;
+    for(int b=0; b<mnBlocks; b++)
+    {
+        mvHcc[b].setZero();
+        mvbc[b].setZero();
+    }
+    for(int t=0; t<mnThreads; t++)
+    {
+        const Accumulator &acc = mvAccumulators[t];
+        for(int b=0; b<mnBlocks; b++)
+        {
+            mvHcc[b] += acc.Hcc[b];
+            mvbc[b] += acc.bc[b];
+        }
+        cost += acc.cost;
+        mdMaxDiag = std::max(mdMaxDiag, acc.maxDiag);
+    }
+    for(int b=0; b<mnBlocks; b++)
+        mdMaxDiag = std::max(mdMaxDiag, mvHcc[b].diagonal().maxCoeff());
+
+    return cost;
+}
+
+void BASolver::EliminateLandmark(const int j, const double &lambda, Accumulator &acc)
+{
+    Eigen::Matrix3d H = mvHll[j];
+    H.diagonal().array() += lambda;
+    const Eigen::Matrix3d Hinv = H.inverse();
+    mvHllInv[j] = Hinv;
+    const Eigen::Vector3d Hb = Hinv*mvbl[j];
+
+    // Only the lower triangle of the reduced system is filled
+    const int end = mvLandmarkObsEnd[j];
+    for(int a=mvLandmarkObsStart[j]; a<end; a++)
+    {
+        if(!mvObsActive[a])
+            continue;
+        const int oa = mvLandmarkObs[a];
+        const int ca = mvCameraBlock[oa>=0 ? mvPointObs[oa].cam : mvLineObs[-1-oa].cam];
+        if(ca<0)
+            continue;
+
+        const Matrix63d HclHinv = mvHcl[a]*Hinv;
+        acc.r.segment<6>(6*ca).noalias() -= mvHcl[a]*Hb;
+
+        for(int b=a; b<end; b++)
+        {
+            if(!mvObsActive[b])
+                continue;
+            const int ob = mvLandmarkObs[b];
+            const int cb = mvCameraBlock[ob>=0 ? mvPointObs[ob].cam : mvLineObs[-1-ob].cam];
+            if(cb<0)
+                continue;
+
+            const Matrix6d M = HclHinv*mvHcl[b].transpose();
+            if(ca>cb)
+                acc.S.block<6,6>(6*ca,6*cb) -= M;
+            else if(ca<cb)
+                acc.S.block<6,6>(6*cb,6*ca) -= M.transpose();
+            else if(a==b)
+                acc.S.block<6,6>(6*ca,6*ca) -= M;
+            else
+                acc.S.block<6,6>(6*ca,6*ca) -= M + M.transpose();
+        }
+    }
+}
+
+bool BASolver::SolveStep(const double &lambda, bool* pbStopFlag)
+{
+    if(mnLinearSolver==PCG_SCHUR)
+    {
+        if(!SolveReducedPCG(lambda, pbStopFlag))
+            return false;
+        BackSubstitute();
+        return true;
+    }
+
+    for(int t=0; t<mnThreads; t++)
+    {
+        mvAccumulators[t].S.setZero();
+        mvAccumulators[t].r.setZero();
+    }
+
+    ParallelFor(mnThreads, mvLandmarks.size(), [this, &lambda](const int t, const int begin, const int end)
+    {
+        for(int j=begin; j<end; j++)
+            EliminateLandmark(j, lambda, mvAccumulators[t]);
+    });
+
+    mdc.setZero(6*mnBlocks);
+    if(mnBlocks>0)
+    {
+        mS = mvAccumulators[0].S;
+        mr = mvAccumulators[0].r;
+        for(int t=1; t<mnThreads; t++)
+        {
+            mS += mvAccumulators[t].S;
+            mr += mvAccumulators[t].r;
+        }
+        for(int b=0; b<mnBlocks; b++)
+        {
+            mS.block<6,6>(6*b,6*b) += mvHcc[b];
+            mS.block<6,6>(6*b,6*b).diagonal().array() += lambda;
+            mr.segment<6>(6*b) += mvbc[b];
+        }
+
+        Eigen::LDLT<Eigen::MatrixXd> ldlt(mS);
+        if(ldlt.info()!=Eigen::Success)
+            return false;
+        mdc = ldlt.solve(-mr);
+        if(!mdc.allFinite())
+            return false;
+    }
+
+    BackSubstitute();
+    return true;
+}
+
+void BASolver::PrepareLandmarkPCG(const int j, const double &lambda, Accumulator &acc)
+{
+    Eigen::Matrix3d H = mvHll[j];
+    H.diagonal().array() += lambda;
+    const Eigen::Matrix3d Hinv = H.inverse();
+    mvHllInv[j] = Hinv;
+    const Eigen::Vector3d Hb = Hinv*mvbl[j];
+
+    // A keyframe observes a landmark at most once, only the a==b terms reach the diagonal blocks
+    for(int a=mvLandmarkObsStart[j]; a<mvLandmarkObsEnd[j]; a++)
+    {
+        if(!mvObsActive[a])
+            continue;
+        const int oa = mvLandmarkObs[a];
+        const int ca = mvCameraBlock[oa>=0 ? mvPointObs[oa].cam : mvLineObs[-1-oa].cam];
+        if(ca<0)
+            continue;
+
+        acc.r.segment<6>(6*ca).noalias() -= mvHcl[a]*Hb;
+        acc.P[ca].noalias() -= mvHcl[a]*Hinv*mvHcl[a].transpose();
+    }
+}
+
+void BASolver::MultiplyLandmark(const int j, const Eigen::VectorXd &x, Eigen::VectorXd &q) const
+{
+    // q -= Hcl*Hinv*Hcl'*x over the observations of the landmark
+    Eigen::Vector3d v = Eigen::Vector3d::Zero();
+    for(int a=mvLandmarkObsStart[j]; a<mvLandmarkObsEnd[j]; a++)
+    {
+        if(!mvObsActive[a])
+            continue;
+        const int oa = mvLandmarkObs[a];
+        const int ca = mvCameraBlock[oa>=0 ? mvPointObs[oa].cam : mvLineObs[-1-oa].cam];
+        if(ca>=0)
+            v.noalias() += mvHcl[a].transpose()*x.segment<6>(6*ca);
+    }
+
+    if(v.isZero(0))
+        return;
+    const Eigen::Vector3d u = mvHllInv[j]*v;
+
+    for(int a=mvLandmarkObsStart[j]; a<mvLandmarkObsEnd[j]; a++)
+    {
+        if(!mvObsActive[a])
+            continue;
+        const int oa = mvLandmarkObs[a];
+        const int ca = mvCameraBlock[oa>=0 ? mvPointObs[oa].cam : mvLineObs[-1-oa].cam];
+        if(ca>=0)
+            q.segment<6>(6*ca).noalias() -= mvHcl[a]*u;
+    }
+}
+
+bool BASolver::SolveReducedPCG(const double &lambda, bool* pbStopFlag)
+{
+    for(int t=0; t<mnThreads; t++)
+    {
+        Accumulator &acc = mvAccumulators[t];
+        acc.r.setZero();
+        for(int b=0; b<mnBlocks; b++)
+            acc.P[b].setZero();
+    }
+
+    ParallelFor(mnThreads, mvLandmarks.size(), [this, &lambda](const int t, const int begin, const int end)
+    {
+        for(int j=begin; j<end; j++)
+            PrepareLandmarkPCG(j, lambda, mvAccumulators[t]);
+    });
+
+    mdc.setZero(6*mnBlocks);
+    if(mnBlocks==0)
+        return true;
+
+    // Right hand side and block-Jacobi preconditioner
+    mr = mvAccumulators[0].r;
+    for(int t=1; t<mnThreads; t++)
+        mr += mvAccumulators[t].r;
+    for(int b=0; b<mnBlocks; b++)
+        mr.segment<6>(6*b) += mvbc[b];
+
+    std::atomic<bool> bPrecondOk(true);
+    ParallelFor(mnThreads, mnBlocks, [this, &lambda, &bPrecondOk](const int, const int begin, const int end)
+    {
+        for(int b=begin; b<end; b++)
+        {
+            Matrix6d P = mvHcc[b];
+            P.diagonal().array() += lambda;
+            for(int t=0; t<mnThreads; t++)
+                P += mvAccumulators[t].P[b];
+
+            Eigen::LDLT<Matrix6d> ldlt(P);
+            if(ldlt.info()!=Eigen::Success || !ldlt.isPositive())
+            {
+                bPrecondOk = false;
+                continue;
+            }
+            mvPrecond[b] = ldlt.solve(Matrix6d::Identity());
+        }
+    });
+    if(!bPrecondOk)
+        return false;
+
+    // S*x = (Hcc + lambda*I)*x - sum over the landmarks of Hcl*Hinv*Hcl'*x
+    Eigen::VectorXd &q = mvAccumulators[0].q;
+    auto MultiplyS = [this, &lambda, &q](const Eigen::VectorXd &x)
+    {
+        for(int t=0; t<mnThreads; t++)
+            mvAccumulators[t].q.setZero();
+
+        ParallelFor(mnThreads, mvLandmarks.size(), [this, &x](const int t, const int begin, const int end)
+        {
+            for(int j=begin; j<end; j++)
+                MultiplyLandmark(j, x, mvAccumulators[t].q);
+        });
+
+        for(int t=1; t<mnThreads; t++)
+            q += mvAccumulators[t].q;
+        for(int b=0; b<mnBlocks; b++)
+            q.segment<6>(6*b).noalias() += mvHcc[b]*x.segment<6>(6*b) + lambda*x.segment<6>(6*b);
+    };
+
+    auto Precondition = [this](const Eigen::VectorXd &res, Eigen::VectorXd &z)
+    {
+        for(int b=0; b<mnBlocks; b++)
+            z.segment<6>(6*b).noalias() = mvPrecond[b]*res.segment<6>(6*b);
+    };
+
+    // Solve S*dc = -r
+    Eigen::VectorXd res = -mr;
+    Eigen::VectorXd z(6*mnBlocks);
+    Precondition(res, z);
+    Eigen::VectorXd p = z;
+    double rz = res.dot(z);
+    const double tol2 = mdCGTolerance*mdCGTolerance*res.squaredNorm();
+
+    for(int it=0; it<mnMaxCGIterations && res.squaredNorm()>tol2; it++)
+    {
+        if(pbStopFlag && *pbStopFlag)
+            return false;
+
+        MultiplyS(p);
+        const double pq = p.dot(q);
+        if(pq<=0 || !std::isfinite(pq))
+            break;
+
+        const double alpha = rz/pq;
+        mdc.noalias() += alpha*p;
+        res.noalias() -= alpha*q;
+        mnCGIterations++;
+
+        Precondition(res, z);
+        const double rzNew = res.dot(z);
+        p = z + (rzNew/rz)*p;
+        rz = rzNew;
+    }
+
+    return mdc.allFinite();
+}
+
+void BASolver::BackSubstitute()
+{
+    // Back substitution of the landmarks
+    ParallelFor(mnThreads, mvLandmarks.size(), [this](const int, const int begin, const int end)
+    {
+        for(int j=begin; j<end; j++)
+        {
+            Eigen::Vector3d v = -mvbl[j];
+            for(int k=mvLandmarkObsStart[j]; k<mvLandmarkObsEnd[j]; k++)
+            {
+                if(!mvObsActive[k])
+                    continue;
+                const int o = mvLandmarkObs[k];
+                const int c = mvCameraBlock[o>=0 ? mvPointObs[o].cam : mvLineObs[-1-o].cam];
+                if(c>=0)
+                    v.noalias() -= mvHcl[k].transpose()*mdc.segment<6>(6*c);
+            }
+            mvdl[j] = mvHllInv[j]*v;
+        }
+    });
+}
+
+double BASolver::Cost(const std::vector<Camera> &vCameras, const std::vector<Eigen::Vector3d> &vLandmarks, const bool bRobust)
+{
+    const int nPointObs = mvPointObs.size();
+    const int nObs = nPointObs + mvLineObs.size();
+
+    for(int t=0; t<mnThreads; t++)
+        mvAccumulators[t].cost = 0;
+
+    ParallelFor(mnThreads, nObs, [&](const int t, const int begin, const int end)
+    {
+        double cost = 0;
+        double w;
+        for(int i=begin; i<end; i++)
+        {
+            if(i<nPointObs)
+            {
+                const PointObs &obs = mvPointObs[i];
+                Eigen::Vector3d e;
+                double chi2;
+                if(obs.bOutlier || !PointError(obs, vCameras[obs.cam], vLandmarks[mvPointLandmark[obs.point]], e, chi2))
+                    continue;
+                cost += bRobust ? OutlierRejection::Cost(chi2, obs.ur<0 ? deltaMono : deltaStereo, w) : chi2;
+            }
+            else
+            {
+                const LineObs &obs = mvLineObs[i-nPointObs];
+                const int j = mvLineLandmark[obs.line];
+                Eigen::Vector2d e;
+                double chi2;
+                if(obs.bOutlier || !LineError(obs, vCameras[obs.cam], vLandmarks[j], vLandmarks[j+1], e, chi2))
+                    continue;
+                cost += bRobust ? OutlierRejection::Cost(chi2, sqrt(obs.weight*chi2LineBase), w) : chi2;
+            }
+        }
+        mvAccumulators[t].cost = cost;
+    });
+
+    double cost = 0;
+    for(int t=0; t<mnThreads; t++)
+        cost += mvAccumulators[t].cost;
+    return cost;
+}
+
+double BASolver::Chi2()
+{
+    BuildStructure();
+    return Cost(mvCameras, mvLandmarks, false);
+}
+
+int BASolver::Optimize(const int nIterations, const bool bRobust, bool* pbStopFlag, OptimizationMonitor* pMonitor)
+{
+    BuildStructure();
+
+    // Levenberg-Marquardt with the damping strategy of g2o::OptimizationAlgorithmLevenberg
+    double lambda = -1;
+    double ni = 2;
+    double newCost = 0;
+    int iter = 0;
+    mnCGIterations = 0;
+    for(; iter<nIterations; iter++)
+    {
+        if(pbStopFlag && *pbStopFlag)
+            break;
+
+        const double cost = Linearize(bRobust);
+        if(lambda<0)
+            lambda = mdLambdaInit>0 ? mdLambdaInit : 1e-5*mdMaxDiag;
+        if(lambda<=0)
+            break;
+
+        bool bAccepted = false;
+        for(int nTries=0; nTries<10 && !bAccepted; nTries++)
+        {
+            if(!SolveStep(lambda, pbStopFlag))
+            {
+                if(pbStopFlag && *pbStopFlag)
+                    break;
+                lambda *= ni;
+                ni *= 2;
+                continue;
+            }
+
+            mvCamerasNew = mvCameras;
+            double scale = 0;
+            for(size_t i=0; i<mvCameras.size(); i++)
+            {
+                const int b = mvCameraBlock[i];
+                if(b<0)
+                    continue;
+                const Vector6d dx = mdc.segment<6>(6*b);
+                UpdatePose(dx, mvCamerasNew[i].Rcw, mvCamerasNew[i].tcw);
+                scale += dx.dot(lambda*dx - mvbc[b]);
+            }
+
+            mvLandmarksNew.resize(mvLandmarks.size());
+            for(size_t j=0; j<mvLandmarks.size(); j++)
+            {
+                mvLandmarksNew[j] = mvLandmarks[j] + mvdl[j];
+                scale += mvdl[j].dot(lambda*mvdl[j] - mvbl[j]);
+            }
+
+            newCost = Cost(mvCamerasNew, mvLandmarksNew, bRobust);
+            const double rho = (cost - newCost)/(scale + 1e-3);
+            if(rho>0 && std::isfinite(newCost))
+            {
+                mvCameras.swap(mvCamerasNew);
+                mvLandmarks.swap(mvLandmarksNew);
+                const double alpha = 1.0 - pow(2*rho - 1, 3);
+                lambda *= std::min(std::max(1.0/3.0, alpha), 2.0/3.0);
+                ni = 2;
+                bAccepted = true;
+            }
+            else
+            {
+                lambda *= ni;
+                ni *= 2;
+            }
+        }
+
+        if(!bAccepted)
+            break;
+
+        if(pMonitor && pMonitor->Iteration(newCost))
+        {
+            iter++;
+            break;
+        }
+    }
+
+    return iter;
+}
+
+void BASolver::Solve(bool* pbStopFlag, OptimizationMonitor* pMonitor)
+{
+    // The weight of the lines in a keyframe depends on its number of point observations
+    std::vector<int> vnPointEdges(mvCameras.size(),0);
+    for(size_t i=0; i<mvPointObs.size(); i++)
+    {
+        mvPointObs[i].bOutlier = false;
+        vnPointEdges[mvPointObs[i].cam]++;
+    }
+    for(size_t i=0; i<mvLineObs.size(); i++)
+    {
+        mvLineObs[i].bOutlier = false;
+        mvLineObs[i].weight = LineWeight(vnPointEdges[mvLineObs[i].cam]);
+    }
+
+    if(pMonitor)
+        pMonitor->StartRound();
+    Optimize(5, true, pbStopFlag, pMonitor);
+
+    if(pbStopFlag && *pbStopFlag)
+        return;
+
+    // Out of time: no second optimization
+    if(pMonitor && pMonitor->Expired())
+        return;
+
+    // Check inlier observations
+    ClassifyObservations();
+    for(size_t i=0; i<mvPointObs.size(); i++)
+    {
+        if(IsPointObsOutlier(i))
+        {
+            mvPointObs[i].bOutlier = true;
+            vnPointEdges[mvPointObs[i].cam]--;
+        }
+    }
+
+    for(size_t i=0; i<mvLineObs.size(); i++)
+    {
+        if(IsLineObsOutlier(i))
+            mvLineObs[i].bOutlier = true;
+
+        // Update the information Matrix for the next iteration
+        mvLineObs[i].weight = LineWeight(vnPointEdges[mvLineObs[i].cam]);
+    }
+
+    // Optimize again without the outliers
+    if(pMonitor)
+        pMonitor->StartRound();
+    Optimize(10, false, pbStopFlag, pMonitor);
+}
+
+void BASolver::SetSlidingWindow(const bool bSlidingWindow)
+{
+    mbSlidingWindow = bSlidingWindow;
+    if(!mbSlidingWindow)
+        ResetWindow();
+}
+
+void BASolver::ResetWindow()
+{
+    Clear();
+}
+
+BASolver::WindowLandmark& BASolver::GetWindowPoint(MapPoint* pMP, const long unsigned int nWindowKF)
+{
+    std::pair<std::unordered_map<MapPoint*,WindowLandmark>::iterator,bool> ins = mmWindowPoints.insert(std::make_pair(pMP,WindowLandmark()));
+    WindowLandmark &lm = ins.first->second;
+    if(ins.second)
+        lm.idx = -1;
+
+    // The version is read before the observations: a change in between only causes an extra read
+    const long unsigned int nObsVersion = pMP->GetObservationsVersion();
+    if(ins.second || lm.nId!=pMP->mnId || lm.nObsVersion!=nObsVersion)
+    {
+        lm.nId = pMP->mnId;
+        lm.nObsVersion = nObsVersion;
+        lm.bObsChanged = true;
+        lm.vObs.clear();
+        pMP->ForEachObservation([&lm](KeyFrame* pKFi, const std::tuple<int,int> &indexes)
+        {
+            lm.vObs.push_back(std::make_pair(pKFi, std::get<0>(indexes)));
+        });
+        mnReadLandmarks++;
+    }
+    lm.nWindowKF = nWindowKF;
+    return lm;
+}
+
+BASolver::WindowLandmark& BASolver::GetWindowLine(MapLine* pML, const long unsigned int nWindowKF)
+{
+    std::pair<std::unordered_map<MapLine*,WindowLandmark>::iterator,bool> ins = mmWindowLines.insert(std::make_pair(pML,WindowLandmark()));
+    WindowLandmark &lm = ins.first->second;
+    if(ins.second)
+        lm.idx = -1;
+
+    const long unsigned int nObsVersion = pML->GetObservationsVersion();
+    if(ins.second || lm.nId!=pML->mnId || lm.nObsVersion!=nObsVersion)
+    {
+        lm.nId = pML->mnId;
+        lm.nObsVersion = nObsVersion;
+        lm.bObsChanged = true;
+        lm.vObs.clear();
+        pML->ForEachObservation([&lm](KeyFrame* pKFi, const size_t idx)
+        {
+            lm.vObs.push_back(std::make_pair(pKFi, (int)idx));
+        });
+        mnReadLandmarks++;
+    }
+    lm.nWindowKF = nWindowKF;
+    return lm;
+}
+
+void BASolver::UpdateWindow(KeyFrame* pKF, Map* pMap, std::list<KeyFrame*> &lLocalKeyFrames, std::list<KeyFrame*> &lFixedCameras,
+                            std::vector<MapPoint*> &vpLocalMapPoints, std::vector<MapLine*> &vpLocalMapLines, int& num_fixedKF)
+{
+    mnReadLandmarks = 0;
+
+    // Local KeyFrames: pKF and its covisible KeyFrames
+    lLocalKeyFrames.push_back(pKF);
+    pKF->mnBALocalForKF = pKF->mnId;
+    Map* pCurrentMap = pKF->GetMap();
+
+    const std::vector<KeyFrame*> vNeighKFs = pKF->GetVectorCovisibleKeyFrames();
+    for(size_t i=0; i<vNeighKFs.size(); i++)
+    {
+        KeyFrame* pKFi = vNeighKFs[i];
+        pKFi->mnBALocalForKF = pKF->mnId;
+        if(!pKFi->isBad() && pKFi->GetMap() == pCurrentMap)
+            lLocalKeyFrames.push_back(pKFi);
+    }
+
+    // Local MapPoints and MapLines seen in Local KeyFrames
+    num_fixedKF = 0;
+    for(std::list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin(), lend=lLocalKeyFrames.end(); lit!=lend; lit++)
+    {
+        KeyFrame* pKFi = *lit;
+        if(pKFi->mnId==pMap->GetInitKFid())
+            num_fixedKF = 1;
+
+        const std::vector<MapPoint*> vpMPs = pKFi->GetMapPointMatches();
+        for(size_t i=0; i<vpMPs.size(); i++)
+        {
+            MapPoint* pMP = vpMPs[i];
+            if(pMP && pMP->mnBALocalForKF!=pKF->mnId && !pMP->isBad() && pMP->GetMap() == pCurrentMap)
+            {
+                vpLocalMapPoints.push_back(pMP);
+                pMP->mnBALocalForKF = pKF->mnId;
+            }
+        }
+
+        const std::vector<MapLine*> vpMLs = pKFi->GetMapLineMatches();
+        for(size_t i=0; i<vpMLs.size(); i++)
+        {
+            MapLine* pML = vpMLs[i];
+            if(pML && pML->mnBALocalForKF!=pKF->mnId && !pML->isBad() && pML->GetMap() == pCurrentMap)
+            {
+                vpLocalMapLines.push_back(pML);
+                pML->mnBALocalForKF = pKF->mnId;
+            }
+        }
+    }
+
+    // Fixed Keyframes. Keyframes that see Local MapPoints or MapLines but that are not Local Keyframes
+    for(size_t i=0; i<vpLocalMapPoints.size()+vpLocalMapLines.size(); i++)
+    {
+        const WindowLandmark &lm = i<vpLocalMapPoints.size() ? GetWindowPoint(vpLocalMapPoints[i], pKF->mnId) :
+                                                               GetWindowLine(vpLocalMapLines[i-vpLocalMapPoints.size()], pKF->mnId);
+        for(size_t k=0; k<lm.vObs.size(); k++)
+        {
+            KeyFrame* pKFi = lm.vObs[k].first;
+            if(pKFi->mnBALocalForKF!=pKF->mnId && pKFi->mnBAFixedForKF!=pKF->mnId)
+            {
+                pKFi->mnBAFixedForKF = pKF->mnId;
+                if(!pKFi->isBad() && pKFi->GetMap() == pCurrentMap)
+                    lFixedCameras.push_back(pKFi);
+            }
+        }
+    }
+
+    num_fixedKF = lFixedCameras.size() + num_fixedKF;
+    Optimizer::FixOldestKeyFramesPL(pKF, pMap, lLocalKeyFrames, lFixedCameras, num_fixedKF);
+}
+
+void BASolver::UpdateWindowProblem(KeyFrame* pKF, Map* pMap, const std::list<KeyFrame*> &lLocalKeyFrames, const std::list<KeyFrame*> &lFixedCameras,
+                                   const std::vector<MapPoint*> &vpLocalMapPoints, const std::vector<MapLine*> &vpLocalMapLines,
+                                   std::vector<int> &vLocalCameras, std::vector<int> &vPoints, std::vector<int> &vLines)
+{
+    const long unsigned int nWindowKF = pKF->mnId;
+    Map* pCurrentMap = pKF->GetMap();
+    const int nObs = mvPointObs.size() + mvLineObs.size();
+    int nAddedObs = 0;
+    int nAddedKFs = 0;
+
+    // Cameras of the window at their current pose, the local ones first
+    vLocalCameras.clear();
+    for(int bFixedKF=0; bFixedKF<2; bFixedKF++)
+    {
+        const std::list<KeyFrame*> &lKFs = bFixedKF ? lFixedCameras : lLocalKeyFrames;
+        for(std::list<KeyFrame*>::const_iterator lit=lKFs.begin(), lend=lKFs.end(); lit!=lend; lit++)
+        {
+            KeyFrame* pKFi = *lit;
+            const Eigen::Matrix4d Tcw = Converter::toMatrix4d(pKFi->GetPose());
+            const bool bFixed = bFixedKF || pKFi->mnId==pMap->GetInitKFid();
+
+            std::pair<std::unordered_map<KeyFrame*,WindowCamera>::iterator,bool> ins = mmWindowCameras.insert(std::make_pair(pKFi,WindowCamera()));
+            WindowCamera &wc = ins.first->second;
+            if(ins.second)
+            {
+                wc.idx = AddCamera(Tcw.block<3,3>(0,0), Tcw.block<3,1>(0,3), bFixed);
+                if(wc.idx>=(int)mvpWindowKFs.size())
+                    mvpWindowKFs.resize(wc.idx+1, static_cast<KeyFrame*>(NULL));
+                mvpWindowKFs[wc.idx] = pKFi;
+                nAddedKFs++;
+            }
+            else
+            {
+                Camera &cam = mvCameras[wc.idx];
+                cam.Rcw = Tcw.block<3,3>(0,0);
+                cam.tcw = Tcw.block<3,1>(0,3);
+                if(cam.bFixed!=bFixed)
+                {
+                    cam.bFixed = bFixed;
+                    mbBlocksBuilt = false;
+                }
+            }
+            wc.nWindowKF = nWindowKF;
+            if(!bFixedKF)
+                vLocalCameras.push_back(wc.idx);
+        }
+    }
+
+    // Camera of an observation, -1 if its keyframe is not in the window
+    auto GetCamera = [&](KeyFrame* pKFi) -> int
+    {
+        if(pKFi->isBad() || pKFi->GetMap() != pCurrentMap)
+            return -1;
+        std::unordered_map<KeyFrame*,WindowCamera>::const_iterator it = mmWindowCameras.find(pKFi);
+        if(it==mmWindowCameras.end() || it->second.nWindowKF!=nWindowKF)
+            return -1;
+        return it->second.idx;
+    };
+
+    // Points and lines that left the window, with their observations. Their MapPoint or MapLine is not
+    // accessed, it may no longer exist.
+    for(std::unordered_map<MapPoint*,WindowLandmark>::iterator it=mmWindowPoints.begin(); it!=mmWindowPoints.end();)
+    {
+        if(it->second.nWindowKF!=nWindowKF)
+        {
+            if(it->second.idx>=0)
+            {
+                RemovePoint(it->second.idx);
+                mvpWindowMPs[it->second.idx] = NULL;
+            }
+            it = mmWindowPoints.erase(it);
+        }
+        else
+            it++;
+    }
+    for(std::unordered_map<MapLine*,WindowLandmark>::iterator it=mmWindowLines.begin(); it!=mmWindowLines.end();)
+    {
+        if(it->second.nWindowKF!=nWindowKF)
+        {
+            if(it->second.idx>=0)
+            {
+                RemoveLine(it->second.idx);
+                mvpWindowMLs[it->second.idx] = NULL;
+            }
+            it = mmWindowLines.erase(it);
+        }
+        else
+            it++;
+    }
+
+    // Points and lines of the window at their current position. Only those new in the window or whose
+    // observations changed get their observations (again).
+    vPoints.resize(vpLocalMapPoints.size());
+    for(size_t i=0; i<vpLocalMapPoints.size(); i++)
+    {
+        MapPoint* pMP = vpLocalMapPoints[i];
+        WindowLandmark &lm = mmWindowPoints.find(pMP)->second;
+        const Eigen::Vector3d Xw = Converter::toVector3d(pMP->GetWorldPos());
+        if(lm.idx<0)
+        {
+            lm.idx = AddPoint(Xw);
+            if(lm.idx>=(int)mvpWindowMPs.size())
+                mvpWindowMPs.resize(lm.idx+1, static_cast<MapPoint*>(NULL));
+        }
+        else
+        {
+            mvLandmarks[mvPointLandmark[lm.idx]] = Xw;
+            if(lm.bObsChanged)
+                RemoveLandmarkObservations(mvPointLandmark[lm.idx]);
+        }
+        mvpWindowMPs[lm.idx] = pMP;
+        vPoints[i] = lm.idx;
+
+        if(!lm.bObsChanged)
+            continue;
+        for(size_t k=0; k<lm.vObs.size(); k++)
+        {
+            KeyFrame* pKFi = lm.vObs[k].first;
+            const int leftIndex = lm.vObs[k].second;
+            const int cam = leftIndex == -1 ? -1 : GetCamera(pKFi);
+            if(cam<0)
+                continue;
+
+            const cv::KeyPoint &kpUn = pKFi->mvKeysUn[leftIndex];
+            AddPointObservation(lm.idx, cam, kpUn.pt.x, kpUn.pt.y, pKFi->mvuRight[leftIndex], pKFi->mvInvLevelSigma2[kpUn.octave]);
+            nAddedObs++;
+        }
+        lm.bObsChanged = false;
+    }
+
+    vLines.resize(vpLocalMapLines.size());
+    for(size_t i=0; i<vpLocalMapLines.size(); i++)
+    {
+        MapLine* pML = vpLocalMapLines[i];
+        WindowLandmark &lm = mmWindowLines.find(pML)->second;
+        const Vector6d pos = pML->GetWorldPos();
+        if(lm.idx<0)
+        {
+            lm.idx = AddLine(pos.head(3), pos.tail(3));
+            if(lm.idx>=(int)mvpWindowMLs.size())
+                mvpWindowMLs.resize(lm.idx+1, static_cast<MapLine*>(NULL));
+        }
+        else
+        {
+            const int j = mvLineLandmark[lm.idx];
+            mvLandmarks[j] = pos.head(3);
+            mvLandmarks[j+1] = pos.tail(3);
+            if(lm.bObsChanged)
+                RemoveLandmarkObservations(j);
+        }
+        mvpWindowMLs[lm.idx] = pML;
+        vLines[i] = lm.idx;
+
+        if(!lm.bObsChanged)
+            continue;
+        for(size_t k=0; k<lm.vObs.size(); k++)
+        {
+            KeyFrame* pKFi = lm.vObs[k].first;
+            const int idxLine = lm.vObs[k].second;
+            const int cam = GetCamera(pKFi);
+            if(cam<0)
+                continue;
+
+            AddLineObservation(lm.idx, cam, pKFi->mvle_l[idxLine], pKFi->mvInvLevelSigma2_l[pKFi->mvKeysUn_Line[idxLine].octave]);
+            nAddedObs++;
+        }
+        lm.bObsChanged = false;
+    }
+
+    // Keyframes that left the window, after their landmarks: usually no observation is left to remove
+    int nRemovedKFs = 0;
+    for(std::unordered_map<KeyFrame*,WindowCamera>::iterator it=mmWindowCameras.begin(); it!=mmWindowCameras.end();)
+    {
+        if(it->second.nWindowKF!=nWindowKF)
+        {
+            RemoveCamera(it->second.idx);
+            mvpWindowKFs[it->second.idx] = NULL;
+            it = mmWindowCameras.erase(it);
+            nRemovedKFs++;
+        }
+        else
+            it++;
+    }
+
+    const int nRemovedObs = nObs + nAddedObs - (int)(mvPointObs.size() + mvLineObs.size());
+    Verbose::PrintMess("LM-LBA: window updated with " + std::to_string(nAddedKFs) + " keyframes in and " + std::to_string(nRemovedKFs) +
+                       " out, " + std::to_string(nAddedObs) + " observations added and " + std::to_string(nRemovedObs) + " removed, " +
+                       "observations of " + std::to_string(mnReadLandmarks) + " of " + std::to_string(vpLocalMapPoints.size()+vpLocalMapLines.size()) +
+                       " landmarks read from the map", Verbose::VERBOSITY_DEBUG);
+}
+
+void BASolver::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int& num_fixedKF,
+                                       const OptimizationBudget* pBudget, OptimizationStats* pStats)
+{
+    if(pKF->mpCamera->GetType()!=pKF->mpCamera->CAM_PINHOLE)
+        return Optimizer::LocalBundleAdjustmentPL(pKF, pbStopFlag, pMap, num_fixedKF, false, pBudget, pStats);
+
+    OptimizationMonitor monitor(pBudget, pStats);
+
+    // Without the sliding window the problem is built again from an empty one
+    if(!mbSlidingWindow)
+        ResetWindow();
+
+    std::list<KeyFrame*> lLocalKeyFrames;
+    std::list<KeyFrame*> lFixedCameras;
+    std::vector<MapPoint*> vpMPs;
+    std::vector<MapLine*> vpMLs;
+    UpdateWindow(pKF, pMap, lLocalKeyFrames, lFixedCameras, vpMPs, vpMLs, num_fixedKF);
+
+    SetCalibration(pKF->fx, pKF->fy, pKF->cx, pKF->cy, pKF->mbf);
+    mdLambdaInit = pMap->IsInertial() ? 100.0 : -1;
+
+    std::vector<int> vLocalCameras, vPoints, vLines;
+    UpdateWindowProblem(pKF, pMap, lLocalKeyFrames, lFixedCameras, vpMPs, vpMLs, vLocalCameras, vPoints, vLines);
+
+    if(pbStopFlag)
+        if(*pbStopFlag)
+            return;
+
+    ProblemCapture::CaptureLocalBA(*this);
+
+    Solve(pbStopFlag, monitor.IsActive() ? &monitor : NULL);
+
+    ClassifyObservations();
+
+    std::vector<std::pair<KeyFrame*,MapPoint*> > vToErase;
+    vToErase.reserve(mvPointObs.size());
+    for(size_t i=0; i<mvPointObs.size(); i++)
+    {
+        MapPoint* pMPi = mvpWindowMPs[mvPointObs[i].point];
+        if(pMPi->isBad())
+            continue;
+        if(IsPointObsOutlier(i))
+            vToErase.push_back(std::make_pair(mvpWindowKFs[mvPointObs[i].cam], pMPi));
+    }
+
+    std::vector<std::pair<KeyFrame*,MapLine*> > vToErase_l;
+    vToErase_l.reserve(mvLineObs.size());
+    for(size_t i=0; i<mvLineObs.size(); i++)
+    {
+        MapLine* pMLi = mvpWindowMLs[mvLineObs[i].line];
+        if(pMLi->isBad())
+            continue;
+        if(IsLineObsOutlier(i))
+            vToErase_l.push_back(std::make_pair(mvpWindowKFs[mvLineObs[i].cam], pMLi));
+    }
+
+    if(vToErase.size()+vToErase_l.size() >= (mvPointObs.size()+mvLineObs.size()) * 0.5)
+    {
+        Verbose::PrintMess("LM-LBA: ERROR IN THE OPTIMIZATION, MOST OF THE POINTS HAS BECOME OUTLIERS", Verbose::VERBOSITY_NORMAL);
+        return;
+    }
+
+    // Get Map Mutex
+    std::unique_lock<std::mutex> lock(pMap->mMutexMapUpdate);
+
+    for(size_t i=0;i<vToErase.size();i++)
+    {
+        KeyFrame* pKFi = vToErase[i].first;
+        MapPoint* pMPi = vToErase[i].second;
+        pKFi->EraseMapPointMatch(pMPi);
+        pMPi->EraseObservation(pKFi);
+    }
+
+    for(size_t i=0;i<vToErase_l.size();i++)
+    {
+        KeyFrame* pKFi = vToErase_l[i].first;
+        MapLine* pMLi = vToErase_l[i].second;
+        pKFi->EraseMapLineMatch(pMLi);
+        pMLi->EraseObservation(pKFi);
+    }
+
+    // Recover optimized data
+    for(size_t i=0; i<vLocalCameras.size(); i++)
+    {
+        const Camera &cam = mvCameras[vLocalCameras[i]];
+        mvpWindowKFs[vLocalCameras[i]]->SetPose(Converter::toCvSE3(cam.Rcw, cam.tcw));
+    }
+
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        vpMPs[i]->SetWorldPos(Converter::toCvMat(GetPoint(vPoints[i])));
+        vpMPs[i]->UpdateNormalAndDepth();
+    }
+
+    for(size_t i=0; i<vpMLs.size(); i++)
+    {
+        Eigen::Vector3d Xs, Xe;
+        GetLine(vLines[i], Xs, Xe);
+        vpMLs[i]->SetWorldPos(Xs, Xe);
+        vpMLs[i]->UpdateNormalAndDepth();
+    }
+
+    pMap->IncreaseChangeIndex();
+}
+
+void BASolver::GlobalBundleAdjustmentWithLines(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF,
+                                               const bool bRobust)
+{
+    // KeyFrames by id: the clusters of the partitioned GBA grow from the oldest ones
+    std::vector<KeyFrame*> vpAllKFs = pMap->GetAllKeyFrames();
+    std::sort(vpAllKFs.begin(), vpAllKFs.end(), KeyFrame::lId);
+    const std::vector<MapPoint*> vpAllMPs = pMap->GetAllMapPoints();
+    const std::vector<MapLine*> vpAllMLs = pMap->GetAllMapLines();
+    if(vpAllKFs.empty())
+        return;
+
+    KeyFrame* pKF0 = vpAllKFs[0];
+    if(pKF0->mpCamera->GetType()!=pKF0->mpCamera->CAM_PINHOLE)
+        return Optimizer::GlobalBundleAdjustemntWithLines(pMap, nIterations, pbStopFlag, nLoopKF, bRobust);
+
+    SetCalibration(pKF0->fx, pKF0->fy, pKF0->cx, pKF0->cy, pKF0->mbf);
+    Clear();
+    mdLambdaInit = -1;
+
+    // KeyFrames, the first one of the map fixed
+    std::map<KeyFrame*,int> mCameraIdx;
+    std::vector<KeyFrame*> vpKFs;
+    for(size_t i=0; i<vpAllKFs.size(); i++)
+    {
+        KeyFrame* pKFi = vpAllKFs[i];
+        if(pKFi->isBad())
+            continue;
+        const Eigen::Matrix4d Tcw = Converter::toMatrix4d(pKFi->GetPose());
+        mCameraIdx[pKFi] = AddCamera(Tcw.block<3,3>(0,0), Tcw.block<3,1>(0,3), pKFi->mnId==pMap->GetInitKFid());
+        vpKFs.push_back(pKFi);
+    }
+
+    // MapPoints and MapLines with at least one observation in the KeyFrames
+    std::vector<MapPoint*> vpMPs;
+    std::vector<std::pair<int,int> > vObs;
+    for(size_t i=0; i<vpAllMPs.size(); i++)
+    {
+        MapPoint* pMP = vpAllMPs[i];
+        if(pMP->isBad())
+            continue;
+
+        vObs.clear();
+        const std::map<KeyFrame*,std::tuple<int,int>> observations = pMP->GetObservations();
+        for(std::map<KeyFrame*,std::tuple<int,int>>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            const int leftIndex = std::get<0>(mit->second);
+            std::map<KeyFrame*,int>::const_iterator cit = mCameraIdx.find(mit->first);
+            if(leftIndex == -1 || cit==mCameraIdx.end())
+                continue;
+            vObs.push_back(std::make_pair(cit->second, leftIndex));
+        }
+        if(vObs.empty())
+            continue;
+
+        const int idx = AddPoint(Converter::toVector3d(pMP->GetWorldPos()));
+        for(size_t k=0; k<vObs.size(); k++)
+        {
+            KeyFrame* pKFi = vpKFs[vObs[k].first];
+            const cv::KeyPoint &kpUn = pKFi->mvKeysUn[vObs[k].second];
+            AddPointObservation(idx, vObs[k].first, kpUn.pt.x, kpUn.pt.y, pKFi->mvuRight[vObs[k].second], pKFi->mvInvLevelSigma2[kpUn.octave]);
+        }
+        vpMPs.push_back(pMP);
+    }
+
+    std::vector<MapLine*> vpMLs;
+    for(size_t i=0; i<vpAllMLs.size(); i++)
+    {
+        MapLine* pML = vpAllMLs[i];
+        if(pML->isBad())
+            continue;
+
+        vObs.clear();
+        const std::map<KeyFrame*,size_t> observations = pML->GetObservations();
+        for(std::map<KeyFrame*,size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        {
+            std::map<KeyFrame*,int>::const_iterator cit = mCameraIdx.find(mit->first);
+            if(cit==mCameraIdx.end())
+                continue;
+            vObs.push_back(std::make_pair(cit->second, (int)mit->second));
+        }
+        if(vObs.empty())
+            continue;
+
+        const Vector6d pos = pML->GetWorldPos();
+        const int idx = AddLine(pos.head(3), pos.tail(3));
+        for(size_t k=0; k<vObs.size(); k++)
+        {
+            KeyFrame* pKFi = vpKFs[vObs[k].first];
+            const int idxLine = vObs[k].second;
+            AddLineObservation(idx, vObs[k].first, pKFi->mvle_l[idxLine], pKFi->mvInvLevelSigma2_l[pKFi->mvKeysUn_Line[idxLine].octave]);
+        }
+        vpMLs.push_back(pML);
+    }
+
+    // The weight of the lines in a keyframe depends on its number of point observations
+    std::vector<int> vnPointEdges(mvCameras.size(),0);
+    for(size_t i=0; i<mvPointObs.size(); i++)
+        vnPointEdges[mvPointObs[i].cam]++;
+    for(size_t i=0; i<mvLineObs.size(); i++)
+        mvLineObs[i].weight = LineWeight(vnPointEdges[mvLineObs[i].cam]);
+
+    // Covisibility graph of the keyframes, for the partition (and the capture, to replay it partitioned)
+    const bool bPartition = mnClusterKFs>0 && (int)vpKFs.size()>=2*mnClusterKFs;
+    std::vector<std::vector<std::pair<int,int> > > vCovisibility;
+    if(bPartition || ProblemCapture::IsEnabled())
+    {
+        std::unordered_map<KeyFrame*,int> mKFIdx;
+        for(size_t i=0; i<vpKFs.size(); i++)
+            mKFIdx[vpKFs[i]] = i;
+
+        vCovisibility.resize(vpKFs.size());
+        for(size_t i=0; i<vpKFs.size(); i++)
+        {
+            const std::vector<KeyFrame*> vpCovKFs = vpKFs[i]->GetVectorCovisibleKeyFrames();
+            for(size_t k=0; k<vpCovKFs.size(); k++)
+            {
+                std::unordered_map<KeyFrame*,int>::const_iterator it = mKFIdx.find(vpCovKFs[k]);
+                if(it!=mKFIdx.end())
+                    vCovisibility[i].push_back(std::make_pair(it->second, vpKFs[i]->GetWeight(vpCovKFs[k])));
+            }
+        }
+
+        ProblemCapture::CaptureGlobalBA(*this, nIterations, bRobust, vCovisibility);
+    }
+
+    int nIt;
+    if(bPartition)
+        nIt = OptimizePartitioned(vCovisibility, nIterations, bRobust, pbStopFlag);
+    else
+        nIt = Optimize(nIterations, bRobust, pbStopFlag);
+    Verbose::PrintMess("LM-GBA: " + std::to_string(nIt) + " iterations, " + std::to_string(mnCGIterations) + " CG iterations, " +
+                       std::to_string(vpKFs.size()) + " keyframes, " + std::to_string(vpMPs.size()) + " points, " +
+                       std::to_string(vpMLs.size()) + " lines", Verbose::VERBOSITY_DEBUG);
+    Verbose::PrintMess("BA: End of the optimization", Verbose::VERBOSITY_NORMAL);
+
+    // Recover optimized data
+    const bool bOrigin = nLoopKF==pMap->GetOriginKF()->mnId;
+
+    for(size_t i=0; i<vpKFs.size(); i++)
+    {
+        KeyFrame* pKFi = vpKFs[i];
+        const cv::Mat Tcw = Converter::toCvSE3(mvCameras[i].Rcw, mvCameras[i].tcw);
+        if(bOrigin)
+            pKFi->SetPose(Tcw);
+        else
+        {
+            pKFi->mTcwGBA.create(4,4,CV_32F);
+            Tcw.copyTo(pKFi->mTcwGBA);
+            pKFi->mnBAGlobalForKF = nLoopKF;
+        }
+    }
+
+    for(size_t i=0; i<vpMPs.size(); i++)
+    {
+        MapPoint* pMP = vpMPs[i];
+        if(pMP->isBad())
+            continue;
+
+        if(bOrigin)
+        {
+            pMP->SetWorldPos(Converter::toCvMat(GetPoint(i)));
+            pMP->UpdateNormalAndDepth();
+        }
+        else
+        {
+            pMP->mPosGBA.create(3,1,CV_32F);
+            Converter::toCvMat(GetPoint(i)).copyTo(pMP->mPosGBA);
+            pMP->mnBAGlobalForKF = nLoopKF;
+        }
+    }
+
+    for(size_t i=0; i<vpMLs.size(); i++)
+    {
+        MapLine* pML = vpMLs[i];
+        if(pML->isBad())
+            continue;
+
+        Eigen::Vector3d Xs, Xe;
+        GetLine(i, Xs, Xe);
+        if(bOrigin)
+        {
+            pML->SetWorldPos(Xs, Xe);
+            pML->UpdateNormalAndDepth();
+        }
+        else
+        {
+            Vector6d pos;
+            pos << Xs, Xe;
+            pML->mPosGBA = pos;
+            pML->mnBAGlobalForKF = nLoopKF;
+        }
+    }
+}
+
+int BASolver::PartitionCameras(const std::vector<std::vector<std::pair<int,int> > > &vCovisibility, std::vector<int> &vCluster) const
+{
+    const int N = vCovisibility.size();
+    const int nTarget = std::max((N + mnClusterKFs - 1)/mnClusterKFs, 1);
+    const int nSize = (N + nTarget - 1)/nTarget;
+
+    // Each cluster grows from the first unassigned camera (the oldest keyframe), adding the unassigned
+    // camera with the largest covisibility weight to the cluster, until nSize cameras or no neighbour
+    vCluster.assign(N,-1);
+    std::vector<int> vScore(N,0);
+    std::vector<int> vTouched;
+    int nClusters = 0;
+    int seed = 0;
+    while(true)
+    {
+        while(seed<N && vCluster[seed]>=0)
+            seed++;
+        if(seed==N)
+            break;
+
+        // (score, -camera): the strongest link first, the oldest keyframe on ties
+        std::priority_queue<std::pair<int,int> > queue;
+        queue.push(std::make_pair(0,-seed));
+        int nCameras = 0;
+        while(!queue.empty() && nCameras<nSize)
+        {
+            const int i = -queue.top().second;
+            const int score = queue.top().first;
+            queue.pop();
+            if(vCluster[i]>=0 || score<vScore[i])
+                continue;
+
+            vCluster[i] = nClusters;
+            nCameras++;
+            for(size_t k=0; k<vCovisibility[i].size(); k++)
+            {
+                const int n = vCovisibility[i][k].first;
+                if(vCluster[n]>=0)
+                    continue;
+                vScore[n] += vCovisibility[i][k].second;
+                vTouched.push_back(n);
+                queue.push(std::make_pair(vScore[n],-n));
+            }
+        }
+
+        for(size_t k=0; k<vTouched.size(); k++)
+            vScore[vTouched[k]] = 0;
+        vTouched.clear();
+        nClusters++;
+    }
+
+    return nClusters;
+}
+
+void BASolver::BuildSubproblem(const std::vector<int> &vFreeCameras, const std::vector<int> &vFreePoints, const std::vector<int> &vFreeLines,
+                               const std::vector<int> &vFixedPoints, const std::vector<int> &vFixedLines,
+                               const std::vector<int> &vPointObsStart, const std::vector<int> &vPointObsIdx,
+                               const std::vector<int> &vLineObsStart, const std::vector<int> &vLineObsIdx,
+                               BASolver &sub, std::vector<int> &vCameras, std::vector<int> &vPoints, std::vector<int> &vLines) const
+{
+    sub.SetCalibration(fx, fy, cx, cy, bf);
+    sub.SetLinearSolver(mnLinearSolver, mnMaxCGIterations, mdCGTolerance);
+    sub.Clear();
+    sub.mdLambdaInit = mdLambdaInit;
+    vCameras.clear();
+    vPoints.clear();
+    vLines.clear();
+
+    // Cameras of the subproblem (a camera fixed in this problem stays fixed)
+    std::unordered_map<int,int> mCamera;
+    for(size_t i=0; i<vFreeCameras.size(); i++)
+    {
+        const Camera &cam = mvCameras[vFreeCameras[i]];
+        mCamera[vFreeCameras[i]] = sub.AddCamera(cam.Rcw, cam.tcw, cam.bFixed);
+        vCameras.push_back(vFreeCameras[i]);
+    }
+
+    // An optimized landmark brings all its observations, fixing the cameras not in vFreeCameras. A fixed
+    // landmark only brings its observations from optimized cameras.
+    auto GetCamera = [&](const int c, const bool bFreeLandmark) -> int
+    {
+        std::unordered_map<int,int>::const_iterator it = mCamera.find(c);
+        if(it!=mCamera.end())
+            return (bFreeLandmark || !sub.mvCameras[it->second].bFixed) ? it->second : -1;
+        if(!bFreeLandmark)
+            return -1;
+        const int idx = sub.AddCamera(mvCameras[c].Rcw, mvCameras[c].tcw, true);
+        mCamera[c] = idx;
+        vCameras.push_back(c);
+        return idx;
+    };
+
+    for(int bFixed=0; bFixed<2; bFixed++)
+    {
+        const std::vector<int> &vPointList = bFixed ? vFixedPoints : vFreePoints;
+        for(size_t i=0; i<vPointList.size(); i++)
+        {
+            const int p = vPointList[i];
+            const int idx = sub.AddPoint(GetPoint(p), bFixed);
+            vPoints.push_back(p);
+            for(int k=vPointObsStart[p]; k<vPointObsStart[p+1]; k++)
+            {
+                const PointObs &obs = mvPointObs[vPointObsIdx[k]];
+                const int c = GetCamera(obs.cam, !bFixed);
+                if(c<0)
+                    continue;
+                sub.AddPointObservation(idx, c, obs.u, obs.v, obs.ur, obs.invSigma2);
+                sub.mvPointObs.back().bOutlier = obs.bOutlier;
+            }
+        }
+
+        const std::vector<int> &vLineList = bFixed ? vFixedLines : vFreeLines;
+        for(size_t i=0; i<vLineList.size(); i++)
+        {
+            const int l = vLineList[i];
+            Eigen::Vector3d Xs, Xe;
+            GetLine(l, Xs, Xe);
+            const int idx = sub.AddLine(Xs, Xe, bFixed);
+            vLines.push_back(l);
+            for(int k=vLineObsStart[l]; k<vLineObsStart[l+1]; k++)
+            {
+                const LineObs &obs = mvLineObs[vLineObsIdx[k]];
+                const int c = GetCamera(obs.cam, !bFixed);
+                if(c<0)
+                    continue;
+                sub.AddLineObservation(idx, c, obs.l, obs.invSigma2);
+                sub.mvLineObs.back().weight = obs.weight;
+                sub.mvLineObs.back().bOutlier = obs.bOutlier;
+            }
+        }
+    }
+}
+
+void BASolver::GetSubproblemResult(const BASolver &sub, const std::vector<int> &vCameras, const std::vector<int> &vPoints,
+                                   const std::vector<int> &vLines)
+{
+    for(size_t i=0; i<vCameras.size(); i++)
+        if(!sub.mvCameras[i].bFixed)
+            mvCameras[vCameras[i]] = sub.mvCameras[i];
+
+    for(size_t i=0; i<vPoints.size(); i++)
+        if(!sub.mvLandmarkFixed[sub.mvPointLandmark[i]])
+            mvLandmarks[mvPointLandmark[vPoints[i]]] = sub.GetPoint(i);
+
+    for(size_t i=0; i<vLines.size(); i++)
+    {
+        if(sub.mvLandmarkFixed[sub.mvLineLandmark[i]])
+            continue;
+        const int j = mvLineLandmark[vLines[i]];
+        sub.GetLine(i, mvLandmarks[j], mvLandmarks[j+1]);
+    }
+}
+
+int BASolver::OptimizePartitioned(const std::vector<std::vector<std::pair<int,int> > > &vCovisibility, const int nIterations,
+                                  const bool bRobust, bool* pbStopFlag)
+{
+    const int N = mvCameras.size();
+    const int nPoints = mvPointLandmark.size();
+    const int nLines = mvLineLandmark.size();
+    if(mnClusterKFs<=0)
+        return Optimize(nIterations, bRobust, pbStopFlag);
+
+    std::vector<int> vCluster;
+    const int nClusters = PartitionCameras(vCovisibility, vCluster);
+
+    // Separators: cameras covisible with a camera of another cluster
+    std::vector<char> vbSeparator(N,0);
+    int nSeparators = 0;
+    for(int i=0; i<N; i++)
+    {
+        for(size_t k=0; k<vCovisibility[i].size(); k++)
+        {
+            if(vCluster[vCovisibility[i][k].first]!=vCluster[i])
+            {
+                vbSeparator[i] = 1;
+                nSeparators++;
+                break;
+            }
+        }
+    }
+
+    // Observations of each point and line
+    std::vector<int> vPointObsStart(nPoints+1,0), vLineObsStart(nLines+1,0);
+    for(size_t i=0; i<mvPointObs.size(); i++)
+        vPointObsStart[mvPointObs[i].point+1]++;
+    for(size_t i=0; i<mvLineObs.size(); i++)
+        vLineObsStart[mvLineObs[i].line+1]++;
+    for(int p=0; p<nPoints; p++)
+        vPointObsStart[p+1] += vPointObsStart[p];
+    for(int l=0; l<nLines; l++)
+        vLineObsStart[l+1] += vLineObsStart[l];
+
+    std::vector<int> vPointObsIdx(mvPointObs.size()), vLineObsIdx(mvLineObs.size());
+    {
+        std::vector<int> vNext(vPointObsStart.begin(), vPointObsStart.end()-1);
+        for(size_t i=0; i<mvPointObs.size(); i++)
+            vPointObsIdx[vNext[mvPointObs[i].point]++] = i;
+        vNext.assign(vLineObsStart.begin(), vLineObsStart.end()-1);
+        for(size_t i=0; i<mvLineObs.size(); i++)
+            vLineObsIdx[vNext[mvLineObs[i].line]++] = i;
+    }
+
+    // A landmark is optimized in the cluster with most observations from its non separator cameras
+    // (fixed in the others that observe it), and again in the separator problem if a separator sees it
+    std::vector<std::vector<int> > vClusterCameras(nClusters);
+    std::vector<int> vSepCameras;
+    for(int i=0; i<N; i++)
+    {
+        if(vbSeparator[i])
+            vSepCameras.push_back(i);
+        else
+            vClusterCameras[vCluster[i]].push_back(i);
+    }
+
+    std::vector<std::vector<int> > vFreePoints(nClusters), vFixedPoints(nClusters), vFreeLines(nClusters), vFixedLines(nClusters);
+    std::vector<int> vSepPoints, vSepLines;
+    std::vector<int> vCount(nClusters,0);
+    std::vector<int> vSeen;
+    for(int type=0; type<2; type++)
+    {
+        const int n = type==0 ? nPoints : nLines;
+        const std::vector<int> &vStart = type==0 ? vPointObsStart : vLineObsStart;
+        const std::vector<int> &vIdx = type==0 ? vPointObsIdx : vLineObsIdx;
+        for(int j=0; j<n; j++)
+        {
+            bool bSeparator = false;
+            for(int k=vStart[j]; k<vStart[j+1]; k++)
+            {
+                const int c = type==0 ? mvPointObs[vIdx[k]].cam : mvLineObs[vIdx[k]].cam;
+                if(vbSeparator[c])
+                {
+                    bSeparator = true;
+                    continue;
+                }
+                if(vCount[vCluster[c]]++==0)
+                    vSeen.push_back(vCluster[c]);
+            }
+
+            int owner = -1;
+            for(size_t k=0; k<vSeen.size(); k++)
+                if(owner<0 || vCount[vSeen[k]]>vCount[owner] || (vCount[vSeen[k]]==vCount[owner] && vSeen[k]<owner))
+                    owner = vSeen[k];
+            for(size_t k=0; k<vSeen.size(); k++)
+            {
+                if(vSeen[k]!=owner)
+                    (type==0 ? vFixedPoints : vFixedLines)[vSeen[k]].push_back(j);
+                vCount[vSeen[k]] = 0;
+            }
+            vSeen.clear();
+
+            if(owner>=0)
+                (type==0 ? vFreePoints : vFreeLines)[owner].push_back(j);
+            if(bSeparator)
+                (type==0 ? vSepPoints : vSepLines).push_back(j);
+        }
+    }
+
+    Verbose::PrintMess("LM-GBA: " + std::to_string(nClusters) + " clusters, " + std::to_string(nSeparators) + " separator keyframes",
+                       Verbose::VERBOSITY_DEBUG);
+
+    // Clusters in parallel, all built before any result is copied
+    std::vector<BASolver> vSolvers(nClusters);
+    std::vector<std::vector<int> > vSubCameras(nClusters), vSubPoints(nClusters), vSubLines(nClusters);
+    std::vector<int> vIterations(nClusters,0);
+    std::vector<int> vCGIterations(nClusters,0);
+    ParallelFor(mnThreads, nClusters, [&](const int, const int begin, const int end)
+    {
+        for(int c=begin; c<end; c++)
+        {
+            BuildSubproblem(vClusterCameras[c], vFreePoints[c], vFreeLines[c], vFixedPoints[c], vFixedLines[c],
+                            vPointObsStart, vPointObsIdx, vLineObsStart, vLineObsIdx,
+                            vSolvers[c], vSubCameras[c], vSubPoints[c], vSubLines[c]);
+            vIterations[c] = vSolvers[c].Optimize(nIterations, bRobust, pbStopFlag);
+            vCGIterations[c] = vSolvers[c].GetCGIterations();
+        }
+    });
+
+    int nIt = 0;
+    mnCGIterations = 0;
+    for(int c=0; c<nClusters; c++)
+    {
+        GetSubproblemResult(vSolvers[c], vSubCameras[c], vSubPoints[c], vSubLines[c]);
+        vSolvers[c] = BASolver();
+        nIt = std::max(nIt, vIterations[c]);
+        mnCGIterations += vCGIterations[c];
+    }
+
+    if(pbStopFlag && *pbStopFlag)
+        return nIt;
+
+    // Separator problem, with the threads of this solver
+    BASolver sep;
+    std::vector<int> vCameras, vPoints, vLines;
+    BuildSubproblem(vSepCameras, vSepPoints, vSepLines, std::vector<int>(), std::vector<int>(),
+                    vPointObsStart, vPointObsIdx, vLineObsStart, vLineObsIdx, sep, vCameras, vPoints, vLines);
+    sep.SetThreads(mnThreads);
+    nIt += sep.Optimize(nIterations, bRobust, pbStopFlag);
+    mnCGIterations += sep.GetCGIterations();
+    GetSubproblemResult(sep, vCameras, vPoints, vLines);
+
+    return nIt;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,151 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "DescriptorMedoid.h"
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+
+#include "KeyFrame.h"
+#include "ORBmatcher.h"
+
+namespace ORB_SLAM3
+{
+
+cv::Mat DescriptorMedoid::Update(const std::vector<std::pair<KeyFrame*,int> > &vObs, const bool bLines)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    // Erase the sampled observations that are gone or whose keyframe is bad
+    std::vector<size_t> vKept;
+    vKept.reserve(mvSampleObs.size());
+    for(size_t i=0; i<mvSampleObs.size(); i++)
+    {
+        if(std::find(vObs.begin(),vObs.end(),mvSampleObs[i])!=vObs.end() && !mvSampleObs[i].first->isBad())
+            vKept.push_back(i);
+    }
+    if(vKept.size()<mvSampleObs.size())
+    {
+        for(size_t k=0; k<vKept.size(); k++)
+        {
+            std::vector<int> &vRow = mvvDistances[vKept[k]];
+            for(size_t l=0; l<vKept.size(); l++)
+                vRow[l] = vRow[vKept[l]];
+            vRow.resize(vKept.size());
+            mvSampleObs[k] = mvSampleObs[vKept[k]];
+            mvSampleDescriptors[k] = mvSampleDescriptors[vKept[k]];
+            if(k!=vKept[k])
+                mvvDistances[k].swap(vRow);
+        }
+        mvSampleObs.resize(vKept.size());
+        mvSampleDescriptors.resize(vKept.size());
+        mvvDistances.resize(vKept.size());
+    }
+    const size_t nKept = mvSampleObs.size();
+
+    // Observations not sampled, sorted from the most recent keyframe. Once the sample is full, only those more
+    // recent than its oldest observation can enter it.
+    long unsigned int minId = 0;
+    if(nKept==(size_t)MAX_SAMPLE)
+        minId = mvSampleObs[OldestSample()].first->mnId+1;
+    std::vector<std::pair<long unsigned int,size_t> > vNew;
+    for(size_t i=0; i<vObs.size(); i++)
+    {
+        KeyFrame* pKF = vObs[i].first;
+        if(pKF->mnId<minId)
+            continue;
+        if(std::find(mvSampleObs.begin(),mvSampleObs.begin()+nKept,vObs[i])!=mvSampleObs.begin()+nKept)
+            continue;
+        if(pKF->isBad())
+            continue;
+        vNew.push_back(std::make_pair(pKF->mnId,i));
+    }
+    std::sort(vNew.begin(),vNew.end(),std::greater<std::pair<long unsigned int,size_t> >());
+
+    // Added while there is room, then each one replaces the oldest sampled observation, so the sample
+    // follows the appearance of the landmark in the recent views. The distances of the new descriptor
+    // to the sampled ones are computed.
+    for(size_t k=0; k<vNew.size(); k++)
+    {
+        const std::pair<KeyFrame*,int> &obs = vObs[vNew[k].second];
+        const cv::Mat descriptor = bLines ? obs.first->mDescriptors_l.row(obs.second) : obs.first->mDescriptors.row(obs.second);
+        const size_t n = mvSampleObs.size();
+
+        if(n<(size_t)MAX_SAMPLE)
+        {
+            std::vector<int> vRow(n+1,0);
+            for(size_t j=0; j<n; j++)
+            {
+                vRow[j] = ORBmatcher::DescriptorDistance(descriptor,mvSampleDescriptors[j]);
+                mvvDistances[j].push_back(vRow[j]);
+            }
+
+            mvSampleObs.push_back(obs);
+            mvSampleDescriptors.push_back(descriptor);
+            mvvDistances.push_back(vRow);
+            continue;
+        }
+
+        // From the most recent one: the rest are not more recent than the oldest sampled one either
+        const size_t oldest = OldestSample();
+        if(obs.first->mnId<=mvSampleObs[oldest].first->mnId)
+            break;
+
+        for(size_t j=0; j<n; j++)
+        {
+            const int dist = j==oldest ? 0 : ORBmatcher::DescriptorDistance(descriptor,mvSampleDescriptors[j]);
+            mvvDistances[oldest][j] = dist;
+            mvvDistances[j][oldest] = dist;
+        }
+        mvSampleObs[oldest] = obs;
+        mvSampleDescriptors[oldest] = descriptor;
+    }
+
+    const size_t N = mvSampleObs.size();
+    if(N==0)
+        return cv::Mat();
+
+    // Take the descriptor with least median distance to the rest
+    int BestMedian = INT_MAX;
+    size_t BestIdx = 0;
+    std::vector<int> vDists;
+    for(size_t i=0; i<N; i++)
+    {
+        vDists = mvvDistances[i];
+        std::nth_element(vDists.begin(),vDists.begin()+(N-1)/2,vDists.end());
+        const int median = vDists[(N-1)/2];
+
+        if(median<BestMedian)
+        {
+            BestMedian = median;
+            BestIdx = i;
+        }
+    }
+
+    return mvSampleDescriptors[BestIdx].clone();
+}
+
+size_t DescriptorMedoid::OldestSample() const
+{
+    size_t oldest = 0;
+    for(size_t i=1; i<mvSampleObs.size(); i++)
+        if(mvSampleObs[i].first->mnId<mvSampleObs[oldest].first->mnId)
+            oldest = i;
+    return oldest;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,143 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "EpochReclaimer.h"
+
+#include "MapPoint.h"
+#include "MapLine.h"
+
+namespace ORB_SLAM3
+{
+
+bool EpochReclaimer::sbEnabled = false;
+std::mutex EpochReclaimer::smMutex;
+unsigned long EpochReclaimer::snEpoch = 0;
+unsigned int EpochReclaimer::snRegistered = 0;
+unsigned int EpochReclaimer::snPassed = 0;
+std::deque<std::pair<unsigned long,MapPoint*> > EpochReclaimer::sdRetiredPoints;
+std::deque<std::pair<unsigned long,MapLine*> > EpochReclaimer::sdRetiredLines;
+
+namespace
+{
+
+// Epochs a landmark waits from its retirement until it is deleted
+const unsigned long nGraceEpochs = 3;
+
+}
+
+void EpochReclaimer::Enable(const bool bEnable)
+{
+    sbEnabled = bEnable;
+}
+
+void EpochReclaimer::Register(const int participant)
+{
+    if(!sbEnabled)
+        return;
+
+    std::unique_lock<std::mutex> lock(smMutex);
+    snRegistered |= 1u<<participant;
+}
+
+void EpochReclaimer::Unregister(const int participant)
+{
+    if(!sbEnabled)
+        return;
+
+    std::vector<MapPoint*> vpMPs;
+    std::vector<MapLine*> vpMLs;
+    {
+        std::unique_lock<std::mutex> lock(smMutex);
+        snRegistered &= ~(1u<<participant);
+        snPassed &= ~(1u<<participant);
+        // The epoch may have been waiting only for this thread
+        TryAdvance(vpMPs, vpMLs);
+    }
+
+    for(size_t i=0; i<vpMPs.size(); i++)
+        delete vpMPs[i];
+    for(size_t i=0; i<vpMLs.size(); i++)
+        delete vpMLs[i];
+}
+
+void EpochReclaimer::Quiescent(const int participant)
+{
+    if(!sbEnabled)
+        return;
+
+    std::vector<MapPoint*> vpMPs;
+    std::vector<MapLine*> vpMLs;
+    {
+        std::unique_lock<std::mutex> lock(smMutex);
+        if(!(snRegistered & (1u<<participant)))
+            return;
+        snPassed |= 1u<<participant;
+        TryAdvance(vpMPs, vpMLs);
+    }
+
+    // Deleted out of the lock, the other threads go on retiring and passing meanwhile
+    for(size_t i=0; i<vpMPs.size(); i++)
+        delete vpMPs[i];
+    for(size_t i=0; i<vpMLs.size(); i++)
+        delete vpMLs[i];
+}
+
+void EpochReclaimer::TryAdvance(std::vector<MapPoint*> &vpMPs, std::vector<MapLine*> &vpMLs)
+{
+    if(!snRegistered || (snPassed & snRegistered)!=snRegistered)
+        return;
+
+    snEpoch++;
+    snPassed = 0;
+
+    // Retired in epoch order
+    while(!sdRetiredPoints.empty() && sdRetiredPoints.front().first+nGraceEpochs<=snEpoch)
+    {
+        vpMPs.push_back(sdRetiredPoints.front().second);
+        sdRetiredPoints.pop_front();
+    }
+    while(!sdRetiredLines.empty() && sdRetiredLines.front().first+nGraceEpochs<=snEpoch)
+    {
+        vpMLs.push_back(sdRetiredLines.front().second);
+        sdRetiredLines.pop_front();
+    }
+}
+
+void EpochReclaimer::Retire(MapPoint* pMP)
+{
+    if(!sbEnabled)
+        return;
+
+    std::unique_lock<std::mutex> lock(smMutex);
+    sdRetiredPoints.push_back(std::make_pair(snEpoch,pMP));
+}
+
+void EpochReclaimer::Retire(MapLine* pML)
+{
+    if(!sbEnabled)
+        return;
+
+    std::unique_lock<std::mutex> lock(smMutex);
+    sdRetiredLines.push_back(std::make_pair(snEpoch,pML));
+}
+
+size_t EpochReclaimer::GetPending()
+{
+    std::unique_lock<std::mutex> lock(smMutex);
+    return sdRetiredPoints.size()+sdRetiredLines.size();
+}
+
+} //namespace ORB_SLAM
@@ -71,7 +71,9 @@ Frame::Frame(const Frame &frame)
      mvRightToLeftMatch(frame.mvRightToLeftMatch), mvStereo3Dpoints(frame.mvStereo3Dpoints),
      mTlr(frame.mTlr.clone()), mRlr(frame.mRlr.clone()), mtlr(frame.mtlr.clone()), mTrl(frame.mTrl.clone()), mTimeStereoMatch(frame.mTimeStereoMatch), mTimeStereoMatch_Lines(frame.mTimeStereoMatch_Lines), 
      n_inliers(frame.n_inliers), n_inliers_pt(frame.n_inliers_pt), n_inliers_ls(frame.n_inliers_ls), 
-     mTimeORB_Ext(frame.mTimeORB_Ext), mTimeLines_Ext(frame.mTimeLines_Ext), inv_width(frame.inv_width), inv_height(frame.inv_width)
+     mTimeORB_Ext(frame.mTimeORB_Ext), mTimeLines_Ext(frame.mTimeLines_Ext), inv_width(frame.inv_width), inv_height(frame.inv_width),
+     mbLinesTracked(frame.mbLinesTracked), mvLineTrackIdx(frame.mvLineTrackIdx),
+     mbPointsTracked(frame.mbPointsTracked), mvPointTrackIdx(frame.mvPointTrackIdx)
 {
     for(int i=0;i<FRAME_GRID_COLS;i++)
         for(int j=0; j<FRAME_GRID_ROWS; j++){
@@ -92,6 +94,8 @@ Frame::Frame(const Frame &frame)
 
     mmProjectPoints = frame.mmProjectPoints;
     mmMatchedInImage = frame.mmMatchedInImage;
+
+    mImTrack = frame.mImTrack;
 }
 
 Frame::Frame(const cv::Mat &imLeft, const cv::Mat &imRight, const double &timeStamp, ORBextractor* extractorLeft, ORBextractor* extractorRight, ORBVocabulary* voc, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera, Frame* pPrevF, const IMU::Calib &ImuCalib)
@@ -449,7 +453,7 @@ Frame::Frame(const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeSt
 }
 
 // RGB-D with lines
-Frame::Frame(const std::vector<string> &labels, const std::vector<uint8_t> &masks, const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,Lineextractor* LineextractorLeft,ORBVocabulary* voc,LineVocabulary* voc_l, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera,Frame* pPrevF, const IMU::Calib &ImuCalib)
+Frame::Frame(const std::vector<string> &labels, const std::vector<uint8_t> &masks, const cv::Mat &imGray, const cv::Mat &imDepth, const double &timeStamp, ORBextractor* extractor,Lineextractor* LineextractorLeft,ORBVocabulary* voc,LineVocabulary* voc_l, cv::Mat &K, cv::Mat &distCoef, const float &bf, const float &thDepth, GeometricCamera* pCamera,Frame* pPrevF, const IMU::Calib &ImuCalib, Frame* pLineTrackF, Frame* pPointTrackF)
         :mpcpi(NULL),mpORBvocabulary(voc),mpLinevocabulary(voc_l),mpORBextractorLeft(extractor),mpLineextractorLeft(LineextractorLeft),mpORBextractorRight(static_cast<ORBextractor*>(NULL)),
          mTimeStamp(timeStamp), mK(K.clone()),mDistCoef(distCoef.clone()), mbf(bf), mThDepth(thDepth),
          mImuCalib(ImuCalib), mpImuPreintegrated(NULL), mpPrevFrame(pPrevF), mpImuPreintegratedFrame(NULL), mpReferenceKF(static_cast<KeyFrame*>(NULL)), mbImuPreintegrated(false),
@@ -474,7 +478,38 @@ Frame::Frame(const std::vector<string> &labels, const std::vector<uint8_t> &mask
 #endif
     //cout<<"Start Frame 1~~~~~~~~~~~~~~~"<<endl;
 //    std::chrono::steady_clock::time_point tt1 = std::chrono::steady_clock::now();
-    ExtractORB(0,imGray,labels, masks,0,0);
+    if(pPointTrackF)
+    {
+        // Track the keypoints of the last frame with a MapPoint, off the person masks, ORB only if too few of them survive
+        vector<cv::KeyPoint> vPrevKeys;
+        vector<int> vPrevIdx, vTrackedIdx;
+        vPrevKeys.reserve(pPointTrackF->N);
+        vPrevIdx.reserve(pPointTrackF->N);
+        for(int i=0; i<pPointTrackF->N; i++)
+        {
+            if(pPointTrackF->mvpMapPoints[i] && !pPointTrackF->mvbOutlier[i])
+            {
+                vPrevKeys.push_back(pPointTrackF->mvKeys[i]);
+                vPrevIdx.push_back(i);
+            }
+        }
+
+        mpORBextractorLeft->Track(pPointTrackF->mImTrack, imGray, vPrevKeys, mvKeys, vTrackedIdx, labels, masks);
+        mbPointsTracked = (int)mvKeys.size() >= mpORBextractorLeft->mnMinTrackedPoints;
+        if(mbPointsTracked)
+        {
+            // Tracked keypoints keep the descriptor of the keypoint they come from
+            mvPointTrackIdx.resize(vTrackedIdx.size());
+            mDescriptors.create(vTrackedIdx.size(), pPointTrackF->mDescriptors.cols, pPointTrackF->mDescriptors.type());
+            for(size_t i=0; i<vTrackedIdx.size(); i++)
+            {
+                mvPointTrackIdx[i] = vPrevIdx[vTrackedIdx[i]];
+                pPointTrackF->mDescriptors.row(mvPointTrackIdx[i]).copyTo(mDescriptors.row(i));
+            }
+        }
+    }
+    if(!mbPointsTracked)
+        ExtractORB(0,imGray,labels, masks,0,0);
 //    std::chrono::steady_clock::time_point tt2 = std::chrono::steady_clock::now();
 //    double PointExtratrack= std::chrono::duration_cast<std::chrono::duration<double> >(tt2 - tt1).count();
 //    cout<<"Extracting Points use : "<<PointExtratrack<<" s"<<endl;
@@ -510,7 +545,28 @@ mTimeORB_Ext = std::chrono::duration_cast<std::chrono::duration<double,std::mill
 
     //cout<<"Start Frame 3~~~~~~~~~~~~~~~"<<endl;
 //    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
-    ExtractLine(0,imGray, labels, masks);
+#ifdef SAVE_TIMES
+    std::chrono::steady_clock::time_point time_StartExtLines = std::chrono::steady_clock::now();
+#endif
+    if(pLineTrackF)
+    {
+        // Track the lines of the last frame, off the person masks, LSD+LBD only if too few of them survive
+        mpLineextractorLeft->Track(pLineTrackF->mImTrack, imGray, pLineTrackF->mvKeys_Line, pLineTrackF->mDescriptors_Line,
+                                   mvKeys_Line, mDescriptors_Line, mvLineTrackIdx, labels, masks);
+        mbLinesTracked = (int)mvKeys_Line.size() >= mpLineextractorLeft->mnMinTrackedLines;
+    }
+    if(!mbLinesTracked)
+    {
+        mvLineTrackIdx.clear();
+        ExtractLine(0,imGray, labels, masks);
+    }
+    if(mpLineextractorLeft->mbTrackLines || mpORBextractorLeft->mbTrackPoints)
+        mImTrack = imGray;
+#ifdef SAVE_TIMES
+    std::chrono::steady_clock::time_point time_EndExtLines = std::chrono::steady_clock::now();
+
+mTimeLines_Ext = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(time_EndExtLines - time_StartExtLines).count();
+#endif
 //    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
 //    double LineExtratrack= std::chrono::duration_cast<std::chrono::duration<double> >(t2 - t1).count();
 //    cout<<"Extracting Lines use : "<<LineExtratrack<<" s"<<endl;
@@ -726,6 +782,45 @@ void Frame::ExtractORB(int flag, const cv::Mat &im, const std::vector<string> &l
         monoRight = (*mpORBextractorRight)(im,cv::Mat(),mvKeysRight, mDescriptorsRight,vLapping,labels,masks);
 }
 
+void Frame::DetectRGBDPoints(const cv::Mat &imGray, const cv::Mat &imDepth, const std::vector<string> &labels, const std::vector<uint8_t> &masks)
+{
+    mbPointsTracked = false;
+    mvPointTrackIdx.clear();
+    mBowVec.clear();
+    mFeatVec.clear();
+
+    ExtractORB(0,imGray, labels, masks,0,0);
+    N = mvKeys.size();
+    monoLeft = -1;
+
+    UndistortKeyPoints();
+    ComputeStereoFromRGBD(imDepth);
+
+    mvpMapPoints = vector<MapPoint*>(N,static_cast<MapPoint*>(NULL));
+    mvbOutlier = vector<bool>(N,false);
+
+    for(unsigned int i=0; i<FRAME_GRID_COLS;i++)
+        for (unsigned int j=0; j<FRAME_GRID_ROWS;j++)
+            mGrid[i][j].clear();
+    AssignFeaturesToGrid();
+}
+
+void Frame::DetectRGBDLines(const cv::Mat &imGray, const cv::Mat &imDepth, const std::vector<string> &labels, const std::vector<uint8_t> &masks)
+{
+    mbLinesTracked = false;
+    mvLineTrackIdx.clear();
+
+    ExtractLine(0,imGray, labels, masks);
+    N_l = mvKeys_Line.size();
+
+    UndistortKeyLines();
+    mvDepth_l.clear();
+    ComputeRGBDLines(imDepth);
+
+    mvpMapLines = vector<MapLine*>(N_l,static_cast<MapLine*>(NULL));
+    mvbOutlier_Line = vector<bool>(N_l,false);
+}
+
 void Frame::ExtractLine(int flag, const cv::Mat &im, const std::vector<string> &labels, const std::vector<uint8_t> &masks)
 {
     if(flag==0)
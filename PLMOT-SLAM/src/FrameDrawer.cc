@@ -872,7 +872,7 @@ void FrameDrawer::Update(Tracking *pTracker)
         mvIniKeys=pTracker->mInitialFrame.mvKeys;
         mvIniMatches=pTracker->mvIniMatches;
     }
-    else if(pTracker->mLastProcessedState==Tracking::OK)
+    else if(pTracker->mLastProcessedState==Tracking::OK || pTracker->mLastProcessedState==Tracking::OK_KLT)
     {
         for(int i=0;i<N;i++)
         {
@@ -922,6 +922,9 @@ void FrameDrawer::Update(Tracking *pTracker)
         }
     }
     mState=static_cast<int>(pTracker->mLastProcessedState);
+    // Optical flow tracking is drawn as tracking
+    if(mState==Tracking::OK_KLT)
+        mState=Tracking::OK;
 }
 
 } //namespace ORB_SLAM
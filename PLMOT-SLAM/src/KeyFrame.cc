@@ -21,14 +21,42 @@
 #include "Converter.h"
 #include "ORBmatcher.h"
 #include "ImuTypes.h"
+#include "EpochReclaimer.h"
 #include<mutex>
+#include<limits>
 
 namespace ORB_SLAM3
 {
 
+// Lookup in the covisibility weights, sorted by keyframe pointer
+static vector<pair<KeyFrame*,int> >::iterator LowerBoundConnection(vector<pair<KeyFrame*,int> > &vConnections, KeyFrame* pKF)
+{
+    return lower_bound(vConnections.begin(),vConnections.end(),make_pair(pKF,std::numeric_limits<int>::min()));
+}
+
+// Sorts the observing keyframes and counts the repetitions of each one into (keyframe, count) pairs sorted by pointer
+static void CountKeyFrames(vector<KeyFrame*> &vpKFs, vector<pair<KeyFrame*,int> > &vCounter)
+{
+    sort(vpKFs.begin(),vpKFs.end());
+    vCounter.clear();
+    for(size_t i=0, iend=vpKFs.size(); i<iend; i++)
+    {
+        if(vCounter.empty() || vCounter.back().first!=vpKFs[i])
+            vCounter.push_back(make_pair(vpKFs[i],1));
+        else
+            vCounter.back().second++;
+    }
+}
+
 long unsigned int KeyFrame::nNextId=0;
 
 KeyFrame::KeyFrame():
+        KeyFrame(cv::Mat(), cv::Mat())
+{
+
+}
+
+KeyFrame::KeyFrame(const cv::Mat &descriptors, const cv::Mat &descriptors_l):
         mnFrameId(0),  mTimeStamp(0), mnGridCols(FRAME_GRID_COLS), mnGridRows(FRAME_GRID_ROWS),
         mfGridElementWidthInv(0), mfGridElementHeightInv(0),
         mnTrackReferenceForFrame(0), mnFuseTargetForKF(0), mnBALocalForKF(0), mnBAFixedForKF(0), mnBALocalForMerge(0),
@@ -36,7 +64,7 @@ KeyFrame::KeyFrame():
         fx(0), fy(0), cx(0), cy(0), invfx(0), invfy(0), mnPlaceRecognitionQuery(0), mnPlaceRecognitionWords(0), mPlaceRecognitionScore(0),
         mbf(0), mb(0), mThDepth(0), N(0), N_l(0), mvKeys(static_cast<vector<cv::KeyPoint> >(NULL)), mvKeysUn(static_cast<vector<cv::KeyPoint> >(NULL)),
         mvKeys_Line(static_cast<vector<cv::line_descriptor::KeyLine> >(NULL)), mvKeysUn_Line(static_cast<vector<cv::line_descriptor::KeyLine> >(NULL)),
-        mvuRight(static_cast<vector<float> >(NULL)), mvDepth(static_cast<vector<float> >(NULL)), mvDepth_l(static_cast<vector<pair<float,float>> >(NULL)),/*mDescriptors(NULL),*/
+        mvuRight(static_cast<vector<float> >(NULL)), mvDepth(static_cast<vector<float> >(NULL)), mvDepth_l(static_cast<vector<pair<float,float>> >(NULL)), mDescriptors(descriptors.clone()), mDescriptors_l(descriptors_l.clone()),
         /*mBowVec(NULL), mFeatVec(NULL),*/ mnScaleLevels(0), mfScaleFactor(0), mnScaleLevels_l(0),
         mfLogScaleFactor(0), mvScaleFactors(0), mvLevelSigma2(0), mvScaleFactors_l(0),
         mvInvLevelSigma2(0), mvInvLevelSigma2_l(0), mnMinX(0), mnMinY(0), mnMaxX(0),
@@ -201,10 +229,11 @@ void KeyFrame::AddConnection(KeyFrame *pKF, const int &weight)
 {
     {
         unique_lock<mutex> lock(mMutexConnections);
-        if(!mConnectedKeyFrameWeights.count(pKF))
-            mConnectedKeyFrameWeights[pKF]=weight;
-        else if(mConnectedKeyFrameWeights[pKF]!=weight)
-            mConnectedKeyFrameWeights[pKF]=weight;
+        vector<pair<KeyFrame*,int> >::iterator it = LowerBoundConnection(mvConnectedKeyFrameWeights,pKF);
+        if(it==mvConnectedKeyFrameWeights.end() || it->first!=pKF)
+            mvConnectedKeyFrameWeights.insert(it,make_pair(pKF,weight));
+        else if(it->second!=weight)
+            it->second=weight;
         else
             return;
     }
@@ -216,32 +245,30 @@ void KeyFrame::UpdateBestCovisibles()
 {
     unique_lock<mutex> lock(mMutexConnections);
     vector<pair<int,KeyFrame*> > vPairs;
-    vPairs.reserve(mConnectedKeyFrameWeights.size());
-    for(map<KeyFrame*,int>::iterator mit=mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
-       vPairs.push_back(make_pair(mit->second,mit->first));
+    vPairs.reserve(mvConnectedKeyFrameWeights.size());
+    for(size_t i=0, iend=mvConnectedKeyFrameWeights.size(); i<iend; i++)
+       vPairs.push_back(make_pair(mvConnectedKeyFrameWeights[i].second,mvConnectedKeyFrameWeights[i].first));
 
+    // Decreasing weight, refilling the ordered vectors in place
     sort(vPairs.begin(),vPairs.end());
-    list<KeyFrame*> lKFs;
-    list<int> lWs;
-    for(size_t i=0, iend=vPairs.size(); i<iend;i++)
+    mvpOrderedConnectedKeyFrames.clear();
+    mvOrderedWeights.clear();
+    for(vector<pair<int,KeyFrame*> >::reverse_iterator rit=vPairs.rbegin(), rend=vPairs.rend(); rit!=rend; rit++)
     {
-        if(!vPairs[i].second->isBad())
+        if(!rit->second->isBad())
         {
-            lKFs.push_front(vPairs[i].second);
-            lWs.push_front(vPairs[i].first);
+            mvpOrderedConnectedKeyFrames.push_back(rit->second);
+            mvOrderedWeights.push_back(rit->first);
         }
     }
-
-    mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
-    mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
 }
 
 set<KeyFrame*> KeyFrame::GetConnectedKeyFrames()
 {
     unique_lock<mutex> lock(mMutexConnections);
     set<KeyFrame*> s;
-    for(map<KeyFrame*,int>::iterator mit=mConnectedKeyFrameWeights.begin();mit!=mConnectedKeyFrameWeights.end();mit++)
-        s.insert(mit->first);
+    for(size_t i=0, iend=mvConnectedKeyFrameWeights.size(); i<iend; i++)
+        s.insert(s.end(),mvConnectedKeyFrameWeights[i].first);
     return s;
 }
 
@@ -251,6 +278,12 @@ vector<KeyFrame*> KeyFrame::GetVectorCovisibleKeyFrames()
     return mvpOrderedConnectedKeyFrames;
 }
 
+void KeyFrame::GetVectorCovisibleKeyFrames(vector<KeyFrame*> &vpKFs)
+{
+    unique_lock<mutex> lock(mMutexConnections);
+    vpKFs.assign(mvpOrderedConnectedKeyFrames.begin(),mvpOrderedConnectedKeyFrames.end());
+}
+
 vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N)
 {
     unique_lock<mutex> lock(mMutexConnections);
@@ -261,6 +294,13 @@ vector<KeyFrame*> KeyFrame::GetBestCovisibilityKeyFrames(const int &N)
 
 }
 
+void KeyFrame::GetBestCovisibilityKeyFrames(const int &N, vector<KeyFrame*> &vpKFs)
+{
+    unique_lock<mutex> lock(mMutexConnections);
+    const size_t n = std::min(mvpOrderedConnectedKeyFrames.size(),(size_t)std::max(N,0));
+    vpKFs.assign(mvpOrderedConnectedKeyFrames.begin(),mvpOrderedConnectedKeyFrames.begin()+n);
+}
+
 vector<KeyFrame*> KeyFrame::GetCovisiblesByWeight(const int &w)
 {
     unique_lock<mutex> lock(mMutexConnections);
@@ -287,8 +327,9 @@ vector<KeyFrame*> KeyFrame::GetCovisiblesByWeight(const int &w)
 int KeyFrame::GetWeight(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexConnections);
-    if(mConnectedKeyFrameWeights.count(pKF))
-        return mConnectedKeyFrameWeights[pKF];
+    vector<pair<KeyFrame*,int> >::iterator it = LowerBoundConnection(mvConnectedKeyFrameWeights,pKF);
+    if(it!=mvConnectedKeyFrameWeights.end() && it->first==pKF)
+        return it->second;
     else
         return 0;
 }
@@ -469,7 +510,7 @@ MapLine* KeyFrame::GetMapLine(const size_t &idx)
 
 void KeyFrame::UpdateConnections(bool upParent)
 {
-    map<KeyFrame*,int> KFcounter;
+    vector<pair<KeyFrame*,int> > KFcounter;
 
     vector<MapPoint*> vpMP;
 
@@ -480,6 +521,8 @@ void KeyFrame::UpdateConnections(bool upParent)
 
     //For all map points in keyframe check in which other keyframes are they seen
     //Increase counter for those keyframes
+    vector<KeyFrame*> vpObsKFs;
+    vpObsKFs.reserve(4*vpMP.size());
     for(vector<MapPoint*>::iterator vit=vpMP.begin(), vend=vpMP.end(); vit!=vend; vit++)
     {
         MapPoint* pMP = *vit;
@@ -490,16 +533,23 @@ void KeyFrame::UpdateConnections(bool upParent)
         if(pMP->isBad())
             continue;
 
-        map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-
-        for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        pMP->ForEachObservation([&](KeyFrame* pKFi, const tuple<int,int> &)
         {
-            if(mit->first->mnId==mnId || mit->first->isBad() || mit->first->GetMap() != mpMap)
-                continue;
-            KFcounter[mit->first]++;
+            if(pKFi->mnId!=mnId)
+                vpObsKFs.push_back(pKFi);
+        });
+    }
 
-        }
+    CountKeyFrames(vpObsKFs,KFcounter);
+
+    // Keyframes are checked once each, outside of the observation locks of the landmarks
+    vector<pair<KeyFrame*,int> >::iterator itEnd = KFcounter.begin();
+    for(vector<pair<KeyFrame*,int> >::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
+    {
+        if(!mit->first->isBad() && mit->first->GetMap() == mpMap)
+            *itEnd++ = *mit;
     }
+    KFcounter.erase(itEnd,KFcounter.end());
 
     // This should not happen
     if(KFcounter.empty())
@@ -515,7 +565,7 @@ void KeyFrame::UpdateConnections(bool upParent)
     vPairs.reserve(KFcounter.size());
     if(!upParent)
         cout << "UPDATE_CONN: current KF " << mnId << endl;
-    for(map<KeyFrame*,int>::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*,int> >::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
     {
         if(!upParent)
             cout << "  UPDATE_CONN: KF " << mit->first->mnId << " ; num matches: " << mit->second << endl;
@@ -538,21 +588,19 @@ void KeyFrame::UpdateConnections(bool upParent)
     }
 
     sort(vPairs.begin(),vPairs.end());
-    list<KeyFrame*> lKFs;
-    list<int> lWs;
-    for(size_t i=0; i<vPairs.size();i++)
-    {
-        lKFs.push_front(vPairs[i].second);
-        lWs.push_front(vPairs[i].first);
-    }
 
     {
         unique_lock<mutex> lockCon(mMutexConnections);
 
         // mspConnectedKeyFrames = spConnectedKeyFrames;
-        mConnectedKeyFrameWeights = KFcounter;
-        mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
-        mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+        mvConnectedKeyFrameWeights.swap(KFcounter);
+        mvpOrderedConnectedKeyFrames.clear();
+        mvOrderedWeights.clear();
+        for(vector<pair<int,KeyFrame*> >::reverse_iterator rit=vPairs.rbegin(), rend=vPairs.rend(); rit!=rend; rit++)
+        {
+            mvpOrderedConnectedKeyFrames.push_back(rit->second);
+            mvOrderedWeights.push_back(rit->first);
+        }
 
 //        if(mbFirstConnection && mnId!=mpMap->GetInitKFid())
 //        {
@@ -594,7 +642,7 @@ void KeyFrame::UpdateConnections(bool upParent)
 
 void KeyFrame::UpdateConnectionsWithLines(bool upParent)
 {
-    map<KeyFrame*,int> KFcounter;
+    vector<pair<KeyFrame*,int> > KFcounter;
 
     vector<MapPoint*> vpMP;
     vector<MapLine*> vpML;
@@ -607,6 +655,8 @@ void KeyFrame::UpdateConnectionsWithLines(bool upParent)
 
     //For all map points in keyframe check in which other keyframes are they seen
     //Increase counter for those keyframes
+    vector<KeyFrame*> vpObsKFs;
+    vpObsKFs.reserve(4*vpMP.size());
     for(vector<MapPoint*>::iterator vit=vpMP.begin(), vend=vpMP.end(); vit!=vend; vit++)
     {
         MapPoint* pMP = *vit;
@@ -617,15 +667,11 @@ void KeyFrame::UpdateConnectionsWithLines(bool upParent)
         if(pMP->isBad())
             continue;
 
-        map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-
-        for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        pMP->ForEachObservation([&](KeyFrame* pKFi, const tuple<int,int> &)
         {
-            if(mit->first->mnId==mnId || mit->first->isBad() || mit->first->GetMap() != mpMap)
-                continue;
-            KFcounter[mit->first]++;
-
-        }
+            if(pKFi->mnId!=mnId)
+                vpObsKFs.push_back(pKFi);
+        });
     }
     
     for(vector<MapLine*>::iterator vit=vpML.begin(), vend=vpML.end(); vit!=vend; vit++)
@@ -638,16 +684,24 @@ void KeyFrame::UpdateConnectionsWithLines(bool upParent)
         if(pML->isBad())
             continue;
 
-        map<KeyFrame*,size_t> observations = pML->GetObservations();
-
-        for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+        pML->ForEachObservation([&](KeyFrame* pKFi, const size_t)
         {
-            if(mit->first->mnId==mnId || mit->first->isBad() || mit->first->GetMap() != mpMap)
-                continue;
-            KFcounter[mit->first]++;
-        }
+            if(pKFi->mnId!=mnId)
+                vpObsKFs.push_back(pKFi);
+        });
     } 
 
+    CountKeyFrames(vpObsKFs,KFcounter);
+
+    // Keyframes are checked once each, outside of the observation locks of the landmarks
+    vector<pair<KeyFrame*,int> >::iterator itEnd = KFcounter.begin();
+    for(vector<pair<KeyFrame*,int> >::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
+    {
+        if(!mit->first->isBad() && mit->first->GetMap() == mpMap)
+            *itEnd++ = *mit;
+    }
+    KFcounter.erase(itEnd,KFcounter.end());
+
     // This should not happen
     if(KFcounter.empty())
         return;
@@ -662,7 +716,7 @@ void KeyFrame::UpdateConnectionsWithLines(bool upParent)
     vPairs.reserve(KFcounter.size());
     if(!upParent)
         cout << "UPDATE_CONN: current KF " << mnId << endl;
-    for(map<KeyFrame*,int>::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*,int> >::iterator mit=KFcounter.begin(), mend=KFcounter.end(); mit!=mend; mit++)
     {
         if(!upParent)
             cout << "  UPDATE_CONN: KF " << mit->first->mnId << " ; num matches: " << mit->second << endl;
@@ -685,21 +739,19 @@ void KeyFrame::UpdateConnectionsWithLines(bool upParent)
     }
 
     sort(vPairs.begin(),vPairs.end());
-    list<KeyFrame*> lKFs;
-    list<int> lWs;
-    for(size_t i=0; i<vPairs.size();i++)
-    {
-        lKFs.push_front(vPairs[i].second);
-        lWs.push_front(vPairs[i].first);
-    }
 
     {
         unique_lock<mutex> lockCon(mMutexConnections);
 
         // mspConnectedKeyFrames = spConnectedKeyFrames;
-        mConnectedKeyFrameWeights = KFcounter;
-        mvpOrderedConnectedKeyFrames = vector<KeyFrame*>(lKFs.begin(),lKFs.end());
-        mvOrderedWeights = vector<int>(lWs.begin(), lWs.end());
+        mvConnectedKeyFrameWeights.swap(KFcounter);
+        mvpOrderedConnectedKeyFrames.clear();
+        mvOrderedWeights.clear();
+        for(vector<pair<int,KeyFrame*> >::reverse_iterator rit=vPairs.rbegin(), rend=vPairs.rend(); rit!=rend; rit++)
+        {
+            mvpOrderedConnectedKeyFrames.push_back(rit->second);
+            mvOrderedWeights.push_back(rit->first);
+        }
 
 //        if(mbFirstConnection && mnId!=mpMap->GetInitKFid())
 //        {
@@ -862,7 +914,7 @@ void KeyFrame::SetBadFlag()
     }
     //std::cout << "KF.BADFLAG-> Erasing KF..." << std::endl;
 
-    for(map<KeyFrame*,int>::iterator mit = mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*,int> >::iterator mit = mvConnectedKeyFrameWeights.begin(), mend=mvConnectedKeyFrameWeights.end(); mit!=mend; mit++)
     {
         mit->first->EraseConnection(this);
     }
@@ -883,7 +935,7 @@ void KeyFrame::SetBadFlag()
         unique_lock<mutex> lock(mMutexConnections);
         unique_lock<mutex> lock1(mMutexFeatures);
 
-        mConnectedKeyFrameWeights.clear();
+        mvConnectedKeyFrameWeights.clear();
         mvpOrderedConnectedKeyFrames.clear();
 
         // Update Spanning Tree
@@ -966,6 +1018,9 @@ void KeyFrame::SetBadFlag()
             //cout << "Error: KF haven't got a parent, it is imposible reach this code point without him" << endl;
         }
         mbBad = true;
+        // The map points no longer have this keyframe among their observations, they can be deleted once bad
+        if(EpochReclaimer::IsEnabled())
+            fill(mvpMapPoints.begin(), mvpMapPoints.end(), static_cast<MapPoint*>(NULL));
     }
 
 
@@ -997,7 +1052,7 @@ void KeyFrame::SetBadFlagWithLines()
     }
     //std::cout << "KF.BADFLAG-> Erasing KF..." << std::endl;
 
-    for(map<KeyFrame*,int>::iterator mit = mConnectedKeyFrameWeights.begin(), mend=mConnectedKeyFrameWeights.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*,int> >::iterator mit = mvConnectedKeyFrameWeights.begin(), mend=mvConnectedKeyFrameWeights.end(); mit!=mend; mit++)
     {
         mit->first->EraseConnection(this);
     }
@@ -1026,7 +1081,7 @@ void KeyFrame::SetBadFlagWithLines()
         unique_lock<mutex> lock(mMutexConnections);
         unique_lock<mutex> lock1(mMutexFeatures);
 
-        mConnectedKeyFrameWeights.clear();
+        mvConnectedKeyFrameWeights.clear();
         mvpOrderedConnectedKeyFrames.clear();
 
         // Update Spanning Tree
@@ -1109,6 +1164,13 @@ void KeyFrame::SetBadFlagWithLines()
             //cout << "Error: KF haven't got a parent, it is imposible reach this code point without him" << endl;
         }
         mbBad = true;
+        // The map points and lines no longer have this keyframe among their observations, they can be deleted
+        // once bad
+        if(EpochReclaimer::IsEnabled())
+        {
+            fill(mvpMapPoints.begin(), mvpMapPoints.end(), static_cast<MapPoint*>(NULL));
+            fill(mvpMapLines.begin(), mvpMapLines.end(), static_cast<MapLine*>(NULL));
+        }
     }
 
 
@@ -1127,9 +1189,10 @@ void KeyFrame::EraseConnection(KeyFrame* pKF)
     bool bUpdate = false;
     {
         unique_lock<mutex> lock(mMutexConnections);
-        if(mConnectedKeyFrameWeights.count(pKF))
+        vector<pair<KeyFrame*,int> >::iterator it = LowerBoundConnection(mvConnectedKeyFrameWeights,pKF);
+        if(it!=mvConnectedKeyFrameWeights.end() && it->first==pKF)
         {
-            mConnectedKeyFrameWeights.erase(pKF);
+            mvConnectedKeyFrameWeights.erase(it);
             bUpdate=true;
         }
     }
@@ -1294,7 +1357,7 @@ void KeyFrame::PreSave(set<KeyFrame*>& spKF,set<MapPoint*>& spMP, set<GeometricC
     //cout << "KeyFrame: ID from MapPoints stored" << endl;
     // Save the id of each connected KF with it weight
     mBackupConnectedKeyFrameIdWeights.clear();
-    for(std::map<KeyFrame*,int>::const_iterator it = mConnectedKeyFrameWeights.begin(), end = mConnectedKeyFrameWeights.end(); it != end; ++it)
+    for(std::vector<std::pair<KeyFrame*,int> >::const_iterator it = mvConnectedKeyFrameWeights.begin(), end = mvConnectedKeyFrameWeights.end(); it != end; ++it)
     {
         if(spKF.find(it->first) != spKF.end())
             mBackupConnectedKeyFrameIdWeights[it->first->mnId] = it->second;
@@ -1377,13 +1440,15 @@ void KeyFrame::PostLoad(map<long unsigned int, KeyFrame*>& mpKFid, map<long unsi
     }
 
     // Conected KeyFrames with him weight
-    mConnectedKeyFrameWeights.clear();
+    mvConnectedKeyFrameWeights.clear();
+    mvConnectedKeyFrameWeights.reserve(mBackupConnectedKeyFrameIdWeights.size());
     for(map<long unsigned int, int>::const_iterator it = mBackupConnectedKeyFrameIdWeights.begin(), end = mBackupConnectedKeyFrameIdWeights.end();
         it != end; ++it)
     {
         KeyFrame* pKFi = mpKFid[it->first];
-        mConnectedKeyFrameWeights[pKFi] = it->second;
+        mvConnectedKeyFrameWeights.push_back(make_pair(pKFi,it->second));
     }
+    sort(mvConnectedKeyFrameWeights.begin(),mvConnectedKeyFrameWeights.end());
 
     // Restore parent KeyFrame
     if(mBackupParentId>=0)
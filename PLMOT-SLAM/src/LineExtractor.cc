@@ -22,10 +22,12 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
 #include <vector>
 #include <chrono>
 
 #include "LineExtractor.h"
+#include "ORBextractor.h"
 
 using namespace cv;
 using namespace line_descriptor;
@@ -35,7 +37,7 @@ namespace ORB_SLAM3
 {
 
 Lineextractor::Lineextractor(int _lsd_nfeatures, int _lsd_refine, float _lsd_scale, int _nlevels, float _scale, int _extractor)
-    :lsd_nfeatures(_lsd_nfeatures), lsd_refine(_lsd_refine), lsd_scale(_lsd_scale), nlevels(_nlevels), scale(_scale), extractor(_extractor)
+    :mbTrackLines(false), mnMinTrackedLines(30), mbIncrementalLBD(false), lsd_nfeatures(_lsd_nfeatures), lsd_refine(_lsd_refine), lsd_scale(_lsd_scale), nlevels(_nlevels), scale(_scale), extractor(_extractor)
 {
 
 }
@@ -78,38 +80,8 @@ void Lineextractor::operator()( const cv::Mat& img, const cv::Mat& mask,
 
 
         //TODO 新增内容，目的是剔除环境中的动态特征点
-        Mat mskMat;
-        int nums = labels.size();
-        int height = image.size().height;
-        int width = image.size().width;
-        Mat dst = Mat(image.size(),CV_8U,Scalar(0,0,0));
-        for (int i = 0; i <nums ; ++i)
-        {
-            if(labels[i] == "person")
-            {
-                vector<uint8_t >::const_iterator first1 = masks.begin()+i*height*width;
-                vector<uint8_t >::const_iterator first2 = masks.begin()+(i+1)*height*width;
-                vector<uint8_t > mask(first1,first2);
-                Mat msk = Mat(mask);
-                Mat MSK = msk.reshape(1,height);
-                Mat dst_temp = Mat(image.size(),CV_8U,Scalar(0,0,0));
-                for (int j = 0; j <height ; ++j)
-                {
-                    for (int k = 0; k <width ; ++k)
-                    {
-                        if(MSK.at<uint8_t>(j,k) == 1)
-                        {
-                            dst_temp.at<uchar>(j,k) = 255;
-                        }
-                    }
-                }
-                dst += dst_temp;
-            }
-
-        }
-
         vector<vector<Point>> contours;
-        findContours(dst,contours,RETR_EXTERNAL,CHAIN_APPROX_NONE);
+        ORBextractor::PersonContours(image.size(), labels, masks, contours);
 
 
         //cout<<"before removal -------------"<<keylines.size()<<" 个"<<endl;
@@ -146,21 +118,17 @@ void Lineextractor::operator()( const cv::Mat& img, const cv::Mat& mask,
                 keylines[i].class_id = i;
         }
 
-        nlevels_l=nlevels;
-        mvLevelSigma2_l.resize(nlevels);
-        mvLevelSigma2_l[0]=1.0f;
-        mvInvLevelSigma2_l.resize(nlevels);
-        for (int i = 0; i < nlevels; i++) 
+        SetPyramid(lsd);
+//        std::chrono::steady_clock::time_point tt1 = std::chrono::steady_clock::now();
+        // LBD only on the kept lines, reusing the pyramid of the detector
+        if(mbIncrementalLBD)
         {
-            mvImagePyramid_l.push_back(lsd->gaussianPyrs[i]);
-            mvScaleFactor_l.push_back(lsd->mvScaleFactor[i]);
-            mvInvScaleFactor_l.push_back(lsd->mvInvScaleFactor[i]);
-            if (i>0)  
-                mvLevelSigma2_l[i]=mvScaleFactor_l[i]*mvScaleFactor_l[i];
-            mvInvLevelSigma2_l[i]=1.0f/mvLevelSigma2_l[i];
+            descriptors_line = cv::Mat();
+            if(!keylines.empty())
+                lbd->computeFromPyramid( mvImagePyramid_l, keylines, descriptors_line);
         }
-//        std::chrono::steady_clock::time_point tt1 = std::chrono::steady_clock::now();
-        lbd->compute( img, keylines, descriptors_line);
+        else
+            lbd->compute( img, keylines, descriptors_line);
 //        std::chrono::steady_clock::time_point tt2 = std::chrono::steady_clock::now();
 //        double LBDCULCU= std::chrono::duration_cast<std::chrono::duration<double> >(tt2 - tt1).count();
 //        cout<<"LBD use : "<<LBDCULCU<<" s"<<endl;
@@ -186,22 +154,194 @@ void Lineextractor::operator()( const cv::Mat& img, const cv::Mat& mask,
                     keylines[i].class_id = i;
         }
 
-        nlevels_l=nlevels;
-        mvLevelSigma2_l.resize(nlevels);
-        mvLevelSigma2_l[0]=1.0f;
-        mvInvLevelSigma2_l.resize(nlevels);
-        for (int i = 0; i < nlevels; i++) 
-        {
-            mvImagePyramid_l.push_back(lsd->gaussianPyrs[i]);
-            mvScaleFactor_l.push_back(lsd->mvScaleFactor[i]);
-            mvInvScaleFactor_l.push_back(lsd->mvInvScaleFactor[i]);
-            if (i>0)  
-                mvLevelSigma2_l[i]=mvScaleFactor_l[i]*mvScaleFactor_l[i];
-            mvInvLevelSigma2_l[i]=1.0f/mvLevelSigma2_l[i];
-        } 
+        SetPyramid(lsd);
 
         lbd->compute( img, keylines, descriptors_line);        
     }
 }
 
+void Lineextractor::SetPyramid(const Ptr<line_descriptor::LSDDetectorC> &lsd)
+{
+    // Pyramid and scale info of the last detection (not accumulated over frames)
+    nlevels_l=nlevels;
+    mvImagePyramid_l.resize(nlevels);
+    mvScaleFactor_l.resize(nlevels);
+    mvInvScaleFactor_l.resize(nlevels);
+    mvLevelSigma2_l.resize(nlevels);
+    mvLevelSigma2_l[0]=1.0f;
+    mvInvLevelSigma2_l.resize(nlevels);
+    for (int i = 0; i < nlevels; i++)
+    {
+        mvImagePyramid_l[i] = lsd->gaussianPyrs[i];
+        mvScaleFactor_l[i] = lsd->mvScaleFactor[i];
+        mvInvScaleFactor_l[i] = lsd->mvInvScaleFactor[i];
+        if (i>0)
+            mvLevelSigma2_l[i]=mvScaleFactor_l[i]*mvScaleFactor_l[i];
+        mvInvLevelSigma2_l[i]=1.0f/mvLevelSigma2_l[i];
+    }
+}
+
+int Lineextractor::Track(const cv::Mat &prevImage, const cv::Mat &image,
+            const std::vector<cv::line_descriptor::KeyLine>& prevKeylines, const cv::Mat& prevDescriptors,
+            std::vector<cv::line_descriptor::KeyLine>& keylines, cv::Mat& descriptors_line, std::vector<int> &vPrevIdx,
+            const std::vector<string> &labels, const std::vector<uint8_t> &masks)
+{
+    // Sampling along the segments
+    const float sampleStep = 10.f;
+    const int nMinSamples = 5;
+    const int nMaxSamples = 15;
+    // KLT and refit thresholds
+    const float thErr = 20.f;
+    const float thMinInlierRatio = 0.6f;
+    const float thRMS = 1.5f;
+    const float minLengthRatio = 0.5f;
+    const float maxLengthRatio = 2.f;
+
+    keylines.clear();
+    vPrevIdx.clear();
+    descriptors_line = cv::Mat();
+
+    if(prevImage.empty() || prevKeylines.empty() || prevImage.size()!=image.size())
+        return 0;
+
+    const int nPrev = prevKeylines.size();
+    vector<cv::Point2f> vPrevPts;
+    vector<float> vT;
+    vector<int> vFirstSample(nPrev+1);
+    vPrevPts.reserve(nPrev*nMaxSamples);
+    vT.reserve(nPrev*nMaxSamples);
+
+    for(int i=0; i<nPrev; i++)
+    {
+        const KeyLine &kl = prevKeylines[i];
+        vFirstSample[i] = vPrevPts.size();
+        const float dx = kl.endPointX - kl.startPointX;
+        const float dy = kl.endPointY - kl.startPointY;
+        const float length = sqrt(dx*dx+dy*dy);
+        const int nSamples = std::max(nMinSamples,std::min(nMaxSamples,int(length/sampleStep)+1));
+        for(int j=0; j<nSamples; j++)
+        {
+            const float t = float(j)/float(nSamples-1);
+            vPrevPts.push_back(cv::Point2f(kl.startPointX+t*dx, kl.startPointY+t*dy));
+            vT.push_back(t);
+        }
+    }
+    vFirstSample[nPrev] = vPrevPts.size();
+
+    // All the samples are tracked in a single call
+    vector<cv::Point2f> vPts;
+    vector<uchar> vStatus;
+    vector<float> vErr;
+    cv::calcOpticalFlowPyrLK(prevImage, image, vPrevPts, vPts, vStatus, vErr, cv::Size(21,21), 3,
+                             cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, 20, 0.03));
+
+    const float maxX = image.cols-1;
+    const float maxY = image.rows-1;
+
+    // A static segment covered by a person would be tracked onto it: dropped as the detected ones
+    vector<vector<Point>> contours;
+    ORBextractor::PersonContours(image.size(), labels, masks, contours);
+
+    keylines.reserve(nPrev);
+    vPrevIdx.reserve(nPrev);
+    for(int i=0; i<nPrev; i++)
+    {
+        const int nSamples = vFirstSample[i+1]-vFirstSample[i];
+
+        // Mean of the tracked samples and of their parameter along the segment
+        int nIn = 0;
+        float mx = 0, my = 0, mt = 0;
+        for(int j=vFirstSample[i]; j<vFirstSample[i+1]; j++)
+        {
+            if(!vStatus[j] || vErr[j]>thErr)
+                continue;
+            mx += vPts[j].x;
+            my += vPts[j].y;
+            mt += vT[j];
+            nIn++;
+        }
+        if(nIn<std::max(3,int(thMinInlierRatio*nSamples)))
+            continue;
+        mx /= nIn;
+        my /= nIn;
+        mt /= nIn;
+
+        // Refit the segment: principal direction of the tracked samples
+        float cxx = 0, cxy = 0, cyy = 0;
+        for(int j=vFirstSample[i]; j<vFirstSample[i+1]; j++)
+        {
+            if(!vStatus[j] || vErr[j]>thErr)
+                continue;
+            const float ex = vPts[j].x-mx;
+            const float ey = vPts[j].y-my;
+            cxx += ex*ex;
+            cxy += ex*ey;
+            cyy += ey*ey;
+        }
+        const float theta = 0.5f*atan2(2.f*cxy, cxx-cyy);
+        const float ux = cos(theta), uy = sin(theta);
+
+        // Perpendicular residual and regression of the position along the line against the sample parameter
+        float rss = 0, cts = 0, ctt = 0, ms = 0;
+        for(int j=vFirstSample[i]; j<vFirstSample[i+1]; j++)
+        {
+            if(!vStatus[j] || vErr[j]>thErr)
+                continue;
+            const float ex = vPts[j].x-mx;
+            const float ey = vPts[j].y-my;
+            const float perp = -uy*ex+ux*ey;
+            const float s = ux*ex+uy*ey;
+            const float et = vT[j]-mt;
+            rss += perp*perp;
+            cts += et*s;
+            ctt += et*et;
+            ms += s;
+        }
+        if(ctt<1e-6f || sqrt(rss/nIn)>thRMS)
+            continue;
+        ms /= nIn;
+        const float b = cts/ctt;
+        const float a = ms-b*mt;
+
+        // Segment endpoints at t=0 and t=1 keep the orientation of the previous segment
+        KeyLine kl = prevKeylines[i];
+        const float sx = mx+a*ux, sy = my+a*uy;
+        const float ex = mx+(a+b)*ux, ey = my+(a+b)*uy;
+        if(sx<0 || sy<0 || ex<0 || ey<0 || sx>maxX || sy>maxY || ex>maxX || ey>maxY)
+            continue;
+        if(ORBextractor::NearContours(cv::Point2f(sx,sy), contours) || ORBextractor::NearContours(cv::Point2f(ex,ey), contours))
+            continue;
+
+        const float prevLength = sqrt((kl.endPointX-kl.startPointX)*(kl.endPointX-kl.startPointX)+(kl.endPointY-kl.startPointY)*(kl.endPointY-kl.startPointY));
+        const float length = fabs(b);
+        if(prevLength<=0 || length<minLengthRatio*prevLength || length>maxLengthRatio*prevLength)
+            continue;
+
+        const float octaveScale = kl.lineLength/prevLength;
+        kl.startPointX = sx;
+        kl.startPointY = sy;
+        kl.endPointX = ex;
+        kl.endPointY = ey;
+        kl.sPointInOctaveX = sx*octaveScale;
+        kl.sPointInOctaveY = sy*octaveScale;
+        kl.ePointInOctaveX = ex*octaveScale;
+        kl.ePointInOctaveY = ey*octaveScale;
+        kl.lineLength = length*octaveScale;
+        kl.angle = atan2(ey-sy, ex-sx);
+        kl.size = (ex-sx)*(ey-sy);
+        kl.pt = cv::Point2f((sx+ex)/2, (sy+ey)/2);
+        kl.class_id = keylines.size();
+
+        keylines.push_back(kl);
+        vPrevIdx.push_back(i);
+    }
+
+    // Tracked segments keep the descriptor of the segment they come from
+    descriptors_line.create(keylines.size(), prevDescriptors.cols, prevDescriptors.type());
+    for(size_t i=0; i<vPrevIdx.size(); i++)
+        prevDescriptors.row(vPrevIdx[i]).copyTo(descriptors_line.row(i));
+
+    return keylines.size();
+}
+
 } //namespace ORB_SLAM
@@ -21,6 +21,7 @@
 #include "LineMatcher.h"
 
 //STL
+#include <chrono>
 #include <cmath>
 #include <functional>
 #include <future>
@@ -33,6 +34,8 @@
 
 #include "gridStructure.h"
 #include "Converter.h"
+#include "KeyFrame.h"
+#include "GeometricCamera.h"
 
 namespace ORB_SLAM3 {
 
@@ -209,103 +212,480 @@ int LineMatcher::matchGrid(const std::vector<line_2d> &lines1, const cv::Mat &de
     return matches;
 }
 
-int LineMatcher::SearchByProjection(Frame &CurrentFrame, Frame &LastFrame, const GridStructure &grid, const float &th, const float &angth)
+// Largest eigenvalue of the 2x2 covariance of a projected endpoint given the covariance of the pose
+static double EndpointVariance(GeometricCamera* pCamera, const Eigen::Vector3d &x3Dc, const Eigen::Matrix<double,6,6> &covTcw)
 {
+    // Left perturbation of the pose [rotation, translation]: d(x3Dc) = -[x3Dc]x * dw + dt
+    Eigen::Matrix<double,3,6> Jx;
+    Jx.block<3,3>(0,0) <<           0.0,  x3Dc(2), -x3Dc(1),
+                               -x3Dc(2),      0.0,  x3Dc(0),
+                                x3Dc(1), -x3Dc(0),      0.0;
+    Jx.block<3,3>(0,3).setIdentity();
+
+    const Eigen::Matrix<double,2,6> J = pCamera->projectJac(x3Dc) * Jx;
+    const Eigen::Matrix2d S = J * covTcw * J.transpose();
+
+    const double m = 0.5*(S(0,0)+S(1,1));
+    const double d = 0.5*(S(0,0)-S(1,1));
+    return m + std::sqrt(d*d + S(0,1)*S(0,1));
+}
+
+int LineMatcher::SearchByProjection(Frame &CurrentFrame, Frame &LastFrame, const Eigen::Matrix<double,6,6> &covTcw, const float &th, const float &angth, LineProjectionStats *pStats)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    int nProjected = 0, nCandidates = 0;
+    const int TH_HIGH = 120;
+    const float minRatio12L = 0.9;
+    const double chi2_95 = 5.991; // 2 DoF
+    const double maxWindow = 0.1*(CurrentFrame.mnMaxX-CurrentFrame.mnMinX);
+
+    const Eigen::Matrix4d Tcw = Converter::toMatrix4d(CurrentFrame.mTcw);
+    const Eigen::Matrix3d Rcw = Tcw.block<3,3>(0,0);
+    const Eigen::Vector3d tcw = Tcw.block<3,1>(0,3);
+
+    // Fill in the grid of the current keylines
+    GridStructure grid(FRAME_GRID_ROWS, FRAME_GRID_COLS);
+    std::list<std::pair<int, int>> line_coords;
+    for(int i2=0; i2<CurrentFrame.N_l; ++i2)
+    {
+        const cv::line_descriptor::KeyLine &kl = CurrentFrame.mvKeysUn_Line[i2];
+        getLineCoords(kl.startPointX * CurrentFrame.inv_width, kl.startPointY * CurrentFrame.inv_height,
+                      kl.endPointX * CurrentFrame.inv_width, kl.endPointY * CurrentFrame.inv_height, line_coords);
+        for(const std::pair<int, int> &p : line_coords)
+            grid.at(p.first, p.second).push_back(i2);
+    }
+
+    std::vector<int> vMatches12(LastFrame.N_l, -1);
+    std::vector<int> vMatches21(CurrentFrame.N_l, -1);
+    std::vector<int> vDist21(CurrentFrame.N_l, 256);
+
+    for(int i1=0; i1<LastFrame.N_l; i1++)
+    {
+        MapLine* pML = LastFrame.mvpMapLines[i1];
+        if(!pML || LastFrame.mvbOutlier_Line[i1])
+            continue;
+
+        // Project Lines to the Image
+        const Vector6d Xw = pML->GetWorldPos();
+        const Eigen::Vector3d x3Dc_sp = Rcw*Xw.head(3)+tcw;
+        const Eigen::Vector3d x3Dc_ep = Rcw*Xw.tail(3)+tcw;
+
+        if(x3Dc_sp(2)<=0 || x3Dc_ep(2)<=0)
+            continue;
+
+        const Eigen::Vector2d uv_sp = CurrentFrame.mpCamera->project(x3Dc_sp);
+        const Eigen::Vector2d uv_ep = CurrentFrame.mpCamera->project(x3Dc_ep);
+
+        if(uv_sp(0)<CurrentFrame.mnMinX || uv_sp(0)>CurrentFrame.mnMaxX || uv_ep(0)<CurrentFrame.mnMinX || uv_ep(0)>CurrentFrame.mnMaxX)
+            continue;
+        if(uv_sp(1)<CurrentFrame.mnMinY || uv_sp(1)>CurrentFrame.mnMaxY || uv_ep(1)<CurrentFrame.mnMinY || uv_ep(1)>CurrentFrame.mnMaxY)
+            continue;
+
+        const double length = (uv_ep-uv_sp).norm();
+        if(length<1.0)
+            continue;
+
+        nProjected++;
+
+        // Search in a window. Size depends on the uncertainty of the predicted pose and the scale
+        const int nLastOctave = LastFrame.mvKeys_Line[i1].octave;
+        const double sigma2 = std::max(EndpointVariance(CurrentFrame.mpCamera, x3Dc_sp, covTcw),
+                                       EndpointVariance(CurrentFrame.mpCamera, x3Dc_ep, covTcw));
+        double window = std::max((double)th*CurrentFrame.mvScaleFactors_l[nLastOctave], std::sqrt(chi2_95*sigma2));
+        window = std::min(window, maxWindow);
+
+        GridWindow win;
+        const int wcells = std::ceil(window*CurrentFrame.inv_width);
+        const int hcells = std::ceil(window*CurrentFrame.inv_height);
+        win.width = std::make_pair(wcells, wcells);
+        win.height = std::make_pair(hcells, hcells);
+
+        std::unordered_set<int> candidates;
+        grid.get(uv_sp(0) * CurrentFrame.inv_width, uv_sp(1) * CurrentFrame.inv_height, win, candidates);
+        grid.get(uv_ep(0) * CurrentFrame.inv_width, uv_ep(1) * CurrentFrame.inv_height, win, candidates);
+
+        if(candidates.empty())
+            continue;
+
+        // Projected line direction and normal
+        const Eigen::Vector2d dir = (uv_ep-uv_sp)/length;
+        const Eigen::Vector2d nor(-dir(1), dir(0));
+        const double angle = atan2(dir(1), dir(0));
+
+        const cv::Mat dML = pML->GetDescriptor();
+
+        int bestDist = 256, bestDist2 = 256;
+        int bestIdx = -1;
+
+        for(const int &i2 : candidates)
+        {
+            if(CurrentFrame.mvpMapLines[i2])
+                if(CurrentFrame.mvpMapLines[i2]->Observations()>0)
+                    continue;
+
+            const cv::line_descriptor::KeyLine &kl = CurrentFrame.mvKeysUn_Line[i2];
+
+            // check for orientation
+            double theta = atan2(kl.endPointY-kl.startPointY, kl.endPointX-kl.startPointX)-angle;
+            if(theta<-M_PI) theta+=2*M_PI;
+            else if(theta>M_PI) theta-=2*M_PI;
+            if(fabs(theta)>angth)
+                continue;
+
+            // both endpoints close to the projected line and overlapping the projected segment
+            const Eigen::Vector2d sp(kl.startPointX-uv_sp(0), kl.startPointY-uv_sp(1));
+            const Eigen::Vector2d ep(kl.endPointX-uv_sp(0), kl.endPointY-uv_sp(1));
+            if(fabs(nor.dot(sp))>window || fabs(nor.dot(ep))>window)
+                continue;
+            const double ts = dir.dot(sp), te = dir.dot(ep);
+            if(std::max(ts,te)<-window || std::min(ts,te)>length+window)
+                continue;
+
+            nCandidates++;
+
+            const int dist = distance(dML, CurrentFrame.mDescriptors_Line.row(i2));
+
+            if(dist<bestDist)
+            {
+                bestDist2=bestDist;
+                bestDist=dist;
+                bestIdx=i2;
+            }
+            else if(dist<bestDist2)
+                bestDist2=dist;
+        }
+
+        if(bestDist>TH_HIGH || bestDist>=bestDist2*minRatio12L)
+            continue;
+
+        // Keep the closest descriptor if several lines fall on the same keyline
+        if(bestDist<vDist21[bestIdx])
+        {
+            if(vMatches21[bestIdx]>=0)
+                vMatches12[vMatches21[bestIdx]] = -1;
+            vMatches21[bestIdx] = i1;
+            vDist21[bestIdx] = bestDist;
+            vMatches12[i1] = bestIdx;
+        }
+    }
+
     int matches = 0;
+    for(int i1=0; i1<LastFrame.N_l; i1++)
+    {
+        const int i2 = vMatches12[i1];
+        if(i2<0)
+            continue;
+
+        CurrentFrame.mvpMapLines[i2]=LastFrame.mvpMapLines[i1];
+        matches++;
+    }
+
+    if(pStats)
+    {
+        std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+        pStats->nProjected = nProjected;
+        pStats->nCandidates = nCandidates;
+        pStats->nMatches = matches;
+        pStats->mTime = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t1 - t0).count();
+    }
+
+    return matches;
+}
+
+// Clips the line a*x+b*y+c=0 to the rectangle [minX,maxX]x[minY,maxY], false if it does not cross it
+static bool ClipLine(const Eigen::Vector3d &l, const double minX, const double minY, const double maxX, const double maxY,
+                     Eigen::Vector2d &p1, Eigen::Vector2d &p2)
+{
+    Eigen::Vector2d pts[4];
+    int n = 0;
+    if(std::fabs(l(1))>1e-9)
+    {
+        const double y1 = -(l(0)*minX+l(2))/l(1), y2 = -(l(0)*maxX+l(2))/l(1);
+        if(y1>=minY && y1<=maxY) pts[n++] = Eigen::Vector2d(minX,y1);
+        if(y2>=minY && y2<=maxY) pts[n++] = Eigen::Vector2d(maxX,y2);
+    }
+    if(std::fabs(l(0))>1e-9)
+    {
+        const double x1 = -(l(1)*minY+l(2))/l(0), x2 = -(l(1)*maxY+l(2))/l(0);
+        if(x1>minX && x1<maxX) pts[n++] = Eigen::Vector2d(x1,minY);
+        if(x2>minX && x2<maxX) pts[n++] = Eigen::Vector2d(x2,maxY);
+    }
+    if(n<2)
+        return false;
+
+    p1 = pts[0];
+    p2 = pts[1];
+    return true;
+}
+
+int LineMatcher::SearchForTriangulation(KeyFrame* pKF1, KeyFrame* pKF2, const cv::Mat &F12, std::vector<std::pair<size_t,size_t> > &vMatchedPairs)
+{
     const int TH_HIGH = 120;
+    const float minRatio12L = 0.9;
+    const double minOverlap = 0.5;      // overlap of the keyline of pKF2 and the epipolar band, over the shortest of both
+    const double maxCosEpipolar = 0.98; // lines closer than ~11 deg to the epipolar lines cannot be triangulated
+
+    vMatchedPairs.clear();
+
+    const Eigen::Matrix3d F21 = Converter::toMatrix3d(F12).transpose();
+    const std::vector<MapLine*> vpMapLines1 = pKF1->GetMapLineMatches();
+    const std::vector<MapLine*> vpMapLines2 = pKF2->GetMapLineMatches();
 
-    const cv::Mat Rcw = CurrentFrame.mTcw.rowRange(0,3).colRange(0,3);
-    const cv::Mat tcw = CurrentFrame.mTcw.rowRange(0,3).col(3);
+    const double minX = pKF2->mnMinX, minY = pKF2->mnMinY, maxX = pKF2->mnMaxX, maxY = pKF2->mnMaxY;
+    const double invW = pKF2->mfGridElementWidthInv, invH = pKF2->mfGridElementHeightInv;
 
-    for(int i=0; i<LastFrame.N_l; i++)
+    // Fill in the grid of the keylines of pKF2 without a MapLine
+    GridStructure grid(FRAME_GRID_ROWS, FRAME_GRID_COLS);
+    std::list<std::pair<int, int>> line_coords;
+    for(int i2=0; i2<pKF2->N_l; ++i2)
     {
-        MapLine* pML = LastFrame.mvpMapLines[i];
-        if(pML)
+        if(vpMapLines2[i2])
+            continue;
+        const cv::line_descriptor::KeyLine &kl = pKF2->mvKeysUn_Line[i2];
+        getLineCoords((kl.startPointX-minX)*invW, (kl.startPointY-minY)*invH,
+                      (kl.endPointX-minX)*invW, (kl.endPointY-minY)*invH, line_coords);
+        for(const std::pair<int, int> &p : line_coords)
+            grid.at(p.first, p.second).push_back(i2);
+    }
+
+    GridWindow win;
+    win.width = std::make_pair(1, 1);
+    win.height = std::make_pair(1, 1);
+
+    std::vector<int> vMatches12(pKF1->N_l, -1);
+    std::vector<int> vMatches21(pKF2->N_l, -1);
+    std::vector<int> vDist21(pKF2->N_l, 256);
+
+    for(int i1=0; i1<pKF1->N_l; i1++)
+    {
+        if(vpMapLines1[i1])
+            continue;
+
+        const cv::line_descriptor::KeyLine &kl1 = pKF1->mvKeysUn_Line[i1];
+        const Eigen::Vector3d sp1(kl1.startPointX, kl1.startPointY, 1.0);
+        const Eigen::Vector3d ep1(kl1.endPointX, kl1.endPointY, 1.0);
+
+        // Epipolar lines of the endpoints and of the midpoint
+        const Eigen::Vector3d les = F21*sp1;
+        const Eigen::Vector3d lee = F21*ep1;
+        const Eigen::Vector3d lem = F21*(0.5*(sp1+ep1));
+        const double nm = lem.head(2).norm();
+        if(nm<1e-9)
+            continue;
+
+        Eigen::Vector2d c1, c2;
+        if(!ClipLine(lem, minX, minY, maxX, maxY, c1, c2))
+            continue;
+
+        std::unordered_set<int> candidates;
+        getLineCoords((c1(0)-minX)*invW, (c1(1)-minY)*invH, (c2(0)-minX)*invW, (c2(1)-minY)*invH, line_coords);
+        for(const std::pair<int, int> &p : line_coords)
+            grid.get(p.first, p.second, win, candidates);
+
+        if(candidates.empty())
+            continue;
+
+        const cv::Mat d1 = pKF1->mDescriptors_l.row(i1);
+
+        int bestDist = 256, bestDist2 = 256;
+        int bestIdx = -1;
+
+        for(const int &i2 : candidates)
         {
-            if(!LastFrame.mvbOutlier_Line[i])
+            const Eigen::Vector3d &l2 = pKF2->mvle_l[i2];
+            if(std::fabs(l2.head(2).dot(lem.head(2)))>maxCosEpipolar*nm*l2.head(2).norm())
+                continue;
+
+            // Intersections of the keyline with the epipolar lines of the endpoints, along the keyline
+            const cv::line_descriptor::KeyLine &kl2 = pKF2->mvKeysUn_Line[i2];
+            const Eigen::Vector2d sp2(kl2.startPointX, kl2.startPointY);
+            const Eigen::Vector2d ep2(kl2.endPointX, kl2.endPointY);
+            const double length2 = (ep2-sp2).norm();
+            if(length2<1.0)
+                continue;
+            const Eigen::Vector2d dir2 = (ep2-sp2)/length2;
+
+            const Eigen::Vector3d xs = l2.cross(les);
+            const Eigen::Vector3d xe = l2.cross(lee);
+            if(std::fabs(xs(2))<1e-9 || std::fabs(xe(2))<1e-9)
+                continue;
+            const double ts = dir2.dot(xs.head(2)/xs(2)-sp2);
+            const double te = dir2.dot(xe.head(2)/xe(2)-sp2);
+
+            const double overlap = std::min(std::max(ts,te),length2) - std::max(std::min(ts,te),0.0);
+            if(overlap<minOverlap*std::min(length2,std::fabs(te-ts)))
+                continue;
+
+            const int dist = distance(d1, pKF2->mDescriptors_l.row(i2));
+
+            if(dist<bestDist)
             {
-                // Project Lines to the Image
-                Eigen::Vector3d sp = pML->GetWorldPos().head(3);
-                Eigen::Vector3d ep = pML->GetWorldPos().tail(3);
-                cv::Mat x3Dw_sp = Converter::toCvMat(sp);
-                cv::Mat x3Dw_ep = Converter::toCvMat(ep);
-                cv::Mat x3Dc_sp = Rcw*x3Dw_sp+tcw;
-                cv::Mat x3Dc_ep = Rcw*x3Dw_ep+tcw;
-
-                const float invzc_sp = 1.0/x3Dc_sp.at<float>(2);
-                const float invzc_ep = 1.0/x3Dc_ep.at<float>(2);
-
-                if(invzc_sp<0 || invzc_ep<0)
-                    continue;
+                bestDist2=bestDist;
+                bestDist=dist;
+                bestIdx=i2;
+            }
+            else if(dist<bestDist2)
+                bestDist2=dist;
+        }
 
-                cv::Point2f uv_sp = CurrentFrame.mpCamera->project(x3Dc_sp);
-                cv::Point2f uv_ep = CurrentFrame.mpCamera->project(x3Dc_ep);
+        if(bestDist>TH_HIGH || bestDist>=bestDist2*minRatio12L)
+            continue;
 
-                if(uv_sp.x<CurrentFrame.mnMinX || uv_sp.x>CurrentFrame.mnMaxX || uv_ep.x<CurrentFrame.mnMinX || uv_ep.x>CurrentFrame.mnMaxX)
-                    continue;
-                if(uv_sp.y<CurrentFrame.mnMinY || uv_sp.y>CurrentFrame.mnMaxY || uv_ep.y<CurrentFrame.mnMinY || uv_ep.y>CurrentFrame.mnMaxY)
-                    continue;
+        // Keep the closest descriptor if several keylines fall on the same keyline
+        if(bestDist<vDist21[bestIdx])
+        {
+            if(vMatches21[bestIdx]>=0)
+                vMatches12[vMatches21[bestIdx]] = -1;
+            vMatches21[bestIdx] = i1;
+            vDist21[bestIdx] = bestDist;
+            vMatches12[i1] = bestIdx;
+        }
+    }
 
-                int nLastOctave = LastFrame.mvKeys_Line[i].octave;
+    for(int i1=0; i1<pKF1->N_l; i1++)
+        if(vMatches12[i1]>=0)
+            vMatchedPairs.push_back(std::make_pair(i1, vMatches12[i1]));
 
-                // Search in a window. Size depends on scale
-                int window = floor(th);
+    return vMatchedPairs.size();
+}
 
-                if(CurrentFrame.mvScaleFactors_l[nLastOctave]>1)
-                    window = floor(th+CurrentFrame.mvScaleFactors_l[nLastOctave]);
+int LineMatcher::Fuse(KeyFrame* pKF, const std::vector<MapLine*> &vpMapLines)
+{
+    const int TH_LOW = 80;
+    const double chi2_95 = 5.991;   // 2 DoF, distances of both projected endpoints to the keyline
+    const double minOverlap = 0.5;  // over the shortest of the keyline and the projected line
 
-                GridWindow win;
-                win.width = std::make_pair(window, window);
-                win.height = std::make_pair(window, window);
+    if(pKF->mpCamera->GetType()!=pKF->mpCamera->CAM_PINHOLE || pKF->mpCamera2)
+        return 0;
 
-                const line_2d coords = std::make_pair(std::make_pair(uv_sp.x * CurrentFrame.inv_width, uv_sp.y * CurrentFrame.inv_height),
-                                        std::make_pair(uv_ep.x * CurrentFrame.inv_width, uv_ep.x * CurrentFrame.inv_height)); 
+    const Eigen::Matrix3d Rcw = Converter::toMatrix3d(pKF->GetRotation());
+    const Eigen::Vector3d tcw = Converter::toVector3d(pKF->GetTranslation());
+    const Eigen::Vector3d Ow = -Rcw.transpose()*tcw;
 
-                const point_2d spoint = coords.first;
-                const point_2d epoint = coords.second;
+    const double minX = pKF->mnMinX, minY = pKF->mnMinY;
+    const double invW = pKF->mfGridElementWidthInv, invH = pKF->mfGridElementHeightInv;
 
-                std::unordered_set<int> candidates;
-                grid.get(spoint.first, spoint.second, win, candidates);
-                grid.get(epoint.first, epoint.second, win, candidates);
+    // Fill in the grid of the keylines of the keyframe
+    GridStructure grid(FRAME_GRID_ROWS, FRAME_GRID_COLS);
+    std::list<std::pair<int, int>> line_coords;
+    for(int i=0; i<pKF->N_l; ++i)
+    {
+        const cv::line_descriptor::KeyLine &kl = pKF->mvKeysUn_Line[i];
+        getLineCoords((kl.startPointX-minX)*invW, (kl.startPointY-minY)*invH,
+                      (kl.endPointX-minX)*invW, (kl.endPointY-minY)*invH, line_coords);
+        for(const std::pair<int, int> &p : line_coords)
+            grid.at(p.first, p.second).push_back(i);
+    }
 
-                if (candidates.empty()) continue;
+    GridWindow win;
+    win.width = std::make_pair(1, 1);
+    win.height = std::make_pair(1, 1);
 
-                const cv::Mat dML = pML->GetDescriptor();
+    int nFused = 0;
 
-                int bestDist = 256;
-                int bestidx = -1;
+    for(size_t iML=0; iML<vpMapLines.size(); iML++)
+    {
+        MapLine* pML = vpMapLines[iML];
+        if(!pML || pML->isBad() || pML->IsInKeyFrame(pKF))
+            continue;
 
-                for (const int &i2 : candidates) 
-                {
-                    if(CurrentFrame.mvpMapLines[i2])
-                        if(CurrentFrame.mvpMapLines[i2]->Observations()>0)
-                            continue;
+        const Vector6d Xw = pML->GetWorldPos();
+        const Eigen::Vector3d x3Dc_sp = Rcw*Xw.head(3)+tcw;
+        const Eigen::Vector3d x3Dc_ep = Rcw*Xw.tail(3)+tcw;
 
-                    const int dist = distance(dML, CurrentFrame.mDescriptors_Line.row(i2));
+        // Depth must be positive
+        if(x3Dc_sp(2)<=0 || x3Dc_ep(2)<=0)
+            continue;
 
-                    if(dist<bestDist)
-                    {
-                        bestDist=dist;
-                        bestidx=i2;
-                    }
-                }
+        const Eigen::Vector2d uv_sp = pKF->mpCamera->project(x3Dc_sp);
+        const Eigen::Vector2d uv_ep = pKF->mpCamera->project(x3Dc_ep);
+        const Eigen::Vector2d uv_mid = 0.5*(uv_sp+uv_ep);
+
+        // Line must be inside the image (midpoint)
+        if(!pKF->IsInImage(uv_mid(0),uv_mid(1)))
+            continue;
+
+        const double length = (uv_ep-uv_sp).norm();
+        if(length<1.0)
+            continue;
+
+        // Depth must be inside the scale pyramid of the image
+        const Eigen::Vector3d PO = 0.5*(Xw.head(3)+Xw.tail(3))-Ow;
+        const double dist3D = PO.norm();
+        if(dist3D<pML->GetMinDistanceInvariance() || dist3D>pML->GetMaxDistanceInvariance())
+            continue;
+
+        // Viewing angle must be less than 60 deg
+        const Eigen::Vector3d Pn = Converter::toVector3d(pML->GetNormal());
+        if(PO.dot(Pn)<0.5*dist3D)
+            continue;
+
+        std::unordered_set<int> candidates;
+        getLineCoords((uv_sp(0)-minX)*invW, (uv_sp(1)-minY)*invH, (uv_ep(0)-minX)*invW, (uv_ep(1)-minY)*invH, line_coords);
+        for(const std::pair<int, int> &p : line_coords)
+            grid.get(p.first, p.second, win, candidates);
+
+        if(candidates.empty())
+            continue;
+
+        const Eigen::Vector2d dir = (uv_ep-uv_sp)/length;
+        const cv::Mat dML = pML->GetDescriptor();
+
+        int bestDist = 256;
+        int bestIdx = -1;
+
+        for(const int &idx : candidates)
+        {
+            const cv::line_descriptor::KeyLine &kl = pKF->mvKeysUn_Line[idx];
+            const Eigen::Vector3d &le = pKF->mvle_l[idx];
 
-                if(bestDist<=TH_HIGH)
+            // Reprojection error of the endpoints as in the optimization
+            const double es = le(0)*uv_sp(0)+le(1)*uv_sp(1)+le(2);
+            const double ee = le(0)*uv_ep(0)+le(1)*uv_ep(1)+le(2);
+            if((es*es+ee*ee)*pKF->mvInvLevelSigma2_l[kl.octave]>chi2_95)
+                continue;
+
+            // Overlap of the keyline and the projected line
+            const double ts = dir.dot(Eigen::Vector2d(kl.startPointX,kl.startPointY)-uv_sp);
+            const double te = dir.dot(Eigen::Vector2d(kl.endPointX,kl.endPointY)-uv_sp);
+            const double overlap = std::min(std::max(ts,te),length) - std::max(std::min(ts,te),0.0);
+            if(overlap<minOverlap*std::min(length,std::fabs(te-ts)))
+                continue;
+
+            const int dist = distance(dML, pKF->mDescriptors_l.row(idx));
+
+            if(dist<bestDist)
+            {
+                bestDist = dist;
+                bestIdx = idx;
+            }
+        }
+
+        // If there is already a MapLine replace otherwise add new measurement
+        if(bestDist<=TH_LOW)
+        {
+            MapLine* pMLinKF = pKF->GetMapLine(bestIdx);
+            if(pMLinKF)
+            {
+                if(!pMLinKF->isBad())
                 {
-                    float theta = CurrentFrame.mvKeys_Line[bestidx].angle-atan2(uv_ep.y - uv_sp.y, uv_ep.x - uv_sp.x);;
-                    if(theta<-M_PI) theta+=2*M_PI;
-                    else if(theta>M_PI) theta-=2*M_PI;
-                    if(fabs(theta)<angth)
-                    {
-                        CurrentFrame.mvpMapLines[bestidx]=pML;
-                        matches++;
-                    }
+                    if(pMLinKF->Observations()>pML->Observations())
+                        pML->Replace(pMLinKF);
+                    else
+                        pMLinKF->Replace(pML);
                 }
-
             }
+            else
+            {
+                pML->AddObservation(pKF,bestIdx);
+                pKF->AddMapLine(pML,bestIdx);
+            }
+            nFused++;
         }
     }
-    return matches;
+
+    return nFused;
 }
 
 } //namesapce ORB_SLAM3
@@ -21,9 +21,12 @@
 #include "LocalMapping.h"
 #include "LoopClosing.h"
 #include "ORBmatcher.h"
+#include "LineMatcher.h"
 #include "Optimizer.h"
 #include "Converter.h"
 #include "Tracking.h"
+#include "SolverUtils.h"
+#include "EpochReclaimer.h"
 
 #include<mutex>
 #include<chrono>
@@ -32,8 +35,8 @@ namespace ORB_SLAM3
 {
 
 LocalMapping::LocalMapping(System* pSys, Atlas *pAtlas, const float bMonocular, bool bInertial, const string &_strSeqName):
-    mpSystem(pSys), mbMonocular(bMonocular), mbInertial(bInertial), mbResetRequested(false), mbResetRequestedActiveMap(false), mbFinishRequested(false), mbFinished(true), mpAtlas(pAtlas), bInitializing(false),
-    mbAbortBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true),
+    mpSystem(pSys), mbMonocular(bMonocular), mbInertial(bInertial), mbResetRequested(false), mbResetRequestedActiveMap(false), mbFinishRequested(false), mbFinished(true), mbWakeUp(false), mpAtlas(pAtlas), bInitializing(false),
+    mbAbortBA(false), mnLinesFused(0), mptLocalBA(NULL), mbAbortLocalBA(false), mbStopped(false), mbStopRequested(false), mbNotStop(false), mbAcceptKeyFrames(true),
     mbNewInit(false), mIdxInit(0), mScale(1.0), mInitSect(0), mbNotBA1(true), mbNotBA2(true), mIdxIteration(0), infoInertial(Eigen::MatrixXd::Zero(9,9))
 {
     mnMatchesInliers = 0;
@@ -254,8 +257,8 @@ void LocalMapping::Run()
             // Safe area to stop
             while(isStopped() && !CheckFinish())
             {
-                // cout << "LM: usleep if is stopped" << endl;
-                usleep(3000);
+                // Wait for the release
+                WaitForWork(true);
             }
             if(CheckFinish())
                 break;
@@ -269,12 +272,15 @@ void LocalMapping::Run()
         if(CheckFinish())
             break;
 
-        // cout << "LM: normal usleep" << endl;
-        usleep(3000);
+        ReleaseBadLandmarks();
+
+        // Wait for a new keyframe
+        WaitForWork(false);
     }
 
     //f_lm.close();
 
+    EpochReclaimer::Unregister(EpochReclaimer::LOCAL_MAPPING);
     SetFinish();
 }
 
@@ -294,6 +300,13 @@ void LocalMapping::Run_Lines()
             // std::cout << "LM" << std::endl;
             std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
 
+            // Pipelined: the local BA of the previous keyframe may still be running in the BA thread, only its
+            // keyframe culling waits for the steps below
+            const bool bPipelined = mpTracker->mbLocalMappingPipeline && !mbInertial;
+            unique_lock<mutex> lockPipeline(mMutexLocalBAStage, std::defer_lock);
+            if(bPipelined)
+                lockPipeline.lock();
+
             // BoW conversion and insertion in Map
             ProcessNewKeyFrameWithLines();
             std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
@@ -307,6 +320,10 @@ void LocalMapping::Run_Lines()
 
             // Triangulate new MapPoints
             CreateNewMapPoints();
+
+            // Triangulate new MapLines
+            if(mpTracker->mbLineTriangulation)
+                CreateNewMapLines();
             std::chrono::steady_clock::time_point t3 = std::chrono::steady_clock::now();
 
             // Save here:
@@ -318,10 +335,11 @@ void LocalMapping::Run_Lines()
             // # fixedKFs in LBA
 
             mbAbortBA = false;
+            mnLinesFused = 0;
 
             if(!CheckNewKeyFrames())
             {
-                // Find more matches in neighbor keyframes and fuse point duplications
+                // Find more matches in neighbor keyframes and fuse point (and line) duplications
                 SearchInNeighbors();
             }
 
@@ -339,7 +357,12 @@ void LocalMapping::Run_Lines()
             //--
             int num_FixedKF_BA = 0;
 
-            if(!CheckNewKeyFrames() && !stopRequested())
+            if(bPipelined)
+            {
+                lockPipeline.unlock();
+                StartLocalBA(mpCurrentKeyFrame);
+            }
+            else if(!CheckNewKeyFrames() && !stopRequested())
             {
                 if(mpAtlas->KeyFramesInMap()>2)
                 {
@@ -366,18 +389,7 @@ void LocalMapping::Run_Lines()
                         Optimizer::LocalInertialBA(mpCurrentKeyFrame, &mbAbortBA, mpCurrentKeyFrame->GetMap(), bLarge, !mpCurrentKeyFrame->GetMap()->GetIniertialBA2());
                     }
                     else
-                    {
-                        //std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-                        if(mpTracker->SLAM==0)
-                            Optimizer::LocalBundleAdjustmentPL(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap(),num_FixedKF_BA);
-                        if(mpTracker->SLAM==1)
-                            Optimizer::LocalBundleAdjustmentOnlyLines(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap());
-                        if(mpTracker->SLAM==2)
-                            Optimizer::LocalBundleAdjustmentOnlyLinesAngle(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap());
-                        if(mpTracker->SLAM==3)
-                            Optimizer::LocalBundleAdjustmentOnlyLinesWithAngle(mpCurrentKeyFrame,&mbAbortBA, mpCurrentKeyFrame->GetMap());
-                        //std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-                    }
+                        LocalBundleAdjustmentWithLines(mpCurrentKeyFrame,&mbAbortBA,num_FixedKF_BA);
                 }
 
                 t5 = std::chrono::steady_clock::now();
@@ -391,7 +403,7 @@ void LocalMapping::Run_Lines()
                 }
 
                 // Check redundant local Keyframes
-                KeyFrameCullingWithLines();
+                KeyFrameCullingWithLines(mpCurrentKeyFrame);
 
                 t6 = std::chrono::steady_clock::now();
 
@@ -445,7 +457,9 @@ void LocalMapping::Run_Lines()
 
             std::chrono::steady_clock::time_point t7 = std::chrono::steady_clock::now();
 
-            mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
+            // Pipelined, the BA thread passes the keyframe to the loop closing
+            if(!bPipelined)
+                mpLoopCloser->InsertKeyFrame(mpCurrentKeyFrame);
             std::chrono::steady_clock::time_point t8 = std::chrono::steady_clock::now();
 
             double t_procKF = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t1 - t0).count();
@@ -456,6 +470,10 @@ void LocalMapping::Run_Lines()
             double t_Opt = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t5 - t4).count();
             double t_KF_cull = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t6 - t5).count();
 
+            if(!bPipelined)
+                Verbose::PrintMess("LM: " + to_string(mpAtlas->MapLinesInMap()) + " map lines, " + to_string(mnLinesFused) + " lines fused, local BA "
+                                   + to_string(t_Opt) + " ms", Verbose::VERBOSITY_DEBUG);
+
             // DEBUG
             //double total = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t8 - t0).count();
 
@@ -474,16 +492,23 @@ void LocalMapping::Run_Lines()
             //--
 
         }
-        else if(Stop() && !mbBadImu)
+        else
         {
-            // Safe area to stop
-            while(isStopped() && !CheckFinish())
+            // The local BA in the BA thread has to finish before stopping
+            if(stopRequested())
+                JoinLocalBA(true);
+
+            if(Stop() && !mbBadImu)
             {
-                // cout << "LM: usleep if is stopped" << endl;
-                usleep(3000);
+                // Safe area to stop
+                while(isStopped() && !CheckFinish())
+                {
+                    // Wait for the release
+                    WaitForWork(true);
+                }
+                if(CheckFinish())
+                    break;
             }
-            if(CheckFinish())
-                break;
         }
 
         ResetIfRequestedWithLines();
@@ -494,20 +519,152 @@ void LocalMapping::Run_Lines()
         if(CheckFinish())
             break;
 
-        // cout << "LM: normal usleep" << endl;
-        usleep(3000);
+        ReleaseBadLandmarks();
+
+        // Wait for a new keyframe
+        WaitForWork(false);
     }
 
     //f_lm.close();
 
+    JoinLocalBA(true);
+
+    EpochReclaimer::Unregister(EpochReclaimer::LOCAL_MAPPING);
     SetFinish();
 }
 
+void LocalMapping::LocalBundleAdjustmentWithLines(KeyFrame* pKF, bool* pbStopFlag, int &num_FixedKF_BA)
+{
+    if(mpTracker->SLAM==0)
+    {
+        const OptimizationBudget* pBudget = mpTracker->mbOptimizationBudget ? &mpTracker->mLocalBABudget : NULL;
+        OptimizationStats* pStats = pBudget ? &mLocalBAStats : NULL;
+        if(mpTracker->mnBASolver>=1 && !mpTracker->mbLineOrthonormal)
+        {
+            mBASolver.SetThreads(mpTracker->mnBAThreads);
+            mBASolver.SetSlidingWindow(mpTracker->mnBASolver==2);
+            mBASolver.LocalBundleAdjustmentPL(pKF,pbStopFlag, pKF->GetMap(),num_FixedKF_BA,pBudget,pStats);
+        }
+        else
+            Optimizer::LocalBundleAdjustmentPL(pKF,pbStopFlag, pKF->GetMap(),num_FixedKF_BA,mpTracker->mbLineOrthonormal,pBudget,pStats);
+
+        if(pStats)
+            Verbose::PrintMess("LM-LBA: " + to_string(pStats->nIterations) + " iterations, chi2 " + to_string(pStats->dChi2) + ", "
+                               + to_string(pStats->dTime) + " ms" + (pStats->bDeadline ? " (deadline)" : ""), Verbose::VERBOSITY_DEBUG);
+    }
+    if(mpTracker->SLAM==1)
+        Optimizer::LocalBundleAdjustmentOnlyLines(pKF,pbStopFlag, pKF->GetMap());
+    if(mpTracker->SLAM==2)
+        Optimizer::LocalBundleAdjustmentOnlyLinesAngle(pKF,pbStopFlag, pKF->GetMap());
+    if(mpTracker->SLAM==3)
+        Optimizer::LocalBundleAdjustmentOnlyLinesWithAngle(pKF,pbStopFlag, pKF->GetMap());
+}
+
+void LocalMapping::StartLocalBA(KeyFrame* pKF)
+{
+    // The local BA of the previous keyframe is aborted if it is still running, as a new keyframe would abort it
+    JoinLocalBA(true);
+
+    if(stopRequested())
+    {
+        mpLoopCloser->InsertKeyFrame(pKF);
+        return;
+    }
+
+    mbAbortLocalBA = false;
+    mptLocalBA = new thread(&LocalMapping::RunLocalBA, this, pKF);
+}
+
+void LocalMapping::JoinLocalBA(const bool bAbort)
+{
+    if(!mptLocalBA)
+        return;
+
+    if(bAbort)
+        mbAbortLocalBA = true;
+    mptLocalBA->join();
+    delete mptLocalBA;
+    mptLocalBA = NULL;
+}
+
+void LocalMapping::RunLocalBA(KeyFrame* pKF)
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    if(mpAtlas->KeyFramesInMap()>2)
+    {
+        int num_FixedKF_BA = 0;
+        LocalBundleAdjustmentWithLines(pKF,&mbAbortLocalBA,num_FixedKF_BA);
+    }
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+    {
+        // Check redundant local Keyframes, not concurrently with the processing of the next keyframe
+        unique_lock<mutex> lock(mMutexLocalBAStage);
+        if(!pKF->isBad())
+            KeyFrameCullingWithLines(pKF);
+    }
+
+    const double t_Opt = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(t1 - t0).count();
+    Verbose::PrintMess("LM: " + to_string(mpAtlas->MapLinesInMap()) + " map lines, local BA " + to_string(t_Opt) + " ms (pipelined)",
+                       Verbose::VERBOSITY_DEBUG);
+
+    mpLoopCloser->InsertKeyFrame(pKF);
+}
+
+void LocalMapping::ReleaseBadLandmarks()
+{
+    // The keyframes in the queue may hold landmarks set bad after the Tracking matched them, they are
+    // dropped when the keyframes are processed
+    if(!EpochReclaimer::IsEnabled() || mptLocalBA || CheckNewKeyFrames())
+        return;
+
+    for(list<MapPoint*>::iterator lit=mlpRecentAddedMapPoints.begin(); lit!=mlpRecentAddedMapPoints.end();)
+    {
+        if((*lit)->isBad())
+            lit = mlpRecentAddedMapPoints.erase(lit);
+        else
+            lit++;
+    }
+    for(list<MapLine*>::iterator lit=mlpRecentAddedMapLines.begin(); lit!=mlpRecentAddedMapLines.end();)
+    {
+        if((*lit)->isBad())
+            lit = mlpRecentAddedMapLines.erase(lit);
+        else
+            lit++;
+    }
+
+    EpochReclaimer::Quiescent(EpochReclaimer::LOCAL_MAPPING);
+}
+
 void LocalMapping::InsertKeyFrame(KeyFrame *pKF)
 {
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        mlNewKeyFrames.push_back(pKF);
+        mbAbortBA=true;
+    }
+    mcvNewKFs.notify_one();
+}
+
+void LocalMapping::WaitForWork(const bool bStopped)
+{
+    const int maxWaitMs = 100;
+
     unique_lock<mutex> lock(mMutexNewKFs);
-    mlNewKeyFrames.push_back(pKF);
-    mbAbortBA=true;
+    mcvNewKFs.wait_for(lock, std::chrono::milliseconds(maxWaitMs), [&]{
+        return mbWakeUp || (!bStopped && !mlNewKeyFrames.empty() && !mbBadImu);
+    });
+    mbWakeUp = false;
+}
+
+void LocalMapping::WakeUp()
+{
+    {
+        unique_lock<mutex> lock(mMutexNewKFs);
+        mbWakeUp = true;
+    }
+    mcvNewKFs.notify_one();
 }
 
 
@@ -550,6 +707,8 @@ void LocalMapping::ProcessNewKeyFrame()
                     mlpRecentAddedMapPoints.push_back(pMP);
                 }
             }
+            else // set bad after the Tracking matched it, it does not observe the keyframe
+                mpCurrentKeyFrame->EraseMapPointMatch(i);
         }
     }
 
@@ -596,6 +755,8 @@ void LocalMapping::ProcessNewKeyFrameWithLines()
                     mlpRecentAddedMapPoints.push_back(pMP);
                 }
             }
+            else // set bad after the Tracking matched it, it does not observe the keyframe
+                mpCurrentKeyFrame->EraseMapPointMatch(i);
         }
     }
 
@@ -617,6 +778,8 @@ void LocalMapping::ProcessNewKeyFrameWithLines()
                     mlpRecentAddedMapLines.push_back(pML);
                 }
             }
+            else
+                mpCurrentKeyFrame->EraseMapLineMatch(i);
         }
     }
 
@@ -735,6 +898,46 @@ void LocalMapping::CreateNewMapPoints()
         }
     }
 
+    // Search matches with epipolar restriction and triangulate. With several threads the neighbors are processed in
+    // parallel and their points added to the map afterwards in the order of the neighbors
+    const int nPairs = vpNeighKFs.size();
+    const int nThreads = std::min(mpTracker->mnTriangulationThreads, nPairs);
+    if(nThreads<=1)
+    {
+        for(int i=0; i<nPairs; i++)
+        {
+            if(i>0 && CheckNewKeyFrames())// && (mnMatchesInliers>50))
+                return;
+
+            vector<TriangulatedPoint> vPoints;
+            TriangulateWithKeyFrame(vpNeighKFs[i],vPoints);
+            AddTriangulatedPoints(vpNeighKFs[i],vPoints);
+        }
+        return;
+    }
+
+    vector<vector<TriangulatedPoint> > vvPoints(nPairs);
+    vector<char> vbProcessed(nPairs,0);
+    ParallelFor(nThreads, nPairs, [&](const int t, const int begin, const int end)
+    {
+        for(int i=begin; i<end; i++)
+        {
+            if(i>0 && CheckNewKeyFrames())
+                return;
+
+            TriangulateWithKeyFrame(vpNeighKFs[i],vvPoints[i]);
+            vbProcessed[i] = 1;
+        }
+    });
+
+    // The merge stops at the first neighbor not processed, as the serial loop would. A keypoint triangulated with
+    // several neighbors keeps the point of the first one
+    for(int i=0; i<nPairs && vbProcessed[i]; i++)
+        AddTriangulatedPoints(vpNeighKFs[i],vvPoints[i]);
+}
+
+void LocalMapping::TriangulateWithKeyFrame(KeyFrame* pKF2, vector<TriangulatedPoint> &vPoints)
+{
     float th = 0.6f;
 
     ORBmatcher matcher(th,false);
@@ -756,309 +959,466 @@ void LocalMapping::CreateNewMapPoints()
 
     const float ratioFactor = 1.5f*mpCurrentKeyFrame->mfScaleFactor;
 
-    // Search matches with epipolar restriction and triangulate
-    for(size_t i=0; i<vpNeighKFs.size(); i++)
+    GeometricCamera* pCamera1 = mpCurrentKeyFrame->mpCamera, *pCamera2 = pKF2->mpCamera;
+
+    // Check first that baseline is not too short
+    cv::Mat Ow2 = pKF2->GetCameraCenter();
+    cv::Mat vBaseline = Ow2-Ow1;
+    const float baseline = cv::norm(vBaseline);
+
+    if(!mbMonocular)
     {
-        if(i>0 && CheckNewKeyFrames())// && (mnMatchesInliers>50))
+        if(baseline<pKF2->mb)
+        return;
+    }
+    else
+    {
+        const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
+        const float ratioBaselineDepth = baseline/medianDepthKF2;
+
+        if(ratioBaselineDepth<0.01)
             return;
+    }
 
-        KeyFrame* pKF2 = vpNeighKFs[i];
+    // Compute Fundamental Matrix
+    cv::Mat F12 = ComputeF12(mpCurrentKeyFrame,pKF2);
+
+    // Search matches that fullfil epipolar constraint
+    vector<pair<size_t,size_t> > vMatchedIndices;
+    bool bCoarse = mbInertial &&
+            ((!mpCurrentKeyFrame->GetMap()->GetIniertialBA2() && mpCurrentKeyFrame->GetMap()->GetIniertialBA1())||
+             mpTracker->mState==Tracking::RECENTLY_LOST);
+    matcher.SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedIndices,false,bCoarse);
+
+    cv::Mat Rcw2 = pKF2->GetRotation();
+    cv::Mat Rwc2 = Rcw2.t();
+    cv::Mat tcw2 = pKF2->GetTranslation();
+    cv::Mat Tcw2(3,4,CV_32F);
+    Rcw2.copyTo(Tcw2.colRange(0,3));
+    tcw2.copyTo(Tcw2.col(3));
+
+    const float &fx2 = pKF2->fx;
+    const float &fy2 = pKF2->fy;
+    const float &cx2 = pKF2->cx;
+    const float &cy2 = pKF2->cy;
+    const float &invfx2 = pKF2->invfx;
+    const float &invfy2 = pKF2->invfy;
+
+    // Triangulate each match
+    const int nmatches = vMatchedIndices.size();
+    for(int ikp=0; ikp<nmatches; ikp++)
+    {
+        const int &idx1 = vMatchedIndices[ikp].first;
+        const int &idx2 = vMatchedIndices[ikp].second;
+
+        const cv::KeyPoint &kp1 = (mpCurrentKeyFrame -> NLeft == -1) ? mpCurrentKeyFrame->mvKeysUn[idx1]
+                                                                     : (idx1 < mpCurrentKeyFrame -> NLeft) ? mpCurrentKeyFrame -> mvKeys[idx1]
+                                                                                                           : mpCurrentKeyFrame -> mvKeysRight[idx1 - mpCurrentKeyFrame -> NLeft];
+        const float kp1_ur=mpCurrentKeyFrame->mvuRight[idx1];
+        bool bStereo1 = (!mpCurrentKeyFrame->mpCamera2 && kp1_ur>=0);
+        const bool bRight1 = (mpCurrentKeyFrame -> NLeft == -1 || idx1 < mpCurrentKeyFrame -> NLeft) ? false
+                                                                           : true;
+
+        const cv::KeyPoint &kp2 = (pKF2 -> NLeft == -1) ? pKF2->mvKeysUn[idx2]
+                                                        : (idx2 < pKF2 -> NLeft) ? pKF2 -> mvKeys[idx2]
+                                                                                 : pKF2 -> mvKeysRight[idx2 - pKF2 -> NLeft];
+
+        const float kp2_ur = pKF2->mvuRight[idx2];
+        bool bStereo2 = (!pKF2->mpCamera2 && kp2_ur>=0);
+        const bool bRight2 = (pKF2 -> NLeft == -1 || idx2 < pKF2 -> NLeft) ? false
+                                                                           : true;
+
+        if(mpCurrentKeyFrame->mpCamera2 && pKF2->mpCamera2){
+            if(bRight1 && bRight2){
+                Rcw1 = mpCurrentKeyFrame->GetRightRotation();
+                Rwc1 = Rcw1.t();
+                tcw1 = mpCurrentKeyFrame->GetRightTranslation();
+                Tcw1 = mpCurrentKeyFrame->GetRightPose();
+                Ow1 = mpCurrentKeyFrame->GetRightCameraCenter();
+
+                Rcw2 = pKF2->GetRightRotation();
+                Rwc2 = Rcw2.t();
+                tcw2 = pKF2->GetRightTranslation();
+                Tcw2 = pKF2->GetRightPose();
+                Ow2 = pKF2->GetRightCameraCenter();
+
+                pCamera1 = mpCurrentKeyFrame->mpCamera2;
+                pCamera2 = pKF2->mpCamera2;
+            }
+            else if(bRight1 && !bRight2){
+                Rcw1 = mpCurrentKeyFrame->GetRightRotation();
+                Rwc1 = Rcw1.t();
+                tcw1 = mpCurrentKeyFrame->GetRightTranslation();
+                Tcw1 = mpCurrentKeyFrame->GetRightPose();
+                Ow1 = mpCurrentKeyFrame->GetRightCameraCenter();
+
+                Rcw2 = pKF2->GetRotation();
+                Rwc2 = Rcw2.t();
+                tcw2 = pKF2->GetTranslation();
+                Tcw2 = pKF2->GetPose();
+                Ow2 = pKF2->GetCameraCenter();
+
+                pCamera1 = mpCurrentKeyFrame->mpCamera2;
+                pCamera2 = pKF2->mpCamera;
+            }
+            else if(!bRight1 && bRight2){
+                Rcw1 = mpCurrentKeyFrame->GetRotation();
+                Rwc1 = Rcw1.t();
+                tcw1 = mpCurrentKeyFrame->GetTranslation();
+                Tcw1 = mpCurrentKeyFrame->GetPose();
+                Ow1 = mpCurrentKeyFrame->GetCameraCenter();
+
+                Rcw2 = pKF2->GetRightRotation();
+                Rwc2 = Rcw2.t();
+                tcw2 = pKF2->GetRightTranslation();
+                Tcw2 = pKF2->GetRightPose();
+                Ow2 = pKF2->GetRightCameraCenter();
+
+                pCamera1 = mpCurrentKeyFrame->mpCamera;
+                pCamera2 = pKF2->mpCamera2;
+            }
+            else{
+                Rcw1 = mpCurrentKeyFrame->GetRotation();
+                Rwc1 = Rcw1.t();
+                tcw1 = mpCurrentKeyFrame->GetTranslation();
+                Tcw1 = mpCurrentKeyFrame->GetPose();
+                Ow1 = mpCurrentKeyFrame->GetCameraCenter();
+
+                Rcw2 = pKF2->GetRotation();
+                Rwc2 = Rcw2.t();
+                tcw2 = pKF2->GetTranslation();
+                Tcw2 = pKF2->GetPose();
+                Ow2 = pKF2->GetCameraCenter();
+
+                pCamera1 = mpCurrentKeyFrame->mpCamera;
+                pCamera2 = pKF2->mpCamera;
+            }
+        }
 
-        GeometricCamera* pCamera1 = mpCurrentKeyFrame->mpCamera, *pCamera2 = pKF2->mpCamera;
+        // Check parallax between rays
+        cv::Mat xn1 = pCamera1->unprojectMat(kp1.pt);
+        cv::Mat xn2 = pCamera2->unprojectMat(kp2.pt);
 
-        // Check first that baseline is not too short
-        cv::Mat Ow2 = pKF2->GetCameraCenter();
-        cv::Mat vBaseline = Ow2-Ow1;
-        const float baseline = cv::norm(vBaseline);
+        cv::Mat ray1 = Rwc1*xn1;
+        cv::Mat ray2 = Rwc2*xn2;
+        const float cosParallaxRays = ray1.dot(ray2)/(cv::norm(ray1)*cv::norm(ray2));
 
-        if(!mbMonocular)
+        float cosParallaxStereo = cosParallaxRays+1;
+        float cosParallaxStereo1 = cosParallaxStereo;
+        float cosParallaxStereo2 = cosParallaxStereo;
+
+        if(bStereo1)
+            cosParallaxStereo1 = cos(2*atan2(mpCurrentKeyFrame->mb/2,mpCurrentKeyFrame->mvDepth[idx1]));
+        else if(bStereo2)
+            cosParallaxStereo2 = cos(2*atan2(pKF2->mb/2,pKF2->mvDepth[idx2]));
+
+        cosParallaxStereo = min(cosParallaxStereo1,cosParallaxStereo2);
+
+        cv::Mat x3D;
+        if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 ||
+           (cosParallaxRays<0.9998 && mbInertial) || (cosParallaxRays<0.9998 && !mbInertial)))
         {
-            if(baseline<pKF2->mb)
+            // Linear Triangulation Method
+            cv::Mat A(4,4,CV_32F);
+            A.row(0) = xn1.at<float>(0)*Tcw1.row(2)-Tcw1.row(0);
+            A.row(1) = xn1.at<float>(1)*Tcw1.row(2)-Tcw1.row(1);
+            A.row(2) = xn2.at<float>(0)*Tcw2.row(2)-Tcw2.row(0);
+            A.row(3) = xn2.at<float>(1)*Tcw2.row(2)-Tcw2.row(1);
+
+            cv::Mat w,u,vt;
+            cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
+
+            x3D = vt.row(3).t();
+
+            if(x3D.at<float>(3)==0)
+                continue;
+
+            // Euclidean coordinates
+            x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
+
+        }
+        else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)
+        {
+            x3D = mpCurrentKeyFrame->UnprojectStereo(idx1);
+        }
+        else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)
+        {
+            x3D = pKF2->UnprojectStereo(idx2);
+        }
+        else
+        {
+            continue; //No stereo and very low parallax
+        }
+
+        cv::Mat x3Dt = x3D.t();
+
+        if(x3Dt.empty()) continue;
+        //Check triangulation in front of cameras
+        float z1 = Rcw1.row(2).dot(x3Dt)+tcw1.at<float>(2);
+        if(z1<=0)
             continue;
+
+        float z2 = Rcw2.row(2).dot(x3Dt)+tcw2.at<float>(2);
+        if(z2<=0)
+            continue;
+
+        //Check reprojection error in first keyframe
+        const float &sigmaSquare1 = mpCurrentKeyFrame->mvLevelSigma2[kp1.octave];
+        const float x1 = Rcw1.row(0).dot(x3Dt)+tcw1.at<float>(0);
+        const float y1 = Rcw1.row(1).dot(x3Dt)+tcw1.at<float>(1);
+        const float invz1 = 1.0/z1;
+
+        if(!bStereo1)
+        {
+            cv::Point2f uv1 = pCamera1->project(cv::Point3f(x1,y1,z1));
+            float errX1 = uv1.x - kp1.pt.x;
+            float errY1 = uv1.y - kp1.pt.y;
+
+            if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)
+                continue;
+
         }
         else
         {
-            const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
-            const float ratioBaselineDepth = baseline/medianDepthKF2;
+            float u1 = fx1*x1*invz1+cx1;
+            float u1_r = u1 - mpCurrentKeyFrame->mbf*invz1;
+            float v1 = fy1*y1*invz1+cy1;
+            float errX1 = u1 - kp1.pt.x;
+            float errY1 = v1 - kp1.pt.y;
+            float errX1_r = u1_r - kp1_ur;
+            if((errX1*errX1+errY1*errY1+errX1_r*errX1_r)>7.8*sigmaSquare1)
+                continue;
+        }
 
-            if(ratioBaselineDepth<0.01)
+        //Check reprojection error in second keyframe
+        const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
+        const float x2 = Rcw2.row(0).dot(x3Dt)+tcw2.at<float>(0);
+        const float y2 = Rcw2.row(1).dot(x3Dt)+tcw2.at<float>(1);
+        const float invz2 = 1.0/z2;
+        if(!bStereo2)
+        {
+            cv::Point2f uv2 = pCamera2->project(cv::Point3f(x2,y2,z2));
+            float errX2 = uv2.x - kp2.pt.x;
+            float errY2 = uv2.y - kp2.pt.y;
+            if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)
+                continue;
+        }
+        else
+        {
+            float u2 = fx2*x2*invz2+cx2;
+            float u2_r = u2 - mpCurrentKeyFrame->mbf*invz2;
+            float v2 = fy2*y2*invz2+cy2;
+            float errX2 = u2 - kp2.pt.x;
+            float errY2 = v2 - kp2.pt.y;
+            float errX2_r = u2_r - kp2_ur;
+            if((errX2*errX2+errY2*errY2+errX2_r*errX2_r)>7.8*sigmaSquare2)
                 continue;
         }
 
-        // Compute Fundamental Matrix
-        cv::Mat F12 = ComputeF12(mpCurrentKeyFrame,pKF2);
+        //Check scale consistency
+        cv::Mat normal1 = x3D-Ow1;
+        float dist1 = cv::norm(normal1);
 
-        // Search matches that fullfil epipolar constraint
-        vector<pair<size_t,size_t> > vMatchedIndices;
-        bool bCoarse = mbInertial &&
-                ((!mpCurrentKeyFrame->GetMap()->GetIniertialBA2() && mpCurrentKeyFrame->GetMap()->GetIniertialBA1())||
-                 mpTracker->mState==Tracking::RECENTLY_LOST);
-        matcher.SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedIndices,false,bCoarse);
-
-        cv::Mat Rcw2 = pKF2->GetRotation();
-        cv::Mat Rwc2 = Rcw2.t();
-        cv::Mat tcw2 = pKF2->GetTranslation();
-        cv::Mat Tcw2(3,4,CV_32F);
-        Rcw2.copyTo(Tcw2.colRange(0,3));
-        tcw2.copyTo(Tcw2.col(3));
+        cv::Mat normal2 = x3D-Ow2;
+        float dist2 = cv::norm(normal2);
 
-        const float &fx2 = pKF2->fx;
-        const float &fy2 = pKF2->fy;
-        const float &cx2 = pKF2->cx;
-        const float &cy2 = pKF2->cy;
-        const float &invfx2 = pKF2->invfx;
-        const float &invfy2 = pKF2->invfy;
+        if(dist1==0 || dist2==0)
+            continue;
 
-        // Triangulate each match
-        const int nmatches = vMatchedIndices.size();
-        for(int ikp=0; ikp<nmatches; ikp++)
-        {
-            const int &idx1 = vMatchedIndices[ikp].first;
-            const int &idx2 = vMatchedIndices[ikp].second;
-
-            const cv::KeyPoint &kp1 = (mpCurrentKeyFrame -> NLeft == -1) ? mpCurrentKeyFrame->mvKeysUn[idx1]
-                                                                         : (idx1 < mpCurrentKeyFrame -> NLeft) ? mpCurrentKeyFrame -> mvKeys[idx1]
-                                                                                                               : mpCurrentKeyFrame -> mvKeysRight[idx1 - mpCurrentKeyFrame -> NLeft];
-            const float kp1_ur=mpCurrentKeyFrame->mvuRight[idx1];
-            bool bStereo1 = (!mpCurrentKeyFrame->mpCamera2 && kp1_ur>=0);
-            const bool bRight1 = (mpCurrentKeyFrame -> NLeft == -1 || idx1 < mpCurrentKeyFrame -> NLeft) ? false
-                                                                               : true;
-
-            const cv::KeyPoint &kp2 = (pKF2 -> NLeft == -1) ? pKF2->mvKeysUn[idx2]
-                                                            : (idx2 < pKF2 -> NLeft) ? pKF2 -> mvKeys[idx2]
-                                                                                     : pKF2 -> mvKeysRight[idx2 - pKF2 -> NLeft];
-
-            const float kp2_ur = pKF2->mvuRight[idx2];
-            bool bStereo2 = (!pKF2->mpCamera2 && kp2_ur>=0);
-            const bool bRight2 = (pKF2 -> NLeft == -1 || idx2 < pKF2 -> NLeft) ? false
-                                                                               : true;
-
-            if(mpCurrentKeyFrame->mpCamera2 && pKF2->mpCamera2){
-                if(bRight1 && bRight2){
-                    Rcw1 = mpCurrentKeyFrame->GetRightRotation();
-                    Rwc1 = Rcw1.t();
-                    tcw1 = mpCurrentKeyFrame->GetRightTranslation();
-                    Tcw1 = mpCurrentKeyFrame->GetRightPose();
-                    Ow1 = mpCurrentKeyFrame->GetRightCameraCenter();
-
-                    Rcw2 = pKF2->GetRightRotation();
-                    Rwc2 = Rcw2.t();
-                    tcw2 = pKF2->GetRightTranslation();
-                    Tcw2 = pKF2->GetRightPose();
-                    Ow2 = pKF2->GetRightCameraCenter();
-
-                    pCamera1 = mpCurrentKeyFrame->mpCamera2;
-                    pCamera2 = pKF2->mpCamera2;
-                }
-                else if(bRight1 && !bRight2){
-                    Rcw1 = mpCurrentKeyFrame->GetRightRotation();
-                    Rwc1 = Rcw1.t();
-                    tcw1 = mpCurrentKeyFrame->GetRightTranslation();
-                    Tcw1 = mpCurrentKeyFrame->GetRightPose();
-                    Ow1 = mpCurrentKeyFrame->GetRightCameraCenter();
-
-                    Rcw2 = pKF2->GetRotation();
-                    Rwc2 = Rcw2.t();
-                    tcw2 = pKF2->GetTranslation();
-                    Tcw2 = pKF2->GetPose();
-                    Ow2 = pKF2->GetCameraCenter();
-
-                    pCamera1 = mpCurrentKeyFrame->mpCamera2;
-                    pCamera2 = pKF2->mpCamera;
-                }
-                else if(!bRight1 && bRight2){
-                    Rcw1 = mpCurrentKeyFrame->GetRotation();
-                    Rwc1 = Rcw1.t();
-                    tcw1 = mpCurrentKeyFrame->GetTranslation();
-                    Tcw1 = mpCurrentKeyFrame->GetPose();
-                    Ow1 = mpCurrentKeyFrame->GetCameraCenter();
-
-                    Rcw2 = pKF2->GetRightRotation();
-                    Rwc2 = Rcw2.t();
-                    tcw2 = pKF2->GetRightTranslation();
-                    Tcw2 = pKF2->GetRightPose();
-                    Ow2 = pKF2->GetRightCameraCenter();
-
-                    pCamera1 = mpCurrentKeyFrame->mpCamera;
-                    pCamera2 = pKF2->mpCamera2;
-                }
-                else{
-                    Rcw1 = mpCurrentKeyFrame->GetRotation();
-                    Rwc1 = Rcw1.t();
-                    tcw1 = mpCurrentKeyFrame->GetTranslation();
-                    Tcw1 = mpCurrentKeyFrame->GetPose();
-                    Ow1 = mpCurrentKeyFrame->GetCameraCenter();
-
-                    Rcw2 = pKF2->GetRotation();
-                    Rwc2 = Rcw2.t();
-                    tcw2 = pKF2->GetTranslation();
-                    Tcw2 = pKF2->GetPose();
-                    Ow2 = pKF2->GetCameraCenter();
-
-                    pCamera1 = mpCurrentKeyFrame->mpCamera;
-                    pCamera2 = pKF2->mpCamera;
-                }
-            }
+        if(mbFarPoints && (dist1>=mThFarPoints||dist2>=mThFarPoints)) // MODIFICATION
+            continue;
 
-            // Check parallax between rays
-            cv::Mat xn1 = pCamera1->unprojectMat(kp1.pt);
-            cv::Mat xn2 = pCamera2->unprojectMat(kp2.pt);
+        const float ratioDist = dist2/dist1;
+        const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors[kp1.octave]/pKF2->mvScaleFactors[kp2.octave];
 
-            cv::Mat ray1 = Rwc1*xn1;
-            cv::Mat ray2 = Rwc2*xn2;
-            const float cosParallaxRays = ray1.dot(ray2)/(cv::norm(ray1)*cv::norm(ray2));
+        if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)
+            continue;
 
-            float cosParallaxStereo = cosParallaxRays+1;
-            float cosParallaxStereo1 = cosParallaxStereo;
-            float cosParallaxStereo2 = cosParallaxStereo;
+        // Triangulation is succesfull
+        TriangulatedPoint point;
+        point.idx1 = idx1;
+        point.idx2 = idx2;
+        point.x3D = x3D;
+        vPoints.push_back(point);
+    }
+}
 
-            if(bStereo1)
-                cosParallaxStereo1 = cos(2*atan2(mpCurrentKeyFrame->mb/2,mpCurrentKeyFrame->mvDepth[idx1]));
-            else if(bStereo2)
-                cosParallaxStereo2 = cos(2*atan2(pKF2->mb/2,pKF2->mvDepth[idx2]));
+void LocalMapping::AddTriangulatedPoints(KeyFrame* pKF2, const vector<TriangulatedPoint> &vPoints)
+{
+    for(size_t i=0; i<vPoints.size(); i++)
+    {
+        const int &idx1 = vPoints[i].idx1;
+        const int &idx2 = vPoints[i].idx2;
 
-            cosParallaxStereo = min(cosParallaxStereo1,cosParallaxStereo2);
+        // Already triangulated with a previous neighbor
+        if(mpCurrentKeyFrame->GetMapPoint(idx1) || pKF2->GetMapPoint(idx2))
+            continue;
 
-            cv::Mat x3D;
-            if(cosParallaxRays<cosParallaxStereo && cosParallaxRays>0 && (bStereo1 || bStereo2 ||
-               (cosParallaxRays<0.9998 && mbInertial) || (cosParallaxRays<0.9998 && !mbInertial)))
-            {
-                // Linear Triangulation Method
-                cv::Mat A(4,4,CV_32F);
-                A.row(0) = xn1.at<float>(0)*Tcw1.row(2)-Tcw1.row(0);
-                A.row(1) = xn1.at<float>(1)*Tcw1.row(2)-Tcw1.row(1);
-                A.row(2) = xn2.at<float>(0)*Tcw2.row(2)-Tcw2.row(0);
-                A.row(3) = xn2.at<float>(1)*Tcw2.row(2)-Tcw2.row(1);
+        MapPoint* pMP = new MapPoint(vPoints[i].x3D,mpCurrentKeyFrame,mpAtlas->GetCurrentMap());
 
-                cv::Mat w,u,vt;
-                cv::SVD::compute(A,w,u,vt,cv::SVD::MODIFY_A| cv::SVD::FULL_UV);
+        pMP->AddObservation(mpCurrentKeyFrame,idx1);
+        pMP->AddObservation(pKF2,idx2);
 
-                x3D = vt.row(3).t();
+        mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
+        pKF2->AddMapPoint(pMP,idx2);
 
-                if(x3D.at<float>(3)==0)
-                    continue;
+        pMP->ComputeDistinctiveDescriptors();
 
-                // Euclidean coordinates
-                x3D = x3D.rowRange(0,3)/x3D.at<float>(3);
+        pMP->UpdateNormalAndDepth();
+
+        mpAtlas->AddMapPoint(pMP);
+        mlpRecentAddedMapPoints.push_back(pMP);
+    }
+}
 
-            }
-            else if(bStereo1 && cosParallaxStereo1<cosParallaxStereo2)
-            {
-                x3D = mpCurrentKeyFrame->UnprojectStereo(idx1);
-            }
-            else if(bStereo2 && cosParallaxStereo2<cosParallaxStereo1)
-            {
-                x3D = pKF2->UnprojectStereo(idx2);
-            }
-            else
-            {
-                continue; //No stereo and very low parallax
-            }
 
-            cv::Mat x3Dt = x3D.t();
+void LocalMapping::CreateNewMapLines()
+{
+    // Lines are triangulated for pinhole monocular/stereo/RGB-D keyframes only
+    if(mpCurrentKeyFrame->mpCamera->GetType()!=mpCurrentKeyFrame->mpCamera->CAM_PINHOLE || mpCurrentKeyFrame->mpCamera2)
+        return;
+
+    // Retrieve neighbor keyframes in covisibility graph
+    int nn = 10;
+    if(mbMonocular)
+        nn=20;
+    const vector<KeyFrame*> vpNeighKFs = mpCurrentKeyFrame->GetBestCovisibilityKeyFrames(nn);
+
+    const Eigen::Matrix3d Rcw1 = Converter::toMatrix3d(mpCurrentKeyFrame->GetRotation());
+    const Eigen::Vector3d tcw1 = Converter::toVector3d(mpCurrentKeyFrame->GetTranslation());
+    const Eigen::Matrix3d Rwc1 = Rcw1.transpose();
+    const Eigen::Vector3d Ow1 = -Rwc1*tcw1;
+
+    const float &fx1 = mpCurrentKeyFrame->fx;
+    const float &fy1 = mpCurrentKeyFrame->fy;
+    const float &cx1 = mpCurrentKeyFrame->cx;
+    const float &cy1 = mpCurrentKeyFrame->cy;
+    const float &invfx1 = mpCurrentKeyFrame->invfx;
+    const float &invfy1 = mpCurrentKeyFrame->invfy;
+
+    const float ratioFactor = 1.5f*(mpCurrentKeyFrame->mnScaleLevels_l>1 ? mpCurrentKeyFrame->mvScaleFactors_l[1] : 1.f);
 
-            if(x3Dt.empty()) continue;
-            //Check triangulation in front of cameras
-            float z1 = Rcw1.row(2).dot(x3Dt)+tcw1.at<float>(2);
-            if(z1<=0)
+    // Search matches with epipolar restriction and triangulate
+    for(size_t i=0; i<vpNeighKFs.size(); i++)
+    {
+        if(i>0 && CheckNewKeyFrames())
+            return;
+
+        KeyFrame* pKF2 = vpNeighKFs[i];
+        if(pKF2->mpCamera->GetType()!=pKF2->mpCamera->CAM_PINHOLE || pKF2->mpCamera2)
+            continue;
+
+        // Check first that baseline is not too short
+        const Eigen::Matrix3d Rcw2 = Converter::toMatrix3d(pKF2->GetRotation());
+        const Eigen::Vector3d tcw2 = Converter::toVector3d(pKF2->GetTranslation());
+        const Eigen::Vector3d Ow2 = -Rcw2.transpose()*tcw2;
+        const float baseline = (Ow2-Ow1).norm();
+
+        if(!mbMonocular)
+        {
+            if(baseline<pKF2->mb)
                 continue;
+        }
+        else
+        {
+            const float medianDepthKF2 = pKF2->ComputeSceneMedianDepth(2);
+            const float ratioBaselineDepth = baseline/medianDepthKF2;
 
-            float z2 = Rcw2.row(2).dot(x3Dt)+tcw2.at<float>(2);
-            if(z2<=0)
+            if(ratioBaselineDepth<0.01)
                 continue;
+        }
+
+        // Search matches that fullfil epipolar constraint
+        cv::Mat F12 = ComputeF12(mpCurrentKeyFrame,pKF2);
+        vector<pair<size_t,size_t> > vMatchedIndices;
+        LineMatcher::SearchForTriangulation(mpCurrentKeyFrame,pKF2,F12,vMatchedIndices);
 
-            //Check reprojection error in first keyframe
-            const float &sigmaSquare1 = mpCurrentKeyFrame->mvLevelSigma2[kp1.octave];
-            const float x1 = Rcw1.row(0).dot(x3Dt)+tcw1.at<float>(0);
-            const float y1 = Rcw1.row(1).dot(x3Dt)+tcw1.at<float>(1);
-            const float invz1 = 1.0/z1;
+        const float &fx2 = pKF2->fx;
+        const float &fy2 = pKF2->fy;
+        const float &cx2 = pKF2->cx;
+        const float &cy2 = pKF2->cy;
 
-            if(!bStereo1)
-            {
-                cv::Point2f uv1 = pCamera1->project(cv::Point3f(x1,y1,z1));
-                float errX1 = uv1.x - kp1.pt.x;
-                float errY1 = uv1.y - kp1.pt.y;
+        // Triangulate each match: the rays of the endpoints of the keyline in the current keyframe are
+        // intersected with the plane back-projected from the keyline in pKF2
+        const int nmatches = vMatchedIndices.size();
+        for(int ikl=0; ikl<nmatches; ikl++)
+        {
+            const size_t &idx1 = vMatchedIndices[ikl].first;
+            const size_t &idx2 = vMatchedIndices[ikl].second;
+
+            const cv::line_descriptor::KeyLine &kl1 = mpCurrentKeyFrame->mvKeysUn_Line[idx1];
+            const cv::line_descriptor::KeyLine &kl2 = pKF2->mvKeysUn_Line[idx2];
+            const Eigen::Vector3d &le1 = mpCurrentKeyFrame->mvle_l[idx1];
+            const Eigen::Vector3d &le2 = pKF2->mvle_l[idx2];
+
+            // Planes through the camera centers and the keylines (normals in world frame)
+            const Eigen::Vector3d n1 = Rwc1*Eigen::Vector3d(fx1*le1(0), fy1*le1(1), cx1*le1(0)+cy1*le1(1)+le1(2));
+            const Eigen::Vector3d nc2(fx2*le2(0), fy2*le2(1), cx2*le2(0)+cy2*le2(1)+le2(2));
+            const Eigen::Vector3d n2 = Rcw2.transpose()*nc2;
+            const double d2 = nc2.dot(tcw2);
+
+            // Check parallax between the planes
+            const double cosParallaxPlanes = std::fabs(n1.dot(n2))/(n1.norm()*n2.norm());
+            if(cosParallaxPlanes>0.9998)
+                continue;
 
-                if((errX1*errX1+errY1*errY1)>5.991*sigmaSquare1)
-                    continue;
+            const Eigen::Vector3d rays = Rwc1*Eigen::Vector3d((kl1.startPointX-cx1)*invfx1, (kl1.startPointY-cy1)*invfy1, 1.0);
+            const Eigen::Vector3d raye = Rwc1*Eigen::Vector3d((kl1.endPointX-cx1)*invfx1, (kl1.endPointY-cy1)*invfy1, 1.0);
+            const double dens = n2.dot(rays);
+            const double dene = n2.dot(raye);
+            if(std::fabs(dens)<1e-9 || std::fabs(dene)<1e-9)
+                continue;
 
-            }
-            else
-            {
-                float u1 = fx1*x1*invz1+cx1;
-                float u1_r = u1 - mpCurrentKeyFrame->mbf*invz1;
-                float v1 = fy1*y1*invz1+cy1;
-                float errX1 = u1 - kp1.pt.x;
-                float errY1 = v1 - kp1.pt.y;
-                float errX1_r = u1_r - kp1_ur;
-                if((errX1*errX1+errY1*errY1+errX1_r*errX1_r)>7.8*sigmaSquare1)
-                    continue;
-            }
+            // Check triangulation in front of cameras (the ray parameter is the depth in the current keyframe)
+            const double z1s = -(n2.dot(Ow1)+d2)/dens;
+            const double z1e = -(n2.dot(Ow1)+d2)/dene;
+            if(z1s<=0 || z1e<=0)
+                continue;
 
-            //Check reprojection error in second keyframe
-            const float sigmaSquare2 = pKF2->mvLevelSigma2[kp2.octave];
-            const float x2 = Rcw2.row(0).dot(x3Dt)+tcw2.at<float>(0);
-            const float y2 = Rcw2.row(1).dot(x3Dt)+tcw2.at<float>(1);
-            const float invz2 = 1.0/z2;
-            if(!bStereo2)
-            {
-                cv::Point2f uv2 = pCamera2->project(cv::Point3f(x2,y2,z2));
-                float errX2 = uv2.x - kp2.pt.x;
-                float errY2 = uv2.y - kp2.pt.y;
-                if((errX2*errX2+errY2*errY2)>5.991*sigmaSquare2)
-                    continue;
-            }
-            else
-            {
-                float u2 = fx2*x2*invz2+cx2;
-                float u2_r = u2 - mpCurrentKeyFrame->mbf*invz2;
-                float v2 = fy2*y2*invz2+cy2;
-                float errX2 = u2 - kp2.pt.x;
-                float errY2 = v2 - kp2.pt.y;
-                float errX2_r = u2_r - kp2_ur;
-                if((errX2*errX2+errY2*errY2+errX2_r*errX2_r)>7.8*sigmaSquare2)
-                    continue;
-            }
+            const Eigen::Vector3d sp3D = Ow1 + z1s*rays;
+            const Eigen::Vector3d ep3D = Ow1 + z1e*raye;
 
-            //Check scale consistency
-            cv::Mat normal1 = x3D-Ow1;
-            float dist1 = cv::norm(normal1);
+            const double z2s = Rcw2.row(2).dot(sp3D)+tcw2(2);
+            const double z2e = Rcw2.row(2).dot(ep3D)+tcw2(2);
+            if(z2s<=0 || z2e<=0)
+                continue;
 
-            cv::Mat normal2 = x3D-Ow2;
-            float dist2 = cv::norm(normal2);
+            // Check scale consistency
+            const Eigen::Vector3d mid3D = 0.5*(sp3D+ep3D);
+            const float dist1 = (mid3D-Ow1).norm();
+            const float dist2 = (mid3D-Ow2).norm();
 
             if(dist1==0 || dist2==0)
                 continue;
 
-            if(mbFarPoints && (dist1>=mThFarPoints||dist2>=mThFarPoints)) // MODIFICATION
+            if(mbFarPoints && (dist1>=mThFarPoints||dist2>=mThFarPoints))
                 continue;
 
             const float ratioDist = dist2/dist1;
-            const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors[kp1.octave]/pKF2->mvScaleFactors[kp2.octave];
+            const float ratioOctave = mpCurrentKeyFrame->mvScaleFactors_l[kl1.octave]/pKF2->mvScaleFactors_l[kl2.octave];
 
             if(ratioDist*ratioFactor<ratioOctave || ratioDist>ratioOctave*ratioFactor)
                 continue;
 
             // Triangulation is succesfull
-            MapPoint* pMP = new MapPoint(x3D,mpCurrentKeyFrame,mpAtlas->GetCurrentMap());
+            MapLine* pML = new MapLine(sp3D,ep3D,mpCurrentKeyFrame,mpAtlas->GetCurrentMap());
 
-            pMP->AddObservation(mpCurrentKeyFrame,idx1);            
-            pMP->AddObservation(pKF2,idx2);
+            pML->AddObservation(mpCurrentKeyFrame,idx1);
+            pML->AddObservation(pKF2,idx2);
 
-            mpCurrentKeyFrame->AddMapPoint(pMP,idx1);
-            pKF2->AddMapPoint(pMP,idx2);
+            mpCurrentKeyFrame->AddMapLine(pML,idx1);
+            pKF2->AddMapLine(pML,idx2);
 
-            pMP->ComputeDistinctiveDescriptors();
+            pML->ComputeDistinctiveDescriptors();
 
-            pMP->UpdateNormalAndDepth();
+            pML->UpdateNormalAndDepth();
 
-            mpAtlas->AddMapPoint(pMP);
-            mlpRecentAddedMapPoints.push_back(pMP);
+            mpAtlas->AddMapLine(pML);
+            mlpRecentAddedMapLines.push_back(pML);
         }
     }
 }
 
-
 void LocalMapping::SearchInNeighbors()
 {
     // Retrieve neighbor keyframes
@@ -1149,6 +1509,47 @@ void LocalMapping::SearchInNeighbors()
     matcher.Fuse(mpCurrentKeyFrame,vpFuseCandidates);
     if(mpCurrentKeyFrame->NLeft != -1) matcher.Fuse(mpCurrentKeyFrame,vpFuseCandidates,true);
 
+    // Fuse duplicated map lines, from the current KF in target KFs and from target KFs in current KF
+    if(mpTracker->mbLineFusion)
+    {
+        vector<MapLine*> vpMapLineMatches = mpCurrentKeyFrame->GetMapLineMatches();
+        for(vector<KeyFrame*>::iterator vit=vpTargetKFs.begin(), vend=vpTargetKFs.end(); vit!=vend; vit++)
+            mnLinesFused += LineMatcher::Fuse(*vit,vpMapLineMatches);
+
+        vector<MapLine*> vpLineFuseCandidates;
+        vpLineFuseCandidates.reserve(vpTargetKFs.size()*vpMapLineMatches.size());
+
+        for(vector<KeyFrame*>::iterator vitKF=vpTargetKFs.begin(), vendKF=vpTargetKFs.end(); vitKF!=vendKF; vitKF++)
+        {
+            vector<MapLine*> vpMapLinesKFi = (*vitKF)->GetMapLineMatches();
+
+            for(vector<MapLine*>::iterator vitML=vpMapLinesKFi.begin(), vendML=vpMapLinesKFi.end(); vitML!=vendML; vitML++)
+            {
+                MapLine* pML = *vitML;
+                if(!pML)
+                    continue;
+                if(pML->isBad() || pML->mnFuseCandidateForKF == mpCurrentKeyFrame->mnId)
+                    continue;
+                pML->mnFuseCandidateForKF = mpCurrentKeyFrame->mnId;
+                vpLineFuseCandidates.push_back(pML);
+            }
+        }
+
+        mnLinesFused += LineMatcher::Fuse(mpCurrentKeyFrame,vpLineFuseCandidates);
+
+        // Update lines
+        vpMapLineMatches = mpCurrentKeyFrame->GetMapLineMatches();
+        for(size_t i=0, iend=vpMapLineMatches.size(); i<iend; i++)
+        {
+            MapLine* pML=vpMapLineMatches[i];
+            if(pML && !pML->isBad())
+            {
+                pML->ComputeDistinctiveDescriptors();
+                pML->UpdateNormalAndDepth();
+            }
+        }
+    }
+
 
     // Update points
     vpMapPointMatches = mpCurrentKeyFrame->GetMapPointMatches();
@@ -1194,6 +1595,9 @@ void LocalMapping::RequestStop()
     mbStopRequested = true;
     unique_lock<mutex> lock2(mMutexNewKFs);
     mbAbortBA = true;
+    mbAbortLocalBA = true;
+    mbWakeUp = true;
+    mcvNewKFs.notify_one();
 }
 
 bool LocalMapping::Stop()
@@ -1233,6 +1637,8 @@ void LocalMapping::Release()
         delete *lit;
     mlNewKeyFrames.clear();
 
+    WakeUp();
+
     cout << "Local Mapping RELEASE" << endl;
 }
 
@@ -1334,14 +1740,11 @@ void LocalMapping::KeyFrameCulling()
                         const int &scaleLevel = (pKF -> NLeft == -1) ? pKF->mvKeysUn[i].octave
                                                                      : (i < pKF -> NLeft) ? pKF -> mvKeys[i].octave
                                                                                           : pKF -> mvKeysRight[i].octave;
-                        const map<KeyFrame*, tuple<int,int>> observations = pMP->GetObservations();
                         int nObs=0;
-                        for(map<KeyFrame*, tuple<int,int>>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+                        pMP->ForEachObservation([&](KeyFrame* pKFi, const tuple<int,int> &indexes)
                         {
-                            KeyFrame* pKFi = mit->first;
-                            if(pKFi==pKF)
-                                continue;
-                            tuple<int,int> indexes = mit->second;
+                            if(pKFi==pKF || nObs>thObs)
+                                return;
                             int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
                             int scaleLeveli = -1;
                             if(pKFi -> NLeft == -1)
@@ -1358,12 +1761,8 @@ void LocalMapping::KeyFrameCulling()
                             }
 
                             if(scaleLeveli<=scaleLevel+1)
-                            {
                                 nObs++;
-                                if(nObs>thObs)
-                                    break;
-                            }
-                        }
+                        });
                         if(nObs>thObs)
                         {
                             nRedundantObservations++;
@@ -1419,15 +1818,15 @@ void LocalMapping::KeyFrameCulling()
     }
 }
 
-void LocalMapping::KeyFrameCullingWithLines()
+void LocalMapping::KeyFrameCullingWithLines(KeyFrame* pCurrentKF)
 {
     // Check redundant keyframes (only local keyframes)
     // A keyframe is considered redundant if the 90% of the sum of MapPoints and MapLines it sees, are seen
     // in at least other 3 keyframes (in the same or finer scale)
     // We only consider close stereo points
     const int Nd = 21; // MODIFICATION_STEREO_IMU 20 This should be the same than that one from LIBA
-    mpCurrentKeyFrame->UpdateBestCovisibles();
-    vector<KeyFrame*> vpLocalKeyFrames = mpCurrentKeyFrame->GetVectorCovisibleKeyFrames();
+    pCurrentKF->UpdateBestCovisibles();
+    vector<KeyFrame*> vpLocalKeyFrames = pCurrentKF->GetVectorCovisibleKeyFrames();
 
     float redundant_th;
     if(!mbInertial)
@@ -1445,7 +1844,7 @@ void LocalMapping::KeyFrameCullingWithLines()
     if (mbInertial)
     {
         int count = 0;
-        KeyFrame* aux_KF = mpCurrentKeyFrame;
+        KeyFrame* aux_KF = pCurrentKF;
         while(count<Nd && aux_KF->mPrevKF)
         {
             aux_KF = aux_KF->mPrevKF;
@@ -1488,14 +1887,11 @@ void LocalMapping::KeyFrameCullingWithLines()
                         const int &scaleLevel = (pKF -> NLeft == -1) ? pKF->mvKeysUn[i].octave
                                                                      : (i < pKF -> NLeft) ? pKF -> mvKeys[i].octave
                                                                                           : pKF -> mvKeysRight[i].octave;
-                        const map<KeyFrame*, tuple<int,int>> observations = pMP->GetObservations();
                         int nObs=0;
-                        for(map<KeyFrame*, tuple<int,int>>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+                        pMP->ForEachObservation([&](KeyFrame* pKFi, const tuple<int,int> &indexes)
                         {
-                            KeyFrame* pKFi = mit->first;
-                            if(pKFi==pKF)
-                                continue;
-                            tuple<int,int> indexes = mit->second;
+                            if(pKFi==pKF || nObs>thObs)
+                                return;
                             int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
                             int scaleLeveli = -1;
                             if(pKFi -> NLeft == -1)
@@ -1512,12 +1908,8 @@ void LocalMapping::KeyFrameCullingWithLines()
                             }
 
                             if(scaleLeveli<=scaleLevel+1)
-                            {
                                 nObs++;
-                                if(nObs>thObs)
-                                    break;
-                            }
-                        }
+                        });
                         if(mpTracker->SLAM==0)
                         {
                             if(nObs>thObs)
@@ -1549,22 +1941,16 @@ void LocalMapping::KeyFrameCullingWithLines()
                     if(pML->Observations()>thObs)
                     {
                         const int &scaleLevel = pKF->mvKeysUn_Line[i].octave;
-                        const map<KeyFrame*, size_t> observations = pML->GetObservations();
                         int nObs=0;
-                        for(map<KeyFrame*, size_t>::const_iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+                        pML->ForEachObservation([&](KeyFrame* pKFi, const size_t idx)
                         {
-                            KeyFrame* pKFi = mit->first;
-                            if(pKFi==pKF)
-                                continue;
-                            const int &scaleLeveli = pKFi->mvKeysUn_Line[mit->second].octave;
+                            if(pKFi==pKF || nObs>=thObs)
+                                return;
+                            const int &scaleLeveli = pKFi->mvKeysUn_Line[idx].octave;
 
                             if(scaleLeveli<=scaleLevel+1)
-                            {
                                 nObs++;
-                                if(nObs>=thObs)
-                                    break;
-                            }
-                        }
+                        });
                         if(nObs>=thObs)
                         {
                             nRedundantObservations++;
@@ -1583,7 +1969,7 @@ void LocalMapping::KeyFrameCullingWithLines()
                     if (mpAtlas->KeyFramesInMap()<=Nd)
                         continue;
 
-                    if(pKF->mnId>(mpCurrentKeyFrame->mnId-2))
+                    if(pKF->mnId>(pCurrentKF->mnId-2))
                         continue;
 
                     if(pKF->mPrevKF && pKF->mNextKF)
@@ -1599,7 +1985,7 @@ void LocalMapping::KeyFrameCullingWithLines()
                             pKF->mPrevKF = NULL;
                             pKF->SetBadFlag();
                         }
-                        else if(!mpCurrentKeyFrame->GetMap()->GetIniertialBA2() && (cv::norm(pKF->GetImuPosition()-pKF->mPrevKF->GetImuPosition())<0.02) && (t<3))
+                        else if(!pCurrentKF->GetMap()->GetIniertialBA2() && (cv::norm(pKF->GetImuPosition()-pKF->mPrevKF->GetImuPosition())<0.02) && (t<3))
                         {
                             pKF->mNextKF->mpImuPreintegrated->MergePrevious(pKF->mpImuPreintegrated);
                             pKF->mNextKF->mPrevKF = pKF->mPrevKF;
@@ -1625,7 +2011,7 @@ void LocalMapping::KeyFrameCullingWithLines()
                     if (mpAtlas->KeyFramesInMap()<=Nd)
                         continue;
 
-                    if(pKF->mnId>(mpCurrentKeyFrame->mnId-2))
+                    if(pKF->mnId>(pCurrentKF->mnId-2))
                         continue;
 
                     if(pKF->mPrevKF && pKF->mNextKF)
@@ -1641,7 +2027,7 @@ void LocalMapping::KeyFrameCullingWithLines()
                             pKF->mPrevKF = NULL;
                             pKF->SetBadFlag();
                         }
-                        else if(!mpCurrentKeyFrame->GetMap()->GetIniertialBA2() && (cv::norm(pKF->GetImuPosition()-pKF->mPrevKF->GetImuPosition())<0.02) && (t<3))
+                        else if(!pCurrentKF->GetMap()->GetIniertialBA2() && (cv::norm(pKF->GetImuPosition()-pKF->mPrevKF->GetImuPosition())<0.02) && (t<3))
                         {
                             pKF->mNextKF->mpImuPreintegrated->MergePrevious(pKF->mpImuPreintegrated);
                             pKF->mNextKF->mPrevKF = pKF->mPrevKF;
@@ -1680,16 +2066,12 @@ void LocalMapping::RequestReset()
         cout << "LM: Map reset recieved" << endl;
         mbResetRequested = true;
     }
+    WakeUp();
     cout << "LM: Map reset, waiting..." << endl;
 
-    while(1)
     {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetRequested)
-                break;
-        }
-        usleep(3000);
+        unique_lock<mutex> lock2(mMutexReset);
+        mcvReset.wait(lock2, [&]{ return !mbResetRequested; });
     }
     cout << "LM: Map reset, Done!!!" << endl;
 }
@@ -1702,16 +2084,12 @@ void LocalMapping::RequestResetActiveMap(Map* pMap)
         mbResetRequestedActiveMap = true;
         mpMapToReset = pMap;
     }
+    WakeUp();
     cout << "LM: Active map reset, waiting..." << endl;
 
-    while(1)
     {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetRequestedActiveMap)
-                break;
-        }
-        usleep(3000);
+        unique_lock<mutex> lock2(mMutexReset);
+        mcvReset.wait(lock2, [&]{ return !mbResetRequestedActiveMap; });
     }
     cout << "LM: Active map reset, Done!!!" << endl;
 }
@@ -1759,12 +2137,26 @@ void LocalMapping::ResetIfRequested()
         }
     }
     if(executed_reset)
+    {
+        mcvReset.notify_all();
         cout << "LM: Reset free the mutex" << endl;
+    }
 
 }
 
 void LocalMapping::ResetIfRequestedWithLines()
 {
+    {
+        // The local BA in the BA thread has to finish before the reset
+        bool bResetRequested;
+        {
+            unique_lock<mutex> lock(mMutexReset);
+            bResetRequested = mbResetRequested || mbResetRequestedActiveMap;
+        }
+        if(bResetRequested)
+            JoinLocalBA(true);
+    }
+
     bool executed_reset = false;
     {
         unique_lock<mutex> lock(mMutexReset);
@@ -1776,6 +2168,7 @@ void LocalMapping::ResetIfRequestedWithLines()
             mlNewKeyFrames.clear();
             mlpRecentAddedMapPoints.clear();
             mlpRecentAddedMapLines.clear();
+            mBASolver.ResetWindow();
             mbResetRequested=false;
             mbResetRequestedActiveMap = false;
 
@@ -1796,6 +2189,7 @@ void LocalMapping::ResetIfRequestedWithLines()
             mlNewKeyFrames.clear();
             mlpRecentAddedMapPoints.clear();
             mlpRecentAddedMapLines.clear();
+            mBASolver.ResetWindow();
 
             // Inertial parameters
             mTinit = 0.f;
@@ -1808,14 +2202,20 @@ void LocalMapping::ResetIfRequestedWithLines()
         }
     }
     if(executed_reset)
+    {
+        mcvReset.notify_all();
         cout << "LM: Reset free the mutex" << endl;
+    }
 
 }
 
 void LocalMapping::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        mbFinishRequested = true;
+    }
+    WakeUp();
 }
 
 bool LocalMapping::CheckFinish()
@@ -24,6 +24,9 @@
 #include "Optimizer.h"
 #include "ORBmatcher.h"
 #include "G2oTypes.h"
+#include "BASolver.h"
+#include "SolverUtils.h"
+#include "EpochReclaimer.h"
 #include<opencv2/imgcodecs/legacy/constants_c.h>
 #include<mutex>
 #include<thread>
@@ -34,7 +37,7 @@ namespace ORB_SLAM3
 
 LoopClosing::LoopClosing(Atlas *pAtlas, KeyFrameDatabase *pDB, ORBVocabulary *pVoc, const bool bFixScale):
     mbResetRequested(false), mbResetActiveMapRequested(false), mbFinishRequested(false), mbFinished(true), mpAtlas(pAtlas),
-    mpKeyFrameDB(pDB), mpORBVocabulary(pVoc), mpMatchedKF(NULL), mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
+    mpKeyFrameDB(pDB), mpORBVocabulary(pVoc), mbWakeUp(false), mpMatchedKF(NULL), mLastLoopKFid(0), mbRunningGBA(false), mbFinishedGBA(true),
     mbStopGBA(false), mpThreadGBA(NULL), mbFixScale(bFixScale), mnFullBAIdx(0), mnLoopNumCoincidences(0), mnMergeNumCoincidences(0),
     mbLoopDetected(false), mbMergeDetected(false), mnLoopNumNotFound(0), mnMergeNumNotFound(0)
 {
@@ -229,7 +232,9 @@ void LoopClosing::Run_Lines()
             break;
         }
 
-        usleep(5000);
+        ReleaseBadLandmarks();
+
+        WaitForWork();
     }
 
     //ofstream f_stats;
@@ -243,6 +248,7 @@ void LoopClosing::Run_Lines()
 
     //f_stats.close();
 
+    EpochReclaimer::Unregister(EpochReclaimer::LOOP_CLOSING);
     SetFinish();
 }
 
@@ -423,7 +429,9 @@ void LoopClosing::Run()
             break;
         }
 
-        usleep(5000);
+        ReleaseBadLandmarks();
+
+        WaitForWork();
     }
 
     //ofstream f_stats;
@@ -437,14 +445,57 @@ void LoopClosing::Run()
 
     //f_stats.close();
 
+    EpochReclaimer::Unregister(EpochReclaimer::LOOP_CLOSING);
     SetFinish();
 }
 
 void LoopClosing::InsertKeyFrame(KeyFrame *pKF)
 {
-    unique_lock<mutex> lock(mMutexLoopQueue);
-    if(pKF->mnId!=0)
+    if(pKF->mnId==0)
+        return;
+
+    {
+        unique_lock<mutex> lock(mMutexLoopQueue);
         mlpLoopKeyFrameQueue.push_back(pKF);
+    }
+    mcvLoopQueue.notify_one();
+}
+
+void LoopClosing::WaitForWork()
+{
+    const int maxWaitMs = 100;
+
+    unique_lock<mutex> lock(mMutexLoopQueue);
+    mcvLoopQueue.wait_for(lock, std::chrono::milliseconds(maxWaitMs), [&]{
+        return mbWakeUp || !mlpLoopKeyFrameQueue.empty();
+    });
+    mbWakeUp = false;
+}
+
+void LoopClosing::ReleaseBadLandmarks()
+{
+    // The map points of a loop or merge candidate are kept until it is confirmed or discarded, and the
+    // global BA holds those of the whole map
+    if(!EpochReclaimer::IsEnabled() || mnLoopNumCoincidences>0 || mnMergeNumCoincidences>0 || isRunningGBA())
+        return;
+
+    mvpLoopMPs.clear();
+    mvpLoopMatchedMPs.clear();
+    mvpMergeMPs.clear();
+    mvpMergeMatchedMPs.clear();
+    mvpLoopMapPoints.clear();
+    mvpCurrentMatchedPoints.clear();
+
+    EpochReclaimer::Quiescent(EpochReclaimer::LOOP_CLOSING);
+}
+
+void LoopClosing::WakeUp()
+{
+    {
+        unique_lock<mutex> lock(mMutexLoopQueue);
+        mbWakeUp = true;
+    }
+    mcvLoopQueue.notify_one();
 }
 
 bool LoopClosing::CheckNewKeyFrames()
@@ -749,6 +800,99 @@ bool LoopClosing::DetectAndReffineSim3FromLastKF(KeyFrame* pCurrentKF, KeyFrame*
 
 bool LoopClosing::DetectCommonRegionsFromBoW(std::vector<KeyFrame*> &vpBowCand, KeyFrame* &pMatchedKF2, KeyFrame* &pLastCurrentKF, g2o::Sim3 &g2oScw,
                                              int &nNumCoincidences, std::vector<MapPoint*> &vpMPs, std::vector<MapPoint*> &vpMatchedMPs)
+{
+    set<KeyFrame*> spConnectedKeyFrames = mpCurrentKF->GetConnectedKeyFrames();
+
+    // Varibles to select the best numbe
+    KeyFrame* pBestMatchedKF;
+    int nBestMatchesReproj = 0;
+    int nBestNumCoindicendes = 0;
+    g2o::Sim3 g2oBestScw;
+    std::vector<MapPoint*> vpBestMapPoints;
+    std::vector<MapPoint*> vpBestMatchedMapPoints;
+
+    int numCandidates = vpBowCand.size();
+    vector<int> vnStage(numCandidates, 0);
+    vector<int> vnMatchesStage(numCandidates, 0);
+
+    // The candidates are verified independently, in parallel with several threads, and the best one is selected
+    // afterwards in their order as in a serial loop
+    vector<BoWCandidateResult,Eigen::aligned_allocator<BoWCandidateResult> > vResults(numCandidates);
+    const int nThreads = std::min(mpTracker->mnLoopCandidateThreads, numCandidates);
+    ParallelFor(nThreads, numCandidates, [&](const int, const int begin, const int end)
+    {
+        for(int i=begin; i<end; i++)
+            VerifyBoWCandidate(vpBowCand[i], spConnectedKeyFrames, vResults[i], vnStage[i], vnMatchesStage[i]);
+    });
+
+    for(int i=0; i<numCandidates; i++)
+    {
+        const BoWCandidateResult &result = vResults[i];
+
+        // Messages of the verification, printed here not to interleave those of the threads
+        if(result.nProjMatches>=0)
+            cout <<"BoW: " << result.nProjMatches << " matches between " << result.nCloudPoints << " points with coarse Sim3" << endl;
+        if(result.nProjOptMatches>0)
+        {
+            cout << "BoW: Current KF " << mpCurrentKF->mnId << "; candidate KF " << vpBowCand[i]->mnId << endl;
+            cout << "BoW: There are " << result.nProjOptMatches << " matches between them with the optimized Sim3" << endl;
+        }
+        for(size_t j=0; j<result.vCoincidentKFs.size(); j++)
+        {
+            const BoWCandidateResult::CoincidentKF &coincident = result.vCoincidentKFs[j];
+            cout << "BoW: KF " << vpBowCand[i]->mnId << " to KF " << coincident.nId << " is separated by " << coincident.dist << " meters" << endl;
+            cout << "BoW: Rotation between KF -> " << coincident.Rc_cj << endl;
+            vector<float> v_euler = Converter::toEuler(coincident.Rc_cj);
+            v_euler[0] *= 180 /3.1415;
+            v_euler[1] *= 180 /3.1415;
+            v_euler[2] *= 180 /3.1415;
+            cout << "BoW: Rotation in angles (x, y, z) -> (" << v_euler[0] << ", " << v_euler[1] << ", " << v_euler[2] << ")" << endl;
+        }
+
+        if(nBestMatchesReproj < result.nProjOptMatches)
+        {
+            nBestMatchesReproj = result.nProjOptMatches;
+            nBestNumCoindicendes = result.nNumKFs;
+            pBestMatchedKF = result.pMatchedKF;
+            g2oBestScw = result.gScw;
+            vpBestMapPoints = result.vpMapPoints;
+            vpBestMatchedMapPoints = result.vpMatchedMPs;
+        }
+    }
+
+    if(nBestMatchesReproj > 0)
+    {
+        pLastCurrentKF = mpCurrentKF;
+        nNumCoincidences = nBestNumCoindicendes;
+        pMatchedKF2 = pBestMatchedKF;
+        pMatchedKF2->SetNotErase();
+        g2oScw = g2oBestScw;
+        vpMPs = vpBestMapPoints;
+        vpMatchedMPs = vpBestMatchedMapPoints;
+
+        return nNumCoincidences >= 3;
+    }
+    else
+    {
+        int maxStage = -1;
+        int maxMatched;
+        for(int i=0; i<vnStage.size(); ++i)
+        {
+            if(vnStage[i] > maxStage)
+            {
+                maxStage = vnStage[i];
+                maxMatched = vnMatchesStage[i];
+            }
+        }
+
+//        f_succes_pr << mpCurrentKF->mNameFile << " " << std::to_string(maxStage) << endl;
+//        f_succes_pr << "% NumCand: " << std::to_string(numCandidates) << "; matches: " << std::to_string(maxMatched) << endl;
+    }
+    return false;
+}
+
+void LoopClosing::VerifyBoWCandidate(KeyFrame* pKFi, const set<KeyFrame*> &spConnectedKeyFrames, BoWCandidateResult &result,
+                                     int &nStage, int &nMatchesStage)
 {
     int nBoWMatches = 20;
     int nBoWInliers = 15;
@@ -764,333 +908,277 @@ bool LoopClosing::DetectCommonRegionsFromBoW(std::vector<KeyFrame*> &vpBowCand,
         nProjOptMatches = 50;
     }*/
 
-    set<KeyFrame*> spConnectedKeyFrames = mpCurrentKF->GetConnectedKeyFrames();
-
     int nNumCovisibles = 5;
 
     ORBmatcher matcherBoW(0.9, true);
     ORBmatcher matcher(0.75, true);
-    int nNumGuidedMatching = 0;
 
-    // Varibles to select the best numbe
-    KeyFrame* pBestMatchedKF;
-    int nBestMatchesReproj = 0;
-    int nBestNumCoindicendes = 0;
-    g2o::Sim3 g2oBestScw;
-    std::vector<MapPoint*> vpBestMapPoints;
-    std::vector<MapPoint*> vpBestMatchedMapPoints;
+    //cout << endl << "-------------------------------" << endl;
+    if(!pKFi || pKFi->isBad())
+        return;
 
-    int numCandidates = vpBowCand.size();
-    vector<int> vnStage(numCandidates, 0);
-    vector<int> vnMatchesStage(numCandidates, 0);
 
-    int index = 0;
-    for(KeyFrame* pKFi : vpBowCand)
-    {
-        //cout << endl << "-------------------------------" << endl;
-        if(!pKFi || pKFi->isBad())
-            continue;
+    // Current KF against KF with covisibles version
+    std::vector<KeyFrame*> vpCovKFi = pKFi->GetBestCovisibilityKeyFrames(nNumCovisibles);
+    vpCovKFi.push_back(vpCovKFi[0]);
+    vpCovKFi[0] = pKFi;
 
+    std::vector<std::vector<MapPoint*> > vvpMatchedMPs;
+    vvpMatchedMPs.resize(vpCovKFi.size());
+    std::set<MapPoint*> spMatchedMPi;
+    int numBoWMatches = 0;
 
-        // Current KF against KF with covisibles version
-        std::vector<KeyFrame*> vpCovKFi = pKFi->GetBestCovisibilityKeyFrames(nNumCovisibles);
-        vpCovKFi.push_back(vpCovKFi[0]);
-        vpCovKFi[0] = pKFi;
+    KeyFrame* pMostBoWMatchesKF = pKFi;
+    int nMostBoWNumMatches = 0;
 
-        std::vector<std::vector<MapPoint*> > vvpMatchedMPs;
-        vvpMatchedMPs.resize(vpCovKFi.size());
-        std::set<MapPoint*> spMatchedMPi;
-        int numBoWMatches = 0;
+    std::vector<MapPoint*> vpMatchedPoints = std::vector<MapPoint*>(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
+    std::vector<KeyFrame*> vpKeyFrameMatchedMP = std::vector<KeyFrame*>(mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
 
-        KeyFrame* pMostBoWMatchesKF = pKFi;
-        int nMostBoWNumMatches = 0;
+    int nIndexMostBoWMatchesKF=0;
+    for(int j=0; j<vpCovKFi.size(); ++j)
+    {
+        if(!vpCovKFi[j] || vpCovKFi[j]->isBad())
+            continue;
 
-        std::vector<MapPoint*> vpMatchedPoints = std::vector<MapPoint*>(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-        std::vector<KeyFrame*> vpKeyFrameMatchedMP = std::vector<KeyFrame*>(mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
+        int num = matcherBoW.SearchByBoW(mpCurrentKF, vpCovKFi[j], vvpMatchedMPs[j]);
+        //cout << "BoW: " << num << " putative matches with KF " << vpCovKFi[j]->mnId << endl;
+        if (num > nMostBoWNumMatches)
+        {
+            nMostBoWNumMatches = num;
+            nIndexMostBoWMatchesKF = j;
+        }
+    }
 
-        int nIndexMostBoWMatchesKF=0;
-        for(int j=0; j<vpCovKFi.size(); ++j)
+    bool bAbortByNearKF = false;
+    for(int j=0; j<vpCovKFi.size(); ++j)
+    {
+        if(spConnectedKeyFrames.find(vpCovKFi[j]) != spConnectedKeyFrames.end())
         {
-            if(!vpCovKFi[j] || vpCovKFi[j]->isBad())
+            bAbortByNearKF = true;
+            //cout << "BoW: Candidate KF aborted by proximity" << endl;
+            break;
+        }
+
+        //cout << "Matches: " << num << endl;
+        for(int k=0; k < vvpMatchedMPs[j].size(); ++k)
+        {
+            MapPoint* pMPi_j = vvpMatchedMPs[j][k];
+            if(!pMPi_j || pMPi_j->isBad())
                 continue;
 
-            int num = matcherBoW.SearchByBoW(mpCurrentKF, vpCovKFi[j], vvpMatchedMPs[j]);
-            //cout << "BoW: " << num << " putative matches with KF " << vpCovKFi[j]->mnId << endl;
-            if (num > nMostBoWNumMatches)
+            if(spMatchedMPi.find(pMPi_j) == spMatchedMPi.end())
             {
-                nMostBoWNumMatches = num;
-                nIndexMostBoWMatchesKF = j;
+                spMatchedMPi.insert(pMPi_j);
+                numBoWMatches++;
+
+                vpMatchedPoints[k]= pMPi_j;
+                vpKeyFrameMatchedMP[k] = vpCovKFi[j];
             }
         }
+    }
 
-        bool bAbortByNearKF = false;
-        for(int j=0; j<vpCovKFi.size(); ++j)
-        {
-            if(spConnectedKeyFrames.find(vpCovKFi[j]) != spConnectedKeyFrames.end())
-            {
-                bAbortByNearKF = true;
-                //cout << "BoW: Candidate KF aborted by proximity" << endl;
-                break;
-            }
+    //cout <<"BoW: " << numBoWMatches << " independent putative matches" << endl;
+    if(!bAbortByNearKF && numBoWMatches >= nBoWMatches) // TODO pick a good threshold
+    {
+        /*cout << "-------------------------------" << endl;
+        cout << "Geometric validation with " << numBoWMatches << endl;
+        cout << "KFc: " << mpCurrentKF->mnId << "; KFm: " << pMostBoWMatchesKF->mnId << endl;*/
+        // Geometric validation
 
-            //cout << "Matches: " << num << endl;
-            for(int k=0; k < vvpMatchedMPs[j].size(); ++k)
-            {
-                MapPoint* pMPi_j = vvpMatchedMPs[j][k];
-                if(!pMPi_j || pMPi_j->isBad())
-                    continue;
+        bool bFixedScale = mbFixScale;
+        if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
+            bFixedScale=false;
 
-                if(spMatchedMPi.find(pMPi_j) == spMatchedMPi.end())
-                {
-                    spMatchedMPi.insert(pMPi_j);
-                    numBoWMatches++;
+        Sim3Solver solver = Sim3Solver(mpCurrentKF, pMostBoWMatchesKF, vpMatchedPoints, bFixedScale, vpKeyFrameMatchedMP);
+        solver.SetRansacParameters(0.99, nBoWInliers, 300); // at least 15 inliers
 
-                    vpMatchedPoints[k]= pMPi_j;
-                    vpKeyFrameMatchedMP[k] = vpCovKFi[j];
-                }
-            }
+        bool bNoMore = false;
+        vector<bool> vbInliers;
+        int nInliers;
+        bool bConverge = false;
+        cv::Mat mTcm;
+        while(!bConverge && !bNoMore)
+        {
+            mTcm = solver.iterate(20,bNoMore, vbInliers, nInliers, bConverge);
         }
 
-        //cout <<"BoW: " << numBoWMatches << " independent putative matches" << endl;
-        if(!bAbortByNearKF && numBoWMatches >= nBoWMatches) // TODO pick a good threshold
+        //cout << "Num inliers: " << nInliers << endl;
+        if(bConverge)
         {
-            /*cout << "-------------------------------" << endl;
-            cout << "Geometric validation with " << numBoWMatches << endl;
-            cout << "KFc: " << mpCurrentKF->mnId << "; KFm: " << pMostBoWMatchesKF->mnId << endl;*/
-            // Geometric validation
-
-            bool bFixedScale = mbFixScale;
-            if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
-                bFixedScale=false;
-
-            Sim3Solver solver = Sim3Solver(mpCurrentKF, pMostBoWMatchesKF, vpMatchedPoints, bFixedScale, vpKeyFrameMatchedMP);
-            solver.SetRansacParameters(0.99, nBoWInliers, 300); // at least 15 inliers
-
-            bool bNoMore = false;
-            vector<bool> vbInliers;
-            int nInliers;
-            bool bConverge = false;
-            cv::Mat mTcm;
-            while(!bConverge && !bNoMore)
+            //cout <<"BoW: " << nInliers << " inliers in Sim3Solver" << endl;
+
+            // Match by reprojection
+            //int nNumCovisibles = 5;
+            vpCovKFi.clear();
+            vpCovKFi = pMostBoWMatchesKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
+            int nInitialCov = vpCovKFi.size();
+            vpCovKFi.push_back(pMostBoWMatchesKF);
+            set<KeyFrame*> spCheckKFs(vpCovKFi.begin(), vpCovKFi.end());
+
+            set<MapPoint*> spMapPoints;
+            vector<MapPoint*> vpMapPoints;
+            vector<KeyFrame*> vpKeyFrames;
+            for(KeyFrame* pCovKFi : vpCovKFi)
             {
-                mTcm = solver.iterate(20,bNoMore, vbInliers, nInliers, bConverge);
-            }
-
-            //cout << "Num inliers: " << nInliers << endl;
-            if(bConverge)
-            {
-                //cout <<"BoW: " << nInliers << " inliers in Sim3Solver" << endl;
-
-                // Match by reprojection
-                //int nNumCovisibles = 5;
-                vpCovKFi.clear();
-                vpCovKFi = pMostBoWMatchesKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
-                int nInitialCov = vpCovKFi.size();
-                vpCovKFi.push_back(pMostBoWMatchesKF);
-                set<KeyFrame*> spCheckKFs(vpCovKFi.begin(), vpCovKFi.end());
-
-                set<MapPoint*> spMapPoints;
-                vector<MapPoint*> vpMapPoints;
-                vector<KeyFrame*> vpKeyFrames;
-                for(KeyFrame* pCovKFi : vpCovKFi)
+                for(MapPoint* pCovMPij : pCovKFi->GetMapPointMatches())
                 {
-                    for(MapPoint* pCovMPij : pCovKFi->GetMapPointMatches())
-                    {
-                        if(!pCovMPij || pCovMPij->isBad())
-                            continue;
+                    if(!pCovMPij || pCovMPij->isBad())
+                        continue;
 
-                        if(spMapPoints.find(pCovMPij) == spMapPoints.end())
-                        {
-                            spMapPoints.insert(pCovMPij);
-                            vpMapPoints.push_back(pCovMPij);
-                            vpKeyFrames.push_back(pCovKFi);
-                        }
+                    if(spMapPoints.find(pCovMPij) == spMapPoints.end())
+                    {
+                        spMapPoints.insert(pCovMPij);
+                        vpMapPoints.push_back(pCovMPij);
+                        vpKeyFrames.push_back(pCovKFi);
                     }
                 }
-                //cout << "Point cloud: " << vpMapPoints.size() << endl;
+            }
+            //cout << "Point cloud: " << vpMapPoints.size() << endl;
 
 
-                g2o::Sim3 gScm(Converter::toMatrix3d(solver.GetEstimatedRotation()),Converter::toVector3d(solver.GetEstimatedTranslation()),solver.GetEstimatedScale());
-                g2o::Sim3 gSmw(Converter::toMatrix3d(pMostBoWMatchesKF->GetRotation()),Converter::toVector3d(pMostBoWMatchesKF->GetTranslation()),1.0);
-                g2o::Sim3 gScw = gScm*gSmw; // Similarity matrix of current from the world position
-                cv::Mat mScw = Converter::toCvMat(gScw);
+            g2o::Sim3 gScm(Converter::toMatrix3d(solver.GetEstimatedRotation()),Converter::toVector3d(solver.GetEstimatedTranslation()),solver.GetEstimatedScale());
+            g2o::Sim3 gSmw(Converter::toMatrix3d(pMostBoWMatchesKF->GetRotation()),Converter::toVector3d(pMostBoWMatchesKF->GetTranslation()),1.0);
+            g2o::Sim3 gScw = gScm*gSmw; // Similarity matrix of current from the world position
+            cv::Mat mScw = Converter::toCvMat(gScw);
 
 
-                vector<MapPoint*> vpMatchedMP;
-                vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-                vector<KeyFrame*> vpMatchedKF;
-                vpMatchedKF.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
-                int numProjMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpKeyFrames, vpMatchedMP, vpMatchedKF, 8, 1.5);
-                cout <<"BoW: " << numProjMatches << " matches between " << vpMapPoints.size() << " points with coarse Sim3" << endl;
+            vector<MapPoint*> vpMatchedMP;
+            vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
+            vector<KeyFrame*> vpMatchedKF;
+            vpMatchedKF.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<KeyFrame*>(NULL));
+            int numProjMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpKeyFrames, vpMatchedMP, vpMatchedKF, 8, 1.5);
+            result.nProjMatches = numProjMatches;
+            result.nCloudPoints = vpMapPoints.size();
 
-                if(numProjMatches >= nProjMatches)
-                {
-                    // Optimize Sim3 transformation with every matches
-                    Eigen::Matrix<double, 7, 7> mHessian7x7;
+            if(numProjMatches >= nProjMatches)
+            {
+                // Optimize Sim3 transformation with every matches
+                Eigen::Matrix<double, 7, 7> mHessian7x7;
 
-                    bool bFixedScale = mbFixScale;
-                    if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
-                        bFixedScale=false;
+                bool bFixedScale = mbFixScale;
+                if(mpTracker->mSensor==System::IMU_MONOCULAR && !mpCurrentKF->GetMap()->GetIniertialBA2())
+                    bFixedScale=false;
 
-                    int numOptMatches = Optimizer::OptimizeSim3(mpCurrentKF, pKFi, vpMatchedMP, gScm, 10, mbFixScale, mHessian7x7, true);
-                    //cout <<"BoW: " << numOptMatches << " inliers in the Sim3 optimization" << endl;
-                    //cout << "Inliers in Sim3 optimization: " << numOptMatches << endl;
+                int numOptMatches = Optimizer::OptimizeSim3(mpCurrentKF, pKFi, vpMatchedMP, gScm, 10, mbFixScale, mHessian7x7, true);
+                //cout <<"BoW: " << numOptMatches << " inliers in the Sim3 optimization" << endl;
+                //cout << "Inliers in Sim3 optimization: " << numOptMatches << endl;
 
-                    if(numOptMatches >= nSim3Inliers)
-                    {
-                        //cout <<"BoW: " << numOptMatches << " inliers in Sim3 optimization" << endl;
-                        g2o::Sim3 gSmw(Converter::toMatrix3d(pMostBoWMatchesKF->GetRotation()),Converter::toVector3d(pMostBoWMatchesKF->GetTranslation()),1.0);
-                        g2o::Sim3 gScw = gScm*gSmw; // Similarity matrix of current from the world position
-                        cv::Mat mScw = Converter::toCvMat(gScw);
+                if(numOptMatches >= nSim3Inliers)
+                {
+                    //cout <<"BoW: " << numOptMatches << " inliers in Sim3 optimization" << endl;
+                    g2o::Sim3 gSmw(Converter::toMatrix3d(pMostBoWMatchesKF->GetRotation()),Converter::toVector3d(pMostBoWMatchesKF->GetTranslation()),1.0);
+                    g2o::Sim3 gScw = gScm*gSmw; // Similarity matrix of current from the world position
+                    cv::Mat mScw = Converter::toCvMat(gScw);
 
-                        vector<MapPoint*> vpMatchedMP;
-                        vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
-                        int numProjOptMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpMatchedMP, 5, 1.0);
-                        //cout <<"BoW: " << numProjOptMatches << " matches after of the Sim3 optimization" << endl;
+                    vector<MapPoint*> vpMatchedMP;
+                    vpMatchedMP.resize(mpCurrentKF->GetMapPointMatches().size(), static_cast<MapPoint*>(NULL));
+                    int numProjOptMatches = matcher.SearchByProjection(mpCurrentKF, mScw, vpMapPoints, vpMatchedMP, 5, 1.0);
+                    //cout <<"BoW: " << numProjOptMatches << " matches after of the Sim3 optimization" << endl;
 
-                        if(numProjOptMatches >= nProjOptMatches)
+                    if(numProjOptMatches >= nProjOptMatches)
+                    {
+                        int max_x = -1, min_x = 1000000;
+                        int max_y = -1, min_y = 1000000;
+                        for(MapPoint* pMPi : vpMatchedMP)
                         {
-                            cout << "BoW: Current KF " << mpCurrentKF->mnId << "; candidate KF " << pKFi->mnId << endl;
-                            cout << "BoW: There are " << numProjOptMatches << " matches between them with the optimized Sim3" << endl;
-                            int max_x = -1, min_x = 1000000;
-                            int max_y = -1, min_y = 1000000;
-                            for(MapPoint* pMPi : vpMatchedMP)
+                            if(!pMPi || pMPi->isBad())
                             {
-                                if(!pMPi || pMPi->isBad())
+                                continue;
+                            }
+
+                            tuple<size_t,size_t> indexes = pMPi->GetIndexInKeyFrame(pKFi);
+                            int index = get<0>(indexes);
+                            if(index >= 0)
+                            {
+                                int coord_x = pKFi->mvKeysUn[index].pt.x;
+                                if(coord_x < min_x)
                                 {
-                                    continue;
+                                    min_x = coord_x;
                                 }
-
-                                tuple<size_t,size_t> indexes = pMPi->GetIndexInKeyFrame(pKFi);
-                                int index = get<0>(indexes);
-                                if(index >= 0)
+                                if(coord_x > max_x)
                                 {
-                                    int coord_x = pKFi->mvKeysUn[index].pt.x;
-                                    if(coord_x < min_x)
-                                    {
-                                        min_x = coord_x;
-                                    }
-                                    if(coord_x > max_x)
-                                    {
-                                        max_x = coord_x;
-                                    }
-                                    int coord_y = pKFi->mvKeysUn[index].pt.y;
-                                    if(coord_y < min_y)
-                                    {
-                                        min_y = coord_y;
-                                    }
-                                    if(coord_y > max_y)
-                                    {
-                                        max_y = coord_y;
-                                    }
+                                    max_x = coord_x;
                                 }
-                            }
-                            //cout << "BoW: Coord in X -> " << min_x << ", " << max_x << "; and Y -> " << min_y << ", " << max_y << endl;
-                            //cout << "BoW: features area in X -> " << (max_x - min_x) << " and Y -> " << (max_y - min_y) << endl;
-
-                            int nNumKFs = 0;
-                            //vpMatchedMPs = vpMatchedMP;
-                            //vpMPs = vpMapPoints;
-                            // Check the Sim3 transformation with the current KeyFrame covisibles
-                            vector<KeyFrame*> vpCurrentCovKFs = mpCurrentKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
-                            //cout << "---" << endl;
-                            //cout << "BoW: Geometrical validation" << endl;
-                            int j = 0;
-                            while(nNumKFs < 3 && j<vpCurrentCovKFs.size())
-                            //for(int j=0; j<vpCurrentCovKFs.size(); ++j)
-                            {
-                                KeyFrame* pKFj = vpCurrentCovKFs[j];
-                                cv::Mat mTjc = pKFj->GetPose() * mpCurrentKF->GetPoseInverse();
-                                g2o::Sim3 gSjc(Converter::toMatrix3d(mTjc.rowRange(0, 3).colRange(0, 3)),Converter::toVector3d(mTjc.rowRange(0, 3).col(3)),1.0);
-                                g2o::Sim3 gSjw = gSjc * gScw;
-                                int numProjMatches_j = 0;
-                                vector<MapPoint*> vpMatchedMPs_j;
-                                bool bValid = DetectCommonRegionsFromLastKF(pKFj,pMostBoWMatchesKF, gSjw,numProjMatches_j, vpMapPoints, vpMatchedMPs_j);
-
-                                if(bValid)
+                                int coord_y = pKFi->mvKeysUn[index].pt.y;
+                                if(coord_y < min_y)
                                 {
-                                    //cout << "BoW: KF " << pKFj->mnId << " has " << numProjMatches_j << " matches" << endl;
-                                    cv::Mat Tc_w = mpCurrentKF->GetPose();
-                                    cv::Mat Tw_cj = pKFj->GetPoseInverse();
-                                    cv::Mat Tc_cj = Tc_w * Tw_cj;
-                                    cv::Vec3d vector_dist =  Tc_cj.rowRange(0, 3).col(3);
-                                    cv::Mat Rc_cj = Tc_cj.rowRange(0, 3).colRange(0, 3);
-                                    double dist = cv::norm(vector_dist);
-                                    cout << "BoW: KF " << pKFi->mnId << " to KF " << pKFj->mnId << " is separated by " << dist << " meters" << endl;
-                                    cout << "BoW: Rotation between KF -> " << Rc_cj << endl;
-                                    vector<float> v_euler = Converter::toEuler(Rc_cj);
-                                    v_euler[0] *= 180 /3.1415;
-                                    v_euler[1] *= 180 /3.1415;
-                                    v_euler[2] *= 180 /3.1415;
-                                    cout << "BoW: Rotation in angles (x, y, z) -> (" << v_euler[0] << ", " << v_euler[1] << ", " << v_euler[2] << ")" << endl;
-                                    nNumKFs++;
-                                    /*if(numProjMatches_j > numProjOptMatches)
-                                    {
-                                        pLastCurrentKF = pKFj;
-                                        g2oScw = gSjw;
-                                        vpMatchedMPs = vpMatchedMPs_j;
-                                    }*/
+                                    min_y = coord_y;
+                                }
+                                if(coord_y > max_y)
+                                {
+                                    max_y = coord_y;
                                 }
-
-                                j++;
-                            }
-
-                            if(nNumKFs < 3)
-                            {
-                                vnStage[index] = 8;
-                                vnMatchesStage[index] = nNumKFs;
                             }
-
-                            if(nBestMatchesReproj < numProjOptMatches)
+                        }
+                        //cout << "BoW: Coord in X -> " << min_x << ", " << max_x << "; and Y -> " << min_y << ", " << max_y << endl;
+                        //cout << "BoW: features area in X -> " << (max_x - min_x) << " and Y -> " << (max_y - min_y) << endl;
+
+                        int nNumKFs = 0;
+                        //vpMatchedMPs = vpMatchedMP;
+                        //vpMPs = vpMapPoints;
+                        // Check the Sim3 transformation with the current KeyFrame covisibles
+                        vector<KeyFrame*> vpCurrentCovKFs = mpCurrentKF->GetBestCovisibilityKeyFrames(nNumCovisibles);
+                        //cout << "---" << endl;
+                        //cout << "BoW: Geometrical validation" << endl;
+                        int j = 0;
+                        while(nNumKFs < 3 && j<vpCurrentCovKFs.size())
+                        //for(int j=0; j<vpCurrentCovKFs.size(); ++j)
+                        {
+                            KeyFrame* pKFj = vpCurrentCovKFs[j];
+                            cv::Mat mTjc = pKFj->GetPose() * mpCurrentKF->GetPoseInverse();
+                            g2o::Sim3 gSjc(Converter::toMatrix3d(mTjc.rowRange(0, 3).colRange(0, 3)),Converter::toVector3d(mTjc.rowRange(0, 3).col(3)),1.0);
+                            g2o::Sim3 gSjw = gSjc * gScw;
+                            int numProjMatches_j = 0;
+                            vector<MapPoint*> vpMatchedMPs_j;
+                            bool bValid = DetectCommonRegionsFromLastKF(pKFj,pMostBoWMatchesKF, gSjw,numProjMatches_j, vpMapPoints, vpMatchedMPs_j);
+
+                            if(bValid)
                             {
-                                nBestMatchesReproj = numProjOptMatches;
-                                nBestNumCoindicendes = nNumKFs;
-                                pBestMatchedKF = pMostBoWMatchesKF;
-                                g2oBestScw = gScw;
-                                vpBestMapPoints = vpMapPoints;
-                                vpBestMatchedMapPoints = vpMatchedMP;
+                                //cout << "BoW: KF " << pKFj->mnId << " has " << numProjMatches_j << " matches" << endl;
+                                cv::Mat Tc_w = mpCurrentKF->GetPose();
+                                cv::Mat Tw_cj = pKFj->GetPoseInverse();
+                                cv::Mat Tc_cj = Tc_w * Tw_cj;
+                                cv::Vec3d vector_dist =  Tc_cj.rowRange(0, 3).col(3);
+                                cv::Mat Rc_cj = Tc_cj.rowRange(0, 3).colRange(0, 3);
+                                double dist = cv::norm(vector_dist);
+                                BoWCandidateResult::CoincidentKF coincident;
+                                coincident.nId = pKFj->mnId;
+                                coincident.dist = dist;
+                                coincident.Rc_cj = Rc_cj.clone();
+                                result.vCoincidentKFs.push_back(coincident);
+                                nNumKFs++;
+                                /*if(numProjMatches_j > numProjOptMatches)
+                                {
+                                    pLastCurrentKF = pKFj;
+                                    g2oScw = gSjw;
+                                    vpMatchedMPs = vpMatchedMPs_j;
+                                }*/
                             }
 
+                            j++;
+                        }
 
+                        if(nNumKFs < 3)
+                        {
+                            nStage = 8;
+                            nMatchesStage = nNumKFs;
                         }
 
+                        result.nProjOptMatches = numProjOptMatches;
+                        result.nNumKFs = nNumKFs;
+                        result.pMatchedKF = pMostBoWMatchesKF;
+                        result.gScw = gScw;
+                        result.vpMapPoints = vpMapPoints;
+                        result.vpMatchedMPs = vpMatchedMP;
+
+
                     }
 
                 }
-            }
-        }
-        index++;
-    }
-
-    if(nBestMatchesReproj > 0)
-    {
-        pLastCurrentKF = mpCurrentKF;
-        nNumCoincidences = nBestNumCoindicendes;
-        pMatchedKF2 = pBestMatchedKF;
-        pMatchedKF2->SetNotErase();
-        g2oScw = g2oBestScw;
-        vpMPs = vpBestMapPoints;
-        vpMatchedMPs = vpBestMatchedMapPoints;
 
-        return nNumCoincidences >= 3;
-    }
-    else
-    {
-        int maxStage = -1;
-        int maxMatched;
-        for(int i=0; i<vnStage.size(); ++i)
-        {
-            if(vnStage[i] > maxStage)
-            {
-                maxStage = vnStage[i];
-                maxMatched = vnMatchesStage[i];
             }
         }
-
-//        f_succes_pr << mpCurrentKF->mNameFile << " " << std::to_string(maxStage) << endl;
-//        f_succes_pr << "% NumCand: " << std::to_string(numCandidates) << "; matches: " << std::to_string(maxMatched) << endl;
     }
-    return false;
 }
 
 bool LoopClosing::DetectCommonRegionsFromLastKF(KeyFrame* pCurrentKF, KeyFrame* pMatchedKF, g2o::Sim3 &gScw, int &nNumProjMatches,
@@ -1435,7 +1523,12 @@ void LoopClosing::CorrectLoopWithLines()
     else
     {
         //cout << "With 7DoF" << endl;
-        Optimizer::OptimizeEssentialGraph(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, bFixedScale);
+        const OptimizationBudget* pBudget = mpTracker->mbOptimizationBudget ? &mpTracker->mEssentialGraphBudget : NULL;
+        Optimizer::OptimizeEssentialGraph(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, bFixedScale,
+                                          pBudget, pBudget ? &mEssentialGraphStats : NULL);
+        if(pBudget)
+            Verbose::PrintMess("Loop: essential graph optimized in " + to_string(mEssentialGraphStats.nIterations) + " iterations ("
+                               + to_string(mEssentialGraphStats.dTime) + " ms)", Verbose::VERBOSITY_DEBUG);
     }
 
 
@@ -1455,9 +1548,11 @@ void LoopClosing::CorrectLoopWithLines()
         mbFinishedGBA = false;
         mbStopGBA = false;
 
-        mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment, this, pLoopMap, mpCurrentKF->mnId);
-        // TO DO FIX RunGlobalBundleAdjustmentWithLines
-        //mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustmentWithLines, this, pLoopMap, mpCurrentKF->mnId);
+        // Global BA with lines only with the PCG solver (gbaSolver), the g2o one is too slow on large maps
+        if(mpTracker->mnGBASolver==1 && !pLoopMap->IsInertial())
+            mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustmentWithLines, this, pLoopMap, mpCurrentKF->mnId);
+        else
+            mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment, this, pLoopMap, mpCurrentKF->mnId);
     }
 
     // Loop closed. Release Local Mapping.
@@ -1676,7 +1771,12 @@ void LoopClosing::CorrectLoop()
     else
     {
         //cout << "With 7DoF" << endl;
-        Optimizer::OptimizeEssentialGraph(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, bFixedScale);
+        const OptimizationBudget* pBudget = mpTracker->mbOptimizationBudget ? &mpTracker->mEssentialGraphBudget : NULL;
+        Optimizer::OptimizeEssentialGraph(pLoopMap, mpLoopMatchedKF, mpCurrentKF, NonCorrectedSim3, CorrectedSim3, LoopConnections, bFixedScale,
+                                          pBudget, pBudget ? &mEssentialGraphStats : NULL);
+        if(pBudget)
+            Verbose::PrintMess("Loop: essential graph optimized in " + to_string(mEssentialGraphStats.nIterations) + " iterations ("
+                               + to_string(mEssentialGraphStats.dTime) + " ms)", Verbose::VERBOSITY_DEBUG);
     }
 
 
@@ -2355,7 +2455,9 @@ void LoopClosing::MergeLocalWithLines()
         // Optimize graph (and update the loop position for each element form the begining to the end)
         if(mpTracker->mSensor != System::MONOCULAR)
         {
-            Optimizer::OptimizeEssentialGraph(mpCurrentKF, vpMergeConnectedKFs, vpLocalCurrentWindowKFs, vpCurrentMapKFs, vpCurrentMapMPs, vpCurrentMapMLs);
+            const OptimizationBudget* pBudget = mpTracker->mbOptimizationBudget ? &mpTracker->mEssentialGraphBudget : NULL;
+            Optimizer::OptimizeEssentialGraph(mpCurrentKF, vpMergeConnectedKFs, vpLocalCurrentWindowKFs, vpCurrentMapKFs, vpCurrentMapMPs, vpCurrentMapMLs,
+                                              pBudget, pBudget ? &mEssentialGraphStats : NULL);
         }
 
 
@@ -2424,9 +2526,10 @@ void LoopClosing::MergeLocalWithLines()
         mbRunningGBA = true;
         mbFinishedGBA = false;
         mbStopGBA = false;
-        mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment,this, pMergeMap, mpCurrentKF->mnId);
-        // TO DO FIX RunGlobalBundleAdjustmentWithLines
-        //mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustmentWithLines,this, pMergeMap, mpCurrentKF->mnId);
+        if(mpTracker->mnGBASolver==1 && !pMergeMap->IsInertial())
+            mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustmentWithLines,this, pMergeMap, mpCurrentKF->mnId);
+        else
+            mpThreadGBA = new thread(&LoopClosing::RunGlobalBundleAdjustment,this, pMergeMap, mpCurrentKF->mnId);
     }
 
     mpMergeMatchedKF->AddMergeEdge(mpCurrentKF);
@@ -3555,16 +3658,10 @@ void LoopClosing::RequestReset()
         unique_lock<mutex> lock(mMutexReset);
         mbResetRequested = true;
     }
+    WakeUp();
 
-    while(1)
-    {
-        {
-        unique_lock<mutex> lock2(mMutexReset);
-        if(!mbResetRequested)
-            break;
-        }
-        usleep(5000);
-    }
+    unique_lock<mutex> lock2(mMutexReset);
+    mcvReset.wait(lock2, [&]{ return !mbResetRequested; });
 }
 
 void LoopClosing::RequestResetActiveMap(Map *pMap)
@@ -3574,16 +3671,10 @@ void LoopClosing::RequestResetActiveMap(Map *pMap)
         mbResetActiveMapRequested = true;
         mpMapToReset = pMap;
     }
+    WakeUp();
 
-    while(1)
-    {
-        {
-            unique_lock<mutex> lock2(mMutexReset);
-            if(!mbResetActiveMapRequested)
-                break;
-        }
-        usleep(3000);
-    }
+    unique_lock<mutex> lock2(mMutexReset);
+    mcvReset.wait(lock2, [&]{ return !mbResetActiveMapRequested; });
 }
 
 void LoopClosing::ResetIfRequested()
@@ -3596,6 +3687,7 @@ void LoopClosing::ResetIfRequested()
         mLastLoopKFid=0;  //TODO old variable, it is not use in the new algorithm
         mbResetRequested=false;
         mbResetActiveMapRequested = false;
+        mcvReset.notify_all();
     }
     else if(mbResetActiveMapRequested)
     {
@@ -3613,6 +3705,7 @@ void LoopClosing::ResetIfRequested()
 
         mLastLoopKFid=mpAtlas->GetLastInitKFid(); //TODO old variable, it is not use in the new algorithm
         mbResetActiveMapRequested=false;
+        mcvReset.notify_all();
 
     }
 }
@@ -3623,7 +3716,17 @@ void LoopClosing::RunGlobalBundleAdjustmentWithLines(Map* pActiveMap, unsigned l
 
     const bool bImuInit = pActiveMap->isImuInitialized();
 
-    Optimizer::GlobalBundleAdjustemntWithLines(pActiveMap,10,&mbStopGBA,nLoopKF,false);
+    if(mpTracker->mnGBASolver==1 && !mpTracker->mbLineOrthonormal)
+    {
+        // A GBA interrupted by a new loop can still be running when the next one starts: one solver per call
+        BASolver solver;
+        solver.SetThreads(mpTracker->mnGBAThreads);
+        solver.SetLinearSolver(BASolver::PCG_SCHUR, mpTracker->mnGBACGIterations);
+        solver.SetPartition(mpTracker->mnGBAClusterKFs);
+        solver.GlobalBundleAdjustmentWithLines(pActiveMap,10,&mbStopGBA,nLoopKF,false);
+    }
+    else
+        Optimizer::GlobalBundleAdjustemntWithLines(pActiveMap,10,&mbStopGBA,nLoopKF,false,mpTracker->mbLineOrthonormal);
 
     int idx =  mnFullBAIdx;
     // Optimizer::GlobalBundleAdjustemnt(mpMap,10,&mbStopGBA,nLoopKF,false);
@@ -4103,9 +4206,12 @@ void LoopClosing::RunGlobalBundleAdjustment(Map* pActiveMap, unsigned long nLoop
 
 void LoopClosing::RequestFinish()
 {
-    unique_lock<mutex> lock(mMutexFinish);
-    // cout << "LC: Finish requested" << endl;
-    mbFinishRequested = true;
+    {
+        unique_lock<mutex> lock(mMutexFinish);
+        // cout << "LC: Finish requested" << endl;
+        mbFinishRequested = true;
+    }
+    WakeUp();
 }
 
 bool LoopClosing::CheckFinish()
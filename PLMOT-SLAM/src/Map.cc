@@ -317,6 +317,11 @@ void Map::SetCurrentMap()
 void Map::SetStoredMap()
 {
     mIsInUse = false;
+
+    // Set by the tracking of the map in use, they would not be updated anymore
+    unique_lock<mutex> lock(mMutexMap);
+    mvpReferenceMapPoints.clear();
+    mvpReferenceMapLines.clear();
 }
 
 void Map::clear()
@@ -20,6 +20,7 @@
 #include "MapLine.h"
 #include "ORBmatcher.h"
 #include "Converter.h"
+#include "EpochReclaimer.h"
 
 #include<mutex>
 
@@ -31,8 +32,8 @@ long unsigned int MapLine::nNextId=0;
 mutex MapLine::mGlobalMutex;
 
 MapLine::MapLine(const Eigen::Vector3d &sP, const Eigen::Vector3d &eP, Map* pMap):
-    mnFirstKFid(-1), mnFirstFrame(0), nObs(0), mnTrackReferenceForFrame(0),mnLastFrameSeen(0), mnCorrectedByKF(0), mnCorrectedReference(0),
-    mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1), mnFound(1), mnBALocalForKF(0),
+    mnFirstKFid(-1), mnFirstFrame(0), nObs(0), mnObsVersion(0), mnTrackReferenceForFrame(0),mnLastFrameSeen(0), mnCorrectedByKF(0), mnCorrectedReference(0),
+    mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1), mnFound(1), mnBALocalForKF(0), mnFuseCandidateForKF(0),
     mbBad(false), mpReplaced(static_cast<MapLine*>(NULL)), mpMap(pMap)
 {
     mWorldPos_sP = sP;
@@ -44,8 +45,8 @@ MapLine::MapLine(const Eigen::Vector3d &sP, const Eigen::Vector3d &eP, Map* pMap
 }
 
 MapLine::MapLine(const Eigen::Vector3d &sP, const Eigen::Vector3d &eP, KeyFrame* pRefKF, Map* pMap):
-    mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),mnLastFrameSeen(0), mnCorrectedByKF(0), mnCorrectedReference(0),
-    mpRefKF(pRefKF), mnVisible(1), mnFound(1), mnBALocalForKF(0),
+    mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnObsVersion(0), mnTrackReferenceForFrame(0),mnLastFrameSeen(0), mnCorrectedByKF(0), mnCorrectedReference(0),
+    mpRefKF(pRefKF), mnVisible(1), mnFound(1), mnBALocalForKF(0), mnFuseCandidateForKF(0),
     mbBad(false), mpReplaced(static_cast<MapLine*>(NULL)), mpMap(pMap)
 {
     mWorldPos_sP = sP;
@@ -58,8 +59,8 @@ MapLine::MapLine(const Eigen::Vector3d &sP, const Eigen::Vector3d &eP, KeyFrame*
 }
 
 MapLine::MapLine(const Eigen::Vector3d &sP, const Eigen::Vector3d &eP,  Map* pMap, Frame* pFrame, const int &idxF):
-    mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0),mnLastFrameSeen(0), mnCorrectedByKF(0), mnCorrectedReference(0),
-    mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1), mnFound(1), mnBALocalForKF(0),
+    mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnObsVersion(0), mnTrackReferenceForFrame(0),mnLastFrameSeen(0), mnCorrectedByKF(0), mnCorrectedReference(0),
+    mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1), mnFound(1), mnBALocalForKF(0), mnFuseCandidateForKF(0),
     mbBad(false), mpReplaced(static_cast<MapLine*>(NULL)), mpMap(pMap)
 {
     mWorldPos_sP = sP;
@@ -115,17 +116,27 @@ KeyFrame* MapLine::GetReferenceKeyFrame()
     return mpRefKF;
 }
 
+vector<pair<KeyFrame*,size_t> >::iterator MapLine::FindObservation(KeyFrame* pKF)
+{
+    vector<pair<KeyFrame*,size_t> >::iterator it=mObservations.begin();
+    for(vector<pair<KeyFrame*,size_t> >::iterator end=mObservations.end(); it!=end; it++)
+        if(it->first==pKF)
+            break;
+    return it;
+}
+
 void MapLine::AddObservation(KeyFrame* pKF, size_t idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    if(mObservations.count(pKF))
+    if(FindObservation(pKF)!=mObservations.end())
         return;
-    mObservations[pKF]=idx;
+    mObservations.push_back(make_pair(pKF,idx));
 
     if(pKF->mvDepth_l[idx].first>=0 && pKF->mvDepth_l[idx].second>=0)
         nObs+=2;
     else
         nObs++;
+    mnObsVersion++;
 }
 
 void MapLine::EraseObservation(KeyFrame* pKF)
@@ -133,17 +144,19 @@ void MapLine::EraseObservation(KeyFrame* pKF)
     bool bBad=false;
     {
         unique_lock<mutex> lock(mMutexFeatures);
-        if(mObservations.count(pKF))
+        vector<pair<KeyFrame*,size_t> >::iterator it = FindObservation(pKF);
+        if(it!=mObservations.end())
         {
-            int idx = mObservations[pKF];
+            int idx = it->second;
             if(pKF->mvDepth_l[idx].first>=0 && pKF->mvDepth_l[idx].second>=0)
                 nObs-=2;
             else
                 nObs--;
 
-            mObservations.erase(pKF);
+            mObservations.erase(it);
+            mnObsVersion++;
 
-            if(mpRefKF==pKF)
+            if(mpRefKF==pKF && !mObservations.empty())
                 mpRefKF=mObservations.begin()->first;
 
             // If only 2 observations or less, discard point
@@ -159,7 +172,7 @@ void MapLine::EraseObservation(KeyFrame* pKF)
 map<KeyFrame*, size_t> MapLine::GetObservations()
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    return mObservations;
+    return map<KeyFrame*,size_t>(mObservations.begin(),mObservations.end());
 } 
 
 int MapLine::Observations()
@@ -168,23 +181,33 @@ int MapLine::Observations()
     return nObs;
 }
 
+long unsigned int MapLine::GetObservationsVersion()
+{
+    unique_lock<mutex> lock(mMutexFeatures);
+    return mnObsVersion;
+}
+
 void MapLine::SetBadFlag()
 {
-    map<KeyFrame*,size_t> obs;
+    vector<pair<KeyFrame*,size_t> > obs;
+    bool bWasBad;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
+        bWasBad = mbBad;
         mbBad=true;
-        obs = mObservations;
-        mObservations.clear();
+        obs.swap(mObservations);
+        mnObsVersion++;
     }
-    for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*,size_t> >::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
         pKF->EraseMapLineMatch(mit->second);
     }
 
     mpMap->EraseMapLine(this);
+
+    Retire(bWasBad);
 }
 
 MapLine* MapLine::GetReplaced()
@@ -200,19 +223,21 @@ void MapLine::Replace(MapLine* pML)
         return;
 
     int nvisible, nfound;
-    map<KeyFrame*,size_t> obs;
+    vector<pair<KeyFrame*,size_t> > obs;
+    bool bWasBad;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
-        obs=mObservations;
-        mObservations.clear();
+        obs.swap(mObservations);
+        mnObsVersion++;
+        bWasBad = mbBad;
         mbBad=true;
         nvisible = mnVisible;
         nfound = mnFound;
         mpReplaced = pML;
     }
 
-    for(map<KeyFrame*,size_t>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*,size_t> >::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         // Replace measurement in keyframe
         KeyFrame* pKF = mit->first;
@@ -232,6 +257,15 @@ void MapLine::Replace(MapLine* pML)
     pML->ComputeDistinctiveDescriptors();
 
     mpMap->EraseMapLine(this);
+
+    Retire(bWasBad);
+}
+
+void MapLine::Retire(const bool bWasBad)
+{
+    // Temporal lines of the tracking are deleted by it
+    if(!bWasBad && mnFirstKFid!=-1)
+        EpochReclaimer::Retire(this);
 }
 
 bool MapLine::isBad()
@@ -264,67 +298,28 @@ float MapLine::GetFoundRatio()
 void MapLine::ComputeDistinctiveDescriptors()
 {
     // Retrieve all observed descriptors
-    vector<cv::Mat> vDescriptors;
-
-    map<KeyFrame*,size_t> observations;
+    vector<pair<KeyFrame*,int> > vObs;
 
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         if(mbBad)
             return;
-        observations=mObservations;
+        vObs.reserve(mObservations.size());
+        for(vector<pair<KeyFrame*,size_t> >::iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
+            vObs.push_back(make_pair(mit->first,(int)mit->second));
     }
 
-    if(observations.empty())
+    if(vObs.empty())
         return;
 
-    vDescriptors.reserve(observations.size());
-
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-    {
-        KeyFrame* pKF = mit->first;
-
-        if(!pKF->isBad())
-            vDescriptors.push_back(pKF->mDescriptors_l.row(mit->second));
-    }
-
-    if(vDescriptors.empty())
+    // Only the descriptors of the observations added since the last call are compared to the rest
+    cv::Mat descriptor = mDescriptorMedoid.Update(vObs,true);
+    if(descriptor.empty())
         return;
 
-    // Compute distances between them
-    const size_t N = vDescriptors.size();
-
-    float Distances[N][N];
-    for(size_t i=0;i<N;i++)
-    {
-        Distances[i][i]=0;
-        for(size_t j=i+1;j<N;j++)
-        {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);
-            Distances[i][j]=distij;
-            Distances[j][i]=distij;
-        }
-    }
-
-    // Take the descriptor with least median distance to the rest
-    int BestMedian = INT_MAX;
-    int BestIdx = 0;
-    for(size_t i=0;i<N;i++)
-    {
-        vector<int> vDists(Distances[i],Distances[i]+N);
-        sort(vDists.begin(),vDists.end());
-        int median = vDists[0.5*(N-1)];
-
-        if(median<BestMedian)
-        {
-            BestMedian = median;
-            BestIdx = i;
-        }
-    }
-
     {
         unique_lock<mutex> lock(mMutexFeatures);
-        mDescriptor = vDescriptors[BestIdx].clone();
+        mDescriptor = descriptor;
     }
 }
 
@@ -336,7 +331,7 @@ cv::Mat MapLine::GetDescriptor()
 
 void MapLine::UpdateNormalAndDepth()
 {
-    map<KeyFrame*,size_t> observations;
+    vector<pair<KeyFrame*,size_t> > observations;
     KeyFrame* pRefKF;
     cv::Mat Pos;
     {
@@ -354,7 +349,7 @@ void MapLine::UpdateNormalAndDepth()
 
     cv::Mat normal = cv::Mat::zeros(3,1,CV_32F);
     int n=0;
-    for(map<KeyFrame*,size_t>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*,size_t> >::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
         cv::Mat Owi = pKF->GetCameraCenter();
@@ -364,8 +359,17 @@ void MapLine::UpdateNormalAndDepth()
     }
     cv::Mat PC = Pos - pRefKF->GetCameraCenter();
     const float dist = cv::norm(PC);
-    //const int level = pRefKF->mvKeysUn_Line[observations[pRefKF]].octave;
-    const int level = pRefKF->mvKeys_Line[observations[pRefKF]].octave;
+    size_t idxRef = 0;
+    for(size_t i=0; i<observations.size(); i++)
+    {
+        if(observations[i].first==pRefKF)
+        {
+            idxRef = observations[i].second;
+            break;
+        }
+    }
+    //const int level = pRefKF->mvKeysUn_Line[idxRef].octave;
+    const int level = pRefKF->mvKeys_Line[idxRef].octave;
     const float levelScaleFactor =  pRefKF->mvScaleFactors_l[level];
     const int nLevels = pRefKF->mnScaleLevels_l;
 
@@ -398,8 +402,9 @@ cv::Mat MapLine::GetNormal()
 int MapLine::GetIndexInKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    if(mObservations.count(pKF))
-        return mObservations[pKF];
+    vector<pair<KeyFrame*,size_t> >::iterator it = FindObservation(pKF);
+    if(it!=mObservations.end())
+        return it->second;
     else
         return -1;
 }
@@ -407,7 +412,7 @@ int MapLine::GetIndexInKeyFrame(KeyFrame *pKF)
 bool MapLine::IsInKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    return (mObservations.count(pKF));
+    return FindObservation(pKF)!=mObservations.end();
 }
 
 KeyFrame* MapLine::SetReferenceKeyFrame(KeyFrame* RFKF)
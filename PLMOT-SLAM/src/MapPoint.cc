@@ -18,6 +18,7 @@
 
 #include "MapPoint.h"
 #include "ORBmatcher.h"
+#include "EpochReclaimer.h"
 
 #include<mutex>
 
@@ -28,7 +29,7 @@ long unsigned int MapPoint::nNextId=0;
 mutex MapPoint::mGlobalMutex;
 
 MapPoint::MapPoint():
-    mnFirstKFid(0), mnFirstFrame(0), nObs(0), mnTrackReferenceForFrame(0),
+    mnFirstKFid(0), mnFirstFrame(0), nObs(0), mnObsVersion(0), mnTrackReferenceForFrame(0),
     mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mnVisible(1), mnFound(1), mbBad(false),
     mpReplaced(static_cast<MapPoint*>(NULL))
@@ -37,7 +38,7 @@ MapPoint::MapPoint():
 }
 
 MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
-    mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
+    mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnObsVersion(0), mnTrackReferenceForFrame(0),
     mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
     mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap),
@@ -55,7 +56,7 @@ MapPoint::MapPoint(const cv::Mat &Pos, KeyFrame *pRefKF, Map* pMap):
 }
 
 MapPoint::MapPoint(const double invDepth, cv::Point2f uv_init, KeyFrame* pRefKF, KeyFrame* pHostKF, Map* pMap):
-    mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnTrackReferenceForFrame(0),
+    mnFirstKFid(pRefKF->mnId), mnFirstFrame(pRefKF->mnFrameId), nObs(0), mnObsVersion(0), mnTrackReferenceForFrame(0),
     mnLastFrameSeen(0), mnBALocalForKF(0), mnFuseCandidateForKF(0), mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(pRefKF), mnVisible(1), mnFound(1), mbBad(false),
     mpReplaced(static_cast<MapPoint*>(NULL)), mfMinDistance(0), mfMaxDistance(0), mpMap(pMap),
@@ -75,7 +76,7 @@ MapPoint::MapPoint(const double invDepth, cv::Point2f uv_init, KeyFrame* pRefKF,
 }
 
 MapPoint::MapPoint(const cv::Mat &Pos, Map* pMap, Frame* pFrame, const int &idxF):
-    mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0),
+    mnFirstKFid(-1), mnFirstFrame(pFrame->mnId), nObs(0), mnObsVersion(0), mnTrackReferenceForFrame(0), mnLastFrameSeen(0),
     mnBALocalForKF(0), mnFuseCandidateForKF(0),mnLoopPointForKF(0), mnCorrectedByKF(0),
     mnCorrectedReference(0), mnBAGlobalForKF(0), mpRefKF(static_cast<KeyFrame*>(NULL)), mnVisible(1),
     mnFound(1), mbBad(false), mpReplaced(NULL), mpMap(pMap), mnOriginMapId(pMap->GetId())
@@ -138,17 +139,25 @@ KeyFrame* MapPoint::GetReferenceKeyFrame()
     return mpRefKF;
 }
 
+vector<pair<KeyFrame*,tuple<int,int> > >::iterator MapPoint::FindObservation(KeyFrame* pKF)
+{
+    vector<pair<KeyFrame*,tuple<int,int> > >::iterator it=mObservations.begin();
+    for(vector<pair<KeyFrame*,tuple<int,int> > >::iterator end=mObservations.end(); it!=end; it++)
+        if(it->first==pKF)
+            break;
+    return it;
+}
+
 void MapPoint::AddObservation(KeyFrame* pKF, int idx)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    tuple<int,int> indexes;
-
-    if(mObservations.count(pKF)){
-        indexes = mObservations[pKF];
-    }
-    else{
-        indexes = tuple<int,int>(-1,-1);
+    vector<pair<KeyFrame*,tuple<int,int> > >::iterator it = FindObservation(pKF);
+    if(it==mObservations.end())
+    {
+        mObservations.push_back(make_pair(pKF,tuple<int,int>(-1,-1)));
+        it = mObservations.end()-1;
     }
+    tuple<int,int> &indexes = it->second;
 
     if(pKF -> NLeft != -1 && idx >= pKF -> NLeft){
         get<1>(indexes) = idx;
@@ -157,12 +166,11 @@ void MapPoint::AddObservation(KeyFrame* pKF, int idx)
         get<0>(indexes) = idx;
     }
 
-    mObservations[pKF]=indexes;
-
     if(!pKF->mpCamera2 && pKF->mvuRight[idx]>=0)
         nObs+=2;
     else
         nObs++;
+    mnObsVersion++;
 }
 
 void MapPoint::EraseObservation(KeyFrame* pKF)
@@ -170,10 +178,11 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
     bool bBad=false;
     {
         unique_lock<mutex> lock(mMutexFeatures);
-        if(mObservations.count(pKF))
+        vector<pair<KeyFrame*,tuple<int,int> > >::iterator it = FindObservation(pKF);
+        if(it!=mObservations.end())
         {
             //int idx = mObservations[pKF];
-            tuple<int,int> indexes = mObservations[pKF];
+            tuple<int,int> indexes = it->second;
             int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
 
             if(leftIndex != -1){
@@ -186,9 +195,10 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
                 nObs--;
             }
 
-            mObservations.erase(pKF);
+            mObservations.erase(it);
+            mnObsVersion++;
 
-            if(mpRefKF==pKF)
+            if(mpRefKF==pKF && !mObservations.empty())
                 mpRefKF=mObservations.begin()->first;
 
             // If only 2 observations or less, discard point
@@ -205,7 +215,7 @@ void MapPoint::EraseObservation(KeyFrame* pKF)
 std::map<KeyFrame*, std::tuple<int,int>>  MapPoint::GetObservations()
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    return mObservations;
+    return map<KeyFrame*,tuple<int,int>>(mObservations.begin(),mObservations.end());
 }
 
 int MapPoint::Observations()
@@ -214,17 +224,25 @@ int MapPoint::Observations()
     return nObs;
 }
 
+long unsigned int MapPoint::GetObservationsVersion()
+{
+    unique_lock<mutex> lock(mMutexFeatures);
+    return mnObsVersion;
+}
+
 void MapPoint::SetBadFlag()
 {
-    map<KeyFrame*, tuple<int,int>> obs;
+    vector<pair<KeyFrame*, tuple<int,int> > > obs;
+    bool bWasBad;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
+        bWasBad = mbBad;
         mbBad=true;
-        obs = mObservations;
-        mObservations.clear();
+        obs.swap(mObservations);
+        mnObsVersion++;
     }
-    for(map<KeyFrame*, tuple<int,int>>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*, tuple<int,int> > >::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
         int leftIndex = get<0>(mit -> second), rightIndex = get<1>(mit -> second);
@@ -237,6 +255,8 @@ void MapPoint::SetBadFlag()
     }
 
     mpMap->EraseMapPoint(this);
+
+    Retire(bWasBad);
 }
 
 MapPoint* MapPoint::GetReplaced()
@@ -252,19 +272,21 @@ void MapPoint::Replace(MapPoint* pMP)
         return;
 
     int nvisible, nfound;
-    map<KeyFrame*,tuple<int,int>> obs;
+    vector<pair<KeyFrame*,tuple<int,int> > > obs;
+    bool bWasBad;
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         unique_lock<mutex> lock2(mMutexPos);
-        obs=mObservations;
-        mObservations.clear();
+        obs.swap(mObservations);
+        mnObsVersion++;
+        bWasBad = mbBad;
         mbBad=true;
         nvisible = mnVisible;
         nfound = mnFound;
         mpReplaced = pMP;
     }
 
-    for(map<KeyFrame*,tuple<int,int>>::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*,tuple<int,int> > >::iterator mit=obs.begin(), mend=obs.end(); mit!=mend; mit++)
     {
         // Replace measurement in keyframe
         KeyFrame* pKF = mit->first;
@@ -298,6 +320,15 @@ void MapPoint::Replace(MapPoint* pMP)
     pMP->ComputeDistinctiveDescriptors();
 
     mpMap->EraseMapPoint(this);
+
+    Retire(bWasBad);
+}
+
+void MapPoint::Retire(const bool bWasBad)
+{
+    // Temporal points of the tracking are deleted by it
+    if(!bWasBad && mnFirstKFid!=-1)
+        EpochReclaimer::Retire(this);
 }
 
 bool MapPoint::isBad()
@@ -330,76 +361,34 @@ float MapPoint::GetFoundRatio()
 void MapPoint::ComputeDistinctiveDescriptors()
 {
     // Retrieve all observed descriptors
-    vector<cv::Mat> vDescriptors;
-
-    map<KeyFrame*,tuple<int,int>> observations;
+    vector<pair<KeyFrame*,int> > vObs;
 
     {
         unique_lock<mutex> lock1(mMutexFeatures);
         if(mbBad)
             return;
-        observations=mObservations;
-    }
-
-    if(observations.empty())
-        return;
-
-    vDescriptors.reserve(observations.size());
-
-    for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
-    {
-        KeyFrame* pKF = mit->first;
-
-        if(!pKF->isBad()){
-            tuple<int,int> indexes = mit -> second;
-            int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
-
-            if(leftIndex != -1){
-                vDescriptors.push_back(pKF->mDescriptors.row(leftIndex));
-            }
-            if(rightIndex != -1){
-                vDescriptors.push_back(pKF->mDescriptors.row(rightIndex));
-            }
-        }
-    }
-
-    if(vDescriptors.empty())
-        return;
-
-    // Compute distances between them
-    const size_t N = vDescriptors.size();
-
-    float Distances[N][N];
-    for(size_t i=0;i<N;i++)
-    {
-        Distances[i][i]=0;
-        for(size_t j=i+1;j<N;j++)
+        vObs.reserve(mObservations.size());
+        for(vector<pair<KeyFrame*,tuple<int,int> > >::iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
         {
-            int distij = ORBmatcher::DescriptorDistance(vDescriptors[i],vDescriptors[j]);
-            Distances[i][j]=distij;
-            Distances[j][i]=distij;
+            int leftIndex = get<0>(mit->second), rightIndex = get<1>(mit->second);
+            if(leftIndex != -1)
+                vObs.push_back(make_pair(mit->first,leftIndex));
+            if(rightIndex != -1)
+                vObs.push_back(make_pair(mit->first,rightIndex));
         }
     }
 
-    // Take the descriptor with least median distance to the rest
-    int BestMedian = INT_MAX;
-    int BestIdx = 0;
-    for(size_t i=0;i<N;i++)
-    {
-        vector<int> vDists(Distances[i],Distances[i]+N);
-        sort(vDists.begin(),vDists.end());
-        int median = vDists[0.5*(N-1)];
+    if(vObs.empty())
+        return;
 
-        if(median<BestMedian)
-        {
-            BestMedian = median;
-            BestIdx = i;
-        }
-    }
+    // Only the descriptors of the observations added since the last call are compared to the rest
+    cv::Mat descriptor = mDescriptorMedoid.Update(vObs,false);
+    if(descriptor.empty())
+        return;
 
     {
         unique_lock<mutex> lock(mMutexFeatures);
-        mDescriptor = vDescriptors[BestIdx].clone();
+        mDescriptor = descriptor;
     }
 }
 
@@ -412,8 +401,9 @@ cv::Mat MapPoint::GetDescriptor()
 tuple<int,int> MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    if(mObservations.count(pKF))
-        return mObservations[pKF];
+    vector<pair<KeyFrame*,tuple<int,int> > >::iterator it = FindObservation(pKF);
+    if(it!=mObservations.end())
+        return it->second;
     else
         return tuple<int,int>(-1,-1);
 }
@@ -421,12 +411,12 @@ tuple<int,int> MapPoint::GetIndexInKeyFrame(KeyFrame *pKF)
 bool MapPoint::IsInKeyFrame(KeyFrame *pKF)
 {
     unique_lock<mutex> lock(mMutexFeatures);
-    return (mObservations.count(pKF));
+    return FindObservation(pKF)!=mObservations.end();
 }
 
 void MapPoint::UpdateNormalAndDepth()
 {
-    map<KeyFrame*,tuple<int,int>> observations;
+    vector<pair<KeyFrame*,tuple<int,int> > > observations;
     KeyFrame* pRefKF;
     cv::Mat Pos;
     {
@@ -444,7 +434,7 @@ void MapPoint::UpdateNormalAndDepth()
 
     cv::Mat normal = cv::Mat::zeros(3,1,CV_32F);
     int n=0;
-    for(map<KeyFrame*,tuple<int,int>>::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*,tuple<int,int> > >::iterator mit=observations.begin(), mend=observations.end(); mit!=mend; mit++)
     {
         KeyFrame* pKF = mit->first;
 
@@ -468,7 +458,15 @@ void MapPoint::UpdateNormalAndDepth()
     cv::Mat PC = Pos - pRefKF->GetCameraCenter();
     const float dist = cv::norm(PC);
 
-    tuple<int ,int> indexes = observations[pRefKF];
+    tuple<int ,int> indexes;
+    for(size_t i=0; i<observations.size(); i++)
+    {
+        if(observations[i].first==pRefKF)
+        {
+            indexes = observations[i].second;
+            break;
+        }
+    }
     int leftIndex = get<0>(indexes), rightIndex = get<1>(indexes);
     int level;
     if(pRefKF -> NLeft == -1){
@@ -548,7 +546,7 @@ int MapPoint::PredictScale(const float &currentDist, Frame* pF)
 void MapPoint::PrintObservations()
 {
     cout << "MP_OBS: MP " << mnId << endl;
-    for(map<KeyFrame*,tuple<int,int>>::iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
+    for(vector<pair<KeyFrame*,tuple<int,int> > >::iterator mit=mObservations.begin(), mend=mObservations.end(); mit!=mend; mit++)
     {
         KeyFrame* pKFi = mit->first;
         tuple<int,int> indexes = mit->second;
@@ -577,8 +575,9 @@ void MapPoint::PreSave(set<KeyFrame*>& spKF,set<MapPoint*>& spMP)
 
     mBackupObservationsId1.clear();
     mBackupObservationsId2.clear();
-    // Save the id and position in each KF who view it
-    for(std::map<KeyFrame*,std::tuple<int,int> >::const_iterator it = mObservations.begin(), end = mObservations.end(); it != end; ++it)
+    // Save the id and position in each KF who view it (on a copy, as the observations of other KFs are erased)
+    const std::vector<std::pair<KeyFrame*,std::tuple<int,int> > > observations = mObservations;
+    for(std::vector<std::pair<KeyFrame*,std::tuple<int,int> > >::const_iterator it = observations.begin(), end = observations.end(); it != end; ++it)
     {
         KeyFrame* pKFi = it->first;
         if(spKF.find(pKFi) != spKF.end())
@@ -615,6 +614,7 @@ void MapPoint::PostLoad(map<long unsigned int, KeyFrame*>& mpKFid, map<long unsi
     }
 
     mObservations.clear();
+    mnObsVersion++;
 
     for(map<long unsigned int, int>::const_iterator it = mBackupObservationsId1.begin(), end = mBackupObservationsId1.end(); it != end; ++it)
     {
@@ -623,7 +623,7 @@ void MapPoint::PostLoad(map<long unsigned int, KeyFrame*>& mpKFid, map<long unsi
         std::tuple<int, int> indexes = tuple<int,int>(it->second,it2->second);
         if(pKFi)
         {
-           mObservations[pKFi] = indexes;
+           mObservations.push_back(make_pair(pKFi,indexes));
         }
     }
 
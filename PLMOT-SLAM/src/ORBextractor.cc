@@ -55,6 +55,7 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/video/tracking.hpp>
 #include <vector>
 #include <iostream>
 
@@ -407,7 +408,7 @@ namespace ORB_SLAM3
 
     ORBextractor::ORBextractor(int _nfeatures, float _scaleFactor, int _nlevels,
                                int _iniThFAST, int _minThFAST):
-            nfeatures(_nfeatures), scaleFactor(_scaleFactor), nlevels(_nlevels),
+            mbTrackPoints(false), mnMinTrackedPoints(50), nfeatures(_nfeatures), scaleFactor(_scaleFactor), nlevels(_nlevels),
             iniThFAST(_iniThFAST), minThFAST(_minThFAST)
     {
         mvScaleFactor.resize(nlevels);
@@ -1065,31 +1066,13 @@ namespace ORB_SLAM3
             computeOrbDescriptor(keypoints[i], image, &pattern[0], descriptors.ptr((int)i));
     }
 
-    int ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPoint>& _keypoints,
-                                  OutputArray _descriptors, std::vector<int> &vLappingArea, const std::vector<std::string> &labels, const std::vector<uint8_t> &masks)
+    void ORBextractor::PersonContours(const Size &size, const vector<string> &labels, const vector<uint8_t> &masks,
+                                      vector<vector<Point> > &contours)
     {
-        //cout<<"Start Frame 11~~~~~~~~~~~~~~~"<<endl;
-        //cout << "[ORBextractor]: Max Features: " << nfeatures << endl;
-        if(_image.empty())
-            return -1;
-
-        Mat image = _image.getMat();
-        assert(image.type() == CV_8UC1 );
-
-        // Pre-compute the scale pyramid
-        ComputePyramid(image);
-
-        vector < vector<KeyPoint> > allKeypoints;
-        ComputeKeyPointsOctTree(allKeypoints);
-        //cout<<"1"<<endl;
-        //ComputeKeyPointsOld(allKeypoints);
-
-        //Eliminate the dynamic features
-        Mat mskMat;
         int nums = labels.size();
-        int height = image.size().height;
-        int width = image.size().width;
-        Mat dst = Mat(image.size(),CV_8U,Scalar(0,0,0));
+        int height = size.height;
+        int width = size.width;
+        Mat dst = Mat(size,CV_8U,Scalar(0,0,0));
         for (int i = 0; i <nums ; ++i)
         {
             if(labels[i] == "person")
@@ -1099,7 +1082,7 @@ namespace ORB_SLAM3
                 vector<uint8_t > mask(first1,first2);
                 Mat msk = Mat(mask);
                 Mat MSK = msk.reshape(1,height);
-                Mat dst_temp = Mat(image.size(),CV_8U,Scalar(0,0,0));
+                Mat dst_temp = Mat(size,CV_8U,Scalar(0,0,0));
                 for (int j = 0; j <height ; ++j)
                 {
                     for (int k = 0; k <width ; ++k)
@@ -1115,8 +1098,42 @@ namespace ORB_SLAM3
 
         }
 
-        vector<vector<Point>> contours;
+        contours.clear();
         findContours(dst,contours,RETR_EXTERNAL,CHAIN_APPROX_NONE);
+    }
+
+    bool ORBextractor::NearContours(const Point2f &pt, const vector<vector<Point> > &contours)
+    {
+        for(size_t i=0; i<contours.size(); ++i)
+        {
+            if(pointPolygonTest(contours[i],pt,true) >= -15)
+                return true;
+        }
+        return false;
+    }
+
+    int ORBextractor::operator()( InputArray _image, InputArray _mask, vector<KeyPoint>& _keypoints,
+                                  OutputArray _descriptors, std::vector<int> &vLappingArea, const std::vector<std::string> &labels, const std::vector<uint8_t> &masks)
+    {
+        //cout<<"Start Frame 11~~~~~~~~~~~~~~~"<<endl;
+        //cout << "[ORBextractor]: Max Features: " << nfeatures << endl;
+        if(_image.empty())
+            return -1;
+
+        Mat image = _image.getMat();
+        assert(image.type() == CV_8UC1 );
+
+        // Pre-compute the scale pyramid
+        ComputePyramid(image);
+
+        vector < vector<KeyPoint> > allKeypoints;
+        ComputeKeyPointsOctTree(allKeypoints);
+        //cout<<"1"<<endl;
+        //ComputeKeyPointsOld(allKeypoints);
+
+        //Eliminate the dynamic features
+        vector<vector<Point>> contours;
+        PersonContours(image.size(), labels, masks, contours);
 
         for(int level = 0; level < nlevels; ++level)
         {
@@ -1344,4 +1361,66 @@ namespace ORB_SLAM3
 
     }
 
+    int ORBextractor::Track(const Mat &prevImage, const Mat &image, const vector<KeyPoint> &prevKeypoints,
+                            vector<KeyPoint> &keypoints, vector<int> &vPrevIdx,
+                            const std::vector<std::string> &labels, const std::vector<uint8_t> &masks)
+    {
+        // Maximum distance between a keypoint and its forward-backward track
+        const float thFB = 1.f;
+
+        keypoints.clear();
+        vPrevIdx.clear();
+
+        if(prevImage.empty() || prevKeypoints.empty() || prevImage.size()!=image.size())
+            return 0;
+
+        vector<Point2f> vPrevPts;
+        KeyPoint::convert(prevKeypoints, vPrevPts);
+
+        vector<Point2f> vPts, vBackPts;
+        vector<uchar> vStatus, vBackStatus;
+        vector<float> vErr;
+        const Size winSize(21,21);
+        const int maxLevel = 3;
+        const TermCriteria criteria(TermCriteria::COUNT+TermCriteria::EPS, 20, 0.03);
+        calcOpticalFlowPyrLK(prevImage, image, vPrevPts, vPts, vStatus, vErr, winSize, maxLevel, criteria);
+
+        // Track back from the tracked positions only
+        vBackPts = vPrevPts;
+        calcOpticalFlowPyrLK(image, prevImage, vPts, vBackPts, vBackStatus, vErr, winSize, maxLevel, criteria, OPTFLOW_USE_INITIAL_FLOW);
+
+        const float minX = EDGE_THRESHOLD, minY = EDGE_THRESHOLD;
+        const float maxX = image.cols-EDGE_THRESHOLD, maxY = image.rows-EDGE_THRESHOLD;
+
+        // A static keypoint covered by a person would be tracked onto it: dropped as the detected ones
+        vector<vector<Point>> contours;
+        PersonContours(image.size(), labels, masks, contours);
+
+        keypoints.reserve(prevKeypoints.size());
+        vPrevIdx.reserve(prevKeypoints.size());
+        for(size_t i=0; i<vPts.size(); i++)
+        {
+            if(!vStatus[i] || !vBackStatus[i])
+                continue;
+
+            const Point2f &pt = vPts[i];
+            if(pt.x<minX || pt.y<minY || pt.x>=maxX || pt.y>=maxY)
+                continue;
+
+            const Point2f d = vBackPts[i]-vPrevPts[i];
+            if(d.x*d.x+d.y*d.y>thFB*thFB)
+                continue;
+
+            if(NearContours(pt, contours))
+                continue;
+
+            KeyPoint kp = prevKeypoints[i];
+            kp.pt = pt;
+            keypoints.push_back(kp);
+            vPrevIdx.push_back(i);
+        }
+
+        return keypoints.size();
+    }
+
 } //namespace ORB_SLAM
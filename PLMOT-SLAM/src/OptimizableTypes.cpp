@@ -356,45 +356,17 @@ namespace ORB_SLAM3 {
     }
 
     Eigen::Vector2d EdgeLineSE3ProjectXYZOnlyPose::cam_project(const Eigen::Vector3d & trans_xyz) const{
-    const float invz = 1.0f/trans_xyz[2];
-    Eigen::Vector2d res;
-    res[0] = trans_xyz[0]*invz*fx + cx;
-    res[1] = trans_xyz[1]*invz*fy + cy;
-    return res;
+    return LineEndpointProjection(trans_xyz,fx,fy,cx,cy).Point();
     }
 
 
     void EdgeLineSE3ProjectXYZOnlyPose::linearizeOplus() {
         g2o::VertexSE3Expmap * vi = static_cast<g2o::VertexSE3Expmap *>(_vertices[0]);
-        Eigen::Vector3d xyz_trans_s = vi->estimate().map(Xw_s);
-        Eigen::Vector3d xyz_trans_e = vi->estimate().map(Xw_e);
+        const LineEndpointProjection ps(vi->estimate().map(Xw_s),fx,fy,cx,cy);
+        const LineEndpointProjection pe(vi->estimate().map(Xw_e),fx,fy,cx,cy);
 
-        double x_s = xyz_trans_s[0];
-        double y_s = xyz_trans_s[1];
-        double invz_s = 1.0/xyz_trans_s[2];
-        double invz_s_2 = invz_s*invz_s;
-
-        double x_e = xyz_trans_e[0];
-        double y_e = xyz_trans_e[1];
-        double invz_e = 1.0/xyz_trans_e[2];
-        double invz_e_2 = invz_e*invz_e;
-
-        double l0 = obs_temp(0);
-        double l1 = obs_temp(1);
-
-        _jacobianOplusXi(0,0) = -fx*x_s*y_s*invz_s_2*l0-fy*(1+y_s*y_s*invz_s_2)*l1;
-        _jacobianOplusXi(0,1) = fx*(1+x_s*x_s*invz_s_2)*l0+fy*x_s*y_s*invz_s_2*l1;
-        _jacobianOplusXi(0,2) = -fx*y_s*invz_s*l0+fy*x_s*invz_s*l1; 
-        _jacobianOplusXi(0,3) = fx*invz_s*l0;
-        _jacobianOplusXi(0,4) = fy*invz_s*l1;
-        _jacobianOplusXi(0,5) = (-fx*x_s*l0-fy*y_s*l1)*invz_s_2;
-
-        _jacobianOplusXi(1,0) = -fx*x_e*y_e*invz_e_2*l0-fy*(1+y_e*y_e*invz_e_2)*l1;
-        _jacobianOplusXi(1,1) = fx*(1+x_e*x_e*invz_e_2)*l0+fy*x_e*y_e*invz_e_2*l1;
-        _jacobianOplusXi(1,2) = -fx*y_e*invz_e*l0+fy*x_e*invz_e*l1;  
-        _jacobianOplusXi(1,3) = fx*invz_e*l0;
-        _jacobianOplusXi(1,4) = fy*invz_e*l1;
-        _jacobianOplusXi(1,5) = (-fx*x_e*l0-fy*y_e*l1)*invz_e_2;
+        _jacobianOplusXi << ps.PoseJacobian(ps.LineDistanceJacobian(_measurement,fx,fy)),
+                            pe.PoseJacobian(pe.LineDistanceJacobian(_measurement,fx,fy));
     }
 
     bool EdgeLineAngleSE3ProjectXYZOnlyPose::read(std::istream& is){
@@ -423,79 +395,24 @@ namespace ORB_SLAM3 {
     }
 
     Eigen::Vector2d EdgeLineAngleSE3ProjectXYZOnlyPose::cam_project(const Eigen::Vector3d & trans_xyz) const{
-    const float invz = 1.0f/trans_xyz[2];
-    Eigen::Vector2d res;
-    res[0] = trans_xyz[0]*invz*fx + cx;
-    res[1] = trans_xyz[1]*invz*fy + cy;
-    return res;
+    return LineEndpointProjection(trans_xyz,fx,fy,cx,cy).Point();
     }
 
 
     void EdgeLineAngleSE3ProjectXYZOnlyPose::linearizeOplus() {
         g2o::VertexSE3Expmap * vi = static_cast<g2o::VertexSE3Expmap *>(_vertices[0]);
-        Eigen::Vector3d xyz_trans_s = vi->estimate().map(Xw_s);
-        Eigen::Vector3d xyz_trans_e = vi->estimate().map(Xw_e);
-        Eigen::Vector2d P_pr = cam_project(vi->estimate().map(Xw_s));
-        Eigen::Vector2d Q_pr = cam_project(vi->estimate().map(Xw_e));
-
-        double x_s = xyz_trans_s[0];
-        double y_s = xyz_trans_s[1];
-        double z_s = xyz_trans_s[2];
-        double invz_s = 1.0/xyz_trans_s[2];
-        double invz_s_2 = invz_s*invz_s;
-
-        double x_e = xyz_trans_e[0];
-        double y_e = xyz_trans_e[1];
-        double z_e = xyz_trans_e[2];
-        double invz_e = 1.0/xyz_trans_e[2];
-        double invz_e_2 = invz_e*invz_e;
-
-        double xp = obs_temp(0);
-        double yp = obs_temp(1);
-        double xq = obs_temp(2);
-        double yq = obs_temp(3);
-
-        Eigen::Vector2d QP;
-        QP << xp-xq, yp-yq;
-        Eigen::Vector2d QP_pr;
-        QP_pr << P_pr(0)-xq, P_pr(1)-yq;
-        Eigen::Vector2d PQ_pr;
-        PQ_pr << Q_pr(0)-xp, Q_pr(1)-yp;
-        Eigen::Vector2d Der_start;
-        Eigen::Vector2d Der_end;
-
-        Der_start[0] = ((xp-xq)*QP.norm()*QP_pr.norm()-((xp-xq)*(P_pr(0)-xq)+(yp-yq)*(P_pr(1)-yq))*QP.norm()*(P_pr(0)-xq)/QP_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-        Der_start[1] = ((yp-yq)*QP.norm()*QP_pr.norm()-((xp-xq)*(P_pr(0)-xq)+(yp-yq)*(P_pr(1)-yq))*QP.norm()*(P_pr(1)-yq)/QP_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-
-        Eigen::Matrix<double,2,3> ProjJac_s;
-
-        ProjJac_s << fx*invz_s, 0.f, -fx*x_s*invz_s_2,
-                    0.f, fy*invz_s, -fx*y_s*invz_s_2;
-
-        Eigen::Matrix<double,1,3> Jac_s = Der_start.transpose()*ProjJac_s;
-
-        Der_end[0] = ((xp-xq)*QP.norm()*PQ_pr.norm()-((xp-xq)*(Q_pr(0)-xp)+(yp-yq)*(Q_pr(1)-yp))*QP.norm()*(Q_pr(0)-xp)/PQ_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-        Der_end[1] = ((yp-yq)*QP.norm()*PQ_pr.norm()-((xp-xq)*(Q_pr(0)-xp)+(yp-yq)*(Q_pr(1)-yp))*QP.norm()*(Q_pr(1)-yp)/PQ_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
+        const LineEndpointProjection ps(vi->estimate().map(Xw_s),fx,fy,cx,cy);
+        const LineEndpointProjection pe(vi->estimate().map(Xw_e),fx,fy,cx,cy);
 
-        Eigen::Matrix<double,2,3> ProjJac_e;
+        const Eigen::Vector2d P(_measurement(0), _measurement(1));
+        const Eigen::Vector2d Q(_measurement(2), _measurement(3));
+        const Eigen::Vector2d QP = P - Q;
 
-        ProjJac_e << fx*invz_e, 0.f, -fx*x_e*invz_e_2,
-                    0.f, fy*invz_e, -fx*y_e*invz_e_2;
+        const Eigen::Matrix<double,1,3> Jac_s = LineAngleCosJacobian(ps.Point() - Q, QP)*ps.ProjectionJacobian(fx,fy);
+        const Eigen::Matrix<double,1,3> Jac_e = LineAngleCosJacobian(pe.Point() - P, QP)*pe.ProjectionJacobian(fx,fy);
 
-        Eigen::Matrix<double,1,3> Jac_e = Der_end.transpose()*ProjJac_e;
-        
-        Eigen::Matrix<double,3,6> SE3deriv_s;
-        SE3deriv_s << 0.f, z_s, -y_s, 1.f, 0.f, 0.f,
-                      -z_s, 0.f, x_s, 0.f, 1.f, 0.f,
-                      y_s, -x_s, 0.f, 0.f, 0.f, 1.f;
-
-        Eigen::Matrix<double,3,6> SE3deriv_e;
-        SE3deriv_e << 0.f, z_e, -y_e, 1.f, 0.f, 0.f,
-                      -z_e, 0.f, x_e, 0.f, 1.f, 0.f,
-                      y_e, -x_e, 0.f, 0.f, 0.f, 1.f;
-
-        _jacobianOplusXi << Jac_s*SE3deriv_s,
-                            Jac_e*SE3deriv_e;
+        _jacobianOplusXi << ps.PoseJacobian(Jac_s),
+                            pe.PoseJacobian(Jac_e);
     }
 
     bool EdgeLineWithAngleSE3ProjectXYZOnlyPose::read(std::istream& is){
@@ -524,99 +441,26 @@ namespace ORB_SLAM3 {
     }
 
     Eigen::Vector2d EdgeLineWithAngleSE3ProjectXYZOnlyPose::cam_project(const Eigen::Vector3d & trans_xyz) const{
-    const float invz = 1.0f/trans_xyz[2];
-    Eigen::Vector2d res;
-    res[0] = trans_xyz[0]*invz*fx + cx;
-    res[1] = trans_xyz[1]*invz*fy + cy;
-    return res;
+    return LineEndpointProjection(trans_xyz,fx,fy,cx,cy).Point();
     }
 
     void EdgeLineWithAngleSE3ProjectXYZOnlyPose::linearizeOplus() {
         g2o::VertexSE3Expmap * vi = static_cast<g2o::VertexSE3Expmap *>(_vertices[0]);
-        Eigen::Vector3d xyz_trans_s = vi->estimate().map(Xw_s);
-        Eigen::Vector3d xyz_trans_e = vi->estimate().map(Xw_e);
-        Eigen::Vector2d P_pr = cam_project(vi->estimate().map(Xw_s));
-        Eigen::Vector2d Q_pr = cam_project(vi->estimate().map(Xw_e));
-
-        double x_s = xyz_trans_s[0];
-        double y_s = xyz_trans_s[1];
-        double z_s = xyz_trans_s[2];
-        double invz_s = 1.0/xyz_trans_s[2];
-        double invz_s_2 = invz_s*invz_s;
-
-        double x_e = xyz_trans_e[0];
-        double y_e = xyz_trans_e[1];
-        double z_e = xyz_trans_e[2];
-        double invz_e = 1.0/xyz_trans_e[2];
-        double invz_e_2 = invz_e*invz_e;
-
-        double xp = obs_temp(0);
-        double yp = obs_temp(1);
-        double xq = obs_temp(2);
-        double yq = obs_temp(3);
-        double l0 = obs_temp(4);
-        double l1 = obs_temp(5);
-
-        Eigen::Vector2d QP;
-        QP << xp-xq, yp-yq;
-        Eigen::Vector2d QP_pr;
-        QP_pr << P_pr(0)-xq, P_pr(1)-yq;
-        Eigen::Vector2d PQ_pr;
-        PQ_pr << Q_pr(0)-xp, Q_pr(1)-yp;
-        Eigen::Vector2d Der_start;
-        Eigen::Vector2d Der_end;
-
-        Der_start[0] = ((xp-xq)*QP.norm()*QP_pr.norm()-((xp-xq)*(P_pr(0)-xq)+(yp-yq)*(P_pr(1)-yq))*QP.norm()*(P_pr(0)-xq)/QP_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-        Der_start[1] = ((yp-yq)*QP.norm()*QP_pr.norm()-((xp-xq)*(P_pr(0)-xq)+(yp-yq)*(P_pr(1)-yq))*QP.norm()*(P_pr(1)-yq)/QP_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-
-        Eigen::Matrix<double,2,3> ProjJac_s;
-
-        ProjJac_s << fx*invz_s, 0.f, -fx*x_s*invz_s_2,
-                    0.f, fy*invz_s, -fx*y_s*invz_s_2;
-
-        Eigen::Matrix<double,1,3> Jac_s = Der_start.transpose()*ProjJac_s;
-
-        Der_end[0] = ((xp-xq)*QP.norm()*PQ_pr.norm()-((xp-xq)*(Q_pr(0)-xp)+(yp-yq)*(Q_pr(1)-yp))*QP.norm()*(Q_pr(0)-xp)/PQ_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-        Der_end[1] = ((yp-yq)*QP.norm()*PQ_pr.norm()-((xp-xq)*(Q_pr(0)-xp)+(yp-yq)*(Q_pr(1)-yp))*QP.norm()*(Q_pr(1)-yp)/PQ_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-
-        Eigen::Matrix<double,2,3> ProjJac_e;
-
-        ProjJac_e << fx*invz_e, 0.f, -fx*x_e*invz_e_2,
-                    0.f, fy*invz_e, -fx*y_e*invz_e_2;
-
-        Eigen::Matrix<double,1,3> Jac_e = Der_end.transpose()*ProjJac_e;
-        
-        Eigen::Matrix<double,3,6> SE3deriv_s;
-        SE3deriv_s << 0.f, z_s, -y_s, 1.f, 0.f, 0.f,
-                      -z_s, 0.f, x_s, 0.f, 1.f, 0.f,
-                      y_s, -x_s, 0.f, 0.f, 0.f, 1.f;
-
-        Eigen::Matrix<double,3,6> SE3deriv_e;
-        SE3deriv_e << 0.f, z_e, -y_e, 1.f, 0.f, 0.f,
-                      -z_e, 0.f, x_e, 0.f, 1.f, 0.f,
-                      y_e, -x_e, 0.f, 0.f, 0.f, 1.f;
-
-        Eigen::Matrix<double,1,6> JacOplusS;
-        Eigen::Matrix<double,1,6> JacOplusE;
-       
-        JacOplusS(0,0) = -fx*x_s*y_s*invz_s_2*l0-fy*(1+y_s*y_s*invz_s_2)*l1;
-        JacOplusS(0,1) = fx*(1+x_s*x_s*invz_s_2)*l0+fy*x_s*y_s*invz_s_2*l1;
-        JacOplusS(0,2) = -fx*y_s*invz_s*l0+fy*x_s*invz_s*l1; 
-        JacOplusS(0,3) = fx*invz_s*l0;
-        JacOplusS(0,4) = fy*invz_s*l1;
-        JacOplusS(0,5) = (-fx*x_s*l0-fy*y_s*l1)*invz_s_2;
-
-        JacOplusE(0,0) = -fx*x_e*y_e*invz_e_2*l0-fy*(1+y_e*y_e*invz_e_2)*l1;
-        JacOplusE(0,1) = fx*(1+x_e*x_e*invz_e_2)*l0+fy*x_e*y_e*invz_e_2*l1;
-        JacOplusE(0,2) = -fx*y_e*invz_e*l0+fy*x_e*invz_e*l1;  
-        JacOplusE(0,3) = fx*invz_e*l0;
-        JacOplusE(0,4) = fy*invz_e*l1;
-        JacOplusE(0,5) = (-fx*x_e*l0-fy*y_e*l1)*invz_e_2;
-
-        _jacobianOplusXi << JacOplusS,
-                            JacOplusE,
-                            Jac_s*SE3deriv_s,
-                            Jac_e*SE3deriv_e;
+        const LineEndpointProjection ps(vi->estimate().map(Xw_s),fx,fy,cx,cy);
+        const LineEndpointProjection pe(vi->estimate().map(Xw_e),fx,fy,cx,cy);
+
+        const Eigen::Vector2d P(_measurement(0), _measurement(1));
+        const Eigen::Vector2d Q(_measurement(2), _measurement(3));
+        const Eigen::Vector2d QP = P - Q;
+        const Eigen::Vector3d l = _measurement.tail(3);
+
+        const Eigen::Matrix<double,1,3> Jac_s = LineAngleCosJacobian(ps.Point() - Q, QP)*ps.ProjectionJacobian(fx,fy);
+        const Eigen::Matrix<double,1,3> Jac_e = LineAngleCosJacobian(pe.Point() - P, QP)*pe.ProjectionJacobian(fx,fy);
+
+        _jacobianOplusXi << ps.PoseJacobian(ps.LineDistanceJacobian(l,fx,fy)),
+                            pe.PoseJacobian(pe.LineDistanceJacobian(l,fx,fy)),
+                            ps.PoseJacobian(Jac_s),
+                            pe.PoseJacobian(Jac_e);
     }
 
     EdgeLineSE3ProjectXYZ::EdgeLineSE3ProjectXYZ() : 
@@ -650,58 +494,28 @@ namespace ORB_SLAM3 {
     }
 
     Eigen::Vector2d EdgeLineSE3ProjectXYZ::cam_project(const Eigen::Vector3d & trans_xyz) const{
-    const float invz = 1.0f/trans_xyz[2];
-    Eigen::Vector2d res;
-    res[0] = trans_xyz[0]*invz*fx + cx;
-    res[1] = trans_xyz[1]*invz*fy + cy;
-    return res;
+    return LineEndpointProjection(trans_xyz,fx,fy,cx,cy).Point();
     }
 
     void EdgeLineSE3ProjectXYZ::linearizeOplus() {
         g2o::VertexSE3Expmap * vj= static_cast<g2o::VertexSE3Expmap *>(_vertices[1]);
-        g2o::SE3Quat T(vj->estimate());
+        const g2o::SE3Quat &T = vj->estimate();
         g2o::VertexSBALineXYZ* vi = static_cast<g2o::VertexSBALineXYZ*>(_vertices[0]);
-        Eigen::Vector3d xyz_s = vi->estimate().head(3);
-        Eigen::Vector3d xyz_trans_s = T.map(xyz_s);
-        Eigen::Vector3d xyz_e = vi->estimate().tail(3);
-        Eigen::Vector3d xyz_trans_e = T.map(xyz_e); 
+        const LineEndpointProjection ps(T.map(vi->estimate().head(3)),fx,fy,cx,cy);
+        const LineEndpointProjection pe(T.map(vi->estimate().tail(3)),fx,fy,cx,cy);
 
         const Eigen::Matrix3d R =  T.rotation().toRotationMatrix();
 
-        double x_s = xyz_trans_s[0];
-        double y_s = xyz_trans_s[1];
-        double invz_s = 1.0/xyz_trans_s[2];
-        double invz_s_2 = invz_s*invz_s;
+        const Eigen::Matrix<double,1,3> Jac_s = ps.LineDistanceJacobian(_measurement,fx,fy);
+        const Eigen::Matrix<double,1,3> Jac_e = pe.LineDistanceJacobian(_measurement,fx,fy);
 
-        double x_e = xyz_trans_e[0];
-        double y_e = xyz_trans_e[1];
-        double invz_e = 1.0/xyz_trans_e[2];
-        double invz_e_2 = invz_e*invz_e;
+        // The start point only moves the first residual and the end point the second one
+        _jacobianOplusXi.setZero();
+        _jacobianOplusXi.block<1,3>(0,0) = Jac_s*R;
+        _jacobianOplusXi.block<1,3>(1,3) = Jac_e*R;
 
-        double l0 = obs_temp(0);
-        double l1 = obs_temp(1);
-
-        _jacobianOplusXi(0,0) = fx*l0*invz_s*R(0,0)+fy*l1*invz_s*R(1,0)-(fx*x_s*l0*invz_s_2+fy*y_s*l1*invz_s_2)*R(2,0);
-        _jacobianOplusXi(0,1) = fx*l0*invz_s*R(0,1)+fy*l1*invz_s*R(1,1)-(fx*x_s*l0*invz_s_2+fy*y_s*l1*invz_s_2)*R(2,1);
-        _jacobianOplusXi(0,2) = fx*l0*invz_s*R(0,2)+fy*l1*invz_s*R(1,2)-(fx*x_s*l0*invz_s_2+fy*y_s*l1*invz_s_2)*R(2,2);
-
-        _jacobianOplusXi(1,0) = fx*l0*invz_e*R(0,0)+fy*l1*invz_e*R(1,0)-(fx*x_e*l0*invz_e_2+fy*y_e*l1*invz_e_2)*R(2,0);
-        _jacobianOplusXi(1,1) = fx*l0*invz_e*R(0,1)+fy*l1*invz_e*R(1,1)-(fx*x_e*l0*invz_e_2+fy*y_e*l1*invz_e_2)*R(2,1);
-        _jacobianOplusXi(1,2) = fx*l0*invz_e*R(0,2)+fy*l1*invz_e*R(1,2)-(fx*x_e*l0*invz_e_2+fy*y_e*l1*invz_e_2)*R(2,2);
-
-        _jacobianOplusXj(0,0) = -fx*x_s*y_s*invz_s_2*l0-fy*(1+y_s*y_s*invz_s_2)*l1;
-        _jacobianOplusXj(0,1) = fx*(1+x_s*x_s*invz_s_2)*l0+fy*x_s*y_s*invz_s_2*l1;
-        _jacobianOplusXj(0,2) = -fx*y_s*invz_s*l0+fy*x_s*invz_s*l1; 
-        _jacobianOplusXj(0,3) = fx*invz_s*l0;
-        _jacobianOplusXj(0,4) = fy*invz_s*l1;
-        _jacobianOplusXj(0,5) = (-fx*x_s*l0-fy*y_s*l1)*invz_s_2;
-
-        _jacobianOplusXj(1,0) = -fx*x_e*y_e*invz_e_2*l0-fy*(1+y_e*y_e*invz_e_2)*l1;
-        _jacobianOplusXj(1,1) = fx*(1+x_e*x_e*invz_e_2)*l0+fy*x_e*y_e*invz_e_2*l1;
-        _jacobianOplusXj(1,2) = -fx*y_e*invz_e*l0+fy*x_e*invz_e*l1;  
-        _jacobianOplusXj(1,3) = fx*invz_e*l0;
-        _jacobianOplusXj(1,4) = fy*invz_e*l1;
-        _jacobianOplusXj(1,5) = (-fx*x_e*l0-fy*y_e*l1)*invz_e_2; 
+        _jacobianOplusXj << ps.PoseJacobian(Jac_s),
+                            pe.PoseJacobian(Jac_e);
     }
 
     EdgeLineAngleSE3ProjectXYZ::EdgeLineAngleSE3ProjectXYZ() : 
@@ -735,87 +549,31 @@ namespace ORB_SLAM3 {
     }
 
     Eigen::Vector2d EdgeLineAngleSE3ProjectXYZ::cam_project(const Eigen::Vector3d & trans_xyz) const{
-    const float invz = 1.0f/trans_xyz[2];
-    Eigen::Vector2d res;
-    res[0] = trans_xyz[0]*invz*fx + cx;
-    res[1] = trans_xyz[1]*invz*fy + cy;
-    return res;
+    return LineEndpointProjection(trans_xyz,fx,fy,cx,cy).Point();
     }
 
     void EdgeLineAngleSE3ProjectXYZ::linearizeOplus() {
         g2o::VertexSE3Expmap * vj= static_cast<g2o::VertexSE3Expmap *>(_vertices[1]);
-        g2o::SE3Quat T(vj->estimate());
+        const g2o::SE3Quat &T = vj->estimate();
         g2o::VertexSBALineXYZ* vi = static_cast<g2o::VertexSBALineXYZ*>(_vertices[0]);
-        Eigen::Vector3d xyz_s = vi->estimate().head(3);
-        Eigen::Vector3d xyz_trans_s = T.map(xyz_s);
-        Eigen::Vector3d xyz_e = vi->estimate().tail(3);
-        Eigen::Vector3d xyz_trans_e = T.map(xyz_e); 
-        Eigen::Vector2d P_pr = cam_project(xyz_trans_s);
-        Eigen::Vector2d Q_pr = cam_project(xyz_trans_e);
+        const LineEndpointProjection ps(T.map(vi->estimate().head(3)),fx,fy,cx,cy);
+        const LineEndpointProjection pe(T.map(vi->estimate().tail(3)),fx,fy,cx,cy);
 
         const Eigen::Matrix3d R =  T.rotation().toRotationMatrix();
 
-        double x_s = xyz_trans_s[0];
-        double y_s = xyz_trans_s[1];
-        double z_s = xyz_trans_s[2];
-        double invz_s = 1.0/xyz_trans_s[2];
-        double invz_s_2 = invz_s*invz_s;
-
-        double x_e = xyz_trans_e[0];
-        double y_e = xyz_trans_e[1];
-        double z_e = xyz_trans_e[2];
-        double invz_e = 1.0/xyz_trans_e[2];
-        double invz_e_2 = invz_e*invz_e;
+        const Eigen::Vector2d P(_measurement(0), _measurement(1));
+        const Eigen::Vector2d Q(_measurement(2), _measurement(3));
+        const Eigen::Vector2d QP = P - Q;
 
-        double xp = obs_temp(0);
-        double yp = obs_temp(1);
-        double xq = obs_temp(2);
-        double yq = obs_temp(3);
+        const Eigen::Matrix<double,1,3> Jac_s = LineAngleCosJacobian(ps.Point() - Q, QP)*ps.ProjectionJacobian(fx,fy);
+        const Eigen::Matrix<double,1,3> Jac_e = LineAngleCosJacobian(pe.Point() - P, QP)*pe.ProjectionJacobian(fx,fy);
 
-        Eigen::Vector2d QP;
-        QP << xp-xq, yp-yq;
-        Eigen::Vector2d QP_pr;
-        QP_pr << P_pr(0)-xq, P_pr(1)-yq;
-        Eigen::Vector2d PQ_pr;
-        PQ_pr << Q_pr(0)-xp, Q_pr(1)-yp;
-        Eigen::Vector2d Der_start;
-        Eigen::Vector2d Der_end;
+        _jacobianOplusXi.setZero();
+        _jacobianOplusXi.block<1,3>(0,0) = Jac_s*R;
+        _jacobianOplusXi.block<1,3>(1,3) = Jac_e*R;
 
-        Der_start[0] = ((xp-xq)*QP.norm()*QP_pr.norm()-((xp-xq)*(P_pr(0)-xq)+(yp-yq)*(P_pr(1)-yq))*QP.norm()*(P_pr(0)-xq)/QP_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-        Der_start[1] = ((yp-yq)*QP.norm()*QP_pr.norm()-((xp-xq)*(P_pr(0)-xq)+(yp-yq)*(P_pr(1)-yq))*QP.norm()*(P_pr(1)-yq)/QP_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-
-        Eigen::Matrix<double,2,3> ProjJac_s;
-
-        ProjJac_s << fx*invz_s, 0.f, -fx*x_s*invz_s_2,
-                    0.f, fy*invz_s, -fx*y_s*invz_s_2;
-
-        Eigen::Matrix<double,1,3> Jac_s = Der_start.transpose()*ProjJac_s;
-
-        Der_end[0] = ((xp-xq)*QP.norm()*PQ_pr.norm()-((xp-xq)*(Q_pr(0)-xp)+(yp-yq)*(Q_pr(1)-yp))*QP.norm()*(Q_pr(0)-xp)/PQ_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-        Der_end[1] = ((yp-yq)*QP.norm()*PQ_pr.norm()-((xp-xq)*(Q_pr(0)-xp)+(yp-yq)*(Q_pr(1)-yp))*QP.norm()*(Q_pr(1)-yp)/PQ_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-
-        Eigen::Matrix<double,2,3> ProjJac_e;
-
-        ProjJac_e << fx*invz_e, 0.f, -fx*x_e*invz_e_2,
-                    0.f, fy*invz_e, -fx*y_e*invz_e_2;
-
-        Eigen::Matrix<double,1,3> Jac_e = Der_end.transpose()*ProjJac_e;
-        
-        Eigen::Matrix<double,3,6> SE3deriv_s;
-        SE3deriv_s << 0.f, z_s, -y_s, 1.f, 0.f, 0.f,
-                      -z_s, 0.f, x_s, 0.f, 1.f, 0.f,
-                      y_s, -x_s, 0.f, 0.f, 0.f, 1.f;
-
-        Eigen::Matrix<double,3,6> SE3deriv_e;
-        SE3deriv_e << 0.f, z_e, -y_e, 1.f, 0.f, 0.f,
-                      -z_e, 0.f, x_e, 0.f, 1.f, 0.f,
-                      y_e, -x_e, 0.f, 0.f, 0.f, 1.f;
-
-        _jacobianOplusXi << Jac_s*R,
-                            Jac_e*R;
-
-        _jacobianOplusXj << Jac_s*SE3deriv_s,
-                            Jac_e*SE3deriv_e;
+        _jacobianOplusXj << ps.PoseJacobian(Jac_s),
+                            pe.PoseJacobian(Jac_e);
     }
 
     EdgeLineWithAngleSE3ProjectXYZ::EdgeLineWithAngleSE3ProjectXYZ() : 
@@ -849,121 +607,189 @@ namespace ORB_SLAM3 {
     }
 
     Eigen::Vector2d EdgeLineWithAngleSE3ProjectXYZ::cam_project(const Eigen::Vector3d & trans_xyz) const{
-    const float invz = 1.0f/trans_xyz[2];
-    Eigen::Vector2d res;
-    res[0] = trans_xyz[0]*invz*fx + cx;
-    res[1] = trans_xyz[1]*invz*fy + cy;
-    return res;
+    return LineEndpointProjection(trans_xyz,fx,fy,cx,cy).Point();
     }
 
     void EdgeLineWithAngleSE3ProjectXYZ::linearizeOplus() {
         g2o::VertexSE3Expmap * vj= static_cast<g2o::VertexSE3Expmap *>(_vertices[1]);
-        g2o::SE3Quat T(vj->estimate());
+        const g2o::SE3Quat &T = vj->estimate();
         g2o::VertexSBALineXYZ* vi = static_cast<g2o::VertexSBALineXYZ*>(_vertices[0]);
-        Eigen::Vector3d xyz_s = vi->estimate().head(3);
-        Eigen::Vector3d xyz_trans_s = T.map(xyz_s);
-        Eigen::Vector3d xyz_e = vi->estimate().tail(3);
-        Eigen::Vector3d xyz_trans_e = T.map(xyz_e); 
-        Eigen::Vector2d P_pr = cam_project(xyz_trans_s);
-        Eigen::Vector2d Q_pr = cam_project(xyz_trans_e);
+        const LineEndpointProjection ps(T.map(vi->estimate().head(3)),fx,fy,cx,cy);
+        const LineEndpointProjection pe(T.map(vi->estimate().tail(3)),fx,fy,cx,cy);
 
         const Eigen::Matrix3d R =  T.rotation().toRotationMatrix();
 
-        double x_s = xyz_trans_s[0];
-        double y_s = xyz_trans_s[1];
-        double z_s = xyz_trans_s[2];
-        double invz_s = 1.0/xyz_trans_s[2];
-        double invz_s_2 = invz_s*invz_s;
-
-        double x_e = xyz_trans_e[0];
-        double y_e = xyz_trans_e[1];
-        double z_e = xyz_trans_e[2];
-        double invz_e = 1.0/xyz_trans_e[2];
-        double invz_e_2 = invz_e*invz_e;
-
-        double xp = obs_temp(0);
-        double yp = obs_temp(1);
-        double xq = obs_temp(2);
-        double yq = obs_temp(3);
-        double l0 = obs_temp(4);
-        double l1 = obs_temp(5);
-
-        Eigen::Vector2d QP;
-        QP << xp-xq, yp-yq;
-        Eigen::Vector2d QP_pr;
-        QP_pr << P_pr(0)-xq, P_pr(1)-yq;
-        Eigen::Vector2d PQ_pr;
-        PQ_pr << Q_pr(0)-xp, Q_pr(1)-yp;
-        Eigen::Vector2d Der_start;
-        Eigen::Vector2d Der_end;
-
-        Der_start[0] = ((xp-xq)*QP.norm()*QP_pr.norm()-((xp-xq)*(P_pr(0)-xq)+(yp-yq)*(P_pr(1)-yq))*QP.norm()*(P_pr(0)-xq)/QP_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-        Der_start[1] = ((yp-yq)*QP.norm()*QP_pr.norm()-((xp-xq)*(P_pr(0)-xq)+(yp-yq)*(P_pr(1)-yq))*QP.norm()*(P_pr(1)-yq)/QP_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-
-        Eigen::Matrix<double,2,3> ProjJac_s;
-
-        ProjJac_s << fx*invz_s, 0.f, -fx*x_s*invz_s_2,
-                    0.f, fy*invz_s, -fx*y_s*invz_s_2;
-
-        Eigen::Matrix<double,1,3> Jac_s = Der_start.transpose()*ProjJac_s;
-
-        Der_end[0] = ((xp-xq)*QP.norm()*PQ_pr.norm()-((xp-xq)*(Q_pr(0)-xp)+(yp-yq)*(Q_pr(1)-yp))*QP.norm()*(Q_pr(0)-xp)/PQ_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-        Der_end[1] = ((yp-yq)*QP.norm()*PQ_pr.norm()-((xp-xq)*(Q_pr(0)-xp)+(yp-yq)*(Q_pr(1)-yp))*QP.norm()*(Q_pr(1)-yp)/PQ_pr.norm())/(QP.norm()*QP.norm()*QP_pr.norm()*QP_pr.norm());
-
-        Eigen::Matrix<double,2,3> ProjJac_e;
-
-        ProjJac_e << fx*invz_e, 0.f, -fx*x_e*invz_e_2,
-                    0.f, fy*invz_e, -fx*y_e*invz_e_2;
-
-        Eigen::Matrix<double,1,3> Jac_e = Der_end.transpose()*ProjJac_e;
-        
-        Eigen::Matrix<double,3,6> SE3deriv_s;
-        SE3deriv_s << 0.f, z_s, -y_s, 1.f, 0.f, 0.f,
-                      -z_s, 0.f, x_s, 0.f, 1.f, 0.f,
-                      y_s, -x_s, 0.f, 0.f, 0.f, 1.f;
-
-        Eigen::Matrix<double,3,6> SE3deriv_e;
-        SE3deriv_e << 0.f, z_e, -y_e, 1.f, 0.f, 0.f,
-                      -z_e, 0.f, x_e, 0.f, 1.f, 0.f,
-                      y_e, -x_e, 0.f, 0.f, 0.f, 1.f;
-
-        
-        Eigen::Matrix<double,1,3> JacOplusXis;
-        Eigen::Matrix<double,1,3> JacOplusXie;
-        Eigen::Matrix<double,1,3> JacOplusXjs;
-        Eigen::Matrix<double,1,3> JacOplusXje;
-
-        JacOplusXis(0,0) = fx*l0*invz_s*R(0,0)+fy*l1*invz_s*R(1,0)-(fx*x_s*l0*invz_s_2+fy*y_s*l1*invz_s_2)*R(2,0);
-        JacOplusXis(0,1) = fx*l0*invz_s*R(0,1)+fy*l1*invz_s*R(1,1)-(fx*x_s*l0*invz_s_2+fy*y_s*l1*invz_s_2)*R(2,1);
-        JacOplusXis(0,2) = fx*l0*invz_s*R(0,2)+fy*l1*invz_s*R(1,2)-(fx*x_s*l0*invz_s_2+fy*y_s*l1*invz_s_2)*R(2,2);
-
-        JacOplusXie(0,0) = fx*l0*invz_e*R(0,0)+fy*l1*invz_e*R(1,0)-(fx*x_e*l0*invz_e_2+fy*y_e*l1*invz_e_2)*R(2,0);
-        JacOplusXie(0,1) = fx*l0*invz_e*R(0,1)+fy*l1*invz_e*R(1,1)-(fx*x_e*l0*invz_e_2+fy*y_e*l1*invz_e_2)*R(2,1);
-        JacOplusXie(0,2) = fx*l0*invz_e*R(0,2)+fy*l1*invz_e*R(1,2)-(fx*x_e*l0*invz_e_2+fy*y_e*l1*invz_e_2)*R(2,2);
-
-        JacOplusXjs(0,0) = -fx*x_s*y_s*invz_s_2*l0-fy*(1+y_s*y_s*invz_s_2)*l1;
-        JacOplusXjs(0,1) = fx*(1+x_s*x_s*invz_s_2)*l0+fy*x_s*y_s*invz_s_2*l1;
-        JacOplusXjs(0,2) = -fx*y_s*invz_s*l0+fy*x_s*invz_s*l1; 
-        JacOplusXjs(0,3) = fx*invz_s*l0;
-        JacOplusXjs(0,4) = fy*invz_s*l1;
-        JacOplusXjs(0,5) = (-fx*x_s*l0-fy*y_s*l1)*invz_s_2;
-
-        JacOplusXje(0,0) = -fx*x_e*y_e*invz_e_2*l0-fy*(1+y_e*y_e*invz_e_2)*l1;
-        JacOplusXje(0,1) = fx*(1+x_e*x_e*invz_e_2)*l0+fy*x_e*y_e*invz_e_2*l1;
-        JacOplusXje(0,2) = -fx*y_e*invz_e*l0+fy*x_e*invz_e*l1;  
-        JacOplusXje(0,3) = fx*invz_e*l0;
-        JacOplusXje(0,4) = fy*invz_e*l1;
-        JacOplusXje(0,5) = (-fx*x_e*l0-fy*y_e*l1)*invz_e_2; 
-
-        _jacobianOplusXi << JacOplusXis,
-                            JacOplusXie,
-                            Jac_s*R,
-                            Jac_e*R;
-
-        _jacobianOplusXj << JacOplusXjs,
-                            JacOplusXje,
-                            Jac_s*SE3deriv_s,
-                            Jac_e*SE3deriv_e;
+        const Eigen::Vector2d P(_measurement(0), _measurement(1));
+        const Eigen::Vector2d Q(_measurement(2), _measurement(3));
+        const Eigen::Vector2d QP = P - Q;
+        const Eigen::Vector3d l = _measurement.tail(3);
+
+        const Eigen::Matrix<double,1,3> JacLine_s = ps.LineDistanceJacobian(l,fx,fy);
+        const Eigen::Matrix<double,1,3> JacLine_e = pe.LineDistanceJacobian(l,fx,fy);
+        const Eigen::Matrix<double,1,3> Jac_s = LineAngleCosJacobian(ps.Point() - Q, QP)*ps.ProjectionJacobian(fx,fy);
+        const Eigen::Matrix<double,1,3> Jac_e = LineAngleCosJacobian(pe.Point() - P, QP)*pe.ProjectionJacobian(fx,fy);
+
+        _jacobianOplusXi.setZero();
+        _jacobianOplusXi.block<1,3>(0,0) = JacLine_s*R;
+        _jacobianOplusXi.block<1,3>(1,3) = JacLine_e*R;
+        _jacobianOplusXi.block<1,3>(2,0) = Jac_s*R;
+        _jacobianOplusXi.block<1,3>(3,3) = Jac_e*R;
+
+        _jacobianOplusXj << ps.PoseJacobian(JacLine_s),
+                            pe.PoseJacobian(JacLine_e),
+                            ps.PoseJacobian(Jac_s),
+                            pe.PoseJacobian(Jac_e);
+    }
+
+
+    namespace {
+    // Orthonormal representation (U,W) of a Plücker line, W = [w1 -w2; w2 w1]
+    void PluckerToOrthonormal(const Eigen::Matrix<double,6,1> &L, Eigen::Matrix3d &U, double &w1, double &w2)
+    {
+        const Eigen::Vector3d n = L.head(3);
+        const Eigen::Vector3d d = L.tail(3);
+        const double nn = n.norm();
+        const double nd = d.norm();
+
+        U.col(1) = d/nd;
+        // A line through the origin has no moment, any direction orthogonal to d is valid
+        U.col(0) = nn>1e-12 ? Eigen::Vector3d(n/nn) : U.col(1).unitOrthogonal();
+        U.col(2) = U.col(0).cross(U.col(1));
+
+        const double s = sqrt(nn*nn + nd*nd);
+        w1 = nn/s;
+        w2 = nd/s;
+    }
+    }
+
+    Eigen::Matrix<double,6,1> PluckerFromEndpoints(const Eigen::Vector3d &sP, const Eigen::Vector3d &eP)
+    {
+        Eigen::Matrix<double,6,1> L;
+        L << sP.cross(eP), eP - sP;
+        return L/L.norm();
+    }
+
+    void EndpointsOnPlucker(const Eigen::Matrix<double,6,1> &L, Eigen::Vector3d &sP, Eigen::Vector3d &eP)
+    {
+        const Eigen::Vector3d n = L.head(3);
+        const Eigen::Vector3d d = L.tail(3);
+        // Point of the line closest to the origin
+        const Eigen::Vector3d p0 = d.cross(n)/d.squaredNorm();
+        const Eigen::Vector3d dir = d.normalized();
+        sP = p0 + dir.dot(sP - p0)*dir;
+        eP = p0 + dir.dot(eP - p0)*dir;
+    }
+
+    bool VertexLineOrth::read(std::istream& is){
+        for (int i=0; i<6; i++)
+            is >> _estimate[i];
+        return true;
+    }
+
+    bool VertexLineOrth::write(std::ostream& os) const {
+        for (int i=0; i<6; i++)
+            os << _estimate[i] << " ";
+        return os.good();
+    }
+
+    void VertexLineOrth::oplusImpl(const double* update_) {
+        Eigen::Map<const Eigen::Vector4d> update(update_);
+
+        Eigen::Matrix3d U;
+        double w1, w2;
+        PluckerToOrthonormal(_estimate, U, w1, w2);
+
+        const Eigen::Vector3d theta = update.head(3);
+        const double angle = theta.norm();
+        if(angle>0)
+            U = U*Eigen::AngleAxisd(angle, theta/angle).toRotationMatrix();
+
+        const double phi = update(3);
+        const double w1_new = w1*cos(phi) - w2*sin(phi);
+        const double w2_new = w2*cos(phi) + w1*sin(phi);
+
+        _estimate << w1_new*U.col(0), w2_new*U.col(1);
+    }
+
+    EdgeLineOrthSE3Project::EdgeLineOrthSE3Project() :
+    g2o::BaseBinaryEdge<2, Eigen::Vector4d, VertexLineOrth, g2o::VertexSE3Expmap>()
+    {
+    }
+
+    bool EdgeLineOrthSE3Project::read(std::istream& is){
+        for (int i=0; i<4; i++){
+            is >> _measurement[i];
+        }
+        for (int i=0; i<2; i++)
+            for (int j=i; j<2; j++) {
+                is >> information()(i,j);
+                if (i!=j)
+                    information()(j,i)=information()(i,j);
+            }
+        return true;
+    }
+
+    bool EdgeLineOrthSE3Project::write(std::ostream& os) const {
+        for (int i=0; i<4; i++){
+            os << measurement()[i] << " ";
+        }
+
+        for (int i=0; i<2; i++)
+            for (int j=i; j<2; j++){
+                os << " " <<  information()(i,j);
+            }
+        return os.good();
+    }
+
+    void EdgeLineOrthSE3Project::TransformLine(const g2o::SE3Quat &Tcw, const Eigen::Matrix<double,6,1> &Lw, Eigen::Vector3d &nc, Eigen::Vector3d &dc)
+    {
+        const Eigen::Matrix3d R = Tcw.rotation().toRotationMatrix();
+        dc = R*Lw.tail(3);
+        nc = R*Lw.head(3) + Tcw.translation().cross(dc);
+    }
+
+    void EdgeLineOrthSE3Project::linearizeOplus() {
+        const g2o::VertexSE3Expmap* vj = static_cast<const g2o::VertexSE3Expmap*>(_vertices[1]);
+        const VertexLineOrth* vi = static_cast<const VertexLineOrth*>(_vertices[0]);
+        const g2o::SE3Quat &T = vj->estimate();
+        const Eigen::Matrix3d R = T.rotation().toRotationMatrix();
+
+        // The error does not depend on the scale of the Plücker coordinates, the increments do
+        const Eigen::Matrix<double,6,1> Lw = vi->estimate()/vi->estimate().norm();
+        Eigen::Vector3d nc, dc;
+        TransformLine(T, Lw, nc, dc);
+        const Eigen::Vector3d l = ImageLine(nc);
+        const double invNorm = 1.0/l.head(2).norm();
+        const double invNorm3 = invNorm*invNorm*invNorm;
+
+        // Derivative of the distances with respect to the image line
+        Eigen::Matrix<double,2,3> de_dl;
+        for(int k=0; k<2; k++)
+        {
+            const double u = _measurement(2*k);
+            const double v = _measurement(2*k+1);
+            const double a = u*l(0) + v*l(1) + l(2);
+            de_dl.row(k) << u*invNorm - a*l(0)*invNorm3, v*invNorm - a*l(1)*invNorm3, invNorm;
+        }
+
+        Eigen::Matrix3d K_L;
+        K_L << fy, 0, 0,
+               0, fx, 0,
+               -fy*cx, -fx*cy, fx*fy;
+        const Eigen::Matrix<double,2,3> de_dnc = de_dl*K_L;
+
+        // Line: increments (theta, phi) of the orthonormal representation
+        Eigen::Matrix3d U;
+        double w1, w2;
+        PluckerToOrthonormal(Lw, U, w1, w2);
+        Eigen::Matrix<double,3,4> dn_dx, dd_dx;
+        dn_dx << Eigen::Vector3d::Zero(), -w1*U.col(2), w1*U.col(1), -w2*U.col(0);
+        dd_dx << w2*U.col(2), Eigen::Vector3d::Zero(), -w2*U.col(0), w1*U.col(1);
+
+        _jacobianOplusXi = de_dnc*(R*dn_dx + g2o::skew(T.translation())*R*dd_dx);
+
+        // Pose (rotation first): d(nc)/d(xi) = [-[nc]x -[dc]x]
+        _jacobianOplusXj << -de_dnc*g2o::skew(nc), -de_dnc*g2o::skew(dc);
     }
 
 }
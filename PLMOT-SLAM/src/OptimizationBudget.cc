@@ -0,0 +1,70 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "OptimizationBudget.h"
+
+namespace ORB_SLAM3
+{
+
+OptimizationMonitor::OptimizationMonitor(const OptimizationBudget* pBudget, OptimizationStats* pStats):
+    mpBudget(pBudget), mpStats(pStats), mdLastChi2(-1), mStart(std::chrono::steady_clock::now())
+{
+}
+
+OptimizationMonitor::~OptimizationMonitor()
+{
+    if(!mpStats)
+        return;
+
+    mStats.dTime = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(std::chrono::steady_clock::now() - mStart).count();
+    *mpStats = mStats;
+}
+
+void OptimizationMonitor::StartRound()
+{
+    mdLastChi2 = -1;
+}
+
+bool OptimizationMonitor::Iteration(const double chi2)
+{
+    mStats.nIterations++;
+    mStats.dChi2 = chi2;
+
+    bool bStop = false;
+    if(mpBudget && mpBudget->dMinChi2Decrease>0 && mdLastChi2>0 && mdLastChi2-chi2 < mpBudget->dMinChi2Decrease*mdLastChi2)
+    {
+        mStats.bConverged = true;
+        bStop = true;
+    }
+    mdLastChi2 = chi2;
+
+    return Expired() || bStop;
+}
+
+bool OptimizationMonitor::Expired()
+{
+    if(!mpBudget || mpBudget->dMaxTime<=0)
+        return false;
+
+    if(!mStats.bDeadline)
+    {
+        const double t = std::chrono::duration_cast<std::chrono::duration<double,std::milli> >(std::chrono::steady_clock::now() - mStart).count();
+        mStats.bDeadline = t > mpBudget->dMaxTime;
+    }
+    return mStats.bDeadline;
+}
+
+} //namespace ORB_SLAM
@@ -42,6 +42,9 @@
 #include<mutex>
 
 #include "OptimizableTypes.h"
+#include "OutlierRejection.h"
+#include "ProblemCapture.h"
+#include "BASolver.h"
 
 
 namespace ORB_SLAM3
@@ -52,6 +55,228 @@ bool sortByVal(const pair<MapPoint*, int> &a, const pair<MapPoint*, int> &b)
     return (a.second < b.second);
 }
 
+// MapLines in the BA are either two endpoints (VertexSBALineXYZ, EdgeLineSE3ProjectXYZ) or an
+// orthonormal representation of the infinite line (VertexLineOrth, EdgeLineOrthSE3Project)
+static g2o::OptimizableGraph::Vertex* CreateLineVertex(MapLine* pML, const bool bLineOrth)
+{
+    const Vector6d pos = pML->GetWorldPos();
+    if(bLineOrth)
+    {
+        ORB_SLAM3::VertexLineOrth* vLine = new ORB_SLAM3::VertexLineOrth();
+        vLine->setEstimate(ORB_SLAM3::PluckerFromEndpoints(pos.head(3), pos.tail(3)));
+        return vLine;
+    }
+
+    g2o::VertexSBALineXYZ* vLine = new g2o::VertexSBALineXYZ();
+    vLine->setEstimate(pos);
+    return vLine;
+}
+
+// Optimized endpoints of a MapLine. With the orthonormal representation the current endpoints
+// are moved onto the optimized line
+static Vector6d GetLineVertexEndpoints(g2o::OptimizableGraph::Vertex* v, MapLine* pML, const bool bLineOrth)
+{
+    if(!bLineOrth)
+        return static_cast<g2o::VertexSBALineXYZ*>(v)->estimate();
+
+    const Vector6d pos = pML->GetWorldPos();
+    Eigen::Vector3d sP = pos.head(3);
+    Eigen::Vector3d eP = pos.tail(3);
+    ORB_SLAM3::EndpointsOnPlucker(static_cast<ORB_SLAM3::VertexLineOrth*>(v)->estimate(), sP, eP);
+
+    Vector6d optPos;
+    optPos << sP, eP;
+    return optPos;
+}
+
+static g2o::OptimizableGraph::Edge* CreateLineEdge(KeyFrame* pKF, const size_t idx, g2o::OptimizableGraph::Vertex* vLine,
+                                                   g2o::OptimizableGraph::Vertex* vKF, const bool bLineOrth, const double info)
+{
+    if(bLineOrth)
+    {
+        const cv::line_descriptor::KeyLine &kl = pKF->mvKeysUn_Line[idx];
+        ORB_SLAM3::EdgeLineOrthSE3Project* e = new ORB_SLAM3::EdgeLineOrthSE3Project();
+        e->setVertex(0, vLine);
+        e->setVertex(1, vKF);
+        e->setMeasurement(Eigen::Vector4d(kl.startPointX, kl.startPointY, kl.endPointX, kl.endPointY));
+        e->setInformation(Eigen::Matrix2d::Identity()*info);
+        e->fx = pKF->fx;
+        e->fy = pKF->fy;
+        e->cx = pKF->cx;
+        e->cy = pKF->cy;
+        return e;
+    }
+
+    ORB_SLAM3::EdgeLineSE3ProjectXYZ* e = new ORB_SLAM3::EdgeLineSE3ProjectXYZ();
+    e->setVertex(0, vLine);
+    e->setVertex(1, vKF);
+    e->setMeasurement(pKF->mvle_l[idx]);
+    e->setInformation(Eigen::Matrix2d::Identity()*info);
+    e->fx = pKF->fx;
+    e->fy = pKF->fy;
+    e->cx = pKF->cx;
+    e->cy = pKF->cy;
+    return e;
+}
+
+static bool IsLineEdgeDepthPositive(g2o::OptimizableGraph::Edge* e)
+{
+    if(ORB_SLAM3::EdgeLineOrthSE3Project* eOrth = dynamic_cast<ORB_SLAM3::EdgeLineOrthSE3Project*>(e))
+        return eOrth->isDepthPositive();
+    return static_cast<ORB_SLAM3::EdgeLineSE3ProjectXYZ*>(e)->isDepthPositive();
+}
+
+static void SetLineEdgeInformation(g2o::OptimizableGraph::Edge* e, const double info)
+{
+    if(ORB_SLAM3::EdgeLineOrthSE3Project* eOrth = dynamic_cast<ORB_SLAM3::EdgeLineOrthSE3Project*>(e))
+        eOrth->setInformation(Eigen::Matrix2d::Identity()*info);
+    else
+        static_cast<ORB_SLAM3::EdgeLineSE3ProjectXYZ*>(e)->setInformation(Eigen::Matrix2d::Identity()*info);
+}
+
+// Local BA graph (points and endpoint lines) as a BASolver problem for the problem capture. The lines
+// keep their raw information, their weights are set again by BASolver::Solve.
+static void CaptureLocalBAGraph(KeyFrame* pKF, const bool bInertial, const vector<ORB_SLAM3::EdgeSE3ProjectXYZ*> &vpEdgesMono,
+                                const vector<g2o::EdgeStereoSE3ProjectXYZ*> &vpEdgesStereo,
+                                const vector<g2o::OptimizableGraph::Edge*> &vpEdgesLine, const vector<float> &invSigma2_Line)
+{
+    if(!ProblemCapture::IsEnabled() || pKF->mpCamera->GetType()!=pKF->mpCamera->CAM_PINHOLE)
+        return;
+
+    BASolver solver;
+    solver.SetCalibration(pKF->fx, pKF->fy, pKF->cx, pKF->cy, pKF->mbf);
+    solver.mdLambdaInit = bInertial ? 100.0 : -1;
+
+    // Cameras and landmarks in the order of their first edge
+    map<g2o::HyperGraph::Vertex*,int> mCameraIdx, mPointIdx, mLineIdx;
+    auto GetCamera = [&](g2o::HyperGraph::Vertex* v)
+    {
+        map<g2o::HyperGraph::Vertex*,int>::const_iterator it = mCameraIdx.find(v);
+        if(it!=mCameraIdx.end())
+            return it->second;
+        const g2o::VertexSE3Expmap* vSE3 = static_cast<g2o::VertexSE3Expmap*>(v);
+        const int idx = solver.AddCamera(vSE3->estimate().rotation().toRotationMatrix(), vSE3->estimate().translation(), vSE3->fixed());
+        mCameraIdx[v] = idx;
+        return idx;
+    };
+    auto GetPoint = [&](g2o::HyperGraph::Vertex* v)
+    {
+        map<g2o::HyperGraph::Vertex*,int>::const_iterator it = mPointIdx.find(v);
+        if(it!=mPointIdx.end())
+            return it->second;
+        const int idx = solver.AddPoint(static_cast<g2o::VertexSBAPointXYZ*>(v)->estimate());
+        mPointIdx[v] = idx;
+        return idx;
+    };
+
+    for(size_t i=0; i<vpEdgesMono.size(); i++)
+    {
+        ORB_SLAM3::EdgeSE3ProjectXYZ* e = vpEdgesMono[i];
+        const int point = GetPoint(e->vertex(0));
+        solver.AddPointObservation(point, GetCamera(e->vertex(1)), e->measurement()(0), e->measurement()(1), -1, e->information()(0,0));
+    }
+    for(size_t i=0; i<vpEdgesStereo.size(); i++)
+    {
+        g2o::EdgeStereoSE3ProjectXYZ* e = vpEdgesStereo[i];
+        const int point = GetPoint(e->vertex(0));
+        solver.AddPointObservation(point, GetCamera(e->vertex(1)), e->measurement()(0), e->measurement()(1), e->measurement()(2),
+                                   e->information()(0,0));
+    }
+    for(size_t i=0; i<vpEdgesLine.size(); i++)
+    {
+        ORB_SLAM3::EdgeLineSE3ProjectXYZ* e = static_cast<ORB_SLAM3::EdgeLineSE3ProjectXYZ*>(vpEdgesLine[i]);
+        int line;
+        map<g2o::HyperGraph::Vertex*,int>::const_iterator it = mLineIdx.find(e->vertex(0));
+        if(it!=mLineIdx.end())
+            line = it->second;
+        else
+        {
+            const Vector6d pos = static_cast<g2o::VertexSBALineXYZ*>(e->vertex(0))->estimate();
+            line = solver.AddLine(pos.head(3), pos.tail(3));
+            mLineIdx[e->vertex(0)] = line;
+        }
+        solver.AddLineObservation(line, GetCamera(e->vertex(1)), e->measurement(), invSigma2_Line[i]);
+    }
+
+    ProblemCapture::CaptureLocalBA(solver);
+}
+
+// Classifies the two edges of each Sim3 match (2*i and 2*i+1), a match is an outlier if any of them is.
+// Removed matches (NULL edges) are invalid.
+template<class Edge12, class Edge21>
+static void ClassifySim3Edges(const vector<Edge12*> &vpEdges12, const vector<Edge21*> &vpEdges21, const float th2,
+                              const bool bComputeError, OutlierClassifier &classifier)
+{
+    classifier.Clear();
+    for(size_t i=0; i<vpEdges12.size(); i++)
+    {
+        Edge12* e12 = vpEdges12[i];
+        Edge21* e21 = vpEdges21[i];
+        if(!e12 || !e21)
+        {
+            classifier.Add(0, th2, 2, false);
+            classifier.Add(0, th2, 2, false);
+            continue;
+        }
+
+        if(bComputeError)
+        {
+            e12->computeError();
+            e21->computeError();
+        }
+        classifier.Add(e12->chi2(), th2, 2);
+        classifier.Add(e21->chi2(), th2, 2);
+    }
+    classifier.Classify();
+}
+
+// Stops the iterations of a g2o optimization when the budget of the call is exhausted. If the monitor
+// has nothing to follow it does nothing, otherwise it takes the place of the force stop flag of the
+// optimizer (and stops it as well when *pbStopFlag is set).
+class G2oBudgetAction : public g2o::HyperGraphAction
+{
+public:
+    G2oBudgetAction(g2o::SparseOptimizer &optimizer, OptimizationMonitor &monitor, bool* pbStopFlag):
+        mOptimizer(optimizer), mMonitor(monitor), mpbStopFlag(pbStopFlag), mbStop(false), mbActive(monitor.IsActive())
+    {
+        if(!mbActive)
+            return;
+        mOptimizer.setForceStopFlag(&mbStop);
+        mOptimizer.addPostIterationAction(this);
+    }
+
+    ~G2oBudgetAction()
+    {
+        if(!mbActive)
+            return;
+        mOptimizer.removePostIterationAction(this);
+        mOptimizer.setForceStopFlag(mpbStopFlag);
+    }
+
+    // To be called before each optimize()
+    void StartRound()
+    {
+        if(!mbActive)
+            return;
+        mMonitor.StartRound();
+        mbStop = mpbStopFlag && *mpbStopFlag;
+    }
+
+    virtual g2o::HyperGraphAction* operator()(const g2o::HyperGraph* graph, Parameters* parameters = 0)
+    {
+        if(mMonitor.Iteration(mOptimizer.activeRobustChi2()) || (mpbStopFlag && *mpbStopFlag))
+            mbStop = true;
+        return this;
+    }
+
+protected:
+    g2o::SparseOptimizer &mOptimizer;
+    OptimizationMonitor &mMonitor;
+    bool* mpbStopFlag;
+    bool mbStop;
+    const bool mbActive;
+};
+
 void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
 {
     vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
@@ -59,12 +284,12 @@ void Optimizer::GlobalBundleAdjustemnt(Map* pMap, int nIterations, bool* pbStopF
     BundleAdjustment(vpKFs,vpMP,nIterations,pbStopFlag, nLoopKF, bRobust);
 }
 
-void Optimizer::GlobalBundleAdjustemntWithLines(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+void Optimizer::GlobalBundleAdjustemntWithLines(Map* pMap, int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust, const bool bLineOrth)
 {
     vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
     vector<MapPoint*> vpMP = pMap->GetAllMapPoints();
     vector<MapLine*> vpML = pMap->GetAllMapLines();
-    BundleAdjustmentWithLines(vpKFs,vpMP,vpML,nIterations,pbStopFlag, nLoopKF, bRobust);
+    BundleAdjustmentWithLines(vpKFs,vpMP,vpML,nIterations,pbStopFlag, nLoopKF, bRobust, bLineOrth);
 }
 
 
@@ -428,7 +653,7 @@ void Optimizer::BundleAdjustment(const vector<KeyFrame *> &vpKFs, const vector<M
 }
 
 void Optimizer::BundleAdjustmentWithLines(const vector<KeyFrame *> &vpKFs, const vector<MapPoint *> &vpMP, const vector<MapLine *> &vpML,
-                                 int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust)
+                                 int nIterations, bool* pbStopFlag, const unsigned long nLoopKF, const bool bRobust, const bool bLineOrth)
 {
     vector<bool> vbNotIncludedMP;
     vbNotIncludedMP.resize(vpMP.size());
@@ -478,7 +703,7 @@ void Optimizer::BundleAdjustmentWithLines(const vector<KeyFrame *> &vpKFs, const
 
     const int nExpectedSize_l = (vpKFs.size())*vpML.size();
 
-    vector<ORB_SLAM3::EdgeLineSE3ProjectXYZ*> vpEdgesLine;
+    vector<g2o::OptimizableGraph::Edge*> vpEdgesLine;
     vpEdgesLine.reserve(nExpectedSize_l);
 
     vector<KeyFrame*> vpEdgeKFLine;
@@ -635,8 +860,7 @@ void Optimizer::BundleAdjustmentWithLines(const vector<KeyFrame *> &vpKFs, const
         MapLine* pML = vpML[i];
         if(pML->isBad())
             continue;
-        g2o::VertexSBALineXYZ* vPoint_l = new g2o::VertexSBALineXYZ();
-        vPoint_l->setEstimate(pML->GetWorldPos());
+        g2o::OptimizableGraph::Vertex* vPoint_l = CreateLineVertex(pML, bLineOrth);
         int id_l = pML->mnId+max+1;
         vPoint_l->setId(id_l);
         vPoint_l->setMarginalized(true);
@@ -661,15 +885,11 @@ void Optimizer::BundleAdjustmentWithLines(const vector<KeyFrame *> &vpKFs, const
             const int power = initialorbedges[pKF->mnId]/thr;
             const float Weight = pow(2.0,-power);
             const float thHuberLine = sqrt(Weight*7.815);
-            Eigen::Matrix<double,3,1> obs;
-            obs << pKF->mvle_l[mit->second](0), pKF->mvle_l[mit->second](1), pKF->mvle_l[mit->second](2);
 
-            ORB_SLAM3::EdgeLineSE3ProjectXYZ* e = new ORB_SLAM3::EdgeLineSE3ProjectXYZ();
-            e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id_l)));
-            e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKF->mnId)));
-            e->setMeasurement(obs);
             const float &invSigma2 = pKF->mvInvLevelSigma2_l[pKF->mvKeysUn_Line[mit->second].octave];
-            e->setInformation(Eigen::Matrix2d::Identity()*Weight*invSigma2);
+            g2o::OptimizableGraph::Edge* e = CreateLineEdge(pKF, mit->second, vPoint_l,
+                                                            dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKF->mnId)),
+                                                            bLineOrth, Weight*invSigma2);
 
             if(bRobust)
             {
@@ -678,13 +898,6 @@ void Optimizer::BundleAdjustmentWithLines(const vector<KeyFrame *> &vpKFs, const
             rk->setDelta(thHuberLine);
             }
 
-            e->fx = pKF->fx;
-            e->fy = pKF->fy;
-            e->cx = pKF->cx;
-            e->cy = pKF->cy;
-
-            e->obs_temp = pKF->mvle_l[mit->second]; 
-
             optimizer.addEdge(e);
             vpEdgesLine.push_back(e);
             vpEdgeKFLine.push_back(pKF);
@@ -815,7 +1028,7 @@ void Optimizer::BundleAdjustmentWithLines(const vector<KeyFrame *> &vpKFs, const
 
                 for(size_t i=0, iend=vpEdgesLine.size(); i<iend;i++)
                 {
-                    ORB_SLAM3::EdgeLineSE3ProjectXYZ* e = vpEdgesLine[i];
+                    g2o::OptimizableGraph::Edge* e = vpEdgesLine[i];
                     MapLine* pML = vpMapLineEdge[i];
                     KeyFrame* pKFedge = vpEdgeKFLine[i];
 
@@ -827,7 +1040,7 @@ void Optimizer::BundleAdjustmentWithLines(const vector<KeyFrame *> &vpKFs, const
                     if(pML->isBad())
                         continue;
 
-                    if(e->chi2()>Linechi2[i] || !e->isDepthPositive())
+                    if(e->chi2()>Linechi2[i] || !IsLineEdgeDepthPositive(e))
                     {
                         numBadLines++;
                     }
@@ -882,16 +1095,17 @@ void Optimizer::BundleAdjustmentWithLines(const vector<KeyFrame *> &vpKFs, const
         if(pML->isBad())
             continue;
 
-        g2o::VertexSBALineXYZ* vPoint_l = static_cast<g2o::VertexSBALineXYZ*>(optimizer.vertex(pML->mnId+max+1));
+        g2o::OptimizableGraph::Vertex* vPoint_l = static_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pML->mnId+max+1));
+        const Vector6d pos = GetLineVertexEndpoints(vPoint_l, pML, bLineOrth);
 
         if(nLoopKF==pMap->GetOriginKF()->mnId)
         {
-            pML->SetWorldPos(vPoint_l->estimate().head(3), vPoint_l->estimate().tail(3));
+            pML->SetWorldPos(pos.head(3), pos.tail(3));
             pML->UpdateNormalAndDepth();
         }
         else
         { 
-            pML->mPosGBA = vPoint_l->estimate();
+            pML->mPosGBA = pos;
             pML->mnBAGlobalForKF = nLoopKF;
         }
     }
@@ -1399,9 +1613,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
                     const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
                     e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(deltaMono);
+                    e->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaMono));
 
                     e->pCamera = pFrame->mpCamera;
                     cv::Mat Xw = pMP->GetWorldPos();
@@ -1433,9 +1645,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
                     Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
                     e->setInformation(Info);
 
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(deltaStereo);
+                    e->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaStereo));
 
                     e->fx = pFrame->fx;
                     e->fy = pFrame->fy;
@@ -1474,9 +1684,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
                     const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
                     e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(deltaMono);
+                    e->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaMono));
 
                     e->pCamera = pFrame->mpCamera;
                     cv::Mat Xw = pMP->GetWorldPos();
@@ -1505,9 +1713,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
                     const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
                     e->setInformation(Eigen::Matrix2d::Identity() * invSigma2);
 
-                    g2o::RobustKernelHuber *rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(deltaMono);
+                    e->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaMono));
 
                     e->pCamera = pFrame->mpCamera2;
                     cv::Mat Xw = pMP->GetWorldPos();
@@ -1538,6 +1744,7 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     const int its[4]={10,10,10,10};    
 
     int nBad=0;
+    OutlierClassifier classifier;
     for(size_t it=0; it<4; it++)
     {
 
@@ -1545,89 +1752,38 @@ int Optimizer::PoseOptimization(Frame *pFrame)
         optimizer.initializeOptimization(0);
         optimizer.optimize(its[it]);
 
-        nBad=0;
-        for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++)
+        classifier.Clear();
+        classifier.AddG2oEdges(vpEdgesMono, chi2Mono[it], 2);
+        classifier.AddG2oEdges(vpEdgesMono_FHR, chi2Mono[it], 2);
+        classifier.AddG2oEdges(vpEdgesStereo, chi2Stereo[it], 3);
+        nBad = classifier.Size() - classifier.Classify();
+
+        size_t n = 0;
+        for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++, n++)
         {
             ORB_SLAM3::EdgeSE3ProjectXYZOnlyPose* e = vpEdgesMono[i];
-
-            const size_t idx = vnIndexEdgeMono[i];
-
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
-
-            const float chi2 = e->chi2();
-
-            if(chi2>chi2Mono[it])
-            {                
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {
-                pFrame->mvbOutlier[idx]=false;
-                e->setLevel(0);
-            }
+            pFrame->mvbOutlier[vnIndexEdgeMono[i]] = classifier.IsOutlier(n);
+            e->setLevel(classifier.IsOutlier(n));
 
             if(it==2)
                 e->setRobustKernel(0);
         }
 
-        for(size_t i=0, iend=vpEdgesMono_FHR.size(); i<iend; i++)
+        for(size_t i=0, iend=vpEdgesMono_FHR.size(); i<iend; i++, n++)
         {
             ORB_SLAM3::EdgeSE3ProjectXYZOnlyPoseToBody* e = vpEdgesMono_FHR[i];
-
-            const size_t idx = vnIndexEdgeRight[i];
-
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
-
-            const float chi2 = e->chi2();
-
-            if(chi2>chi2Mono[it])
-            {
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {
-                pFrame->mvbOutlier[idx]=false;
-                e->setLevel(0);
-            }
+            pFrame->mvbOutlier[vnIndexEdgeRight[i]] = classifier.IsOutlier(n);
+            e->setLevel(classifier.IsOutlier(n));
 
             if(it==2)
                 e->setRobustKernel(0);
         }
 
-        for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++)
+        for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++, n++)
         {
             g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = vpEdgesStereo[i];
-
-            const size_t idx = vnIndexEdgeStereo[i];
-
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
-
-            const float chi2 = e->chi2();
-
-            if(chi2>chi2Stereo[it])
-            {
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {                
-                e->setLevel(0);
-                pFrame->mvbOutlier[idx]=false;
-            }
+            pFrame->mvbOutlier[vnIndexEdgeStereo[i]] = classifier.IsOutlier(n);
+            e->setLevel(classifier.IsOutlier(n));
 
             if(it==2)
                 e->setRobustKernel(0);
@@ -1648,8 +1804,10 @@ int Optimizer::PoseOptimization(Frame *pFrame)
     return nInitialCorrespondences-nBad;
 }
 
-int Optimizer::PoseOptimizationPL(Frame *pFrame)
+int Optimizer::PoseOptimizationPL(Frame *pFrame, const OptimizationBudget* pBudget, OptimizationStats* pStats)
 {
+    OptimizationMonitor monitor(pBudget, pStats);
+    ProblemCapture::CapturePose(pFrame);
 //    cout<<"Track RefereceKF 50 "<<endl;
     g2o::SparseOptimizer optimizer;
     g2o::BlockSolver_6_3::LinearSolverType * linearSolver;
@@ -1660,6 +1818,7 @@ int Optimizer::PoseOptimizationPL(Frame *pFrame)
 
     g2o::OptimizationAlgorithmLevenberg* solver = new g2o::OptimizationAlgorithmLevenberg(solver_ptr);
     optimizer.setAlgorithm(solver);
+    G2oBudgetAction budgetAction(optimizer, monitor, NULL);
 
     int nInitialCorrespondences=0;
 
@@ -1720,9 +1879,7 @@ int Optimizer::PoseOptimizationPL(Frame *pFrame)
                 const float invSigma2 = pFrame->mvInvLevelSigma2[kpUn.octave];
                 e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
-                g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                e->setRobustKernel(rk);
-                rk->setDelta(deltaMono);
+                e->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaMono));
 
                 e->pCamera = pFrame->mpCamera;
                 cv::Mat Xw = pMP->GetWorldPos();
@@ -1755,9 +1912,7 @@ int Optimizer::PoseOptimizationPL(Frame *pFrame)
                 Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
                 e->setInformation(Info);
 
-                g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                e->setRobustKernel(rk);
-                rk->setDelta(deltaStereo);
+                e->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaStereo));
 
                 e->fx = pFrame->fx;
                 e->fy = pFrame->fy;
@@ -1806,9 +1961,7 @@ int Optimizer::PoseOptimizationPL(Frame *pFrame)
             e->setInformation(Eigen::Matrix2d::Identity()*Weight*invSigma2);
 
 //            cout<<"Track RefereceKF 534 "<<endl;
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-            e->setRobustKernel(rk);
-            rk->setDelta(deltaLine);
+            e->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaLine));
 
             e->fx = pFrame->fx;
             e->fy = pFrame->fy;
@@ -1826,7 +1979,6 @@ int Optimizer::PoseOptimizationPL(Frame *pFrame)
             e->Xw_e[1] = Xw_e(1);
             e->Xw_e[2] = Xw_e(2);
 
-            e->obs_temp = pFrame->mvle_l[i];
 //            cout<<"Track RefereceKF 535 "<<endl;
             optimizer.addEdge(e);
 //            cout<<"Track RefereceKF 536 "<<endl;
@@ -1849,115 +2001,71 @@ int Optimizer::PoseOptimizationPL(Frame *pFrame)
     const int its[4]={10,10,10,10};    
 
     int nBad=0;
+    OutlierClassifier classifier;
 //    cout<<"Track RefereceKF 55 "<<endl;
     for(size_t it=0; it<4; it++)
     {
+        // No new round after the deadline, the pose and outliers of the last one are kept
+        if(it>0 && monitor.Expired())
+            break;
 
         vSE3->setEstimate(Converter::toSE3Quat(pFrame->mTcw));
         optimizer.initializeOptimization(0);
+        budgetAction.StartRound();
         optimizer.optimize(its[it]);
 
+        // Classify the points and the lines together, the chi2 of the lines with the current Weight
+        classifier.Clear();
+        classifier.AddG2oEdges(vpEdgesMono, chi2Mono[it], 2);
+        classifier.AddG2oEdges(vpEdgesStereo, chi2Stereo[it], 3);
+        classifier.AddG2oEdges(vpEdgesLine, chi2Line, 2);
+        nBad = classifier.Size() - classifier.Classify();
+
         // Find point inliers on each iteration so as to update the Weight for the next
         unsigned int point_inliers = 0;
-        nBad=0;
         for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++)
         {
             ORB_SLAM3::EdgeSE3ProjectXYZOnlyPose* e = vpEdgesMono[i];
-
-            const size_t idx = vnIndexEdgeMono[i];
-
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
-
-            const float chi2 = e->chi2();
-
-            if(chi2>chi2Mono[it])
-            {                
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {
-                pFrame->mvbOutlier[idx]=false;
-                e->setLevel(0);
-                point_inliers++;
-            }
+            const bool bOutlier = classifier.IsOutlier(i);
+            pFrame->mvbOutlier[vnIndexEdgeMono[i]] = bOutlier;
+            e->setLevel(bOutlier);
+            point_inliers += !bOutlier;
 
             if(it==2)
                 e->setRobustKernel(0);
         }
 
+        const size_t nMono = vpEdgesMono.size();
         for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++)
         {
             g2o::EdgeStereoSE3ProjectXYZOnlyPose* e = vpEdgesStereo[i];
-
-            const size_t idx = vnIndexEdgeStereo[i];
-            
-            if(pFrame->mvbOutlier[idx])
-            {
-                e->computeError();
-            }
-
-            const float chi2 = e->chi2();
-
-            if(chi2>chi2Stereo[it])
-            {
-                pFrame->mvbOutlier[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {                
-                e->setLevel(0);
-                pFrame->mvbOutlier[idx]=false;
-                point_inliers++;
-            }
+            const bool bOutlier = classifier.IsOutlier(nMono+i);
+            pFrame->mvbOutlier[vnIndexEdgeStereo[i]] = bOutlier;
+            e->setLevel(bOutlier);
+            point_inliers += !bOutlier;
 
             if(it==2)
                 e->setRobustKernel(0);
-        } 
+        }
 
         // Estimate the Weight for the next iteration
         power = point_inliers/thr;
         Weight = pow(2.0,-power);
         deltaLine = sqrt(Weight*7.815);
-        
+
+        const size_t nPoints = nMono + vpEdgesStereo.size();
         for(size_t i=0, iend=vpEdgesLine.size(); i<iend; i++)
         {
             ORB_SLAM3::EdgeLineSE3ProjectXYZOnlyPose* e = vpEdgesLine[i];
 
-            const size_t idx = vnIndexEdgeLine[i];
-
-            if(pFrame->mvbOutlier_Line[idx])
-            {
-                e->computeError();
-            }
-
-            const float chi2 = e->chi2();
-
-            // Update Information matrix and Huber threshold for the next iteration
+            // Update Information matrix and robust kernel threshold for the next iteration
             e->setInformation(Eigen::Matrix2d::Identity()*Weight*invSigma2_Lines[i]);
             if(it<2)
-            {
-            g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-            e->setRobustKernel(rk);
-            rk->setDelta(deltaLine);
-            }
+                e->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaLine));
 
-            if(chi2>chi2Line)
-            {                
-                pFrame->mvbOutlier_Line[idx]=true;
-                e->setLevel(1);
-                nBad++;
-            }
-            else
-            {
-                pFrame->mvbOutlier_Line[idx]=false;
-                e->setLevel(0);
-            }
+            const bool bOutlier = classifier.IsOutlier(nPoints+i);
+            pFrame->mvbOutlier_Line[vnIndexEdgeLine[i]] = bOutlier;
+            e->setLevel(bOutlier);
 
             if(it==2)
                 e->setRobustKernel(0);
@@ -2052,8 +2160,6 @@ int Optimizer::PoseOptimizationOnlyLine(Frame *pFrame)
             e->Xw_e[1] = Xw_e(1);
             e->Xw_e[2] = Xw_e(2);
 
-            e->obs_temp = pFrame->mvle_l[i]; 
-
             optimizer.addEdge(e);
 
             vpEdgesLine.push_back(e);
@@ -2191,11 +2297,6 @@ int Optimizer::PoseOptimizationOnlyLineAngles(Frame *pFrame)
             e->Xw_e[1] = Xw_e(1);
             e->Xw_e[2] = Xw_e(2);
 
-            e->obs_temp[0] = pFrame->mvKeysUn_Line[i].startPointX; 
-            e->obs_temp[1] = pFrame->mvKeysUn_Line[i].startPointY; 
-            e->obs_temp[2] = pFrame->mvKeysUn_Line[i].endPointX; 
-            e->obs_temp[3] = pFrame->mvKeysUn_Line[i].endPointY; 
-
             optimizer.addEdge(e);
 
             vpEdgesLine.push_back(e);
@@ -2339,14 +2440,6 @@ int Optimizer::PoseOptimizationOnlyLineWithAngles(Frame *pFrame)
             e->Xw_e[1] = Xw_e(1);
             e->Xw_e[2] = Xw_e(2);
 
-            e->obs_temp[0] = pFrame->mvKeysUn_Line[i].startPointX; 
-            e->obs_temp[1] = pFrame->mvKeysUn_Line[i].startPointY; 
-            e->obs_temp[2] = pFrame->mvKeysUn_Line[i].endPointX; 
-            e->obs_temp[3] = pFrame->mvKeysUn_Line[i].endPointY; 
-            e->obs_temp[4] = pFrame->mvle_l[i][0]; 
-            e->obs_temp[5] = pFrame->mvle_l[i][1]; 
-            e->obs_temp[6] = pFrame->mvle_l[i][2]; 
-
             optimizer.addEdge(e);
 
             vpEdgesLine.push_back(e);
@@ -3546,12 +3639,10 @@ void Optimizer::LocalBundleAdjustment(KeyFrame *pKF, bool* pbStopFlag, Map* pMap
     pMap->IncreaseChangeIndex();
 }
 
-void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int& num_fixedKF)
-{    
-    //cout << "LBA" << endl;
+void Optimizer::LocalWindowPL(KeyFrame *pKF, Map* pMap, list<KeyFrame*> &lLocalKeyFrames, list<KeyFrame*> &lFixedCameras,
+                              list<MapPoint*> &lLocalMapPoints, list<MapLine*> &lLocalMapLines, int& num_fixedKF)
+{
     // Local KeyFrames: First Breath Search from Current Keyframe
-    list<KeyFrame*> lLocalKeyFrames;
-
     lLocalKeyFrames.push_back(pKF);
     pKF->mnBALocalForKF = pKF->mnId;
     Map* pCurrentMap = pKF->GetMap();
@@ -3567,7 +3658,6 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
 
     // Local MapPoints seen in Local KeyFrames
     num_fixedKF = 0;
-    list<MapPoint*> lLocalMapPoints;
     set<MapPoint*> sNumObsMP;
     for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin() , lend=lLocalKeyFrames.end(); lit!=lend; lit++)
     {
@@ -3594,7 +3684,6 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
     }
 
     // Local MapLines seen in Local KeyFrames
-    list<MapLine*> lLocalMapLines;
     for(list<KeyFrame*>::iterator lit=lLocalKeyFrames.begin() , lend=lLocalKeyFrames.end(); lit!=lend; lit++)
     {
         KeyFrame* pKFi = *lit;
@@ -3617,7 +3706,6 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
     }
 
     // Fixed Keyframes. Keyframes that see Local MapPoints but that are not Local Keyframes
-    list<KeyFrame*> lFixedCameras;
     for(list<MapPoint*>::iterator lit=lLocalMapPoints.begin(), lend=lLocalMapPoints.end(); lit!=lend; lit++)
     {
         map<KeyFrame*,tuple<int,int>> observations = (*lit)->GetObservations();
@@ -3652,6 +3740,12 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
     }
 
     num_fixedKF = lFixedCameras.size() + num_fixedKF;
+    FixOldestKeyFramesPL(pKF, pMap, lLocalKeyFrames, lFixedCameras, num_fixedKF);
+}
+
+void Optimizer::FixOldestKeyFramesPL(KeyFrame *pKF, Map* pMap, list<KeyFrame*> &lLocalKeyFrames, list<KeyFrame*> &lFixedCameras,
+                                     int& num_fixedKF)
+{
     if(num_fixedKF < 2)
     {
         //Verbose::PrintMess("LM-LBA: New Fixed KFs had been set", Verbose::VERBOSITY_NORMAL);
@@ -3698,6 +3792,20 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
         //return;
     }
     //Verbose::PrintMess("LM-LBA: There are " + to_string(lLocalKeyFrames.size()) + " KFs and " + to_string(lLocalMapPoints.size()) + " MPs to optimize. " + to_string(num_fixedKF) + " KFs are fixed", Verbose::VERBOSITY_DEBUG);
+}
+
+void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pMap, int& num_fixedKF, const bool bLineOrth,
+                                        const OptimizationBudget* pBudget, OptimizationStats* pStats)
+{    
+    OptimizationMonitor monitor(pBudget, pStats);
+    //cout << "LBA" << endl;
+    // Local and fixed KeyFrames, MapPoints and MapLines
+    list<KeyFrame*> lLocalKeyFrames;
+    list<KeyFrame*> lFixedCameras;
+    list<MapPoint*> lLocalMapPoints;
+    list<MapLine*> lLocalMapLines;
+    LocalWindowPL(pKF, pMap, lLocalKeyFrames, lFixedCameras, lLocalMapPoints, lLocalMapLines, num_fixedKF);
+    Map* pCurrentMap = pKF->GetMap();
 
     // Setup optimizer
     g2o::SparseOptimizer optimizer;
@@ -3717,6 +3825,7 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
 
     if(pbStopFlag)
         optimizer.setForceStopFlag(pbStopFlag);
+    G2oBudgetAction budgetAction(optimizer, monitor, pbStopFlag);
 
     unsigned long maxKFid = 0;
 
@@ -3771,7 +3880,7 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
     // Set MapLine vertices
     const int nExpectedSize_l = (lLocalKeyFrames.size()+lFixedCameras.size())*lLocalMapLines.size();
 
-    vector<ORB_SLAM3::EdgeLineSE3ProjectXYZ*> vpEdgesLine;
+    vector<g2o::OptimizableGraph::Edge*> vpEdgesLine;
     vpEdgesLine.reserve(nExpectedSize_l);
 
     vector<KeyFrame*> vpEdgeKFLine;
@@ -3835,9 +3944,7 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
                     const float &invSigma2 = pKFi->mvInvLevelSigma2[kpUn.octave];
                     e->setInformation(Eigen::Matrix2d::Identity()*invSigma2);
 
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(thHuberMono);
+                    e->setRobustKernel(OutlierRejection::CreateG2oKernel(thHuberMono));
 
                     e->pCamera = pKFi->mpCamera;
 
@@ -3865,9 +3972,7 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
                     Eigen::Matrix3d Info = Eigen::Matrix3d::Identity()*invSigma2;
                     e->setInformation(Info);
 
-                    g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                    e->setRobustKernel(rk);
-                    rk->setDelta(thHuberStereo);
+                    e->setRobustKernel(OutlierRejection::CreateG2oKernel(thHuberStereo));
 
                     e->fx = pKFi->fx;
                     e->fy = pKFi->fy;
@@ -3890,8 +3995,7 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
     for(list<MapLine*>::iterator lit=lLocalMapLines.begin(), lend=lLocalMapLines.end(); lit!=lend; lit++)
     {
         MapLine* pML = *lit;
-        g2o::VertexSBALineXYZ* vPoint_l = new g2o::VertexSBALineXYZ();
-        vPoint_l->setEstimate(pML->GetWorldPos());
+        g2o::OptimizableGraph::Vertex* vPoint_l = CreateLineVertex(pML, bLineOrth);
         int id_l = pML->mnId+max+1;
         vPoint_l->setId(id_l);
         vPoint_l->setMarginalized(true);
@@ -3912,26 +4016,13 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
                 const int power = initialorbedges[pKFi->mnId]/thr;
                 const float Weight = pow(2.0,-power);
                 const float thHuberLine = sqrt(Weight*7.815);
-                Eigen::Matrix<double,3,1> obs;
-                obs << pKFi->mvle_l[mit->second](0), pKFi->mvle_l[mit->second](1), pKFi->mvle_l[mit->second](2);
 
-                ORB_SLAM3::EdgeLineSE3ProjectXYZ* e = new ORB_SLAM3::EdgeLineSE3ProjectXYZ();
-                e->setVertex(0, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(id_l)));
-                e->setVertex(1, dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)));
-                e->setMeasurement(obs);
                 const float &invSigma2_l = pKFi->mvInvLevelSigma2_l[pKFi->mvKeysUn_Line[mit->second].octave];
-                e->setInformation(Eigen::Matrix2d::Identity()*Weight*invSigma2_l);
+                g2o::OptimizableGraph::Edge* e = CreateLineEdge(pKFi, mit->second, vPoint_l,
+                                                                dynamic_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pKFi->mnId)),
+                                                                bLineOrth, Weight*invSigma2_l);
 
-                g2o::RobustKernelHuber* rk = new g2o::RobustKernelHuber;
-                e->setRobustKernel(rk);
-                rk->setDelta(thHuberLine);
-
-                e->fx = pKFi->fx;
-                e->fy = pKFi->fy;
-                e->cx = pKFi->cx;
-                e->cy = pKFi->cy;
-
-                e->obs_temp = pKFi->mvle_l[mit->second]; 
+                e->setRobustKernel(OutlierRejection::CreateG2oKernel(thHuberLine));
 
                 optimizer.addEdge(e);
                 vpEdgesLine.push_back(e);
@@ -3950,27 +4041,53 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
         if(*pbStopFlag)
             return;
 
+    // Orthonormal lines are not a BASolver problem
+    if(!bLineOrth)
+        CaptureLocalBAGraph(pKF, pMap->IsInertial(), vpEdgesMono, vpEdgesStereo, vpEdgesLine, invSigma2_Line);
+
     optimizer.initializeOptimization();
 
     std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    budgetAction.StartRound();
     optimizer.optimize(5);
     std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 
     //std::cout << "LBA time = " << std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count() << "[ms]" << std::endl;
     //std::cout << "Keyframes: " << nKFs << " --- MapPoints: " << nPoints << " --- Edges: " << nEdges << endl;
 
+    // Mono, stereo and line edges classified together. The chi2 of the edges out of the optimization
+    // is the one before it, as their error is not computed again.
+    OutlierClassifier classifier;
+    auto ClassifyEdges = [&]()
+    {
+        classifier.Clear();
+        for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++)
+            classifier.Add(vpEdgesMono[i]->chi2(), 5.991, 2, vpEdgesMono[i]->isDepthPositive());
+        for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++)
+            classifier.Add(vpEdgesStereo[i]->chi2(), 7.815, 3, vpEdgesStereo[i]->isDepthPositive());
+        for(size_t i=0, iend=vpEdgesLine.size(); i<iend; i++)
+            classifier.Add(vpEdgesLine[i]->chi2(), Linechi2[i], 2, IsLineEdgeDepthPositive(vpEdgesLine[i]));
+        classifier.Classify();
+    };
+
     bool bDoMore= true;
 
     if(pbStopFlag)
         if(*pbStopFlag)
             bDoMore = false;
 
+    // Out of time: no second optimization, the outliers are still removed below
+    if(monitor.Expired())
+        bDoMore = false;
+
     if(bDoMore)
     {
 
         // Check inlier observations
+        ClassifyEdges();
+        size_t n = 0;
         int nMonoBadObs = 0;
-        for(size_t i=0, iend=vpEdgesMono.size(); i<iend;i++)
+        for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++, n++)
         {
             ORB_SLAM3::EdgeSE3ProjectXYZ* e = vpEdgesMono[i];
             MapPoint* pMP = vpMapPointEdgeMono[i];
@@ -3978,7 +4095,7 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
             if(pMP->isBad())
                 continue;
 
-            if(e->chi2()>5.991 || !e->isDepthPositive())
+            if(classifier.IsOutlier(n))
             {
                 e->setLevel(1); 
                 nMonoBadObs++;
@@ -3989,7 +4106,7 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
         }
 
         int nStereoBadObs = 0;
-        for(size_t i=0, iend=vpEdgesStereo.size(); i<iend;i++)
+        for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++, n++)
         {
             g2o::EdgeStereoSE3ProjectXYZ* e = vpEdgesStereo[i];
             MapPoint* pMP = vpMapPointEdgeStereo[i];
@@ -3997,7 +4114,7 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
             if(pMP->isBad())
                 continue;
 
-            if(e->chi2()>7.815 || !e->isDepthPositive())
+            if(classifier.IsOutlier(n))
             {
                 e->setLevel(1);
                 nStereoBadObs++;
@@ -4009,9 +4126,9 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
 
         // Check inlier observations
         int nLineBadObs = 0;
-        for(size_t i=0, iend=vpEdgesLine.size(); i<iend;i++)
+        for(size_t i=0, iend=vpEdgesLine.size(); i<iend; i++, n++)
         {
-            ORB_SLAM3::EdgeLineSE3ProjectXYZ* e = vpEdgesLine[i];
+            g2o::OptimizableGraph::Edge* e = vpEdgesLine[i];
             MapLine* pML = vpMapLineEdge[i];
 
             const int thr_n = 50;
@@ -4021,14 +4138,14 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
             if(pML->isBad())
                 continue;
 
-            if(e->chi2()>Linechi2[i] || !e->isDepthPositive())
+            if(classifier.IsOutlier(n))
             {
                 e->setLevel(1);
                 nLineBadObs++;
             }
 
             // Update the information Matrix for the next iteration
-            e->setInformation(Eigen::Matrix2d::Identity()*Weight_n*invSigma2_Line[i]);
+            SetLineEdgeInformation(e, Weight_n*invSigma2_Line[i]);
             Linechi2[i]=Weight_n*7.815;
 
             e->setRobustKernel(0);
@@ -4038,6 +4155,7 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
         // Optimize again without the outliers
         //Verbose::PrintMess("LM-LBA: second optimization", Verbose::VERBOSITY_DEBUG);
         optimizer.initializeOptimization(0);
+        budgetAction.StartRound();
         optimizer.optimize(10);
 
     }
@@ -4046,30 +4164,30 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
     vToErase.reserve(vpEdgesMono.size()+vpEdgesStereo.size());
 
     // Check inlier observations       
-    for(size_t i=0, iend=vpEdgesMono.size(); i<iend;i++)
+    ClassifyEdges();
+    size_t n = 0;
+    for(size_t i=0, iend=vpEdgesMono.size(); i<iend; i++, n++)
     {
-        ORB_SLAM3::EdgeSE3ProjectXYZ* e = vpEdgesMono[i];
         MapPoint* pMP = vpMapPointEdgeMono[i];
 
         if(pMP->isBad())
             continue;
 
-        if(e->chi2()>5.991 || !e->isDepthPositive())
+        if(classifier.IsOutlier(n))
         {
             KeyFrame* pKFi = vpEdgeKFMono[i];
             vToErase.push_back(make_pair(pKFi,pMP));
         }
     }
 
-    for(size_t i=0, iend=vpEdgesStereo.size(); i<iend;i++)
+    for(size_t i=0, iend=vpEdgesStereo.size(); i<iend; i++, n++)
     {
-        g2o::EdgeStereoSE3ProjectXYZ* e = vpEdgesStereo[i];
         MapPoint* pMP = vpMapPointEdgeStereo[i];
 
         if(pMP->isBad())
             continue;
 
-        if(e->chi2()>7.815 || !e->isDepthPositive())
+        if(classifier.IsOutlier(n))
         {
             KeyFrame* pKFi = vpEdgeKFStereo[i];
             vToErase.push_back(make_pair(pKFi,pMP));
@@ -4079,15 +4197,14 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
     vector<pair<KeyFrame*,MapLine*> > vToErase_l;
     vToErase_l.reserve(vpEdgesLine.size());
       
-    for(size_t i=0, iend=vpEdgesLine.size(); i<iend;i++)
+    for(size_t i=0, iend=vpEdgesLine.size(); i<iend; i++, n++)
     {
-        ORB_SLAM3::EdgeLineSE3ProjectXYZ* e = vpEdgesLine[i];
         MapLine* pML = vpMapLineEdge[i];
 
         if(pML->isBad())
             continue;
 
-        if(e->chi2()>Linechi2[i] || !e->isDepthPositive())
+        if(classifier.IsOutlier(n))
         {
             KeyFrame* pKFi = vpEdgeKFLine[i];
             vToErase_l.push_back(make_pair(pKFi,pML));
@@ -4249,8 +4366,9 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame *pKF, bool* pbStopFlag, Map* pM
     for(list<MapLine*>::iterator lit=lLocalMapLines.begin(), lend=lLocalMapLines.end(); lit!=lend; lit++)
     {
         MapLine* pML = *lit;
-        g2o::VertexSBALineXYZ* vPoint_l = static_cast<g2o::VertexSBALineXYZ*>(optimizer.vertex(pML->mnId+max+1));
-        pML->SetWorldPos(vPoint_l->estimate().head(3), vPoint_l->estimate().tail(3));
+        g2o::OptimizableGraph::Vertex* vPoint_l = static_cast<g2o::OptimizableGraph::Vertex*>(optimizer.vertex(pML->mnId+max+1));
+        const Vector6d pos = GetLineVertexEndpoints(vPoint_l, pML, bLineOrth);
+        pML->SetWorldPos(pos.head(3), pos.tail(3));
         pML->UpdateNormalAndDepth();
     }
 
@@ -4415,8 +4533,6 @@ void Optimizer::LocalBundleAdjustmentOnlyLines(KeyFrame *pKF, bool* pbStopFlag,
                 e->cx = pKFi->cx;
                 e->cy = pKFi->cy;
 
-                e->obs_temp = pKFi->mvle_l[mit->second]; 
-
                 optimizer.addEdge(e);
                 vpEdgesLine.push_back(e);
                 vpEdgeKFLine.push_back(pKFi);
@@ -4667,11 +4783,6 @@ void Optimizer::LocalBundleAdjustmentOnlyLinesAngle(KeyFrame *pKF, bool* pbStopF
                 e->cx = pKFi->cx;
                 e->cy = pKFi->cy;
 
-                e->obs_temp[0] = pKFi->mvKeysUn_Line[mit->second].startPointX; 
-                e->obs_temp[1] = pKFi->mvKeysUn_Line[mit->second].startPointY; 
-                e->obs_temp[2] = pKFi->mvKeysUn_Line[mit->second].endPointX; 
-                e->obs_temp[3] = pKFi->mvKeysUn_Line[mit->second].endPointY; 
-
 
                 optimizer.addEdge(e);
                 vpEdgesLine.push_back(e);
@@ -4928,14 +5039,6 @@ void Optimizer::LocalBundleAdjustmentOnlyLinesWithAngle(KeyFrame *pKF, bool* pbS
                 e->cx = pKFi->cx;
                 e->cy = pKFi->cy;
 
-                e->obs_temp[0] = pKFi->mvKeysUn_Line[mit->second].startPointX; 
-                e->obs_temp[1] = pKFi->mvKeysUn_Line[mit->second].startPointY; 
-                e->obs_temp[2] = pKFi->mvKeysUn_Line[mit->second].endPointX; 
-                e->obs_temp[3] = pKFi->mvKeysUn_Line[mit->second].endPointY; 
-                e->obs_temp[4] = pKFi->mvle_l[mit->second](0);
-                e->obs_temp[5] = pKFi->mvle_l[mit->second](1);
-                e->obs_temp[6] = pKFi->mvle_l[mit->second](2);
-
                 optimizer.addEdge(e);
                 vpEdgesLine.push_back(e);
                 vpEdgeKFLine.push_back(pKFi);
@@ -5041,8 +5144,10 @@ void Optimizer::LocalBundleAdjustmentOnlyLinesWithAngle(KeyFrame *pKF, bool* pbS
 void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* pCurKF,
                                        const LoopClosing::KeyFrameAndPose &NonCorrectedSim3,
                                        const LoopClosing::KeyFrameAndPose &CorrectedSim3,
-                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale)
+                                       const map<KeyFrame *, set<KeyFrame *> > &LoopConnections, const bool &bFixScale,
+                                       const OptimizationBudget* pBudget, OptimizationStats* pStats)
 {   
+    OptimizationMonitor monitor(pBudget, pStats);
     // Setup optimizer
     g2o::SparseOptimizer optimizer;
     optimizer.setVerbose(false);
@@ -5053,6 +5158,7 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
 
     solver->setUserLambdaInit(1e-16);
     optimizer.setAlgorithm(solver);
+    G2oBudgetAction budgetAction(optimizer, monitor, NULL);
 
     const vector<KeyFrame*> vpKFs = pMap->GetAllKeyFrames();
     const vector<MapPoint*> vpMPs = pMap->GetAllMapPoints();
@@ -5287,10 +5393,13 @@ void Optimizer::OptimizeEssentialGraph(Map* pMap, KeyFrame* pLoopKF, KeyFrame* p
     //cout << "EG: Loop edges: " << count_loop << endl;
     //cout << "EG: covisible edges: " << count_cov << endl;
     //cout << "EG: imu edges: " << count_imu << endl;
+    ProblemCapture::CaptureEssentialGraph(optimizer, 20);
+
     // Optimize!
     optimizer.initializeOptimization();
     optimizer.computeActiveErrors();
     float err0 = optimizer.activeRobustChi2();
+    budgetAction.StartRound();
     optimizer.optimize(20);
     optimizer.computeActiveErrors();
     float errEnd = optimizer.activeRobustChi2();
@@ -5841,8 +5950,10 @@ void Optimizer::OptimizeEssentialGraph6DoF(KeyFrame* pCurKF, vector<KeyFrame*> &
 }
 
 void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF, vector<KeyFrame*> &vpFixedKFs, vector<KeyFrame*> &vpFixedCorrectedKFs,
-                                       vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs, vector<MapLine*> &vpNonCorrectedMLs)
+                                       vector<KeyFrame*> &vpNonFixedKFs, vector<MapPoint*> &vpNonCorrectedMPs, vector<MapLine*> &vpNonCorrectedMLs,
+                                       const OptimizationBudget* pBudget, OptimizationStats* pStats)
 {
+    OptimizationMonitor monitor(pBudget, pStats);
     Verbose::PrintMess("Opt_Essential: There are " + to_string(vpFixedKFs.size()) + " KFs fixed in the merged map", Verbose::VERBOSITY_DEBUG);
     Verbose::PrintMess("Opt_Essential: There are " + to_string(vpFixedCorrectedKFs.size()) + " KFs fixed in the old map", Verbose::VERBOSITY_DEBUG);
     Verbose::PrintMess("Opt_Essential: There are " + to_string(vpNonFixedKFs.size()) + " KFs non-fixed in the merged map", Verbose::VERBOSITY_DEBUG);
@@ -5858,6 +5969,7 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF, vector<KeyFrame*> &vpFi
 
     solver->setUserLambdaInit(1e-16);
     optimizer.setAlgorithm(solver);
+    G2oBudgetAction budgetAction(optimizer, monitor, NULL);
 
     Map* pMap = pCurKF->GetMap();
     const unsigned int nMaxKFid = pMap->GetMaxKFid();
@@ -6102,6 +6214,7 @@ void Optimizer::OptimizeEssentialGraph(KeyFrame* pCurKF, vector<KeyFrame*> &vpFi
 
     // Optimize!
     optimizer.initializeOptimization();
+    budgetAction.StartRound();
     optimizer.optimize(20);
 
     Verbose::PrintMess("Opt_Essential: Finish the optimization", Verbose::VERBOSITY_DEBUG);
@@ -6654,9 +6767,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         const float &invSigmaSquare1 = pKF1->mvInvLevelSigma2[kpUn1.octave];
         e12->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare1);
 
-        g2o::RobustKernelHuber* rk1 = new g2o::RobustKernelHuber;
-        e12->setRobustKernel(rk1);
-        rk1->setDelta(deltaHuber);
+        e12->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaHuber));
         optimizer.addEdge(e12);
 
         // Set edge x2 = S21*X1
@@ -6672,9 +6783,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         float invSigmaSquare2 = pKF2->mvInvLevelSigma2[kpUn2.octave];
         e21->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare2);
 
-        g2o::RobustKernelHuber* rk2 = new g2o::RobustKernelHuber;
-        e21->setRobustKernel(rk2);
-        rk2->setDelta(deltaHuber);
+        e21->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaHuber));
         optimizer.addEdge(e21);
 
         vpEdges12.push_back(e12);
@@ -6687,6 +6796,8 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     optimizer.optimize(5);
 
     // Check inliers
+    OutlierClassifier classifier;
+    ClassifySim3Edges(vpEdges12, vpEdges21, th2, false, classifier);
     int nBad=0;
     for(size_t i=0; i<vpEdges12.size();i++)
     {
@@ -6695,7 +6806,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         if(!e12 || !e21)
             continue;
 
-        if(e12->chi2()>th2 || e21->chi2()>th2)
+        if(classifier.IsOutlier(2*i) || classifier.IsOutlier(2*i+1))
         {
             size_t idx = vnIndexEdge[i];
             vpMatches1[idx]=static_cast<MapPoint*>(NULL);
@@ -6721,6 +6832,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     optimizer.initializeOptimization();
     optimizer.optimize(nMoreIterations);
 
+    ClassifySim3Edges(vpEdges12, vpEdges21, th2, false, classifier);
     int nIn = 0;
     for(size_t i=0; i<vpEdges12.size();i++)
     {
@@ -6729,7 +6841,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         if(!e12 || !e21)
             continue;
 
-        if(e12->chi2()>th2 || e21->chi2()>th2)
+        if(classifier.IsOutlier(2*i) || classifier.IsOutlier(2*i+1))
         {
             size_t idx = vnIndexEdge[i];
             vpMatches1[idx]=static_cast<MapPoint*>(NULL);
@@ -6890,9 +7002,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         const float &invSigmaSquare1 = pKF1->mvInvLevelSigma2[kpUn1.octave];
         e12->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare1);
 
-        g2o::RobustKernelHuber* rk1 = new g2o::RobustKernelHuber;
-        e12->setRobustKernel(rk1);
-        rk1->setDelta(deltaHuber);
+        e12->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaHuber));
         optimizer.addEdge(e12);
 
         // Set edge x2 = S21*X1
@@ -6928,9 +7038,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         float invSigmaSquare2 = pKF2->mvInvLevelSigma2[kpUn2.octave];
         e21->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare2);
 
-        g2o::RobustKernelHuber* rk2 = new g2o::RobustKernelHuber;
-        e21->setRobustKernel(rk2);
-        rk2->setDelta(deltaHuber);
+        e21->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaHuber));
         optimizer.addEdge(e21);
 
         vpEdges12.push_back(e12);
@@ -6947,6 +7055,8 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     optimizer.optimize(5);
 
     // Check inliers
+    OutlierClassifier classifier;
+    ClassifySim3Edges(vpEdges12, vpEdges21, th2, false, classifier);
     int nBad=0;
     int nBadOutKF2 = 0;
     for(size_t i=0; i<vpEdges12.size();i++)
@@ -6956,7 +7066,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         if(!e12 || !e21)
             continue;
 
-        if(e12->chi2()>th2 || e21->chi2()>th2)
+        if(classifier.IsOutlier(2*i) || classifier.IsOutlier(2*i+1))
         {
             size_t idx = vnIndexEdge[i];
             vpMatches1[idx]=static_cast<MapPoint*>(NULL);
@@ -6994,6 +7104,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     optimizer.initializeOptimization();
     optimizer.optimize(nMoreIterations);
 
+    ClassifySim3Edges(vpEdges12, vpEdges21, th2, true, classifier);
     int nIn = 0;
     mAcumHessian = Eigen::MatrixXd::Zero(7, 7);
     for(size_t i=0; i<vpEdges12.size();i++)
@@ -7003,10 +7114,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         if(!e12 || !e21)
             continue;
 
-        e12->computeError();
-        e21->computeError();
-
-        if(e12->chi2()>th2 || e21->chi2()>th2)
+        if(classifier.IsOutlier(2*i) || classifier.IsOutlier(2*i+1))
         {
             size_t idx = vnIndexEdge[i];
             vpMatches1[idx]=static_cast<MapPoint*>(NULL);
@@ -7149,9 +7257,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         const float &invSigmaSquare1 = pKF1->mvInvLevelSigma2[kpUn1.octave];
         e12->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare1);
 
-        g2o::RobustKernelHuber* rk1 = new g2o::RobustKernelHuber;
-        e12->setRobustKernel(rk1);
-        rk1->setDelta(deltaHuber);
+        e12->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaHuber));
         optimizer.addEdge(e12);
 
         // Set edge x2 = S21*X1
@@ -7183,9 +7289,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         float invSigmaSquare2 = pKFm->mvInvLevelSigma2[kpUn2.octave];
         e21->setInformation(Eigen::Matrix2d::Identity()*invSigmaSquare2);
 
-        g2o::RobustKernelHuber* rk2 = new g2o::RobustKernelHuber;
-        e21->setRobustKernel(rk2);
-        rk2->setDelta(deltaHuber);
+        e21->setRobustKernel(OutlierRejection::CreateG2oKernel(deltaHuber));
         optimizer.addEdge(e21);
 
         vpEdges12.push_back(e12);
@@ -7198,6 +7302,8 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     optimizer.optimize(5);
 
     // Check inliers
+    OutlierClassifier classifier;
+    ClassifySim3Edges(vpEdges12, vpEdges21, th2, false, classifier);
     int nBad=0;
     for(size_t i=0; i<vpEdges12.size();i++)
     {
@@ -7206,7 +7312,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         if(!e12 || !e21)
             continue;
 
-        if(e12->chi2()>th2 || e21->chi2()>th2)
+        if(classifier.IsOutlier(2*i) || classifier.IsOutlier(2*i+1))
         {
             size_t idx = vnIndexEdge[i];
             vpMatches1[idx]=static_cast<MapPoint*>(NULL);
@@ -7239,6 +7345,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
     optimizer.initializeOptimization();
     optimizer.optimize(nMoreIterations);
 
+    ClassifySim3Edges(vpEdges12, vpEdges21, th2, true, classifier);
     int nIn = 0;
     mAcumHessian = Eigen::MatrixXd::Zero(7, 7);
     for(size_t i=0; i<vpEdges12.size();i++)
@@ -7248,10 +7355,7 @@ int Optimizer::OptimizeSim3(KeyFrame *pKF1, KeyFrame *pKF2, vector<MapPoint *> &
         if(!e12 || !e21)
             continue;
 
-        e12->computeError();
-        e21->computeError();
-
-        if(e12->chi2()>th2 || e21->chi2()>th2)
+        if(classifier.IsOutlier(2*i) || classifier.IsOutlier(2*i+1))
         {
             size_t idx = vnIndexEdge[i];
             vpMatches1[idx]=static_cast<MapPoint*>(NULL);
@@ -9967,8 +10071,6 @@ void Optimizer::LocalBundleAdjustmentPL(KeyFrame* pMainKF,vector<KeyFrame*> vpAd
             e->cx = pKFi->cx;
             e->cy = pKFi->cy;
 
-            e->obs_temp = pKFi->mvle_l[mit->second]; 
-
             optimizer.addEdge(e);
             vpEdgesLine.push_back(e);
             vpEdgeKFLine.push_back(pKFi);
@@ -0,0 +1,126 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "OutlierRejection.h"
+
+#include <algorithm>
+
+#include "Thirdparty/g2o/g2o/core/robust_kernel_impl.h"
+
+namespace ORB_SLAM3
+{
+
+int OutlierRejection::snKernel = OutlierRejection::KERNEL_HUBER;
+double OutlierRejection::sdMaxThresholdScale = 1.0;
+
+namespace
+{
+
+// g2o kernel for the kernels that g2o does not have
+class RobustKernelPL : public g2o::RobustKernel
+{
+public:
+    RobustKernelPL(const int kernel): mnKernel(kernel) {}
+
+    virtual void robustify(double squaredError, Eigen::Vector3d& rho) const
+    {
+        double r[3];
+        OutlierRejection::Robustify(mnKernel, squaredError, _delta, r);
+        rho << r[0], r[1], r[2];
+    }
+
+protected:
+    int mnKernel;
+};
+
+// Median of the chi2 distribution with dof degrees of freedom
+double Chi2Median(const int dof)
+{
+    static const double median[5] = {0.0, 0.4549, 1.3863, 2.3660, 3.3567};
+    if(dof>0 && dof<5)
+        return median[dof];
+    const double aux = 1.0 - 2.0/(9.0*dof);
+    return dof*aux*aux*aux;
+}
+
+}
+
+g2o::RobustKernel* OutlierRejection::CreateG2oKernel(const double &delta)
+{
+    g2o::RobustKernel* rk;
+    if(snKernel==KERNEL_HUBER)
+        rk = new g2o::RobustKernelHuber;
+    else
+        rk = new RobustKernelPL(snKernel);
+    rk->setDelta(delta);
+    return rk;
+}
+
+void OutlierClassifier::Clear()
+{
+    mvChi2.clear();
+    mvTh.clear();
+    mvDof.clear();
+    mvbValid.clear();
+    mvbOutlier.clear();
+    mdScale = 1.0;
+}
+
+int OutlierClassifier::Add(const double &chi2, const double &th, const int dof, const bool bValid)
+{
+    mvChi2.push_back(chi2);
+    mvTh.push_back(th);
+    mvDof.push_back(dof);
+    mvbValid.push_back(bValid);
+    return mvChi2.size()-1;
+}
+
+int OutlierClassifier::Classify()
+{
+    const size_t N = mvChi2.size();
+    mvbOutlier.resize(N);
+
+    mdScale = 1.0;
+    const double maxScale = OutlierRejection::GetMaxThresholdScale();
+    if(maxScale>1.0 && N>0)
+    {
+        mvNormalized.clear();
+        for(size_t i=0; i<N; i++)
+            if(mvbValid[i] && std::isfinite(mvChi2[i]))
+                mvNormalized.push_back(mvChi2[i]/Chi2Median(mvDof[i]));
+
+        if(!mvNormalized.empty())
+        {
+            std::vector<double>::iterator mid = mvNormalized.begin() + mvNormalized.size()/2;
+            std::nth_element(mvNormalized.begin(), mid, mvNormalized.end());
+            mdScale = std::min(maxScale, std::max(1.0, *mid));
+        }
+    }
+
+    // !(chi2<=th) so that a chi2 that is not a number is an outlier
+    int nInliers = 0;
+    const double scale = mdScale;
+    for(size_t i=0; i<N; i++)
+    {
+        const bool bOutlier = !mvbValid[i] || !(mvChi2[i]<=scale*mvTh[i]);
+        mvbOutlier[i] = bOutlier;
+        nInliers += !bOutlier;
+    }
+
+    return nInliers;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,538 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "PoseSolver.h"
+
+#include <cmath>
+#include <mutex>
+
+#include <Eigen/Cholesky>
+#include <Eigen/Geometry>
+
+#include "Frame.h"
+#include "MapPoint.h"
+#include "MapLine.h"
+#include "Optimizer.h"
+#include "Converter.h"
+#include "GeometricCamera.h"
+#include "SolverUtils.h"
+#include "ProblemCapture.h"
+
+namespace ORB_SLAM3
+{
+
+namespace
+{
+
+const double chi2Mono = 5.991;
+const double chi2Stereo = 7.815;
+const double chi2LineBase = 7.815;
+const double deltaMono = sqrt(5.991);
+const double deltaStereo = sqrt(7.815);
+
+// Threshold so as to lower the weight of Lines according to the Number of the point inliers
+const int thrLineWeight = 50;
+
+inline double LineWeight(const int nPoints)
+{
+    return pow(2.0,-(nPoints/thrLineWeight));
+}
+
+} // namespace
+
+PoseSolver::PoseSolver(): mnIterations(10), fx(0), fy(0), cx(0), cy(0), bf(0)
+{
+}
+
+void PoseSolver::SetCalibration(const double &fx_, const double &fy_, const double &cx_, const double &cy_, const double &bf_)
+{
+    fx = fx_;
+    fy = fy_;
+    cx = cx_;
+    cy = cy_;
+    bf = bf_;
+}
+
+void PoseSolver::Clear()
+{
+    mvPoints.clear();
+    mvLines.clear();
+}
+
+void PoseSolver::AddPoint(const Eigen::Vector3d &Xw, const double &u, const double &v, const double &ur, const double &invSigma2, const size_t idx)
+{
+    PointObs obs;
+    obs.Xw = Xw;
+    obs.u = u;
+    obs.v = v;
+    obs.ur = ur;
+    obs.invSigma2 = invSigma2;
+    obs.idx = idx;
+    obs.bOutlier = false;
+    mvPoints.push_back(obs);
+}
+
+void PoseSolver::AddLine(const Eigen::Vector3d &Xs, const Eigen::Vector3d &Xe, const Eigen::Vector3d &l, const double &invSigma2, const size_t idx)
+{
+    LineObs obs;
+    obs.Xs = Xs;
+    obs.Xe = Xe;
+    obs.l = l;
+    obs.invSigma2 = invSigma2;
+    obs.idx = idx;
+    obs.bOutlier = false;
+    mvLines.push_back(obs);
+}
+
+double PoseSolver::Linearize(const Eigen::Matrix3d &R, const Eigen::Vector3d &t, const double &lineWeight,
+                             const double &deltaLine, const bool bRobust,
+                             Eigen::Matrix<double,6,6> &H, Eigen::Matrix<double,6,1> &b) const
+{
+    H.setZero();
+    b.setZero();
+    double cost = 0;
+
+    Eigen::Matrix<double,3,6> J;
+    for(size_t i=0, iend=mvPoints.size(); i<iend; i++)
+    {
+        const PointObs &obs = mvPoints[i];
+        if(obs.bOutlier)
+            continue;
+
+        const Eigen::Vector3d p = R*obs.Xw + t;
+        if(p(2)<=0)
+            continue;
+        const double invz = 1.0/p(2);
+        const double invz2 = invz*invz;
+        const double u = fx*p(0)*invz + cx;
+        const double v = fy*p(1)*invz + cy;
+
+        // Jacobian of the projection with respect to the point in camera coordinates
+        Eigen::Matrix3d A;
+        A << fx*invz, 0, -fx*p(0)*invz2,
+             0, fy*invz, -fy*p(1)*invz2,
+             fx*invz, 0, -fx*p(0)*invz2 + bf*invz2;
+
+        // e = obs - proj(exp(dx)*T*Xw), d(exp(dx)*p)/d(dx) = [-[p]x I]
+        const Eigen::Matrix3d P = Skew(p);
+        const int dim = obs.ur<0 ? 2 : 3;
+
+        Eigen::Vector3d e;
+        e << obs.u - u, obs.v - v, obs.ur - (u - bf*invz);
+
+        J.topLeftCorner(dim,3) = A.topRows(dim)*P;
+        J.topRightCorner(dim,3) = -A.topRows(dim);
+
+        const double chi2 = obs.invSigma2*e.head(dim).squaredNorm();
+        double w = 1.0;
+        if(bRobust)
+            cost += OutlierRejection::Cost(chi2, dim==2 ? deltaMono : deltaStereo, w);
+        else
+            cost += chi2;
+
+        const double wi = w*obs.invSigma2;
+        H.noalias() += wi*J.topRows(dim).transpose()*J.topRows(dim);
+        b.noalias() += wi*J.topRows(dim).transpose()*e.head(dim);
+    }
+
+    Eigen::Matrix<double,2,6> Jl;
+    for(size_t i=0, iend=mvLines.size(); i<iend; i++)
+    {
+        const LineObs &obs = mvLines[i];
+        if(obs.bOutlier)
+            continue;
+
+        const Eigen::Vector3d X[2] = {R*obs.Xs + t, R*obs.Xe + t};
+        if(X[0](2)<=0 || X[1](2)<=0)
+            continue;
+
+        Eigen::Vector2d e;
+        for(int k=0; k<2; k++)
+        {
+            const Eigen::Vector3d &p = X[k];
+            const double invz = 1.0/p(2);
+            const double invz2 = invz*invz;
+            e(k) = obs.l(0)*(fx*p(0)*invz + cx) + obs.l(1)*(fy*p(1)*invz + cy) + obs.l(2);
+
+            // e = l . [proj(p) 1]
+            const Eigen::RowVector3d g(obs.l(0)*fx*invz, obs.l(1)*fy*invz,
+                                       -(obs.l(0)*fx*p(0) + obs.l(1)*fy*p(1))*invz2);
+            Jl.block<1,3>(k,0) = -g*Skew(p);
+            Jl.block<1,3>(k,3) = g;
+        }
+
+        const double info = lineWeight*obs.invSigma2;
+        const double chi2 = info*e.squaredNorm();
+        double w = 1.0;
+        if(bRobust)
+            cost += OutlierRejection::Cost(chi2, deltaLine, w);
+        else
+            cost += chi2;
+
+        H.noalias() += w*info*Jl.transpose()*Jl;
+        b.noalias() += w*info*Jl.transpose()*e;
+    }
+
+    return cost;
+}
+
+double PoseSolver::Cost(const Eigen::Matrix3d &R, const Eigen::Vector3d &t, const double &lineWeight,
+                        const double &deltaLine, const bool bRobust) const
+{
+    double cost = 0;
+    double w;
+    for(size_t i=0, iend=mvPoints.size(); i<iend; i++)
+    {
+        const PointObs &obs = mvPoints[i];
+        if(obs.bOutlier)
+            continue;
+
+        const Eigen::Vector3d p = R*obs.Xw + t;
+        if(p(2)<=0)
+            continue;
+        const double invz = 1.0/p(2);
+        const double eu = obs.u - (fx*p(0)*invz + cx);
+        const double ev = obs.v - (fy*p(1)*invz + cy);
+        double e2 = eu*eu + ev*ev;
+        if(obs.ur>=0)
+        {
+            const double er = obs.ur - (fx*p(0)*invz + cx - bf*invz);
+            e2 += er*er;
+        }
+
+        const double chi2 = obs.invSigma2*e2;
+        cost += bRobust ? OutlierRejection::Cost(chi2, obs.ur<0 ? deltaMono : deltaStereo, w) : chi2;
+    }
+
+    for(size_t i=0, iend=mvLines.size(); i<iend; i++)
+    {
+        const LineObs &obs = mvLines[i];
+        if(obs.bOutlier)
+            continue;
+
+        const Eigen::Vector3d ps = R*obs.Xs + t;
+        const Eigen::Vector3d pe = R*obs.Xe + t;
+        if(ps(2)<=0 || pe(2)<=0)
+            continue;
+        const double es = obs.l(0)*(fx*ps(0)/ps(2) + cx) + obs.l(1)*(fy*ps(1)/ps(2) + cy) + obs.l(2);
+        const double ee = obs.l(0)*(fx*pe(0)/pe(2) + cx) + obs.l(1)*(fy*pe(1)/pe(2) + cy) + obs.l(2);
+
+        const double chi2 = lineWeight*obs.invSigma2*(es*es + ee*ee);
+        cost += bRobust ? OutlierRejection::Cost(chi2, deltaLine, w) : chi2;
+    }
+
+    return cost;
+}
+
+void PoseSolver::Optimize(Eigen::Matrix3d &R, Eigen::Vector3d &t, const double &lineWeight,
+                          const double &deltaLine, const bool bRobust, OptimizationMonitor* pMonitor) const
+{
+    // Levenberg-Marquardt with the damping strategy of g2o::OptimizationAlgorithmLevenberg
+    Eigen::Matrix<double,6,6> H;
+    Eigen::Matrix<double,6,1> b;
+    double lambda = -1;
+    double ni = 2;
+    double newCost = 0;
+
+    for(int iter=0; iter<mnIterations; iter++)
+    {
+        const double cost = Linearize(R, t, lineWeight, deltaLine, bRobust, H, b);
+        if(lambda<0)
+            lambda = 1e-5*H.diagonal().maxCoeff();
+        if(lambda<=0)
+            break;
+
+        bool bAccepted = false;
+        for(int nTries=0; nTries<10 && !bAccepted; nTries++)
+        {
+            Eigen::Matrix<double,6,6> Hl = H;
+            Hl.diagonal().array() += lambda;
+            const Eigen::Matrix<double,6,1> dx = Hl.ldlt().solve(-b);
+
+            Eigen::Matrix3d Rn = R;
+            Eigen::Vector3d tn = t;
+            UpdatePose(dx, Rn, tn);
+            newCost = Cost(Rn, tn, lineWeight, deltaLine, bRobust);
+
+            const double rho = (cost - newCost)/(dx.dot(lambda*dx - b) + 1e-3);
+            if(rho>0 && std::isfinite(newCost))
+            {
+                R = Rn;
+                t = tn;
+                const double alpha = 1.0 - pow(2*rho - 1, 3);
+                lambda *= std::min(std::max(1.0/3.0, alpha), 2.0/3.0);
+                ni = 2;
+                bAccepted = true;
+            }
+            else
+            {
+                lambda *= ni;
+                ni *= 2;
+            }
+        }
+
+        if(!bAccepted)
+            break;
+
+        if(pMonitor && pMonitor->Iteration(newCost))
+            break;
+    }
+}
+
+int PoseSolver::Solve(Eigen::Matrix3d &Rcw, Eigen::Vector3d &tcw, OptimizationMonitor* pMonitor)
+{
+    const int nInitialCorrespondences = mvPoints.size() + mvLines.size();
+    if(nInitialCorrespondences<3)
+        return 0;
+
+    const Eigen::Matrix3d R0 = Rcw;
+    const Eigen::Vector3d t0 = tcw;
+
+    double Weight = LineWeight(mvPoints.size());
+    double deltaLine = sqrt(Weight*chi2LineBase);
+    double chi2Line = Weight*chi2LineBase;
+
+    // We perform 4 optimizations, after each optimization we classify observation as inlier/outlier
+    // At the next optimization, outliers are not included, but at the end they can be classified as inliers again.
+    int nBad=0;
+    for(size_t it=0; it<4; it++)
+    {
+        // No new round after the deadline, the pose and outliers of the last one are kept
+        if(pMonitor)
+        {
+            if(it>0 && pMonitor->Expired())
+                break;
+            pMonitor->StartRound();
+        }
+
+        Rcw = R0;
+        tcw = t0;
+        Optimize(Rcw, tcw, Weight, deltaLine, it<3, pMonitor);
+
+        // Points first, then lines, classified together
+        mClassifier.Clear();
+        for(size_t i=0, iend=mvPoints.size(); i<iend; i++)
+        {
+            const PointObs &obs = mvPoints[i];
+            const Eigen::Vector3d p = Rcw*obs.Xw + tcw;
+            const double invz = 1.0/p(2);
+            const double eu = obs.u - (fx*p(0)*invz + cx);
+            const double ev = obs.v - (fy*p(1)*invz + cy);
+            double e2 = eu*eu + ev*ev;
+            if(obs.ur>=0)
+            {
+                const double er = obs.ur - (fx*p(0)*invz + cx - bf*invz);
+                e2 += er*er;
+            }
+            if(obs.ur<0)
+                mClassifier.Add(obs.invSigma2*e2, chi2Mono, 2);
+            else
+                mClassifier.Add(obs.invSigma2*e2, chi2Stereo, 3);
+        }
+
+        for(size_t i=0, iend=mvLines.size(); i<iend; i++)
+        {
+            const LineObs &obs = mvLines[i];
+            const Eigen::Vector3d ps = Rcw*obs.Xs + tcw;
+            const Eigen::Vector3d pe = Rcw*obs.Xe + tcw;
+            const double es = obs.l(0)*(fx*ps(0)/ps(2) + cx) + obs.l(1)*(fy*ps(1)/ps(2) + cy) + obs.l(2);
+            const double ee = obs.l(0)*(fx*pe(0)/pe(2) + cx) + obs.l(1)*(fy*pe(1)/pe(2) + cy) + obs.l(2);
+            mClassifier.Add(Weight*obs.invSigma2*(es*es + ee*ee), chi2Line, 2);
+        }
+
+        nBad = mClassifier.Size() - mClassifier.Classify();
+
+        int point_inliers = 0;
+        for(size_t i=0, iend=mvPoints.size(); i<iend; i++)
+        {
+            mvPoints[i].bOutlier = mClassifier.IsOutlier(i);
+            point_inliers += !mvPoints[i].bOutlier;
+        }
+
+        for(size_t i=0, iend=mvLines.size(); i<iend; i++)
+            mvLines[i].bOutlier = mClassifier.IsOutlier(mvPoints.size()+i);
+
+        // Estimate the Weight for the next iteration, the Huber threshold of the lines is only updated in the first two
+        Weight = LineWeight(point_inliers);
+        chi2Line = Weight*chi2LineBase;
+        if(it<2)
+            deltaLine = sqrt(Weight*chi2LineBase);
+
+        if(nInitialCorrespondences<10)
+            break;
+    }
+
+    return nInitialCorrespondences-nBad;
+}
+
+void PoseSolver::SetFrame(Frame *pFrame, Eigen::Matrix3d &Rcw, Eigen::Vector3d &tcw)
+{
+    SetCalibration(pFrame->fx, pFrame->fy, pFrame->cx, pFrame->cy, pFrame->mbf);
+    Clear();
+
+    {
+    std::unique_lock<std::mutex> lock(MapPoint::mGlobalMutex);
+    for(int i=0; i<pFrame->N; i++)
+    {
+        MapPoint* pMP = pFrame->mvpMapPoints[i];
+        if(!pMP)
+            continue;
+
+        const cv::KeyPoint &kpUn = pFrame->mvKeysUn[i];
+        AddPoint(Converter::toVector3d(pMP->GetWorldPos()), kpUn.pt.x, kpUn.pt.y, pFrame->mvuRight[i],
+                 pFrame->mvInvLevelSigma2[kpUn.octave], i);
+    }
+    }
+
+    {
+    std::unique_lock<std::mutex> lock(MapLine::mGlobalMutex);
+    for(int i=0; i<pFrame->N_l; i++)
+    {
+        MapLine* pML = pFrame->mvpMapLines[i];
+        if(!pML)
+            continue;
+
+        const Vector6d Xw = pML->GetWorldPos();
+        AddLine(Xw.head(3), Xw.tail(3), pFrame->mvle_l[i], pFrame->mvInvLevelSigma2_l[pFrame->mvKeys_Line[i].octave], i);
+    }
+    }
+
+    const Eigen::Matrix4d Tcw = Converter::toMatrix4d(pFrame->mTcw);
+    Rcw = Eigen::Quaterniond(Tcw.block<3,3>(0,0)).normalized().toRotationMatrix();
+    tcw = Tcw.block<3,1>(0,3);
+}
+
+int PoseSolver::PoseOptimizationPL(Frame *pFrame, const OptimizationBudget* pBudget, OptimizationStats* pStats)
+{
+    if(pFrame->mpCamera->GetType()!=pFrame->mpCamera->CAM_PINHOLE)
+        return Optimizer::PoseOptimizationPL(pFrame, pBudget, pStats);
+
+    OptimizationMonitor monitor(pBudget, pStats);
+
+    Eigen::Matrix3d Rcw;
+    Eigen::Vector3d tcw;
+    SetFrame(pFrame, Rcw, tcw);
+
+    for(size_t i=0, iend=mvPoints.size(); i<iend; i++)
+        pFrame->mvbOutlier[mvPoints[i].idx] = false;
+    for(size_t i=0, iend=mvLines.size(); i<iend; i++)
+        pFrame->mvbOutlier_Line[mvLines[i].idx] = false;
+
+    ProblemCapture::CapturePose(*this, Rcw, tcw);
+
+    const int nInliers = Solve(Rcw, tcw, monitor.IsActive() ? &monitor : NULL);
+    if(mvPoints.size()+mvLines.size()<3)
+        return 0;
+
+    for(size_t i=0, iend=mvPoints.size(); i<iend; i++)
+        pFrame->mvbOutlier[mvPoints[i].idx] = mvPoints[i].bOutlier;
+    for(size_t i=0, iend=mvLines.size(); i<iend; i++)
+        pFrame->mvbOutlier_Line[mvLines[i].idx] = mvLines[i].bOutlier;
+
+    pFrame->SetPose(Converter::toCvSE3(Rcw, tcw));
+
+    return nInliers;
+}
+
+void PoseSolver::Save(std::ostream &os, const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw) const
+{
+    WriteBinary(os, fx);
+    WriteBinary(os, fy);
+    WriteBinary(os, cx);
+    WriteBinary(os, cy);
+    WriteBinary(os, bf);
+    WriteBinary(os, Rcw);
+    WriteBinary(os, tcw);
+
+    WriteBinary(os, static_cast<int>(mvPoints.size()));
+    for(size_t i=0, iend=mvPoints.size(); i<iend; i++)
+    {
+        const PointObs &obs = mvPoints[i];
+        WriteBinary(os, obs.Xw);
+        WriteBinary(os, obs.u);
+        WriteBinary(os, obs.v);
+        WriteBinary(os, obs.ur);
+        WriteBinary(os, obs.invSigma2);
+        WriteBinary(os, static_cast<long unsigned int>(obs.idx));
+    }
+
+    WriteBinary(os, static_cast<int>(mvLines.size()));
+    for(size_t i=0, iend=mvLines.size(); i<iend; i++)
+    {
+        const LineObs &obs = mvLines[i];
+        WriteBinary(os, obs.Xs);
+        WriteBinary(os, obs.Xe);
+        WriteBinary(os, obs.l);
+        WriteBinary(os, obs.invSigma2);
+        WriteBinary(os, static_cast<long unsigned int>(obs.idx));
+    }
+}
+
+bool PoseSolver::Load(std::istream &is, Eigen::Matrix3d &Rcw, Eigen::Vector3d &tcw)
+{
+    Clear();
+
+    double fx_, fy_, cx_, cy_, bf_;
+    ReadBinary(is, fx_);
+    ReadBinary(is, fy_);
+    ReadBinary(is, cx_);
+    ReadBinary(is, cy_);
+    ReadBinary(is, bf_);
+    ReadBinary(is, Rcw);
+    ReadBinary(is, tcw);
+    SetCalibration(fx_, fy_, cx_, cy_, bf_);
+
+    int nPoints = 0;
+    if(!ReadBinary(is, nPoints) || nPoints<0)
+        return false;
+    mvPoints.reserve(nPoints);
+    for(int i=0; i<nPoints; i++)
+    {
+        Eigen::Vector3d Xw;
+        double u, v, ur, invSigma2;
+        long unsigned int idx;
+        ReadBinary(is, Xw);
+        ReadBinary(is, u);
+        ReadBinary(is, v);
+        ReadBinary(is, ur);
+        ReadBinary(is, invSigma2);
+        if(!ReadBinary(is, idx))
+            return false;
+        AddPoint(Xw, u, v, ur, invSigma2, idx);
+    }
+
+    int nLines = 0;
+    if(!ReadBinary(is, nLines) || nLines<0)
+        return false;
+    mvLines.reserve(nLines);
+    for(int i=0; i<nLines; i++)
+    {
+        Eigen::Vector3d Xs, Xe, l;
+        double invSigma2;
+        long unsigned int idx;
+        ReadBinary(is, Xs);
+        ReadBinary(is, Xe);
+        ReadBinary(is, l);
+        ReadBinary(is, invSigma2);
+        if(!ReadBinary(is, idx))
+            return false;
+        AddLine(Xs, Xe, l, invSigma2, idx);
+    }
+
+    return true;
+}
+
+} //namespace ORB_SLAM
@@ -0,0 +1,340 @@
+/**
+* This file is part of ORB-LINE-SLAM
+*
+* ORB-LINE-SLAM is free software: you can redistribute it and/or modify it under the terms of the GNU General Public
+* License as published by the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* ORB-LINE-SLAM is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+* the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with ORB-LINE-SLAM.
+* If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "ProblemCapture.h"
+
+#include <algorithm>
+
+#include "Frame.h"
+#include "GeometricCamera.h"
+#include "PoseSolver.h"
+#include "BASolver.h"
+#include "OutlierRejection.h"
+#include "SolverUtils.h"
+#include "System.h"
+
+#include "Thirdparty/g2o/g2o/core/sparse_optimizer.h"
+#include "Thirdparty/g2o/g2o/types/types_seven_dof_expmap.h"
+
+namespace ORB_SLAM3
+{
+
+std::string ProblemCapture::msDir = ".";
+int ProblemCapture::snMaxPerProblem = 0;
+std::atomic<int> ProblemCapture::snCaptured[4];
+
+namespace
+{
+
+const unsigned int captureMagic = 0x50434c50;   // "PLCP"
+const int captureVersion = 1;
+
+bool CompareVertexId(const g2o::OptimizableGraph::Vertex* pV1, const g2o::OptimizableGraph::Vertex* pV2)
+{
+    return pV1->id()<pV2->id();
+}
+
+bool CompareEdgeInternalId(const g2o::OptimizableGraph::Edge* pE1, const g2o::OptimizableGraph::Edge* pE2)
+{
+    return pE1->internalId()<pE2->internalId();
+}
+
+void WriteSim3(std::ostream &os, const g2o::Sim3 &S)
+{
+    WriteBinary(os, S.rotation().coeffs().eval());
+    WriteBinary(os, S.translation().eval());
+    WriteBinary(os, S.scale());
+}
+
+bool ReadSim3(std::istream &is, g2o::Sim3 &S)
+{
+    Eigen::Vector4d q;
+    Eigen::Vector3d t;
+    double s;
+    ReadBinary(is, q);
+    ReadBinary(is, t);
+    if(!ReadBinary(is, s))
+        return false;
+    S = g2o::Sim3(Eigen::Quaterniond(q(3),q(0),q(1),q(2)), t, s);
+    return true;
+}
+
+}
+
+void ProblemCapture::Enable(const std::string &dir, const int nMaxPerProblem)
+{
+    msDir = dir.empty() ? std::string(".") : dir;
+    snMaxPerProblem = std::max(nMaxPerProblem,0);
+    for(int i=0; i<4; i++)
+        snCaptured[i] = 0;
+}
+
+const char* ProblemCapture::GetProblemName(const int problem)
+{
+    switch(problem)
+    {
+    case POSE_OPTIMIZATION:
+        return "pose";
+    case LOCAL_BA:
+        return "lba";
+    case GLOBAL_BA:
+        return "gba";
+    case ESSENTIAL_GRAPH:
+        return "essential_graph";
+    default:
+        return "unknown";
+    }
+}
+
+bool ProblemCapture::Open(const int problem, std::ofstream &f)
+{
+    if(!IsEnabled())
+        return false;
+
+    const int n = snCaptured[problem]++;
+    if(n>=snMaxPerProblem)
+        return false;
+
+    const std::string filename = msDir + "/" + GetProblemName(problem) + "_" + std::to_string(n) + ".bin";
+    f.open(filename.c_str(), std::ios::out | std::ios::binary);
+    if(!f.is_open())
+    {
+        Verbose::PrintMess("Problem capture: could not open " + filename, Verbose::VERBOSITY_NORMAL);
+        return false;
+    }
+
+    WriteBinary(f, captureMagic);
+    WriteBinary(f, captureVersion);
+    WriteBinary(f, problem);
+    WriteBinary(f, OutlierRejection::GetKernel());
+    WriteBinary(f, OutlierRejection::GetMaxThresholdScale());
+
+    return true;
+}
+
+bool ProblemCapture::ReadHeader(std::istream &is, int &problem)
+{
+    unsigned int magic = 0;
+    int version = 0, kernel = 0;
+    double thresholdScale = 1.0;
+    ReadBinary(is, magic);
+    ReadBinary(is, version);
+    ReadBinary(is, problem);
+    ReadBinary(is, kernel);
+    if(!ReadBinary(is, thresholdScale) || magic!=captureMagic || version!=captureVersion)
+        return false;
+
+    OutlierRejection::SetKernel(kernel);
+    OutlierRejection::SetMaxThresholdScale(thresholdScale);
+
+    return problem>=POSE_OPTIMIZATION && problem<=ESSENTIAL_GRAPH;
+}
+
+void ProblemCapture::CapturePose(Frame* pFrame)
+{
+    if(!IsEnabled() || snCaptured[POSE_OPTIMIZATION]>=snMaxPerProblem)
+        return;
+    if(pFrame->mpCamera->GetType()!=pFrame->mpCamera->CAM_PINHOLE)
+        return;
+
+    PoseSolver solver;
+    Eigen::Matrix3d Rcw;
+    Eigen::Vector3d tcw;
+    solver.SetFrame(pFrame, Rcw, tcw);
+    CapturePose(solver, Rcw, tcw);
+}
+
+void ProblemCapture::CapturePose(const PoseSolver &solver, const Eigen::Matrix3d &Rcw, const Eigen::Vector3d &tcw)
+{
+    std::ofstream f;
+    if(!Open(POSE_OPTIMIZATION, f))
+        return;
+
+    solver.Save(f, Rcw, tcw);
+}
+
+void ProblemCapture::CaptureLocalBA(const BASolver &solver)
+{
+    std::ofstream f;
+    if(!Open(LOCAL_BA, f))
+        return;
+
+    solver.Save(f);
+}
+
+void ProblemCapture::CaptureGlobalBA(const BASolver &solver, const int nIterations, const bool bRobust,
+                                     const std::vector<std::vector<std::pair<int,int> > > &vCovisibility)
+{
+    std::ofstream f;
+    if(!Open(GLOBAL_BA, f))
+        return;
+
+    solver.Save(f);
+    WriteBinary(f, nIterations);
+    WriteBinary(f, static_cast<char>(bRobust));
+    WriteBinary(f, static_cast<int>(vCovisibility.size()));
+    for(size_t i=0; i<vCovisibility.size(); i++)
+    {
+        WriteBinary(f, static_cast<int>(vCovisibility[i].size()));
+        for(size_t k=0; k<vCovisibility[i].size(); k++)
+        {
+            WriteBinary(f, vCovisibility[i][k].first);
+            WriteBinary(f, vCovisibility[i][k].second);
+        }
+    }
+}
+
+bool ProblemCapture::LoadGlobalBA(std::istream &is, BASolver &solver, int &nIterations, bool &bRobust,
+                                  std::vector<std::vector<std::pair<int,int> > > &vCovisibility)
+{
+    if(!solver.Load(is))
+        return false;
+
+    char robust = 0;
+    int nCameras = 0;
+    ReadBinary(is, nIterations);
+    ReadBinary(is, robust);
+    if(!ReadBinary(is, nCameras) || nCameras<0)
+        return false;
+    bRobust = robust;
+
+    vCovisibility.assign(nCameras, std::vector<std::pair<int,int> >());
+    for(int i=0; i<nCameras; i++)
+    {
+        int nCov = 0;
+        if(!ReadBinary(is, nCov) || nCov<0)
+            return false;
+        vCovisibility[i].resize(nCov);
+        for(int k=0; k<nCov; k++)
+        {
+            ReadBinary(is, vCovisibility[i][k].first);
+            ReadBinary(is, vCovisibility[i][k].second);
+        }
+    }
+
+    return bool(is);
+}
+
+void ProblemCapture::CaptureEssentialGraph(const g2o::SparseOptimizer &optimizer, const int nIterations)
+{
+    std::ofstream f;
+    if(!Open(ESSENTIAL_GRAPH, f))
+        return;
+
+    // Vertices by id and edges in insertion order, so that the graph is rebuilt as it was optimized
+    std::vector<g2o::VertexSim3Expmap*> vpVertices;
+    vpVertices.reserve(optimizer.vertices().size());
+    for(g2o::HyperGraph::VertexIDMap::const_iterator it=optimizer.vertices().begin(); it!=optimizer.vertices().end(); it++)
+    {
+        g2o::VertexSim3Expmap* pV = dynamic_cast<g2o::VertexSim3Expmap*>(it->second);
+        if(pV)
+            vpVertices.push_back(pV);
+    }
+    std::sort(vpVertices.begin(), vpVertices.end(), CompareVertexId);
+
+    std::vector<g2o::EdgeSim3*> vpEdges;
+    vpEdges.reserve(optimizer.edges().size());
+    for(g2o::HyperGraph::EdgeSet::const_iterator it=optimizer.edges().begin(); it!=optimizer.edges().end(); it++)
+    {
+        g2o::EdgeSim3* pE = dynamic_cast<g2o::EdgeSim3*>(*it);
+        if(pE)
+            vpEdges.push_back(pE);
+    }
+    std::sort(vpEdges.begin(), vpEdges.end(), CompareEdgeInternalId);
+
+    WriteBinary(f, nIterations);
+
+    WriteBinary(f, static_cast<int>(vpVertices.size()));
+    for(size_t i=0; i<vpVertices.size(); i++)
+    {
+        g2o::VertexSim3Expmap* pV = vpVertices[i];
+        WriteBinary(f, pV->id());
+        WriteBinary(f, static_cast<char>(pV->fixed()));
+        WriteBinary(f, static_cast<char>(pV->_fix_scale));
+        WriteSim3(f, pV->estimate());
+    }
+
+    WriteBinary(f, static_cast<int>(vpEdges.size()));
+    for(size_t i=0; i<vpEdges.size(); i++)
+    {
+        g2o::EdgeSim3* pE = vpEdges[i];
+        WriteBinary(f, pE->vertex(0)->id());
+        WriteBinary(f, pE->vertex(1)->id());
+        WriteSim3(f, pE->measurement());
+        const Eigen::Matrix<double,7,7> info = pE->information();
+        WriteBinary(f, info);
+    }
+}
+
+bool ProblemCapture::LoadEssentialGraph(std::istream &is, g2o::SparseOptimizer &optimizer, int &nIterations)
+{
+    int nVertices = 0;
+    ReadBinary(is, nIterations);
+    if(!ReadBinary(is, nVertices) || nVertices<0)
+        return false;
+
+    for(int i=0; i<nVertices; i++)
+    {
+        int id;
+        char bFixed, bFixScale;
+        g2o::Sim3 S;
+        ReadBinary(is, id);
+        ReadBinary(is, bFixed);
+        ReadBinary(is, bFixScale);
+        if(!ReadSim3(is, S))
+            return false;
+
+        g2o::VertexSim3Expmap* pV = new g2o::VertexSim3Expmap();
+        pV->setId(id);
+        pV->setEstimate(S);
+        pV->setFixed(bFixed);
+        pV->setMarginalized(false);
+        pV->_fix_scale = bFixScale;
+        optimizer.addVertex(pV);
+    }
+
+    int nEdges = 0;
+    if(!ReadBinary(is, nEdges) || nEdges<0)
+        return false;
+
+    for(int i=0; i<nEdges; i++)
+    {
+        int id0, id1;
+        g2o::Sim3 S;
+        Eigen::Matrix<double,7,7> info;
+        ReadBinary(is, id0);
+        ReadBinary(is, id1);
+        ReadSim3(is, S);
+        if(!ReadBinary(is, info))
+            return false;
+
+        g2o::OptimizableGraph::Vertex* pV0 = optimizer.vertex(id0);
+        g2o::OptimizableGraph::Vertex* pV1 = optimizer.vertex(id1);
+        if(!pV0 || !pV1)
+            return false;
+
+        g2o::EdgeSim3* pE = new g2o::EdgeSim3();
+        pE->setVertex(0, pV0);
+        pE->setVertex(1, pV1);
+        pE->setMeasurement(S);
+        pE->information() = info;
+        optimizer.addEdge(pE);
+    }
+
+    return true;
+}
+
+} //namespace ORB_SLAM
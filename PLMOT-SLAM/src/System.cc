@@ -21,6 +21,7 @@
 
 #include "System.h"
 #include "Converter.h"
+#include "EpochReclaimer.h"
 #include <thread>
 #include <pangolin/pangolin.h>
 #include <iomanip>
@@ -104,6 +105,15 @@ System::System(const string &strVocFile_ORB, const string &strVocFile_Line, cons
     }
     cout << "Line Vocabulary loaded!" << endl << endl;
 
+    // Threads used to transform the features of a frame into BoW (optional)
+    cv::FileNode nodeBoWThreads = fsSettings["Vocabulary.transformThreads"];
+    if(!nodeBoWThreads.empty() && nodeBoWThreads.isInt())
+    {
+        mpVocabulary->setTransformThreads(nodeBoWThreads.operator int());
+        mpVocabulary_l->setTransformThreads(nodeBoWThreads.operator int());
+        cout << "BoW transform threads: " << mpVocabulary->getTransformThreads() << endl;
+    }
+
     //Create KeyFrame Database
     mpKeyFrameDatabase = new KeyFrameDatabase(*mpVocabulary);
 
@@ -191,9 +201,11 @@ System::System(const string &strVocFile_ORB, const string &strVocFile_Line, cons
     cout << "Seq. Name: " << strSequence << endl;
     mpTracker = new Tracking(this, mpVocabulary, mpVocabulary_l, mpFrameDrawer, mpMapDrawer,
                              mpAtlas, mpKeyFrameDatabase, strSettingsFile, mSensor, strSequence);
+    EpochReclaimer::Register(EpochReclaimer::TRACKING);
 
     //Initialize the Local Mapping thread and launch
     mpLocalMapper = new LocalMapping(this, mpAtlas, mSensor==MONOCULAR || mSensor==IMU_MONOCULAR, mSensor==IMU_MONOCULAR || mSensor==IMU_STEREO, strSequence);
+    EpochReclaimer::Register(EpochReclaimer::LOCAL_MAPPING);
     mptLocalMapping = new thread(&ORB_SLAM3::LocalMapping::Run_Lines,mpLocalMapper);
     mpLocalMapper->mInitFr = initFr;
     mpLocalMapper->mThFarPoints = fsSettings["thFarPoints"];
@@ -210,6 +222,7 @@ System::System(const string &strVocFile_ORB, const string &strVocFile_Line, cons
     mpLoopCloser = new LoopClosing(mpAtlas, mpKeyFrameDatabase, mpVocabulary, mSensor!=MONOCULAR);
     if(mpTracker->SLAM==0)
     {
+    EpochReclaimer::Register(EpochReclaimer::LOOP_CLOSING);
     mptLoopClosing = new thread(&ORB_SLAM3::LoopClosing::Run_Lines, mpLoopCloser);
     }
 
@@ -217,6 +230,7 @@ System::System(const string &strVocFile_ORB, const string &strVocFile_Line, cons
     if(bUseViewer)
     {
         mpViewer = new Viewer(this, mpFrameDrawer,mpMapDrawer,mpTracker,strSettingsFile);
+        EpochReclaimer::Register(EpochReclaimer::VIEWER);
         mptViewer = new thread(&Viewer::Run, mpViewer);
         mpTracker->SetViewer(mpViewer);
         mpLoopCloser->mpViewer = mpViewer;
@@ -375,9 +389,11 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     cout << "Seq. Name: " << strSequence << endl;
     mpTracker = new Tracking(this, mpVocabulary, mpFrameDrawer, mpMapDrawer,
                              mpAtlas, mpKeyFrameDatabase, strSettingsFile, mSensor, strSequence);
+    EpochReclaimer::Register(EpochReclaimer::TRACKING);
 
     //Initialize the Local Mapping thread and launch
     mpLocalMapper = new LocalMapping(this, mpAtlas, mSensor==MONOCULAR || mSensor==IMU_MONOCULAR, mSensor==IMU_MONOCULAR || mSensor==IMU_STEREO, strSequence);
+    EpochReclaimer::Register(EpochReclaimer::LOCAL_MAPPING);
     mptLocalMapping = new thread(&ORB_SLAM3::LocalMapping::Run,mpLocalMapper);
     mpLocalMapper->mInitFr = initFr;
     mpLocalMapper->mThFarPoints = fsSettings["thFarPoints"];
@@ -392,12 +408,14 @@ System::System(const string &strVocFile, const string &strSettingsFile, const eS
     //Initialize the Loop Closing thread and launch
     // mSensor!=MONOCULAR && mSensor!=IMU_MONOCULAR
     mpLoopCloser = new LoopClosing(mpAtlas, mpKeyFrameDatabase, mpVocabulary, mSensor!=MONOCULAR); // mSensor!=MONOCULAR);
+    EpochReclaimer::Register(EpochReclaimer::LOOP_CLOSING);
     mptLoopClosing = new thread(&ORB_SLAM3::LoopClosing::Run, mpLoopCloser);
 
     //Initialize the Viewer thread and launch
     if(bUseViewer)
     {
         mpViewer = new Viewer(this, mpFrameDrawer,mpMapDrawer,mpTracker,strSettingsFile);
+        EpochReclaimer::Register(EpochReclaimer::VIEWER);
         mptViewer = new thread(&Viewer::Run, mpViewer);
         mpTracker->SetViewer(mpViewer);
         mpLoopCloser->mpViewer = mpViewer;
@@ -650,6 +668,7 @@ void System::ResetActiveMap()
 
 void System::Shutdown()
 {
+    EpochReclaimer::Unregister(EpochReclaimer::TRACKING);
     mpLocalMapper->RequestFinish();
     mpLoopCloser->RequestFinish();
     if(mpViewer)
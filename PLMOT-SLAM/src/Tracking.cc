@@ -30,6 +30,9 @@
 #include"Initializer.h"
 #include"G2oTypes.h"
 #include"Optimizer.h"
+#include"OutlierRejection.h"
+#include"ProblemCapture.h"
+#include"EpochReclaimer.h"
 #include"PnPsolver.h"
 
 #include<iostream>
@@ -108,7 +111,7 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, LineVocabulary* pVoc_l, Fr
     mbOnlyTracking(false), mbMapUpdated(false), mbVO(false), mpORBVocabulary(pVoc), mpLineVocabulary(pVoc_l), mpKeyFrameDB(pKFDB),
     mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys), mpViewer(NULL),
     mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpAtlas(pAtlas), mnLastRelocFrameId(0), time_recently_lost(5.0),
-    mnInitialFrameId(0), mbCreatedMap(false), mnFirstFrameId(0), mpCamera2(nullptr)
+    mnInitialFrameId(0), mbCreatedMap(false), mnFirstFrameId(0), mpCamera2(nullptr), mnPoseSolver(0), mbLineOrthonormal(false), mnBASolver(0), mnBAThreads(4), mnGBASolver(0), mnGBAThreads(4), mnGBACGIterations(100), mnGBAClusterKFs(0), mbOptimizationBudget(false), mbLineTriangulation(false), mbLineFusion(false), mbLocalMappingPipeline(false), mnTriangulationThreads(1), mnLoopCandidateThreads(1)
 {
     // Load camera parameters from settings file
     cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
@@ -242,6 +245,10 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, LineVocabulary* pVoc_l, Fr
     f_track_times.open("tracking_times.txt");
     f_track_times << "# ORB_Ext(ms), Stereo matching(ms), Preintegrate_IMU(ms), Pose pred(ms), LocalMap_track(ms), NewKF_dec(ms)" << endl;
     f_track_times << fixed ;
+
+    f_line_proj_stats.open("line_projection_stats.txt");
+    f_line_proj_stats << "# Projected lines, Candidates, Matches, time(ms)" << endl;
+    f_line_proj_stats << fixed ;
 #endif
 }
 
@@ -250,7 +257,7 @@ Tracking::Tracking(System *pSys, ORBVocabulary* pVoc, FrameDrawer *pFrameDrawer,
     mbOnlyTracking(false), mbMapUpdated(false), mbVO(false), mpORBVocabulary(pVoc), mpKeyFrameDB(pKFDB),
     mpInitializer(static_cast<Initializer*>(NULL)), mpSystem(pSys), mpViewer(NULL),
     mpFrameDrawer(pFrameDrawer), mpMapDrawer(pMapDrawer), mpAtlas(pAtlas), mnLastRelocFrameId(0), time_recently_lost(5.0),
-    mnInitialFrameId(0), mbCreatedMap(false), mnFirstFrameId(0), mpCamera2(nullptr)
+    mnInitialFrameId(0), mbCreatedMap(false), mnFirstFrameId(0), mpCamera2(nullptr), mnPoseSolver(0), mbLineOrthonormal(false), mnBASolver(0), mnBAThreads(4), mnGBASolver(0), mnGBAThreads(4), mnGBACGIterations(100), mnGBAClusterKFs(0), mbOptimizationBudget(false), mbLineTriangulation(false), mbLineFusion(false), mbLocalMappingPipeline(false), mnTriangulationThreads(1), mnLoopCandidateThreads(1)
 {
     // Load camera parameters from settings file
     cv::FileStorage fSettings(strSettingPath, cv::FileStorage::READ);
@@ -363,6 +370,7 @@ Tracking::~Tracking()
     //f_track_stats.close();
 #ifdef SAVE_TIMES
     f_track_times.close();
+    f_line_proj_stats.close();
 #endif
 }
 
@@ -960,12 +968,25 @@ bool Tracking::ParseORBParamFile(cv::FileStorage &fSettings)
         b_miss_params = true;
     }
 
+    // Optional: track the keypoints by optical flow between keyframes (OK_KLT state)
+    bool bTrackPoints = false;
+    int nMinTrackedPoints = 50;
+    node = fSettings["pointTracking"];
+    if(!node.empty() && node.isInt())
+        bTrackPoints = node.operator int() != 0;
+
+    node = fSettings["pointTrackingMinPoints"];
+    if(!node.empty() && node.isInt())
+        nMinTrackedPoints = node.operator int();
+
     if(b_miss_params)
     {
         return false;
     }
 
     mpORBextractorLeft = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
+    mpORBextractorLeft->mbTrackPoints = bTrackPoints && mSensor==System::RGBD;
+    mpORBextractorLeft->mnMinTrackedPoints = nMinTrackedPoints;
 
     if(mSensor==System::STEREO || mSensor==System::IMU_STEREO)
         mpORBextractorRight = new ORBextractor(nFeatures,fScaleFactor,nLevels,fIniThFAST,fMinThFAST);
@@ -979,6 +1000,8 @@ bool Tracking::ParseORBParamFile(cv::FileStorage &fSettings)
     cout << "- Scale Factor: " << fScaleFactor << endl;
     cout << "- Initial Fast Threshold: " << fIniThFAST << endl;
     cout << "- Minimum Fast Threshold: " << fMinThFAST << endl;
+    if(mpORBextractorLeft->mbTrackPoints)
+        cout << "- Point Tracking between Keyframes (min tracked points: " << nMinTrackedPoints << ")" << endl;
 
     return true;
 }
@@ -1067,6 +1090,158 @@ bool Tracking::ParseLineParamFile(cv::FileStorage &fSettings)
         b_miss_params = true;
     }
 
+    // Optional: pose optimization with points and lines by g2o (0, default) or by the fixed-size solver (1)
+    node = fSettings["poseSolver"];
+    if(!node.empty() && node.isInt())
+        mnPoseSolver = node.operator int();
+
+    // Optional: MapLines in the Local/Global BA as two endpoints (0, default) or orthonormal representation (1)
+    node = fSettings["lineParameterization"];
+    if(!node.empty() && node.isInt())
+        mbLineOrthonormal = node.operator int() == 1;
+
+    // Optional: local BA with points and lines by g2o (0, default), by the multi-threaded solver (1) or
+    // by the multi-threaded solver keeping the problem of the local window between keyframes (2)
+    node = fSettings["baSolver"];
+    if(!node.empty() && node.isInt())
+        mnBASolver = node.operator int();
+
+    node = fSettings["baThreads"];
+    if(!node.empty() && node.isInt())
+        mnBAThreads = std::max(node.operator int(), 1);
+
+    // Optional: global BA of the points by g2o (0, default) or of the points and lines by the multi-threaded
+    // solver with the reduced camera system solved by block-Jacobi preconditioned conjugate gradient (1)
+    node = fSettings["gbaSolver"];
+    if(!node.empty() && node.isInt())
+        mnGBASolver = node.operator int();
+
+    node = fSettings["gbaThreads"];
+    if(!node.empty() && node.isInt())
+        mnGBAThreads = std::max(node.operator int(), 1);
+
+    node = fSettings["gbaCGIterations"];
+    if(!node.empty() && node.isInt())
+        mnGBACGIterations = std::max(node.operator int(), 1);
+
+    // Optional: partition of the multi-threaded global BA in covisibility clusters of about this number of
+    // keyframes, optimized in parallel and stitched by their separator keyframes (0, default, no partition)
+    node = fSettings["gbaClusterKFs"];
+    if(!node.empty() && node.isInt())
+        mnGBAClusterKFs = std::max(node.operator int(), 0);
+
+    // Optional: stop the pose optimizations, the local BA and the essential graph optimization when the
+    // chi2 stops decreasing, and give the first two a deadline relative to the frame period (0, default, off)
+    node = fSettings["optimizationBudget"];
+    if(!node.empty() && node.isInt())
+        mbOptimizationBudget = node.operator int() != 0;
+
+    if(mbOptimizationBudget)
+    {
+        double minChi2Decrease = 1e-3;
+        double poseTime = 0.25;
+        double localBATime = 3.0;
+
+        node = fSettings["optimizationMinChi2Decrease"];
+        if(!node.empty() && node.isReal())
+            minChi2Decrease = node.real();
+
+        node = fSettings["poseOptimizationTime"];
+        if(!node.empty() && node.isReal())
+            poseTime = node.real();
+
+        node = fSettings["localBATime"];
+        if(!node.empty() && node.isReal())
+            localBATime = node.real();
+
+        // Frame period in ms
+        const double period = 1000.0/std::max(mMaxFrames,1);
+        mPoseBudget = OptimizationBudget(poseTime*period, minChi2Decrease);
+        mLocalBABudget = OptimizationBudget(localBATime*period, minChi2Decrease);
+        mEssentialGraphBudget = OptimizationBudget(0, minChi2Decrease);
+    }
+
+    // Optional: robust kernel of the pose optimizations, the local BA and the Sim3 optimizations, Huber (0,
+    // default), Cauchy (1) or Geman-McClure (2), and maximum scale of their adaptive outlier thresholds
+    // (1, default, fixed thresholds). Process-wide, as the kernel is shared by all the optimizers.
+    node = fSettings["robustKernel"];
+    if(!node.empty() && node.isInt())
+        OutlierRejection::SetKernel(node.operator int());
+
+    node = fSettings["outlierThresholdScale"];
+    if(!node.empty() && node.isReal())
+        OutlierRejection::SetMaxThresholdScale(node.real());
+
+    // Optional: capture of the optimization problems to binary files for the replay tool, up to
+    // optimizationCapture of each type (0, default, no capture) in optimizationCaptureDir
+    node = fSettings["optimizationCapture"];
+    if(!node.empty() && node.isInt())
+    {
+        std::string captureDir = ".";
+        cv::FileNode nodeDir = fSettings["optimizationCaptureDir"];
+        if(!nodeDir.empty() && nodeDir.isString())
+            captureDir = nodeDir.string();
+        ProblemCapture::Enable(captureDir, node.operator int());
+    }
+
+    // Optional: triangulate the lines matched between the new keyframe and its covisible keyframes in the
+    // local mapping, keyframes then create only their 50 closest lines from depth (0, default, off)
+    node = fSettings["lineTriangulation"];
+    if(!node.empty() && node.isInt())
+        mbLineTriangulation = node.operator int() != 0;
+
+    // Optional: fuse duplicated map lines of the new keyframe and its neighbors in the local mapping (0, default, off)
+    node = fSettings["lineFusion"];
+    if(!node.empty() && node.isInt())
+        mbLineFusion = node.operator int() != 0;
+
+    // Optional: run the local BA of each keyframe in its own thread while the local mapping processes the next
+    // keyframe, not with IMU (0, default, off)
+    node = fSettings["localMappingPipeline"];
+    if(!node.empty() && node.isInt())
+        mbLocalMappingPipeline = node.operator int() != 0;
+
+    // Optional: threads of the triangulation of new map points with the neighbor keyframes in the local mapping
+    // (1, default, serial)
+    node = fSettings["triangulationThreads"];
+    if(!node.empty() && node.isInt())
+        mnTriangulationThreads = std::max(node.operator int(), 1);
+
+    // Optional: threads of the geometric verification of the BoW candidates of loops and merges in the loop
+    // closing (1, default, serial)
+    node = fSettings["loopCandidateThreads"];
+    if(!node.empty() && node.isInt())
+        mnLoopCandidateThreads = std::max(node.operator int(), 1);
+
+    // Optional: delete the map points and lines set bad once no thread can hold them anymore, instead of
+    // keeping them until the end of the run (0, default, off). Not with the pipelined local mapping, whose
+    // BA thread sets landmarks bad while the next keyframe is processed.
+    node = fSettings["landmarkReclamation"];
+    if(!node.empty() && node.isInt() && node.operator int() != 0)
+    {
+        if(mbLocalMappingPipeline)
+            std::cout << "landmarkReclamation is not used with localMappingPipeline" << std::endl;
+        else
+            EpochReclaimer::Enable(true);
+    }
+
+    // Optional: track the lines between keyframes instead of detecting them in every frame
+    bool bTrackLines = false;
+    int nMinTrackedLines = 30;
+    node = fSettings["lineTracking"];
+    if(!node.empty() && node.isInt())
+        bTrackLines = node.operator int() != 0;
+
+    node = fSettings["lineTrackingMinLines"];
+    if(!node.empty() && node.isInt())
+        nMinTrackedLines = node.operator int();
+
+    // Optional: LBD on the LSD pyramid restricted to the kept lines, or on the whole image (default)
+    bool bIncrementalLBD = false;
+    node = fSettings["lsd_incremental_lbd"];
+    if(!node.empty() && node.isInt())
+        bIncrementalLBD = node.operator int() != 0;
+
 
     if(b_miss_params)
     {
@@ -1075,6 +1250,10 @@ bool Tracking::ParseLineParamFile(cv::FileStorage &fSettings)
 
     mpLineextractorLeft = new Lineextractor(lsd_nfeatures, lsd_refine, lsd_scale, levels, scale, extractor);
     mpLineextractorRight = new Lineextractor(lsd_nfeatures, lsd_refine, lsd_scale, levels, scale, extractor);
+    mpLineextractorLeft->mbIncrementalLBD = bIncrementalLBD;
+    mpLineextractorRight->mbIncrementalLBD = bIncrementalLBD;
+    mpLineextractorLeft->mbTrackLines = bTrackLines && mSensor==System::RGBD;
+    mpLineextractorLeft->mnMinTrackedLines = nMinTrackedLines;
 
     if(extractor==0)
         cout << endl << "Line Detector: LSD" << endl;
@@ -1093,10 +1272,59 @@ bool Tracking::ParseLineParamFile(cv::FileStorage &fSettings)
         cout << "- Image Scale Factor: " << lsd_scale << endl;
     }
     cout << "- Levels of the Pyramid: " << levels << endl;
-    cout << "- Scale of the Pyramid: " << scale << endl <<endl;
+    cout << "- Scale of the Pyramid: " << scale << endl;
+    if(mpLineextractorLeft->mbTrackLines)
+        cout << "- Line Tracking between Keyframes (min tracked lines: " << nMinTrackedLines << ")" << endl;
+    cout << endl;
 
     if(SLAM==0)
-        cout << "Point Line SLAM" << endl << endl;
+    {
+        cout << "Point Line SLAM" << endl;
+        if(mnPoseSolver==1)
+            cout << "- Pose Optimization: fixed-size solver" << endl;
+        if(mbLineOrthonormal)
+            cout << "- Line Parameterization in BA: orthonormal" << endl;
+        if(mnBASolver>=1 && !mbLineOrthonormal)
+            cout << "- Local BA: multi-threaded solver (" << mnBAThreads << " threads" << (mnBASolver==2 ? ", sliding window)" : ")") << endl;
+        if(mnGBASolver==1)
+        {
+            cout << "- Global BA: points and lines";
+            if(!mbLineOrthonormal)
+            {
+                cout << ", multi-threaded PCG solver (" << mnGBAThreads << " threads, " << mnGBACGIterations << " CG iterations";
+                if(mnGBAClusterKFs>0)
+                    cout << ", clusters of " << mnGBAClusterKFs << " keyframes";
+                cout << ")";
+            }
+            cout << endl;
+        }
+        if(OutlierRejection::GetKernel()!=OutlierRejection::KERNEL_HUBER || OutlierRejection::GetMaxThresholdScale()>1.0)
+        {
+            const int kernel = OutlierRejection::GetKernel();
+            cout << "- Robust kernel: " << (kernel==OutlierRejection::KERNEL_CAUCHY ? "Cauchy" : kernel==OutlierRejection::KERNEL_GEMAN_MCCLURE ? "Geman-McClure" : "Huber");
+            if(OutlierRejection::GetMaxThresholdScale()>1.0)
+                cout << ", adaptive outlier thresholds (up to x" << OutlierRejection::GetMaxThresholdScale() << ")";
+            cout << endl;
+        }
+        if(ProblemCapture::IsEnabled())
+            cout << "- Optimization problem capture (replay_optimization)" << endl;
+        if(mbLineTriangulation)
+            cout << "- Line triangulation in local mapping" << endl;
+        if(mbLineFusion)
+            cout << "- Line fusion in local mapping" << endl;
+        if(mbLocalMappingPipeline)
+            cout << "- Pipelined local mapping (local BA in its own thread)" << endl;
+        if(mnTriangulationThreads>1)
+            cout << "- Parallel triangulation of map points (" << mnTriangulationThreads << " threads)" << endl;
+        if(mnLoopCandidateThreads>1)
+            cout << "- Parallel verification of loop candidates (" << mnLoopCandidateThreads << " threads)" << endl;
+        if(EpochReclaimer::IsEnabled())
+            cout << "- Reclamation of bad map points and lines" << endl;
+        if(mbOptimizationBudget)
+            cout << "- Optimization budget: pose " << mPoseBudget.dMaxTime << " ms, local BA " << mLocalBABudget.dMaxTime
+                 << " ms, min chi2 decrease " << mPoseBudget.dMinChi2Decrease << endl;
+        cout << endl;
+    }
     if(SLAM==1)
         cout << "Only Line Pose Estimation and Mapping using the Euclidean distance as an error function (Loop Closing thread is deactivated)" << endl << endl;
     if(SLAM==2)
@@ -1340,7 +1568,13 @@ cv::Mat Tracking::GrabImageRGBD(const cv::Mat &imRGB,const cv::Mat &imD, const d
     std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
     //mCurrentFrame = Frame(mImGray,imDepth,timestamp,mpORBextractorLeft,mpORBVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera);
 
-    mCurrentFrame = Frame(labels, masks, mImGray,imDepth,timestamp,mpORBextractorLeft,mpLineextractorLeft,mpORBVocabulary,mpLineVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera);
+    // Track the lines and points of the last frame when it was tracked, otherwise detect them
+    const bool bLastTracked = (mState==OK || mState==OK_KLT) && !mLastFrame.mImTrack.empty();
+    const bool bTrackLines = mpLineextractorLeft->mbTrackLines && bLastTracked && mLastFrame.N_l>0;
+    const bool bTrackPoints = mpORBextractorLeft->mbTrackPoints && bLastTracked && !mbOnlyTracking && mLastFrame.N>0;
+    mCurrentFrame = Frame(labels, masks, mImGray,imDepth,timestamp,mpORBextractorLeft,mpLineextractorLeft,mpORBVocabulary,mpLineVocabulary,mK,mDistCoef,mbf,mThDepth,mpCamera,
+                          static_cast<Frame*>(NULL), IMU::Calib(), bTrackLines ? &mLastFrame : static_cast<Frame*>(NULL),
+                          bTrackPoints ? &mLastFrame : static_cast<Frame*>(NULL));
 
     std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
 
@@ -2243,6 +2477,8 @@ void Tracking::Track()
         }
 
     }
+
+    ReleaseBadLandmarks();
 }
 
 void Tracking::TrackWithLines()
@@ -2383,13 +2619,27 @@ void Tracking::TrackWithLines()
             // State OK
             // Local Mapping is activated. This is the normal behaviour, unless
             // you explicitly activate the "only tracking" mode.
-            if(mState==OK)
+            if(mState==OK || mState==OK_KLT)
             {
 
                 // Local Mapping might have changed some MapPoints and MapLines tracked in last frame
                 CheckReplacedInLastFrameWithLines();
 
-                if((mVelocity.empty() && !pCurrentMap->isImuInitialized()) || mCurrentFrame.mnId<mnLastRelocFrameId+2)
+                if(mCurrentFrame.mbPointsTracked)
+                {
+                    bOK = TrackWithOpticalFlow();
+                    if(!bOK)
+                    {
+                        // Tracking quality dropped: full extraction and matching
+                        DetectTrackedFeatures();
+                        fill(mCurrentFrame.mvpMapLines.begin(),mCurrentFrame.mvpMapLines.end(),static_cast<MapLine*>(NULL));
+                        if(!mVelocity.empty())
+                            bOK = TrackWithMotionModelWithLines();
+                        if(!bOK)
+                            bOK = TrackReferenceKeyFrameWithLines();
+                    }
+                }
+                else if((mVelocity.empty() && !pCurrentMap->isImuInitialized()) || mCurrentFrame.mnId<mnLastRelocFrameId+2)
                 {
                     //Verbose::PrintMess("TRACK: Track with respect to the reference KF ", Verbose::VERBOSITY_DEBUG);
 //                    cout<<"start to track referenceKF......."<<endl;
@@ -2566,9 +2816,10 @@ void Tracking::TrackWithLines()
             mCurrentFrame.mpReferenceKF = mpReferenceKF;
 
         // If we have an initial estimation of the camera pose and matching. Track the local map.
+        // Frames tracked by optical flow do not search the local map.
         if(!mbOnlyTracking)
         {
-            if(bOK)
+            if(bOK && !mCurrentFrame.mbPointsTracked)
             {
 #ifdef SAVE_TIMES
                 std::chrono::steady_clock::time_point time_StartTrackLocalMap = std::chrono::steady_clock::now();
@@ -2596,8 +2847,8 @@ void Tracking::TrackWithLines()
         }
 
         if(bOK)
-            mState = OK;
-        else if (mState == OK)
+            mState = mCurrentFrame.mbPointsTracked ? OK_KLT : OK;
+        else if (mState == OK || mState == OK_KLT)
         {
             if (mSensor == System::IMU_MONOCULAR || mSensor == System::IMU_STEREO)
             {
@@ -2724,7 +2975,12 @@ void Tracking::TrackWithLines()
 
             // Check if we need to insert a new keyframe
             if(bNeedKF && (bOK|| (mState==RECENTLY_LOST && (mSensor == System::IMU_MONOCULAR || mSensor == System::IMU_STEREO))))
+            {
+                // Keyframes always get ORB and LSD+LBD features
+                if(mCurrentFrame.mbPointsTracked || mCurrentFrame.mbLinesTracked)
+                    DetectFeaturesForKeyFrame();
                 CreateNewKeyFrameWithLines();
+            }
 
 
             // We allow points and lines with high innovation (considererd outliers by the Huber Function)
@@ -2769,7 +3025,7 @@ void Tracking::TrackWithLines()
         mLastFrame = Frame(mCurrentFrame);
     }
 
-    if(mState==OK || mState==RECENTLY_LOST)
+    if(mState==OK || mState==OK_KLT || mState==RECENTLY_LOST)
     {
         // Store frame pose information to retrieve the complete camera trajectory afterwards.
         if(!mCurrentFrame.mTcw.empty())
@@ -2792,6 +3048,7 @@ void Tracking::TrackWithLines()
 //        cout<<"结束本次的Track -----"<<endl;
     }
 
+    ReleaseBadLandmarks();
 }
 
 
@@ -3541,6 +3798,53 @@ void Tracking::CreateMapInAtlas()
 
 }
 
+void Tracking::ReleaseBadLandmarks()
+{
+    // Without a local map (visual odometry in localization mode) the frames may hold the VO landmarks
+    if(!EpochReclaimer::IsEnabled() || (mState!=OK && mState!=OK_KLT) || (mbOnlyTracking && mbVO))
+        return;
+
+    // Bad landmarks are replaced as in CheckReplacedInLastFrame or dropped
+    auto releaseBad = [](Frame &F)
+    {
+        for(size_t i=0; i<F.mvpMapPoints.size(); i++)
+        {
+            MapPoint* pMP = F.mvpMapPoints[i];
+            if(pMP && pMP->isBad())
+            {
+                MapPoint* pRep = pMP->GetReplaced();
+                F.mvpMapPoints[i] = (pRep && !pRep->isBad()) ? pRep : static_cast<MapPoint*>(NULL);
+            }
+        }
+        for(size_t i=0; i<F.mvpMapLines.size(); i++)
+        {
+            MapLine* pML = F.mvpMapLines[i];
+            if(pML && pML->isBad())
+            {
+                MapLine* pRep = pML->GetReplaced();
+                F.mvpMapLines[i] = (pRep && !pRep->isBad()) ? pRep : static_cast<MapLine*>(NULL);
+            }
+        }
+    };
+    releaseBad(mCurrentFrame);
+    releaseBad(mLastFrame);
+
+    // The local map is searched again from the keyframes only in the frames tracked with it. Those tracked
+    // by optical flow keep it, and the reference landmarks of the map drawer set from it: its bad ones are
+    // dropped here.
+    if(mState==OK_KLT)
+    {
+        mvpLocalMapPoints.erase(std::remove_if(mvpLocalMapPoints.begin(), mvpLocalMapPoints.end(),
+                                               [](MapPoint* pMP){ return pMP->isBad(); }), mvpLocalMapPoints.end());
+        mvpLocalMapLines.erase(std::remove_if(mvpLocalMapLines.begin(), mvpLocalMapLines.end(),
+                                              [](MapLine* pML){ return pML->isBad(); }), mvpLocalMapLines.end());
+        mpAtlas->SetReferenceMapPoints(mvpLocalMapPoints);
+        mpAtlas->SetReferenceMapLines(mvpLocalMapLines);
+    }
+
+    EpochReclaimer::Quiescent(EpochReclaimer::TRACKING);
+}
+
 void Tracking::CheckReplacedInLastFrame()
 {
     for(int i =0; i<mLastFrame.N; i++)
@@ -3726,7 +4030,7 @@ bool Tracking::TrackReferenceKeyFrameWithLines()
     }
 //    cout<<"Track RefereceKF 55 "<<endl;
     if(SLAM==0)
-        Optimizer::PoseOptimizationPL(&mCurrentFrame);
+        PoseOptimizationPL(&mCurrentFrame);
     else if(SLAM==1)
         Optimizer::PoseOptimizationOnlyLine(&mCurrentFrame);
     else if(SLAM==2)
@@ -4116,97 +4420,7 @@ bool Tracking::TrackWithMotionModelWithLines()
     }
 
     // Frame to Frame Line Matching
-
-    // Line Matching Searching by projection (TO DO: Improve)
-    /*float th_l = 3.0;
-    float ang_th = M_PI/8.0;
-    fill(mCurrentFrame.mvpMapLines.begin(),mCurrentFrame.mvpMapLines.end(),static_cast<MapLine*>(NULL));
-    mCurrentFrame.n_inliers_ls = LineMatcher::SearchByProjection(mCurrentFrame, mLastFrame, mCurrentFrame.grid_Line, th_l, ang_th);
-
-    // If few matches, uses a wider window search
-    if(mCurrentFrame.n_inliers_ls<10)
-    {
-        Verbose::PrintMess("Not enough Line matches, wider window search!!", Verbose::VERBOSITY_NORMAL);
-        fill(mCurrentFrame.mvpMapLines.begin(),mCurrentFrame.mvpMapLines.end(),static_cast<MapLine*>(NULL));
-
-        mCurrentFrame.n_inliers_ls = LineMatcher::SearchByProjection(mCurrentFrame, mLastFrame, mCurrentFrame.grid_Line, th_l+2, ang_th);
-        Verbose::PrintMess("Matches with wider search: " + to_string(mCurrentFrame.n_inliers_ls), Verbose::VERBOSITY_NORMAL);
-    } */
-
-    std::vector<int> matches_12;
-    float minRatio12L = 0.9;
-    LineMatcher::match(mLastFrame.mDescriptors_Line, mCurrentFrame.mDescriptors_Line, minRatio12L, matches_12);
-
-    const double deltaAngle = M_PI/8.0;
-    const double deltaWidth = (mCurrentFrame.mnMaxX-mCurrentFrame.mnMinX)*0.1;
-    const double deltaHeight = (mCurrentFrame.mnMaxY-mCurrentFrame.mnMinY)*0.1;
-    mCurrentFrame.n_inliers_ls = 0;
-    const int nmatches_12 = matches_12.size();
-
-    for (int i1 = 0; i1 < nmatches_12; ++i1) 
-    {
-        if(!mLastFrame.mvpMapLines[i1]) continue;
-        const int i2 = matches_12[i1];
-        if (i2 < 0) continue;
-
-        if(mCurrentFrame.mvpMapLines[i2])
-            if(mCurrentFrame.mvpMapLines[i2]->Observations()>0)
-                continue;
-
-        // check for orientation and position in image
-
-        // Project In Image
-        const cv::Mat Rcw = mCurrentFrame.mTcw.rowRange(0,3).colRange(0,3);
-        const cv::Mat tcw = mCurrentFrame.mTcw.rowRange(0,3).col(3);
-
-        Eigen::Vector3d sp = mLastFrame.mvpMapLines[i1]->GetWorldPos().head(3);
-        Eigen::Vector3d ep = mLastFrame.mvpMapLines[i1]->GetWorldPos().tail(3);
-        cv::Mat x3Dw_sp = Converter::toCvMat(sp);
-        cv::Mat x3Dw_ep = Converter::toCvMat(ep);
-        cv::Mat x3Dc_sp = Rcw*x3Dw_sp+tcw;
-        cv::Mat x3Dc_ep = Rcw*x3Dw_ep+tcw;
-
-        const float invzc_sp = 1.0/x3Dc_sp.at<float>(2);
-        const float invzc_ep = 1.0/x3Dc_ep.at<float>(2);
-
-        if(invzc_sp<0 || invzc_ep<0)
-            continue;
-
-        cv::Point2f uv_sp = mCurrentFrame.mpCamera->project(x3Dc_sp);
-        cv::Point2f uv_ep = mCurrentFrame.mpCamera->project(x3Dc_ep);
-
-        if(uv_sp.x<mCurrentFrame.mnMinX || uv_sp.x>mCurrentFrame.mnMaxX || uv_ep.x<mCurrentFrame.mnMinX || uv_ep.x>mCurrentFrame.mnMaxX)
-            continue;
-        if(uv_sp.y<mCurrentFrame.mnMinY || uv_sp.y>mCurrentFrame.mnMaxY || uv_ep.y<mCurrentFrame.mnMinY || uv_ep.y>mCurrentFrame.mnMaxY)
-            continue;
-
-        // check for orientation
-        double theta = mCurrentFrame.mvKeys_Line[i2].angle-atan2(uv_ep.y - uv_sp.y, uv_ep.x - uv_sp.x);;
-        if(theta<-M_PI) theta+=2*M_PI;
-        else if(theta>M_PI) theta-=2*M_PI;
-        if(fabs(theta)>deltaAngle) 
-        {
-            matches_12[i1] = -1;
-            continue;
-        }
-        // check for position in image
-        const float sX_curr = mCurrentFrame.mvKeysUn_Line[i2].startPointX;
-        const float sX_last = uv_sp.x;
-        const float sY_curr = mCurrentFrame.mvKeysUn_Line[i2].startPointY;
-        const float sY_last = uv_sp.y;
-        const float eX_curr = mCurrentFrame.mvKeysUn_Line[i2].endPointX;
-        const float eX_last = uv_ep.x;
-        const float eY_curr = mCurrentFrame.mvKeysUn_Line[i2].endPointY;
-        const float eY_last = uv_ep.y;
-        if(fabs(sX_curr-sX_last)>deltaWidth || fabs(eX_curr-eX_last)>deltaWidth || fabs(sY_curr-sY_last)>deltaHeight || fabs(eY_curr-eY_last)>deltaHeight )
-        {
-            matches_12[i1] = -1;
-            continue;
-        }
-        
-        mCurrentFrame.mvpMapLines[i2] = mLastFrame.mvpMapLines[i1]; 
-        ++mCurrentFrame.n_inliers_ls;
-    } 
+    mCurrentFrame.n_inliers_ls = MatchLinesWithLastFrame();
 
     mCurrentFrame.n_inliers = mCurrentFrame.n_inliers_ls + mCurrentFrame.n_inliers_pt;
 
@@ -4221,7 +4435,7 @@ bool Tracking::TrackWithMotionModelWithLines()
 
     // Optimize frame pose with all matches
     if(SLAM==0)
-        Optimizer::PoseOptimizationPL(&mCurrentFrame);
+        PoseOptimizationPL(&mCurrentFrame);
     else if(SLAM==1)
         Optimizer::PoseOptimizationOnlyLine(&mCurrentFrame);
     else if(SLAM==2)
@@ -4289,6 +4503,197 @@ bool Tracking::TrackWithMotionModelWithLines()
         return nmatchesMap_p + nmatchesMap_l>=10;
 }
 
+int Tracking::PoseOptimizationPL(Frame* pFrame)
+{
+    const OptimizationBudget* pBudget = mbOptimizationBudget ? &mPoseBudget : NULL;
+    OptimizationStats* pStats = mbOptimizationBudget ? &mPoseStats : NULL;
+
+    int nInliers;
+    if(mnPoseSolver==1)
+        nInliers = mPoseSolver.PoseOptimizationPL(pFrame, pBudget, pStats);
+    else
+        nInliers = Optimizer::PoseOptimizationPL(pFrame, pBudget, pStats);
+
+    if(pStats && pStats->bDeadline)
+        Verbose::PrintMess("TRACK: pose optimization cut by the deadline after " + to_string(pStats->nIterations) + " iterations ("
+                           + to_string(pStats->dTime) + " ms)", Verbose::VERBOSITY_DEBUG);
+    return nInliers;
+}
+
+int Tracking::MatchLinesWithLastFrame()
+{
+    if(mCurrentFrame.mbLinesTracked)
+    {
+        // Lines tracked by optical flow keep the MapLines of the lines they come from
+        int nmatches = 0;
+        for(int i=0; i<mCurrentFrame.N_l; i++)
+        {
+            const int i1 = mCurrentFrame.mvLineTrackIdx[i];
+            MapLine* pML = mLastFrame.mvpMapLines[i1];
+            if(pML && !mLastFrame.mvbOutlier_Line[i1])
+            {
+                mCurrentFrame.mvpMapLines[i] = pML;
+                nmatches++;
+            }
+        }
+        return nmatches;
+    }
+
+    // Single search by projection, with a window per line sized by the uncertainty of the predicted pose
+    const float th_l = 3.0;
+    const float ang_th = M_PI/8.0;
+    LineProjectionStats lineStats;
+    const int nmatches = LineMatcher::SearchByProjection(mCurrentFrame, mLastFrame, PredictedPoseCovariance(), th_l, ang_th, &lineStats);
+
+#ifdef SAVE_TIMES
+    f_line_proj_stats << lineStats.nProjected << "," << lineStats.nCandidates << ",";
+    f_line_proj_stats << lineStats.nMatches << "," << lineStats.mTime << endl;
+#endif
+
+    return nmatches;
+}
+
+bool Tracking::TrackWithOpticalFlow()
+{
+    // Constant velocity prediction. Tracked keypoints keep the MapPoints of the keypoints they come from.
+    if(!mVelocity.empty())
+        mCurrentFrame.SetPose(mVelocity*mLastFrame.mTcw);
+    else
+        mCurrentFrame.SetPose(mLastFrame.mTcw);
+
+    mCurrentFrame.n_inliers_pt = 0;
+    for(int i=0; i<mCurrentFrame.N; i++)
+    {
+        const int i1 = mCurrentFrame.mvPointTrackIdx[i];
+        MapPoint* pMP = mLastFrame.mvpMapPoints[i1];
+        if(pMP && !pMP->isBad())
+        {
+            mCurrentFrame.mvpMapPoints[i] = pMP;
+            mCurrentFrame.n_inliers_pt++;
+        }
+    }
+
+    mCurrentFrame.n_inliers_ls = MatchLinesWithLastFrame();
+    mCurrentFrame.n_inliers = mCurrentFrame.n_inliers_pt + mCurrentFrame.n_inliers_ls;
+
+    if(mCurrentFrame.n_inliers<20)
+        return false;
+
+    // Optimize frame pose with the tracked set
+    if(SLAM==0)
+        PoseOptimizationPL(&mCurrentFrame);
+    else if(SLAM==1)
+        Optimizer::PoseOptimizationOnlyLine(&mCurrentFrame);
+    else if(SLAM==2)
+        Optimizer::PoseOptimizationOnlyLineAngles(&mCurrentFrame);
+    else if(SLAM==3)
+        Optimizer::PoseOptimizationOnlyLineWithAngles(&mCurrentFrame);
+
+    // Discard outliers. The inliers are used by the keyframe decision as the local map is not searched.
+    int nmatchesMap_p = 0;
+    for(int i=0; i<mCurrentFrame.N; i++)
+    {
+        if(mCurrentFrame.mvpMapPoints[i])
+        {
+            if(mCurrentFrame.mvbOutlier[i])
+            {
+                MapPoint* pMP = mCurrentFrame.mvpMapPoints[i];
+                mCurrentFrame.mvpMapPoints[i]=static_cast<MapPoint*>(NULL);
+                mCurrentFrame.mvbOutlier[i]=false;
+                pMP->mnLastFrameSeen = mCurrentFrame.mnId;
+                mCurrentFrame.n_inliers_pt--;
+                mCurrentFrame.n_inliers--;
+            }
+            else if(mCurrentFrame.mvpMapPoints[i]->Observations()>0)
+                nmatchesMap_p++;
+        }
+    }
+
+    int nmatchesMap_l = 0;
+    for(int i=0; i<mCurrentFrame.N_l; i++)
+    {
+        if(mCurrentFrame.mvpMapLines[i])
+        {
+            if(mCurrentFrame.mvbOutlier_Line[i])
+            {
+                MapLine* pML = mCurrentFrame.mvpMapLines[i];
+                mCurrentFrame.mvpMapLines[i]=static_cast<MapLine*>(NULL);
+                mCurrentFrame.mvbOutlier_Line[i]=false;
+                pML->mnLastFrameSeen = mCurrentFrame.mnId;
+                mCurrentFrame.n_inliers_ls--;
+                mCurrentFrame.n_inliers--;
+            }
+            else if(mCurrentFrame.mvpMapLines[i]->Observations()>0)
+                nmatchesMap_l++;
+        }
+    }
+
+    mnMatchesInliers = nmatchesMap_p + nmatchesMap_l;
+    mpLocalMapper->mnMatchesInliers = mnMatchesInliers;
+
+    // Tracking quality
+    return nmatchesMap_p >= mpORBextractorLeft->mnMinTrackedPoints;
+}
+
+void Tracking::DetectTrackedFeatures()
+{
+    if(mCurrentFrame.mbPointsTracked)
+        mCurrentFrame.DetectRGBDPoints(mImGray, mImdepth, mvLabels, mvMasks);
+    if(mCurrentFrame.mbLinesTracked)
+        mCurrentFrame.DetectRGBDLines(mImGray, mImdepth, mvLabels, mvMasks);
+}
+
+void Tracking::DetectFeaturesForKeyFrame()
+{
+    // The tracked features are replaced by detected ones. Their MapPoints and MapLines are recovered
+    // by projection with the optimized pose, so the pose uncertainty is not taken into account.
+    Frame trackedFrame(mCurrentFrame);
+    const bool bPointsTracked = mCurrentFrame.mbPointsTracked;
+    DetectTrackedFeatures();
+
+    if(bPointsTracked)
+    {
+        ORBmatcher matcher(0.9,true);
+        mCurrentFrame.n_inliers_pt = matcher.SearchByProjection(mCurrentFrame, trackedFrame, 3, false);
+    }
+
+    const float th_l = 3.0;
+    const float ang_th = M_PI/8.0;
+    if(trackedFrame.mbLinesTracked)
+        mCurrentFrame.n_inliers_ls = LineMatcher::SearchByProjection(mCurrentFrame, trackedFrame, Eigen::Matrix<double,6,6>::Zero(), th_l, ang_th);
+    mCurrentFrame.n_inliers = mCurrentFrame.n_inliers_pt + mCurrentFrame.n_inliers_ls;
+
+    // Optical flow frames skipped the local map, the keyframe gets its matches
+    if(bPointsTracked)
+        TrackLocalMapWithLines();
+}
+
+Eigen::Matrix<double,6,6> Tracking::PredictedPoseCovariance()
+{
+    // First order model of the error of the constant velocity prediction: a floor plus a term
+    // proportional to the rotation and translation of the last inter-frame motion
+    const double sigmaRot0 = 0.005, sigmaTrans0 = 0.005; // rad, m
+    const double kRot = 0.5, kTrans = 0.5;
+
+    double rot = 0.0, trans = 0.0;
+    if(!mVelocity.empty())
+    {
+        const cv::Mat R = mVelocity.rowRange(0,3).colRange(0,3);
+        const double c = 0.5*(cv::trace(R)[0]-1.0);
+        rot = acos(std::max(-1.0, std::min(1.0, c)));
+        trans = cv::norm(mVelocity.rowRange(0,3).col(3));
+    }
+
+    const double sigmaRot = sigmaRot0 + kRot*rot;
+    const double sigmaTrans = sigmaTrans0 + kTrans*trans;
+
+    Eigen::Matrix<double,6,6> cov = Eigen::Matrix<double,6,6>::Zero();
+    cov.block<3,3>(0,0) = sigmaRot*sigmaRot*Eigen::Matrix3d::Identity();
+    cov.block<3,3>(3,3) = sigmaTrans*sigmaTrans*Eigen::Matrix3d::Identity();
+
+    return cov;
+}
+
 bool Tracking::TrackLocalMap()
 {
 
@@ -4427,7 +4832,7 @@ bool Tracking::TrackLocalMapWithLines()
     if (!mpAtlas->isImuInitialized())
     {
         if(SLAM==0)
-            Optimizer::PoseOptimizationPL(&mCurrentFrame);
+            PoseOptimizationPL(&mCurrentFrame);
         else if(SLAM==1)
             Optimizer::PoseOptimizationOnlyLine(&mCurrentFrame);
         else if(SLAM==2)
@@ -5395,7 +5800,7 @@ void Tracking::CreateNewKeyFrameWithLines()
                     nLines++;
                 }
 
-                if(vDepthIdx[j].first>mThDepth && nLines>50)
+                if((mbLineTriangulation || vDepthIdx[j].first>mThDepth) && nLines>50)
                     break;
             }
         }
@@ -5765,9 +6170,10 @@ void Tracking::UpdateLocalKeyFrames()
             {
                 if(!pMP->isBad())
                 {
-                    const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-                    for(map<KeyFrame*,tuple<int,int>>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                        keyframeCounter[it->first]++;
+                    pMP->ForEachObservation([&](KeyFrame* pKFi, const tuple<int,int> &)
+                    {
+                        keyframeCounter[pKFi]++;
+                    });
                 }
                 else
                 {
@@ -5788,9 +6194,10 @@ void Tracking::UpdateLocalKeyFrames()
                     continue;
                 if(!pMP->isBad())
                 {
-                    const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-                    for(map<KeyFrame*,tuple<int,int>>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                        keyframeCounter[it->first]++;
+                    pMP->ForEachObservation([&](KeyFrame* pKFi, const tuple<int,int> &)
+                    {
+                        keyframeCounter[pKFi]++;
+                    });
                 }
                 else
                 {
@@ -5827,6 +6234,7 @@ void Tracking::UpdateLocalKeyFrames()
     }
 
     // Include also some not-already-included keyframes that are neighbors to already-included keyframes
+    vector<KeyFrame*> vNeighs;
     for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
     {
         // Limit the number of keyframes
@@ -5835,7 +6243,7 @@ void Tracking::UpdateLocalKeyFrames()
 
         KeyFrame* pKF = *itKF;
 
-        const vector<KeyFrame*> vNeighs = pKF->GetBestCovisibilityKeyFrames(10);
+        pKF->GetBestCovisibilityKeyFrames(10,vNeighs);
 
 
         for(vector<KeyFrame*>::const_iterator itNeighKF=vNeighs.begin(), itEndNeighKF=vNeighs.end(); itNeighKF!=itEndNeighKF; itNeighKF++)
@@ -5919,9 +6327,10 @@ void Tracking::UpdateLocalKeyFramesWithLines()
             {
                 if(!pMP->isBad())
                 {
-                    const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-                    for(map<KeyFrame*,tuple<int,int>>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                        keyframeCounter[it->first]++;
+                    pMP->ForEachObservation([&](KeyFrame* pKFi, const tuple<int,int> &)
+                    {
+                        keyframeCounter[pKFi]++;
+                    });
                 }
                 else
                 {
@@ -5936,9 +6345,10 @@ void Tracking::UpdateLocalKeyFramesWithLines()
                 MapLine* pML = mCurrentFrame.mvpMapLines[i];
                 if(!pML->isBad())
                 {
-                    const map<KeyFrame*,size_t> observations = pML->GetObservations();
-                    for(map<KeyFrame*,size_t>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                        keyframeCounter[it->first]++;
+                    pML->ForEachObservation([&](KeyFrame* pKFi, const size_t)
+                    {
+                        keyframeCounter[pKFi]++;
+                    });
                 }
                 else
                 {
@@ -5959,9 +6369,10 @@ void Tracking::UpdateLocalKeyFramesWithLines()
                     continue;
                 if(!pMP->isBad())
                 {
-                    const map<KeyFrame*,tuple<int,int>> observations = pMP->GetObservations();
-                    for(map<KeyFrame*,tuple<int,int>>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                        keyframeCounter[it->first]++;
+                    pMP->ForEachObservation([&](KeyFrame* pKFi, const tuple<int,int> &)
+                    {
+                        keyframeCounter[pKFi]++;
+                    });
                 }
                 else
                 {
@@ -5979,9 +6390,10 @@ void Tracking::UpdateLocalKeyFramesWithLines()
                     continue;
                 if(!pML->isBad())
                 {
-                    const map<KeyFrame*,size_t> observations = pML->GetObservations();
-                    for(map<KeyFrame*,size_t>::const_iterator it=observations.begin(), itend=observations.end(); it!=itend; it++)
-                        keyframeCounter[it->first]++;
+                    pML->ForEachObservation([&](KeyFrame* pKFi, const size_t)
+                    {
+                        keyframeCounter[pKFi]++;
+                    });
                 }
                 else
                 {
@@ -6018,6 +6430,7 @@ void Tracking::UpdateLocalKeyFramesWithLines()
     }
 
     // Include also some not-already-included keyframes that are neighbors to already-included keyframes
+    vector<KeyFrame*> vNeighs;
     for(vector<KeyFrame*>::const_iterator itKF=mvpLocalKeyFrames.begin(), itEndKF=mvpLocalKeyFrames.end(); itKF!=itEndKF; itKF++)
     {
         // Limit the number of keyframes
@@ -6026,7 +6439,7 @@ void Tracking::UpdateLocalKeyFramesWithLines()
 
         KeyFrame* pKF = *itKF;
 
-        const vector<KeyFrame*> vNeighs = pKF->GetBestCovisibilityKeyFrames(10);
+        pKF->GetBestCovisibilityKeyFrames(10,vNeighs);
 
 
         for(vector<KeyFrame*>::const_iterator itNeighKF=vNeighs.begin(), itEndNeighKF=vNeighs.end(); itNeighKF!=itEndNeighKF; itNeighKF++)
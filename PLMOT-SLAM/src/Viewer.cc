@@ -19,6 +19,7 @@
 
 
 #include "Viewer.h"
+#include "EpochReclaimer.h"
 #include <pangolin/pangolin.h>
 
 #include <mutex>
@@ -360,10 +361,14 @@ void Viewer::Run()
             }
         }
 
+        // The landmarks drawn are got again from the map and the drawers in every iteration
+        EpochReclaimer::Quiescent(EpochReclaimer::VIEWER);
+
         if(CheckFinish())
             break;
     }
 
+    EpochReclaimer::Unregister(EpochReclaimer::VIEWER);
     SetFinish();
 }
 